@@ -0,0 +1,486 @@
+/* Stand-in for the libvlc video output; see FakeVLC.h.
+ *
+ * A media location of "fake:" followed by parameters (separated by '&' or ',', with an
+ * optional leading "//" or "?") plays synthetic video:
+ *
+ *   format=CCCC:WxH  a chroma and size.  Repeat it to cycle through several formats.
+ *   chroma=, width=, height=  shorthand to change the first format (default I420 640x360)
+ *   fps=N            frames per second, or 0 for as fast as the callbacks allow (default 30)
+ *   frames=N         frames before end of stream, or 0 for no end (default 300)
+ *   change_every=N   move to the next format after N frames, calling the cleanup and format
+ *                    callbacks like a mid-stream change of resolution (default 0, never)
+ *   fill=0|1         write the frame number into the first row of each plane (default 1)
+ *   log_every=N      send a debug log message every N frames (default 0, never)
+ *   hold=N           keep the last N frames locked, as a decoder holds reference frames, so
+ *                    each is unlocked and displayed N frames later (default 0)
+ *
+ * for example "fake://?format=I420:3840x2160&format=RV32:320x240&change_every=50&fps=0".
+ * (MediaPlayer->media treats a string without "://" as a file path.)
+ *
+ * The frames come from one thread per player, which calls lock, unlock and display in
+ * order, like a VLC video output.  Log messages from that thread go to every instance that
+ * has a log callback, since a player doesn't know its instance.  libvlc_media_get_stats of
+ * the media reports the frames displayed (as decoded and displayed) and the bytes of their
+ * planes (as read and demuxed), and counts as lost any frame locked into the planes of a
+ * frame still held.
+ */
+
+#ifdef PERLVLC_FAKE_LIBVLC
+#define PERLVLC_FAKE_IMPL
+#include <vlc/vlc.h>
+#include <vlc/libvlc_version.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FakeVLC.h"
+
+#define PERLVLC_FAKE_MAX_FORMATS 8
+#define PERLVLC_FAKE_MAX_HOLD    16
+
+typedef struct PerlVLC_fake_format {
+	char chroma[4];
+	unsigned width, height;
+} PerlVLC_fake_format_t;
+
+/* Passed to the log callback as the libvlc_log_t.  The thread delivering a fake message
+ * records it in PerlVLC_fake_log_key, so the getters recognize it by address alone. */
+typedef struct PerlVLC_fake_log_ctx {
+	const char *module, *file, *name, *header;
+	unsigned line;
+	uintptr_t id;
+} PerlVLC_fake_log_ctx_t;
+
+typedef struct PerlVLC_fake_player {
+	struct PerlVLC_fake_player *next;
+	libvlc_media_player_t *mp;
+	// callbacks, as given to libvlc
+	libvlc_video_lock_cb lock;
+	libvlc_video_unlock_cb unlock;
+	libvlc_video_display_cb display;
+	void *opaque;
+#if (LIBVLC_VERSION_MAJOR >= 2)
+	libvlc_video_format_cb setup;
+	libvlc_video_cleanup_cb cleanup;
+#endif
+	PerlVLC_fake_format_t fixed;  // from libvlc_video_set_format
+	unsigned fixed_pitch;
+	// stream parameters from the MRL
+	PerlVLC_fake_format_t formats[PERLVLC_FAKE_MAX_FORMATS];
+	int format_count, fill;
+	double fps;
+	long frames, change_every, log_every;
+	int hold;
+	// playback thread
+	pthread_t thread;
+	int thread_started;
+	volatile int stop, playing;
+	volatile long shown;          // frames displayed, and the bytes of their planes
+	volatile uint64_t shown_bytes;
+	volatile long lost;           // frames that were given the planes of a held frame
+	int refs;                     // from libvlc_media_player_retain, under the players mutex
+	PerlVLC_fake_log_ctx_t log_ctx;
+} PerlVLC_fake_player_t;
+
+typedef struct PerlVLC_fake_logger {
+	struct PerlVLC_fake_logger *next;
+	libvlc_instance_t *inst;
+	libvlc_log_cb cb;
+	void *data;
+} PerlVLC_fake_logger_t;
+
+static pthread_mutex_t PerlVLC_fake_players_mutex= PTHREAD_MUTEX_INITIALIZER;
+static PerlVLC_fake_player_t *PerlVLC_fake_players= NULL;
+static pthread_mutex_t PerlVLC_fake_loggers_mutex= PTHREAD_MUTEX_INITIALIZER;
+static PerlVLC_fake_logger_t *PerlVLC_fake_loggers= NULL;
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
+static pthread_once_t PerlVLC_fake_log_once= PTHREAD_ONCE_INIT;
+static pthread_key_t PerlVLC_fake_log_key;
+
+static void PerlVLC_fake_log_key_init(void) {
+	pthread_key_create(&PerlVLC_fake_log_key, NULL);
+}
+
+/* Returns the fake context if ctx is the one this thread is currently delivering */
+static const PerlVLC_fake_log_ctx_t* PerlVLC_fake_log_ctx(const libvlc_log_t *ctx) {
+	const void *cur;
+	pthread_once(&PerlVLC_fake_log_once, PerlVLC_fake_log_key_init);
+	cur= pthread_getspecific(PerlVLC_fake_log_key);
+	return (ctx && (const void*) ctx == cur)? (const PerlVLC_fake_log_ctx_t*) cur : NULL;
+}
+#endif
+
+static PerlVLC_fake_player_t* PerlVLC_fake_find(libvlc_media_player_t *mp, int create) {
+	PerlVLC_fake_player_t *fp;
+	pthread_mutex_lock(&PerlVLC_fake_players_mutex);
+	for (fp= PerlVLC_fake_players; fp && fp->mp != mp; fp= fp->next);
+	if (!fp && create && (fp= (PerlVLC_fake_player_t*) calloc(1, sizeof(*fp)))) {
+		fp->mp= mp;
+		fp->log_ctx.module= "fake";
+		fp->log_ctx.file= __FILE__;
+		fp->log_ctx.name= "fake";
+		fp->log_ctx.id= (uintptr_t) fp;
+		fp->next= PerlVLC_fake_players;
+		PerlVLC_fake_players= fp;
+	}
+	pthread_mutex_unlock(&PerlVLC_fake_players_mutex);
+	return fp;
+}
+
+static void PerlVLC_fake_log(PerlVLC_fake_player_t *fp, int level, const char *fmt, ...) {
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
+	PerlVLC_fake_logger_t *l;
+	va_list args, copy;
+	va_start(args, fmt);
+	pthread_once(&PerlVLC_fake_log_once, PerlVLC_fake_log_key_init);
+	pthread_setspecific(PerlVLC_fake_log_key, &fp->log_ctx);
+	pthread_mutex_lock(&PerlVLC_fake_loggers_mutex);
+	for (l= PerlVLC_fake_loggers; l; l= l->next) {
+		va_copy(copy, args);
+		l->cb(l->data, level, (const libvlc_log_t*) &fp->log_ctx, fmt, copy);
+		va_end(copy);
+	}
+	pthread_mutex_unlock(&PerlVLC_fake_loggers_mutex);
+	pthread_setspecific(PerlVLC_fake_log_key, NULL);
+	va_end(args);
+#endif
+}
+
+/* Parse the part of the MRL after "fake:".  Returns false for an unknown parameter. */
+static int PerlVLC_fake_parse(PerlVLC_fake_player_t *fp, const char *spec) {
+	char key[32], val[64], chroma[5];
+	size_t len;
+	unsigned w, h;
+	memcpy(fp->formats[0].chroma, "I420", 4);
+	fp->formats[0].width= 640;
+	fp->formats[0].height= 360;
+	fp->format_count= 0;
+	fp->fps= 30;
+	fp->frames= 300;
+	fp->change_every= 0;
+	fp->log_every= 0;
+	fp->hold= 0;
+	fp->fill= 1;
+	while (*spec == '/' || *spec == '?') spec++;
+	while (*spec) {
+		len= strcspn(spec, "&,");
+		if (len && sscanf(spec, "%31[^=&,]=%63[^&,]", key, val) == 2) {
+			if (0 == strcmp(key, "format")) {
+				if (sscanf(val, "%4[^:]:%ux%u", chroma, &w, &h) != 3 || strlen(chroma) != 4
+					|| fp->format_count >= PERLVLC_FAKE_MAX_FORMATS)
+					return 0;
+				memcpy(fp->formats[fp->format_count].chroma, chroma, 4);
+				fp->formats[fp->format_count].width= w;
+				fp->formats[fp->format_count].height= h;
+				fp->format_count++;
+			}
+			else if (0 == strcmp(key, "chroma") && strlen(val) == 4) memcpy(fp->formats[0].chroma, val, 4);
+			else if (0 == strcmp(key, "width"))        fp->formats[0].width= atoi(val);
+			else if (0 == strcmp(key, "height"))       fp->formats[0].height= atoi(val);
+			else if (0 == strcmp(key, "fps"))          fp->fps= atof(val);
+			else if (0 == strcmp(key, "frames"))       fp->frames= atol(val);
+			else if (0 == strcmp(key, "change_every")) fp->change_every= atol(val);
+			else if (0 == strcmp(key, "log_every"))    fp->log_every= atol(val);
+			else if (0 == strcmp(key, "fill"))         fp->fill= atoi(val);
+			else if (0 == strcmp(key, "hold") && atoi(val) >= 0 && atoi(val) < PERLVLC_FAKE_MAX_HOLD)
+				fp->hold= atoi(val);
+			else return 0;
+		}
+		else if (len) return 0;
+		spec += len;
+		if (*spec) spec++;
+	}
+	if (!fp->format_count) fp->format_count= 1;
+	return 1;
+}
+
+/* A locked frame waiting for its unlock and display */
+typedef struct PerlVLC_fake_held {
+	void *pic, *planes[3];
+} PerlVLC_fake_held_t;
+
+static void PerlVLC_fake_show(PerlVLC_fake_player_t *fp, PerlVLC_fake_held_t *h, unsigned *pitch, unsigned *lines) {
+	if (fp->unlock) fp->unlock(fp->opaque, h->pic, h->planes);
+	if (fp->display) fp->display(fp->opaque, h->pic);
+	fp->shown_bytes += (uint64_t) pitch[0] * lines[0] + (uint64_t) pitch[1] * lines[1] + (uint64_t) pitch[2] * lines[2];
+	fp->shown++;
+}
+
+static void* PerlVLC_fake_thread(void *arg) {
+	PerlVLC_fake_player_t *fp= (PerlVLC_fake_player_t*) arg;
+	PerlVLC_fake_format_t fmt;
+	unsigned pitch[3], lines[3];
+	void *planes[3], *pic, *opaque= fp->opaque;
+	long frame= 0, in_format;
+	int i, j, fmt_idx, held= 0;
+	PerlVLC_fake_held_t hold[PERLVLC_FAKE_MAX_HOLD + 1];
+	uint64_t period_ns= fp->fps > 0? (uint64_t)(1e9 / fp->fps) : 0;
+	struct timespec next;
+	char chroma[5];
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	PerlVLC_fake_log(fp, LIBVLC_NOTICE, "fake stream: %ld frames at %g fps, %d formats",
+		fp->frames, fp->fps, fp->format_count);
+	for (fmt_idx= 0; !fp->stop && (fp->frames <= 0 || frame < fp->frames); fmt_idx++) {
+		fmt= fp->formats[fmt_idx % fp->format_count];
+		memset(pitch, 0, sizeof(pitch));
+		memset(lines, 0, sizeof(lines));
+#if (LIBVLC_VERSION_MAJOR >= 2)
+		if (fp->setup) {
+			memcpy(chroma, fmt.chroma, 4);
+			chroma[4]= '\0';
+			if (!fp->setup(&opaque, chroma, &fmt.width, &fmt.height, pitch, lines)) {
+				PerlVLC_fake_log(fp, LIBVLC_ERROR, "format callback refused %.4s %ux%u", chroma, fmt.width, fmt.height);
+				break;
+			}
+			memcpy(fmt.chroma, chroma, 4);
+		}
+		else
+#endif
+		{
+			fmt= fp->fixed;
+			pitch[0]= fp->fixed_pitch;
+			lines[0]= fmt.height;
+		}
+		PerlVLC_fake_log(fp, LIBVLC_DEBUG, "fake stream format %.4s %ux%u", fmt.chroma, fmt.width, fmt.height);
+		for (in_format= 0;
+			!fp->stop && (fp->frames <= 0 || frame < fp->frames) && (fp->change_every <= 0 || in_format < fp->change_every);
+			in_format++, frame++
+		) {
+			if (period_ns) {
+				next.tv_nsec += period_ns % 1000000000;
+				next.tv_sec += period_ns / 1000000000 + next.tv_nsec / 1000000000;
+				next.tv_nsec %= 1000000000;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+			}
+			planes[0]= planes[1]= planes[2]= NULL;
+			pic= fp->lock(opaque, planes);
+			for (j= 0; j < held; j++)
+				if (planes[0] && planes[0] == hold[j].planes[0])
+					fp->lost++;
+			if (fp->fill)
+				for (i= 0; i < 3; i++)
+					if (planes[i] && lines[i])
+						memset(planes[i], frame & 0xFF, pitch[i]);
+			hold[held].pic= pic;
+			memcpy(hold[held].planes, planes, sizeof(planes));
+			if (++held > fp->hold) {
+				PerlVLC_fake_show(fp, &hold[0], pitch, lines);
+				memmove(hold, hold + 1, --held * sizeof(*hold));
+			}
+			if (fp->log_every > 0 && frame % fp->log_every == 0)
+				PerlVLC_fake_log(fp, LIBVLC_DEBUG, "fake stream frame %ld", frame);
+		}
+		for (j= 0; j < held; j++)
+			PerlVLC_fake_show(fp, &hold[j], pitch, lines);
+		held= 0;
+#if (LIBVLC_VERSION_MAJOR >= 2)
+		if (fp->setup && fp->cleanup)
+			fp->cleanup(opaque);
+#endif
+	}
+	PerlVLC_fake_log(fp, LIBVLC_NOTICE, "fake stream ended after %ld frames", frame);
+	fp->playing= 0;
+	return NULL;
+}
+
+static void PerlVLC_fake_join(PerlVLC_fake_player_t *fp) {
+	if (fp->thread_started) {
+		fp->stop= 1;
+		pthread_join(fp->thread, NULL);
+		fp->thread_started= 0;
+		fp->playing= 0;
+	}
+}
+
+void PerlVLC_fake_video_set_callbacks(libvlc_media_player_t *mp, libvlc_video_lock_cb lock,
+	libvlc_video_unlock_cb unlock, libvlc_video_display_cb display, void *opaque
+) {
+	PerlVLC_fake_player_t *fp= PerlVLC_fake_find(mp, 1);
+	if (fp) {
+		fp->lock= lock;
+		fp->unlock= unlock;
+		fp->display= display;
+		fp->opaque= opaque;
+	}
+	libvlc_video_set_callbacks(mp, lock, unlock, display, opaque);
+}
+
+void PerlVLC_fake_video_set_format(libvlc_media_player_t *mp, const char *chroma,
+	unsigned width, unsigned height, unsigned pitch
+) {
+	PerlVLC_fake_player_t *fp= PerlVLC_fake_find(mp, 1);
+	if (fp) {
+		memcpy(fp->fixed.chroma, chroma, 4);
+		fp->fixed.width= width;
+		fp->fixed.height= height;
+		fp->fixed_pitch= pitch;
+	}
+	libvlc_video_set_format(mp, chroma, width, height, pitch);
+}
+
+#if (LIBVLC_VERSION_MAJOR >= 2)
+void PerlVLC_fake_video_set_format_callbacks(libvlc_media_player_t *mp,
+	libvlc_video_format_cb setup, libvlc_video_cleanup_cb cleanup
+) {
+	PerlVLC_fake_player_t *fp= PerlVLC_fake_find(mp, 1);
+	if (fp) {
+		fp->setup= setup;
+		fp->cleanup= cleanup;
+	}
+	libvlc_video_set_format_callbacks(mp, setup, cleanup);
+}
+#endif
+
+int PerlVLC_fake_media_player_play(libvlc_media_player_t *mp) {
+	PerlVLC_fake_player_t *fp;
+	libvlc_media_t *media= libvlc_media_player_get_media(mp);
+	char *mrl= media? libvlc_media_get_mrl(media) : NULL;
+	int ok;
+	if (media) libvlc_media_release(media);
+	if (!mrl || strncmp(mrl, "fake:", 5) != 0) {
+		if (mrl) libvlc_free(mrl);
+		return libvlc_media_player_play(mp);
+	}
+	if (!(fp= PerlVLC_fake_find(mp, 1))) {
+		libvlc_free(mrl);
+		return -1;
+	}
+	PerlVLC_fake_join(fp);
+	ok= PerlVLC_fake_parse(fp, mrl+5);
+	libvlc_free(mrl);
+	if (!ok || !fp->lock)
+		return -1;
+	fp->stop= 0;
+	fp->playing= 1;
+	fp->shown= 0;
+	fp->shown_bytes= 0;
+	if (pthread_create(&fp->thread, NULL, PerlVLC_fake_thread, fp) != 0) {
+		fp->playing= 0;
+		return -1;
+	}
+	fp->thread_started= 1;
+	return 0;
+}
+
+void PerlVLC_fake_media_player_stop(libvlc_media_player_t *mp) {
+	PerlVLC_fake_player_t *fp= PerlVLC_fake_find(mp, 0);
+	if (fp) PerlVLC_fake_join(fp);
+	libvlc_media_player_stop(mp);
+}
+
+int PerlVLC_fake_media_player_is_playing(libvlc_media_player_t *mp) {
+	PerlVLC_fake_player_t *fp= PerlVLC_fake_find(mp, 0);
+	return (fp && fp->playing) || libvlc_media_player_is_playing(mp);
+}
+
+void PerlVLC_fake_media_player_retain(libvlc_media_player_t *mp) {
+	PerlVLC_fake_player_t *fp;
+	pthread_mutex_lock(&PerlVLC_fake_players_mutex);
+	for (fp= PerlVLC_fake_players; fp && fp->mp != mp; fp= fp->next);
+	if (fp) fp->refs++;
+	pthread_mutex_unlock(&PerlVLC_fake_players_mutex);
+	libvlc_media_player_retain(mp);
+}
+
+/* Playback ends with the last reference */
+void PerlVLC_fake_media_player_release(libvlc_media_player_t *mp) {
+	PerlVLC_fake_player_t **fpp, *fp= NULL;
+	pthread_mutex_lock(&PerlVLC_fake_players_mutex);
+	for (fpp= &PerlVLC_fake_players; *fpp; fpp= &(*fpp)->next)
+		if ((*fpp)->mp == mp) {
+			if ((*fpp)->refs > 0) {
+				(*fpp)->refs--;
+				break;
+			}
+			fp= *fpp;
+			*fpp= fp->next;
+			break;
+		}
+	pthread_mutex_unlock(&PerlVLC_fake_players_mutex);
+	if (fp) {
+		PerlVLC_fake_join(fp);
+		free(fp);
+	}
+	libvlc_media_player_release(mp);
+}
+
+int PerlVLC_fake_media_get_stats(libvlc_media_t *media, libvlc_media_stats_t *stats) {
+	PerlVLC_fake_player_t *fp;
+	libvlc_media_t *m;
+	pthread_mutex_lock(&PerlVLC_fake_players_mutex);
+	for (fp= PerlVLC_fake_players; fp; fp= fp->next) {
+		if (!fp->thread_started || !(m= libvlc_media_player_get_media(fp->mp))) continue;
+		/* the caller holds a reference, so the address can still be compared */
+		libvlc_media_release(m);
+		if (m == media) break;
+	}
+	if (fp) {
+		memset(stats, 0, sizeof(*stats));
+		stats->i_decoded_video= stats->i_displayed_pictures= (int) fp->shown;
+		stats->i_read_bytes= stats->i_demux_read_bytes= (int) fp->shown_bytes;
+		stats->i_lost_pictures= (int) fp->lost;
+	}
+	pthread_mutex_unlock(&PerlVLC_fake_players_mutex);
+	return fp? 1 : libvlc_media_get_stats(media, stats);
+}
+
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
+void PerlVLC_fake_log_set(libvlc_instance_t *inst, libvlc_log_cb cb, void *data) {
+	PerlVLC_fake_logger_t *l;
+	pthread_mutex_lock(&PerlVLC_fake_loggers_mutex);
+	for (l= PerlVLC_fake_loggers; l && l->inst != inst; l= l->next);
+	if (!l && (l= (PerlVLC_fake_logger_t*) calloc(1, sizeof(*l)))) {
+		l->inst= inst;
+		l->next= PerlVLC_fake_loggers;
+		PerlVLC_fake_loggers= l;
+	}
+	if (l) {
+		l->cb= cb;
+		l->data= data;
+	}
+	pthread_mutex_unlock(&PerlVLC_fake_loggers_mutex);
+	libvlc_log_set(inst, cb, data);
+}
+
+void PerlVLC_fake_log_unset(libvlc_instance_t *inst) {
+	PerlVLC_fake_logger_t **lp, *l;
+	pthread_mutex_lock(&PerlVLC_fake_loggers_mutex);
+	for (lp= &PerlVLC_fake_loggers; *lp; lp= &(*lp)->next)
+		if ((*lp)->inst == inst) {
+			l= *lp;
+			*lp= l->next;
+			free(l);
+			break;
+		}
+	pthread_mutex_unlock(&PerlVLC_fake_loggers_mutex);
+	libvlc_log_unset(inst);
+}
+
+void PerlVLC_fake_log_get_context(const libvlc_log_t *ctx, const char **module, const char **file, unsigned *line) {
+	const PerlVLC_fake_log_ctx_t *fctx= PerlVLC_fake_log_ctx(ctx);
+	if (!fctx)
+		libvlc_log_get_context(ctx, module, file, line);
+	else {
+		*module= fctx->module;
+		*file= fctx->file;
+		*line= fctx->line;
+	}
+}
+
+void PerlVLC_fake_log_get_object(const libvlc_log_t *ctx, const char **name, const char **header, uintptr_t *id) {
+	const PerlVLC_fake_log_ctx_t *fctx= PerlVLC_fake_log_ctx(ctx);
+	if (!fctx)
+		libvlc_log_get_object(ctx, name, header, id);
+	else {
+		*name= fctx->name;
+		*header= fctx->header;
+		*id= fctx->id;
+	}
+}
+#endif
+
+#endif /* PERLVLC_FAKE_LIBVLC */
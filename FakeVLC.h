@@ -0,0 +1,49 @@
+/* Stand-in for the libvlc video output, for load-testing the callback machinery.
+ *
+ * Built when Makefile.PL is run with PERLVLC_FAKE_LIBVLC=1 in the environment.  The real
+ * libvlc is still linked for instances and media, but playback of a media whose MRL begins
+ * with "fake:" is replaced by a thread that drives the video callbacks with synthetic frames.
+ * Every other media plays through the real libvlc as usual.  See FakeVLC.c for the MRL
+ * parameters.
+ */
+
+extern void PerlVLC_fake_video_set_callbacks(libvlc_media_player_t *mp, libvlc_video_lock_cb lock,
+	libvlc_video_unlock_cb unlock, libvlc_video_display_cb display, void *opaque);
+extern void PerlVLC_fake_video_set_format(libvlc_media_player_t *mp, const char *chroma,
+	unsigned width, unsigned height, unsigned pitch);
+extern int PerlVLC_fake_media_player_play(libvlc_media_player_t *mp);
+extern void PerlVLC_fake_media_player_stop(libvlc_media_player_t *mp);
+extern int PerlVLC_fake_media_player_is_playing(libvlc_media_player_t *mp);
+extern void PerlVLC_fake_media_player_retain(libvlc_media_player_t *mp);
+extern void PerlVLC_fake_media_player_release(libvlc_media_player_t *mp);
+extern int PerlVLC_fake_media_get_stats(libvlc_media_t *media, libvlc_media_stats_t *stats);
+#if (LIBVLC_VERSION_MAJOR >= 2)
+extern void PerlVLC_fake_video_set_format_callbacks(libvlc_media_player_t *mp,
+	libvlc_video_format_cb setup, libvlc_video_cleanup_cb cleanup);
+#endif
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
+extern void PerlVLC_fake_log_set(libvlc_instance_t *inst, libvlc_log_cb cb, void *data);
+extern void PerlVLC_fake_log_unset(libvlc_instance_t *inst);
+extern void PerlVLC_fake_log_get_context(const libvlc_log_t *ctx, const char **module, const char **file, unsigned *line);
+extern void PerlVLC_fake_log_get_object(const libvlc_log_t *ctx, const char **name, const char **header, uintptr_t *id);
+#endif
+
+#ifndef PERLVLC_FAKE_IMPL
+#define libvlc_video_set_callbacks        PerlVLC_fake_video_set_callbacks
+#define libvlc_video_set_format           PerlVLC_fake_video_set_format
+#define libvlc_media_player_play          PerlVLC_fake_media_player_play
+#define libvlc_media_player_stop          PerlVLC_fake_media_player_stop
+#define libvlc_media_player_is_playing    PerlVLC_fake_media_player_is_playing
+#define libvlc_media_player_retain        PerlVLC_fake_media_player_retain
+#define libvlc_media_player_release       PerlVLC_fake_media_player_release
+#define libvlc_media_get_stats            PerlVLC_fake_media_get_stats
+#if (LIBVLC_VERSION_MAJOR >= 2)
+#define libvlc_video_set_format_callbacks PerlVLC_fake_video_set_format_callbacks
+#endif
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
+#define libvlc_log_set                    PerlVLC_fake_log_set
+#define libvlc_log_unset                  PerlVLC_fake_log_unset
+#define libvlc_log_get_context            PerlVLC_fake_log_get_context
+#define libvlc_log_get_object             PerlVLC_fake_log_get_object
+#endif
+#endif
@@ -68,7 +68,7 @@ libvlc_audio_filter_list_get(vlc)
 			hv_store(elem, "shortname", 9, newSVpv(mcur->psz_shortname, 0), 0);
 			hv_store(elem, "longname",  8, newSVpv(mcur->psz_longname, 0), 0);
 			hv_store(elem, "help",      4, newSVpv(mcur->psz_help, 0), 0);
-			PUSHs(newRV_noinc((SV*)elem));
+			mXPUSHs(newRV_noinc((SV*)elem));
 		}
 		libvlc_module_description_list_release(mlist);
 
@@ -85,10 +85,22 @@ libvlc_video_filter_list_get(vlc)
 			hv_store(elem, "shortname", 9, newSVpv(mcur->psz_shortname, 0), 0);
 			hv_store(elem, "longname",  8, newSVpv(mcur->psz_longname, 0), 0);
 			hv_store(elem, "help",      4, newSVpv(mcur->psz_help, 0), 0);
-			PUSHs(newRV_noinc((SV*)elem));
+			mXPUSHs(newRV_noinc((SV*)elem));
 		}
 		libvlc_module_description_list_release(mlist);
 
+void
+_forget(self)
+	SV *self
+	INIT:
+		MAGIC *mg;
+	PPCODE:
+		/* The instance belongs to another process; leak it rather than release it here */
+		if (sv_isobject(self))
+			for (mg= SvMAGIC(SvRV(self)); mg; mg= mg->mg_moremagic)
+				if (mg->mg_type == PERL_MAGIC_ext && mg->mg_virtual == &PerlVLC_instance_mg_vtbl)
+					mg->mg_ptr= NULL;
+
 void
 _set_event_pipe(vlc, read_fd, write_fd)
 	PerlVLC_vlc_t *vlc
@@ -106,10 +118,31 @@ _recv_event(vlc)
 		char buf[PERLVLC_MSG_BUFFER_SIZE];
 	CODE:
 		got= recv(vlc->event_pipe[0], buf, sizeof(buf), 0);
+		if (got > 0 && vlc->record_fd >= 0)
+			PerlVLC_record_message(vlc, buf, got);
 		RETVAL= (got > 0)? PerlVLC_inflate_message(buf, got) : &PL_sv_undef;
 	OUTPUT:
 		RETVAL
 
+int
+_recv_prioritized(vlc, queues, max, log_limit)
+	PerlVLC_vlc_t *vlc
+	AV *queues
+	int max
+	int log_limit
+	CODE:
+		RETVAL= PerlVLC_recv_prioritized(vlc, queues, max, log_limit);
+	OUTPUT:
+		RETVAL
+
+UV
+log_dropped(vlc)
+	PerlVLC_vlc_t *vlc
+	CODE:
+		RETVAL= vlc->log_dropped;
+	OUTPUT:
+		RETVAL
+
 SV *
 _inflate_message(vlc, buffer)
 	PerlVLC_vlc_t *vlc
@@ -123,6 +156,46 @@ _inflate_message(vlc, buffer)
 	OUTPUT:
 		RETVAL
 
+bool
+_record_messages(vlc, fd)
+	PerlVLC_vlc_t *vlc
+	int fd
+	CODE:
+		if (fd < 0) {
+			vlc->record_fd= -1;
+			RETVAL= 1;
+		}
+		else RETVAL= PerlVLC_record_start(vlc, fd);
+	OUTPUT:
+		RETVAL
+
+void
+_rewrite_message(vlc, buffer, callback_id, picture= 0)
+	SV *vlc
+	SV *buffer
+	int callback_id
+	UV picture
+	INIT:
+		STRLEN len;
+		char *buf;
+	PPCODE:
+		(void) vlc;
+		buf= SvPV_force(buffer, len);
+		PerlVLC_message_rewrite(buf, len, callback_id, (void*) picture);
+
+void
+_encode_picture(vlc, pic, format, level, path, copy, callback_id, job_id)
+	PerlVLC_vlc_t *vlc
+	PerlVLC_picture_t *pic
+	int format
+	int level
+	const char *path
+	bool copy
+	UV callback_id
+	UV job_id
+	PPCODE:
+		PerlVLC_encode_submit(pic, format, level, path, copy, vlc->event_pipe[1], callback_id, job_id);
+
 #if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
 
 void
@@ -178,6 +251,107 @@ libvlc_media_new_fd(vlc, fd)
 	libvlc_instance_t *vlc
 	int fd
 
+SV *
+_media_new_buffer(vlc, buffer_ref)
+	PerlVLC_vlc_t *vlc
+	SV *buffer_ref
+	CODE:
+		if (!SvROK(buffer_ref) || SvROK(SvRV(buffer_ref)) || SvTYPE(SvRV(buffer_ref)) > SVt_PVMG)
+			croak("buffer must be a scalar-ref");
+		RETVAL= PerlVLC_media_new_buffer(vlc, SvRV(buffer_ref));
+	OUTPUT:
+		RETVAL
+
+SV *
+_media_new_mmap(vlc, path)
+	PerlVLC_vlc_t *vlc
+	const char *path
+	CODE:
+		RETVAL= PerlVLC_media_new_mmap(vlc, path);
+	OUTPUT:
+		RETVAL
+
+SV *
+_mmap_file(path)
+	const char *path
+	CODE:
+		RETVAL= newRV_noinc(PerlVLC_mmap_file_scalar(path));
+	OUTPUT:
+		RETVAL
+
+SV*
+_mp4_keyframes(path)
+	const char *path
+	INIT:
+		AV *times= (AV*) sv_2mortal((SV*) newAV());
+	CODE:
+		RETVAL= PerlVLC_mp4_keyframes(path, times)? newRV_inc((SV*) times) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+SV*
+_loudness_measure(rate, channels, samples)
+	unsigned rate
+	unsigned channels
+	SV *samples
+	INIT:
+		PerlVLC_loudness_summary_t summary;
+		STRLEN len;
+		const char *buf= SvPVbyte(samples, len);
+		HV *hv;
+	CODE:
+		if (!channels || len % (sizeof(float) * channels))
+			croak("Expected packed floats, a multiple of %u channels", channels);
+		PerlVLC_loudness_measure(rate, channels, (const float*) buf, len / sizeof(float) / channels, &summary);
+		PerlVLC_loudness_summary_to_hv(&summary, (hv= newHV()));
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+void
+_thread_get_affinity(tid= 0)
+	int tid
+	INIT:
+		AV *cpus= newAV();
+		int i;
+	PPCODE:
+		sv_2mortal((SV*) cpus);
+		if (PerlVLC_thread_get_affinity(tid, cpus)) {
+			EXTEND(SP, av_len(cpus)+1);
+			for (i= 0; i <= av_len(cpus); i++)
+				PUSHs(*av_fetch(cpus, i, 0));
+		}
+
+bool
+_thread_set_affinity(tid, cpus)
+	int tid
+	AV *cpus
+	CODE:
+		RETVAL= PerlVLC_thread_set_affinity(tid, cpus);
+	OUTPUT:
+		RETVAL
+
+SV *
+_media_new_stream(vlc, size, low_water)
+	PerlVLC_vlc_t *vlc
+	UV size
+	UV low_water
+	CODE:
+		RETVAL= PerlVLC_media_new_stream(vlc, size, low_water);
+	OUTPUT:
+		RETVAL
+
+void
+libvlc_media_add_option(media, options)
+	libvlc_media_t *media
+	const char *options
+
+void
+libvlc_media_add_option_flag(media, options, flags)
+	libvlc_media_t *media
+	const char *options
+	unsigned flags
+
 long
 libvlc_media_get_duration(media)
 	libvlc_media_t *media
@@ -326,6 +500,45 @@ libvlc_media_player_set_video_title_display(player, position, timeout)
 
 #endif
 
+int
+libvlc_audio_get_track_count(player)
+	libvlc_media_player_t *player
+
+int
+libvlc_audio_get_track(player)
+	libvlc_media_player_t *player
+
+int
+libvlc_audio_set_track(player, track)
+	libvlc_media_player_t *player
+	int track
+
+int
+libvlc_video_get_track_count(player)
+	libvlc_media_player_t *player
+
+int
+libvlc_video_get_track(player)
+	libvlc_media_player_t *player
+
+int
+libvlc_video_set_track(player, track)
+	libvlc_media_player_t *player
+	int track
+
+int
+libvlc_video_get_spu_count(player)
+	libvlc_media_player_t *player
+
+int
+libvlc_video_get_spu(player)
+	libvlc_media_player_t *player
+
+int
+libvlc_video_set_spu(player, spu)
+	libvlc_media_player_t *player
+	int spu
+
 void
 libvlc_video_set_format(player, chroma, width, height, pitch)
 	libvlc_media_player_t *player
@@ -389,6 +602,98 @@ _build_metadata(media)
 		}
 		PUSHs(ref);
 
+SV *
+stats(media)
+	libvlc_media_t *media
+	INIT:
+		PerlVLC_stats_sample_t sample;
+		HV *hv;
+	CODE:
+		if (!PerlVLC_stats_read(media, &sample))
+			XSRETURN_UNDEF;
+		hv= newHV();
+		PerlVLC_stats_sample_to_hv(&sample, hv);
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+void
+_set_stream_callback(mwrap, event_fd, cb_id)
+	PerlVLC_media_t *mwrap
+	int event_fd
+	int cb_id
+	PPCODE:
+		if (!mwrap->stream)
+			croak("Media is not a stream");
+		pthread_mutex_lock(&mwrap->stream->mutex);
+		mwrap->stream->callback_id= cb_id;
+		mwrap->stream->event_pipe= event_fd;
+		pthread_mutex_unlock(&mwrap->stream->mutex);
+
+UV
+feed(mwrap, data)
+	PerlVLC_media_t *mwrap
+	SV *data
+	INIT:
+		STRLEN len;
+		const char *buf;
+	CODE:
+		if (!mwrap->stream)
+			croak("Media is not a stream");
+		if (mwrap->stream->eof)
+			croak("Can't feed stream after feed_eof");
+		buf= SvPVbyte(data, len);
+		RETVAL= PerlVLC_media_stream_feed(mwrap->stream, buf, len);
+	OUTPUT:
+		RETVAL
+
+void
+feed_eof(mwrap)
+	PerlVLC_media_t *mwrap
+	PPCODE:
+		if (!mwrap->stream)
+			croak("Media is not a stream");
+		PerlVLC_media_stream_finish(mwrap->stream, 0);
+
+bool
+_is_clone(self)
+	SV *self
+	CODE:
+		RETVAL= PerlVLC_is_clone(self, &PerlVLC_media_mg_vtbl);
+	OUTPUT:
+		RETVAL
+
+void
+_stream_close(mwrap)
+	PerlVLC_media_t *mwrap
+	PPCODE:
+		if (mwrap->stream)
+			PerlVLC_media_stream_finish(mwrap->stream, 1);
+
+SV *
+stream_buffered(mwrap)
+	PerlVLC_media_t *mwrap
+	CODE:
+		if (!mwrap->stream)
+			croak("Media is not a stream");
+		pthread_mutex_lock(&mwrap->stream->mutex);
+		RETVAL= newSVuv(mwrap->stream->fill);
+		pthread_mutex_unlock(&mwrap->stream->mutex);
+	OUTPUT:
+		RETVAL
+
+SV *
+stream_space(mwrap)
+	PerlVLC_media_t *mwrap
+	CODE:
+		if (!mwrap->stream)
+			croak("Media is not a stream");
+		pthread_mutex_lock(&mwrap->stream->mutex);
+		RETVAL= newSVuv(mwrap->stream->size - mwrap->stream->fill);
+		pthread_mutex_unlock(&mwrap->stream->mutex);
+	OUTPUT:
+		RETVAL
+
 MODULE = VideoLAN::LibVLC              PACKAGE = VideoLAN::LibVLC::MediaPlayer
 
 void
@@ -425,6 +730,45 @@ _enable_video_callbacks(player, event_fd, cb_id, which_list)
 			}
 		PerlVLC_enable_video_callbacks(player, which);
 
+void
+_enable_loudness_meter(player, event_fd, cb_id, rate, channels, weights, speed, interval)
+	PerlVLC_player_t *player
+	int event_fd
+	int cb_id
+	unsigned rate
+	unsigned channels
+	AV *weights
+	unsigned speed
+	unsigned interval
+	INIT:
+		double w[PERLVLC_LOUDNESS_MAX_CHANNELS];
+		SV **item;
+		int i;
+	PPCODE:
+		if (channels > PERLVLC_LOUDNESS_MAX_CHANNELS)
+			croak("Loudness meter supports 1 to %d channels", PERLVLC_LOUDNESS_MAX_CHANNELS);
+		for (i= 0; i < channels; i++)
+			w[i]= ((item= av_fetch(weights, i, 0)) && *item && SvOK(*item))? SvNV(*item) : 1.0;
+		player->callback_id= cb_id;
+		player->event_pipe= event_fd;
+		PerlVLC_enable_loudness_meter(player, rate, channels, w, speed, interval);
+
+SV *
+loudness(player)
+	PerlVLC_player_t *player
+	INIT:
+		PerlVLC_loudness_summary_t summary;
+		HV *hv;
+	CODE:
+		if (!player->loudness)
+			XSRETURN_UNDEF;
+		PerlVLC_loudness_get_summary(player->loudness, &summary);
+		hv= newHV();
+		PerlVLC_loudness_summary_to_hv(&summary, hv);
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
 void
 _set_video_format(player, format_hv)
 	PerlVLC_player_t *player
@@ -432,11 +776,22 @@ _set_video_format(player, format_hv)
 	INIT:
 		PerlVLC_picture_format_t format;
 		SV **item;
+		AV *pitch, *lines;
+		int i;
 	PPCODE:
 		memset(&format, 0, sizeof(format));
 		PerlVLC_picture_format_init_from_hv(&format, format_hv);
 		if (!format.lines[0]) croak("lines[0] must be set");
-		if (!format.pitch[0]) croak("pitch[0] must be set");
+		if (!format.pitch[0]) croak("pitch[0] must be set for chroma '%.4s'", format.chroma);
+		/* report the complete layout back to the caller */
+		pitch= newAV();
+		lines= newAV();
+		for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+			av_push(pitch, newSVuv(format.pitch[i]));
+			av_push(lines, newSVuv(format.lines[i]));
+		}
+		hv_stores(format_hv, "pitch", newRV_noinc((SV*) pitch));
+		hv_stores(format_hv, "lines", newRV_noinc((SV*) lines));
 		if (player->need_format_response) {
 			if (!(item= hv_fetchs(format_hv, "alloc_count", 0)) || !*item || !SvOK(*item))
 				croak("alloc_count is required when replying to callback");
@@ -450,6 +805,18 @@ _set_video_format(player, format_hv)
 		}
 		memcpy(&player->current_format, &format, sizeof(format));
 
+void
+_vbuf_drain(player)
+	PerlVLC_player_t *player
+	INIT:
+		char buf[PERLVLC_MSG_BUFFER_SIZE];
+		int got;
+	PPCODE:
+		if (player->vbuf_pipe[0] < 0)
+			croak("video buffer pipe not initialized yet");
+		while ((got= recv(player->vbuf_pipe[0], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+			mXPUSHs(newSVpvn(buf, got));
+
 int
 _need_format_response(player, assign=NULL)
 	PerlVLC_player_t *player
@@ -489,7 +856,7 @@ _dequeue_picture(player, pic_address)
 			croak("Picture does not belong to this player");
 		pic= (PerlVLC_picture_t*) pic_address;
 		PerlVLC_player_remove_picture(player, pic);
-		pic->held_by_vlc= 0;
+		PerlVLC_picture_set_held(pic, 0);
 	OUTPUT:
 		RETVAL
 
@@ -529,84 +896,367 @@ trace_pictures(player, ...)
 	OUTPUT:
 		RETVAL
 
-MODULE = VideoLAN::LibVLC              PACKAGE = VideoLAN::LibVLC::Picture
-
-PerlVLC_picture_t *
-new(classname, args)
-	SV *classname
-	SV *args
+void
+_set_lock_policy(player, timeout_ms, policy)
+	PerlVLC_player_t *player
+	int timeout_ms
+	int policy
 	CODE:
-		(void)classname; /* unused, subclasses will have to re-bless if needed */
-		RETVAL= PerlVLC_picture_new_from_hash(args);
-	OUTPUT:
-		RETVAL
+		if (policy != PERLVLC_LOCK_SCRATCH && policy != PERLVLC_LOCK_NULL)
+			croak("Unknown lock policy %d", policy);
+		player->lock_timeout_ms= timeout_ms < 0? -1 : timeout_ms;
+		player->lock_policy= policy;
 
 int
-id(pic, ...)
-	PerlVLC_picture_t *pic;
+lock_timeout_ms(player)
+	PerlVLC_player_t *player
 	CODE:
-		if (items > 1)
-			pic->id= SvIV(ST(1));
-		RETVAL= pic->id;
+		RETVAL= player->lock_timeout_ms;
 	OUTPUT:
 		RETVAL
 
 SV *
-chroma(pic)
-	PerlVLC_picture_t *pic;
+lock_stats(player, reset=0)
+	PerlVLC_player_t *player
+	bool reset
+	INIT:
+		struct PerlVLC_lock_stats st= player->lock_stats;
+		HV *hv;
 	CODE:
-		RETVAL= newSVpvn(pic->format.chroma, 4);
+		/* The video thread updates these without a lock; a snapshot that is off by one frame is fine */
+		if (reset) memset(&player->lock_stats, 0, sizeof(player->lock_stats));
+		hv= newHV();
+		hv_stores(hv, "locks",      newSVuv(st.locks));
+		hv_stores(hv, "timeouts",   newSVuv(st.timeouts));
+		hv_stores(hv, "scratch",    newSVuv(st.scratch));
+		hv_stores(hv, "null",       newSVuv(st.null));
+		hv_stores(hv, "wait_max",   newSVnv(st.wait_max_us * .000001));
+		hv_stores(hv, "wait_total", newSVnv(st.wait_total_us * .000001));
+		hv_stores(hv, "seeks",          newSVuv(st.seeks));
+		hv_stores(hv, "keyframe_seeks", newSVuv(st.keyframe_seeks));
+		hv_stores(hv, "seeks_done",     newSVuv(st.seeks_done));
+		hv_stores(hv, "seek_latency_last",  newSVnv(st.seek_last_us * .000001));
+		hv_stores(hv, "seek_latency_max",   newSVnv(st.seek_max_us * .000001));
+		hv_stores(hv, "seek_latency_total", newSVnv(st.seek_total_us * .000001));
+		RETVAL= newRV_noinc((SV*) hv);
 	OUTPUT:
 		RETVAL
 
-int
-width(pic)
-	PerlVLC_picture_t *pic;
+void
+_seek_start(player, keyframe)
+	PerlVLC_player_t *player
+	bool keyframe
+	PPCODE:
+		PerlVLC_seek_start(player, keyframe);
+
+void
+_set_format_policy(player, policy)
+	PerlVLC_player_t *player
+	SV *policy
+	INIT:
+		PerlVLC_format_policy_t p;
+	PPCODE:
+		if (SvOK(policy)) {
+			if (!SvROK(policy) || SvTYPE(SvRV(policy)) != SVt_PVHV)
+				croak("Expected hashref or undef");
+			PerlVLC_format_policy_from_hv(&p, (HV*) SvRV(policy));
+		}
+		else memset(&p, 0, sizeof(p));
+		/* read by the video thread in the format callback, so MediaPlayer refuses to change it during playback */
+		player->format_policy= p;
+
+SV *
+_format_policy_apply(policy, chroma, width, height)
+	HV *policy
+	const char *chroma
+	unsigned width
+	unsigned height
+	INIT:
+		PerlVLC_format_policy_t p;
+		PerlVLC_picture_format_t format;
+		HV *hv;
 	CODE:
-		RETVAL= pic->format.width;
+		if (strlen(chroma) != 4)
+			croak("Chroma must be 4 characters");
+		PerlVLC_format_policy_from_hv(&p, policy);
+		memset(&format, 0, sizeof(format));
+		memcpy(format.chroma, chroma, 4);
+		format.width= width;
+		format.height= height;
+		if (PerlVLC_format_policy_apply(&p, &format)) {
+			PerlVLC_format_to_hv((hv= newHV()), &format);
+			RETVAL= newRV_noinc((SV*) hv);
+		}
+		else RETVAL= &PL_sv_undef;
 	OUTPUT:
 		RETVAL
 
 int
-height(pic)
-	PerlVLC_picture_t *pic;
+_adopt_pictures(player, pictures)
+	PerlVLC_player_t *player
+	AV *pictures
+	INIT:
+		SV **item;
+		int i;
 	CODE:
-		RETVAL= pic->format.height;
+		RETVAL= 0;
+		for (i= 0; i <= av_len(pictures); i++)
+			if ((item= av_fetch(pictures, i, 0)) && *item
+				&& PerlVLC_player_adopt_picture(player, INT2PTR(PerlVLC_picture_t*, SvUV(*item))))
+				RETVAL++;
 	OUTPUT:
 		RETVAL
 
+void
+_play_start(player)
+	PerlVLC_player_t *player
+	PPCODE:
+		PerlVLC_play_start(player);
+
 SV *
-plane(pic, idx)
-	PerlVLC_picture_t *pic;
-	int idx;
+time_to_format(player)
+	PerlVLC_player_t *player
 	CODE:
-		if (pic->held_by_vlc)
-			croak("Can't access planes while Picture object is held by VLC decoder thread");
-		RETVAL= (idx < 0 || idx > 3)? &PL_sv_undef
-			: pic->plane_buffer_sv[idx]? newSVsv(pic->plane_buffer_sv[idx])
-			: pic->plane[idx]? newRV_noinc(buffer_scalar_wrap(aTHX_ newSV(0),
-					PERLVLC_ALIGN_PLANE(pic->plane[idx]),
-					pic->format.pitch[idx] * pic->format.lines[idx], 0, NULL, NULL))
-			: &PL_sv_undef;
+		RETVAL= player->format_after_us? newSVnv(player->format_after_us * .000001) : &PL_sv_undef;
 	OUTPUT:
 		RETVAL
 
 SV *
-pitch(pic, idx)
-	PerlVLC_picture_t *pic;
-	int idx;
+time_to_first_frame(player)
+	PerlVLC_player_t *player
 	CODE:
-		RETVAL= (idx < 0 || idx > 3 || !(pic->format.pitch[idx] || pic->plane_buffer_sv[idx]))? &PL_sv_undef
-			: newSViv(pic->format.pitch[idx]);
+		RETVAL= player->first_frame_after_us? newSVnv(player->first_frame_after_us * .000001) : &PL_sv_undef;
 	OUTPUT:
 		RETVAL
 
-SV *
-lines(pic, idx)
-	PerlVLC_picture_t *pic;
-	int idx;
-	CODE:
-		RETVAL= (idx < 0 || idx > 3 || !(pic->format.lines[idx] || pic->plane_buffer_sv[idx]))? &PL_sv_undef
+void
+_sample_stats(player, interval_ms, event_fd, cb_id)
+	PerlVLC_player_t *player
+	unsigned interval_ms
+	int event_fd
+	int cb_id
+	PPCODE:
+		if (interval_ms) {
+			PerlVLC_stats_add(player->player, interval_ms, event_fd, cb_id);
+			player->stats_sampled= true;
+		}
+		else if (player->stats_sampled) {
+			PerlVLC_stats_remove(player->player);
+			player->stats_sampled= false;
+		}
+
+void
+_clock_attach(player, enable)
+	PerlVLC_player_t *player
+	bool enable
+	PPCODE:
+		if (enable) PerlVLC_clock_attach(player);
+		else PerlVLC_clock_detach(player);
+
+bool
+_clock_attached(player)
+	PerlVLC_player_t *player
+	CODE:
+		RETVAL= player->clock_attached;
+	OUTPUT:
+		RETVAL
+
+void
+_clock_seek(player, time_ms, position)
+	PerlVLC_player_t *player
+	IV time_ms
+	double position
+	PPCODE:
+		if (player->clock_attached)
+			PerlVLC_clock_seek(player, time_ms, position);
+
+void
+_clock_set_rate(player, rate)
+	PerlVLC_player_t *player
+	double rate
+	PPCODE:
+		if (player->clock_attached)
+			PerlVLC_clock_set_rate(player, rate);
+
+void
+_clock_event(player, type, value=0)
+	PerlVLC_player_t *player
+	const char *type
+	double value
+	INIT:
+		libvlc_event_t event;
+	PPCODE:
+		/* Feed the clock an event as libvlc would, for testing */
+		memset(&event, 0, sizeof(event));
+		if      (0 == strcmp(type, "opening"))  event.type= libvlc_MediaPlayerOpening;
+		else if (0 == strcmp(type, "playing"))  event.type= libvlc_MediaPlayerPlaying;
+		else if (0 == strcmp(type, "paused"))   event.type= libvlc_MediaPlayerPaused;
+		else if (0 == strcmp(type, "stopped"))  event.type= libvlc_MediaPlayerStopped;
+		else if (0 == strcmp(type, "ended"))    event.type= libvlc_MediaPlayerEndReached;
+		else if (0 == strcmp(type, "error"))    event.type= libvlc_MediaPlayerEncounteredError;
+		else if (0 == strcmp(type, "time")) {
+			event.type= libvlc_MediaPlayerTimeChanged;
+			event.u.media_player_time_changed.new_time= (libvlc_time_t) value;
+		}
+		else if (0 == strcmp(type, "position")) {
+			event.type= libvlc_MediaPlayerPositionChanged;
+			event.u.media_player_position_changed.new_position= value;
+		}
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20200)
+		else if (0 == strcmp(type, "length")) {
+			event.type= libvlc_MediaPlayerLengthChanged;
+			event.u.media_player_length_changed.new_length= (libvlc_time_t) value;
+		}
+#endif
+		else croak("Unknown clock event '%s'", type);
+		event.p_obj= player->player;
+		PerlVLC_clock_event_cb(&event, player);
+
+IV
+_get_time(player)
+	PerlVLC_player_t *player
+	INIT:
+		PerlVLC_clock_t c;
+	CODE:
+		if (player->clock_attached) {
+			PerlVLC_clock_read(player, &c);
+			RETVAL= c.time_ms;
+		}
+		else RETVAL= libvlc_media_player_get_time(player->player);
+	OUTPUT:
+		RETVAL
+
+double
+_get_position(player)
+	PerlVLC_player_t *player
+	INIT:
+		PerlVLC_clock_t c;
+	CODE:
+		if (player->clock_attached) {
+			PerlVLC_clock_read(player, &c);
+			RETVAL= c.position;
+		}
+		else RETVAL= libvlc_media_player_get_position(player->player);
+	OUTPUT:
+		RETVAL
+
+IV
+_get_length(player)
+	PerlVLC_player_t *player
+	CODE:
+		/* only changes on events, so needs no interpolation */
+		RETVAL= player->clock_attached? __atomic_load_n(&player->clock.length_ms, __ATOMIC_RELAXED)
+			: libvlc_media_player_get_length(player->player);
+	OUTPUT:
+		RETVAL
+
+bool
+is_playing(player)
+	PerlVLC_player_t *player
+	CODE:
+		RETVAL= player->clock_attached? __atomic_load_n(&player->clock.state, __ATOMIC_RELAXED) == libvlc_Playing
+			: libvlc_media_player_is_playing(player->player);
+	OUTPUT:
+		RETVAL
+
+SV *
+clock(player)
+	PerlVLC_player_t *player
+	INIT:
+		PerlVLC_clock_t c;
+		HV *hv;
+	CODE:
+		if (!player->clock_attached)
+			XSRETURN_UNDEF;
+		PerlVLC_clock_read(player, &c);
+		hv= newHV();
+		hv_stores(hv, "state",    newSViv(c.state));
+		hv_stores(hv, "playing",  newSViv(c.state == libvlc_Playing));
+		hv_stores(hv, "time",     c.time_ms >= 0? newSVnv(c.time_ms * .001) : newSV(0));
+		hv_stores(hv, "position", c.position >= 0? newSVnv(c.position) : newSV(0));
+		hv_stores(hv, "length",   newSVnv(c.length_ms * .001));
+		hv_stores(hv, "rate",     newSVnv(c.rate));
+		hv_stores(hv, "events",   newSVuv(c.events));
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+MODULE = VideoLAN::LibVLC              PACKAGE = VideoLAN::LibVLC::Picture
+
+PerlVLC_picture_t *
+new(classname, args)
+	SV *classname
+	SV *args
+	CODE:
+		(void)classname; /* unused, subclasses will have to re-bless if needed */
+		RETVAL= PerlVLC_picture_new_from_hash(args);
+	OUTPUT:
+		RETVAL
+
+int
+id(pic, ...)
+	PerlVLC_picture_t *pic;
+	CODE:
+		if (items > 1)
+			pic->id= SvIV(ST(1));
+		RETVAL= pic->id;
+	OUTPUT:
+		RETVAL
+
+SV *
+chroma(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= newSVpvn(pic->format.chroma, 4);
+	OUTPUT:
+		RETVAL
+
+int
+width(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= pic->format.width;
+	OUTPUT:
+		RETVAL
+
+int
+height(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= pic->format.height;
+	OUTPUT:
+		RETVAL
+
+SV *
+plane(pic, idx)
+	PerlVLC_picture_t *pic;
+	int idx;
+	CODE:
+		if (pic->held_by_vlc)
+			croak("Can't access planes while Picture object is held by VLC decoder thread");
+		RETVAL= (idx < 0 || idx > 3)? &PL_sv_undef
+			: pic->plane_buffer_sv[idx]? newSVsv(pic->plane_buffer_sv[idx])
+			: pic->plane_ptr[idx]? newRV_noinc(PerlVLC_picture_plane_scalar(pic, idx))
+			: &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+SV *
+pitch(pic, idx)
+	PerlVLC_picture_t *pic;
+	int idx;
+	CODE:
+		RETVAL= (idx < 0 || idx > 3 || !(pic->format.pitch[idx] || pic->plane_buffer_sv[idx]))? &PL_sv_undef
+			: newSViv(pic->format.pitch[idx]);
+	OUTPUT:
+		RETVAL
+
+SV *
+lines(pic, idx)
+	PerlVLC_picture_t *pic;
+	int idx;
+	CODE:
+		RETVAL= (idx < 0 || idx > 3 || !(pic->format.lines[idx] || pic->plane_buffer_sv[idx]))? &PL_sv_undef
 			: newSViv(pic->format.lines[idx]);
 	OUTPUT:
 		RETVAL
@@ -619,6 +1269,515 @@ held_by_vlc(pic)
 	OUTPUT:
 		RETVAL
 
+UV
+address(pic, idx)
+	PerlVLC_picture_t *pic;
+	int idx;
+	CODE:
+		RETVAL= (idx < 0 || idx >= PERLVLC_PICTURE_PLANES)? 0 : PTR2UV(pic->plane_ptr[idx]);
+	OUTPUT:
+		RETVAL
+
+SV *
+owner(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= pic->owner? newSVsv(pic->owner) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+SV *
+plane_layout(classname, chroma, width, height)
+	SV *classname
+	SV *chroma
+	unsigned width
+	unsigned height
+	INIT:
+		PerlVLC_picture_format_t format;
+		STRLEN len;
+		const char *c= SvPV(chroma, len);
+		AV *pitch, *lines;
+		HV *hv;
+		int i, planes;
+	CODE:
+		(void)classname;
+		if (len != 4)
+			croak("chroma must be 4 characters");
+		memset(&format, 0, sizeof(format));
+		memcpy(format.chroma, c, 4);
+		format.width= width;
+		format.height= height;
+		if (!(planes= PerlVLC_picture_format_fill_layout(&format)))
+			XSRETURN_UNDEF;
+		pitch= newAV();
+		lines= newAV();
+		for (i= 0; i < planes; i++) {
+			av_push(pitch, newSVuv(format.pitch[i]));
+			av_push(lines, newSVuv(format.lines[i]));
+		}
+		hv= newHV();
+		hv_stores(hv, "pitch", newRV_noinc((SV*) pitch));
+		hv_stores(hv, "lines", newRV_noinc((SV*) lines));
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+SV *
+alloc(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= newSVpv(PerlVLC_alloc_names[pic->alloc & PERLVLC_ALLOC_BACKEND_MASK], 0);
+	OUTPUT:
+		RETVAL
+
+UV
+share_handle(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= PerlVLC_picture_share(pic);
+	OUTPUT:
+		RETVAL
+
+SV *
+from_handle(classname, handle)
+	SV *classname
+	UV handle
+	CODE:
+		(void)classname;
+		RETVAL= PerlVLC_picture_from_handle(handle);
+	OUTPUT:
+		RETVAL
+
+int
+shared_refs(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= __atomic_load_n(&pic->refs, __ATOMIC_ACQUIRE);
+	OUTPUT:
+		RETVAL
+
+SV *
+default_alloc(classname, ...)
+	SV *classname
+	INIT:
+		HV *hv;
+		int alloc= __atomic_load_n(&PerlVLC_plane_alloc_default, __ATOMIC_RELAXED);
+	CODE:
+		(void)classname;
+		if (items > 1) {
+			if (!SvROK(ST(1)) || SvTYPE(SvRV(ST(1))) != SVt_PVHV)
+				croak("Expected hashref");
+			alloc= PerlVLC_plane_alloc_from_hv((HV*) SvRV(ST(1)), alloc);
+			__atomic_store_n(&PerlVLC_plane_alloc_default, alloc, __ATOMIC_RELAXED);
+		}
+		hv= newHV();
+		hv_stores(hv, "alloc",    newSVpv(PerlVLC_alloc_names[alloc & PERLVLC_ALLOC_BACKEND_MASK], 0));
+		hv_stores(hv, "prefault", newSViv(alloc & PERLVLC_ALLOC_PREFAULT? 1 : 0));
+		hv_stores(hv, "mlock",    newSViv(alloc & PERLVLC_ALLOC_MLOCK? 1 : 0));
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+SV *
+alloc_stats(classname, reset=0)
+	SV *classname
+	bool reset
+	INIT:
+		HV *hv, *backend;
+		PerlVLC_alloc_stats_t *st;
+		int i;
+	CODE:
+		(void)classname;
+		hv= newHV();
+		for (i= 0; i < PERLVLC_ALLOC_BACKENDS; i++) {
+			st= &PerlVLC_alloc_stats[i];
+			backend= newHV();
+			hv_stores(backend, "allocs",     newSVuv(__atomic_load_n(&st->allocs, __ATOMIC_RELAXED)));
+			hv_stores(backend, "frees",      newSVuv(__atomic_load_n(&st->frees, __ATOMIC_RELAXED)));
+			hv_stores(backend, "failures",   newSVuv(__atomic_load_n(&st->failures, __ATOMIC_RELAXED)));
+			hv_stores(backend, "faults",     newSVuv(__atomic_load_n(&st->faults, __ATOMIC_RELAXED)));
+			hv_stores(backend, "bytes_live", newSVuv(__atomic_load_n(&st->bytes_live, __ATOMIC_RELAXED)));
+			hv_stores(backend, "bytes_peak", newSVuv(__atomic_load_n(&st->bytes_peak, __ATOMIC_RELAXED)));
+			hv_store(hv, PerlVLC_alloc_names[i], strlen(PerlVLC_alloc_names[i]), newRV_noinc((SV*) backend), 0);
+			/* bytes_live describes planes that still exist, so it survives a reset */
+			if (reset) {
+				__atomic_store_n(&st->allocs, 0, __ATOMIC_RELAXED);
+				__atomic_store_n(&st->frees, 0, __ATOMIC_RELAXED);
+				__atomic_store_n(&st->failures, 0, __ATOMIC_RELAXED);
+				__atomic_store_n(&st->faults, 0, __ATOMIC_RELAXED);
+				__atomic_store_n(&st->bytes_peak, __atomic_load_n(&st->bytes_live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+			}
+		}
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+SV *
+memory_budget(classname, ...)
+	SV *classname
+	INIT:
+		HV *hv, *args;
+		SV **field;
+		size_t limit= PerlVLC_budget.limit, reserve= PerlVLC_budget.reserve;
+		unsigned wait_ms= PerlVLC_budget.wait_ms;
+	CODE:
+		(void)classname;
+		if (items > 1) {
+			if (!SvROK(ST(1)) || SvTYPE(SvRV(ST(1))) != SVt_PVHV)
+				croak("Expected hashref");
+			args= (HV*) SvRV(ST(1));
+			if ((field= hv_fetchs(args, "limit", 0)) && *field && SvOK(*field))   limit= SvUV(*field);
+			if ((field= hv_fetchs(args, "reserve", 0)) && *field && SvOK(*field)) reserve= SvUV(*field);
+			if ((field= hv_fetchs(args, "wait", 0)) && *field && SvOK(*field))    wait_ms= (unsigned) (SvNV(*field) * 1000 + .5);
+			PerlVLC_budget_set(limit, reserve, wait_ms);
+		}
+		hv= newHV();
+		hv_stores(hv, "limit",   newSVuv(PerlVLC_budget.limit));
+		hv_stores(hv, "reserve", newSVuv(PerlVLC_budget.reserve));
+		hv_stores(hv, "wait",    newSVnv(PerlVLC_budget.wait_ms * .001));
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+SV *
+memory_stats(classname, reset=0)
+	SV *classname
+	bool reset
+	INIT:
+		PerlVLC_budget_t st= PerlVLC_budget;
+		size_t vlc_bytes= __atomic_load_n(&PerlVLC_budget.vlc_bytes, __ATOMIC_RELAXED);
+		HV *hv;
+	CODE:
+		(void)classname;
+		/* The counters change under the budget mutex, but an unlocked snapshot is fine for metrics */
+		hv= newHV();
+		hv_stores(hv, "pictures",    newSVuv(st.pictures));
+		hv_stores(hv, "bytes",       newSVuv(st.bytes));
+		hv_stores(hv, "bytes_peak",  newSVuv(st.bytes_peak));
+		hv_stores(hv, "bytes_alloc", newSVuv(st.alloc_bytes));
+		hv_stores(hv, "bytes_vlc",   newSVuv(vlc_bytes));
+		hv_stores(hv, "bytes_perl",  newSVuv(st.bytes > vlc_bytes? st.bytes - vlc_bytes : 0));
+		hv_stores(hv, "refused",     newSVuv(st.refused));
+		hv_stores(hv, "waits",       newSVuv(st.waits));
+		if (reset)
+			PerlVLC_budget_reset_stats();
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
+int
+_budget_fit(classname, bytes, priority, want)
+	SV *classname
+	UV bytes
+	int priority
+	int want
+	CODE:
+		(void)classname;
+		RETVAL= PerlVLC_budget_fit(bytes, priority, want);
+	OUTPUT:
+		RETVAL
+
+int
+priority(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= pic->priority;
+	OUTPUT:
+		RETVAL
+
+SV *
+sequence(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= pic->sequence? newSVuv(pic->sequence) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+SV *
+lock_time(pic)
+	PerlVLC_picture_t *pic;
+	ALIAS:
+		unlock_time= 1
+		display_time= 2
+	INIT:
+		uint64_t us= ix == 0? pic->lock_us : ix == 1? pic->unlock_us : pic->display_us;
+	CODE:
+		RETVAL= us? newSVnv(us * .000001) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+SV *
+media_time(pic)
+	PerlVLC_picture_t *pic;
+	CODE:
+		RETVAL= pic->display_us && pic->media_time_ms >= 0? newSVnv(pic->media_time_ms * .001) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+bool
+can_encode(self, chroma= NULL)
+	SV *self
+	const char *chroma
+	INIT:
+		PerlVLC_picture_t *pic;
+	CODE:
+		if (!chroma) {
+			if (!(pic= PerlVLC_get_picture_mg(self)))
+				croak("Require a picture or a chroma");
+			chroma= pic->format.chroma;
+		}
+		RETVAL= strlen(chroma) >= 4 && PerlVLC_encode_chroma_supported(chroma);
+	OUTPUT:
+		RETVAL
+
+MODULE = VideoLAN::LibVLC              PACKAGE = VideoLAN::LibVLC::TrackList
+
+PerlVLC_track_list_t *
+new(classname, tracks)
+	SV *classname
+	SV *tracks
+	CODE:
+		(void)classname;
+		if (!SvROK(tracks) || SvTYPE(SvRV(tracks)) != SVt_PVAV)
+			croak("Expected arrayref of hashrefs");
+		RETVAL= PerlVLC_track_list_from_av((AV*) SvRV(tracks));
+	OUTPUT:
+		RETVAL
+
+void
+_from_media(...)
+	INIT:
+		PerlVLC_media_t *mwrap;
+		int i;
+	PPCODE:
+		/* Each argument is replaced by its track list in-place */
+		for (i= 0; i < items; i++) {
+			mwrap= PerlVLC_get_media_mg(ST(i));
+			if (!mwrap) croak("argument %d is not a VideoLAN::LibVLC::Media", i);
+			ST(i)= sv_2mortal(PerlVLC_wrap_track_list(PerlVLC_track_list_from_media(mwrap->media)));
+		}
+		XSRETURN(items);
+
+unsigned
+count(tl)
+	PerlVLC_track_list_t *tl
+	CODE:
+		RETVAL= tl->count;
+	OUTPUT:
+		RETVAL
+
+SV *
+id(tl, idx)
+	PerlVLC_track_list_t *tl
+	int idx
+	ALIAS:
+		type= 1
+		profile= 2
+		level= 3
+		bitrate= 4
+		codec= 5
+		original_fourcc= 6
+		language= 7
+		description= 8
+		channels= 9
+		rate= 10
+		width= 11
+		height= 12
+		sar_num= 13
+		sar_den= 14
+		frame_rate_num= 15
+		frame_rate_den= 16
+		encoding= 17
+	INIT:
+		PerlVLC_track_t *t;
+		uint32_t fourcc;
+		char fourcc_str[4];
+	CODE:
+		if (idx < 0 || idx >= tl->count)
+			XSRETURN_UNDEF;
+		t= tl->track + idx;
+		/* type-specific fields are undef for other types of track */
+		if ((ix == 9 || ix == 10) && t->type != libvlc_track_audio)
+			XSRETURN_UNDEF;
+		if (ix >= 11 && ix <= 16 && t->type != libvlc_track_video)
+			XSRETURN_UNDEF;
+		switch (ix) {
+		case 0: RETVAL= newSViv(t->id); break;
+		case 1: RETVAL= newSViv(t->type); break;
+		case 2: RETVAL= newSViv(t->profile); break;
+		case 3: RETVAL= newSViv(t->level); break;
+		case 4: RETVAL= newSVuv(t->bitrate); break;
+		case 5:
+		case 6:
+			fourcc= ix == 5? t->codec : t->original_fourcc;
+			if (!fourcc) XSRETURN_UNDEF;
+			fourcc_str[0]= fourcc & 0xFF;
+			fourcc_str[1]= (fourcc >> 8) & 0xFF;
+			fourcc_str[2]= (fourcc >> 16) & 0xFF;
+			fourcc_str[3]= (fourcc >> 24) & 0xFF;
+			RETVAL= newSVpvn(fourcc_str, 4);
+			break;
+		case 7: RETVAL= t->language? newSVpv(t->language, 0) : &PL_sv_undef; break;
+		case 8: RETVAL= t->description? newSVpv(t->description, 0) : &PL_sv_undef; break;
+		case 9: RETVAL= newSVuv(t->channels); break;
+		case 10: RETVAL= newSVuv(t->rate); break;
+		case 11: RETVAL= newSVuv(t->width); break;
+		case 12: RETVAL= newSVuv(t->height); break;
+		case 13: RETVAL= newSVuv(t->sar_num); break;
+		case 14: RETVAL= newSVuv(t->sar_den); break;
+		case 15: RETVAL= newSVuv(t->frame_rate_num); break;
+		case 16: RETVAL= newSVuv(t->frame_rate_den); break;
+		case 17: RETVAL= t->encoding? newSVpv(t->encoding, 0) : &PL_sv_undef; break;
+		default: croak("BUG: unhandled track field %d", (int) ix);
+		}
+	OUTPUT:
+		RETVAL
+
+SV *
+frame_rate(tl, idx)
+	PerlVLC_track_list_t *tl
+	int idx
+	CODE:
+		RETVAL= (idx < 0 || idx >= tl->count
+			|| tl->track[idx].type != libvlc_track_video
+			|| !tl->track[idx].frame_rate_den)? &PL_sv_undef
+			: newSVnv((double) tl->track[idx].frame_rate_num / tl->track[idx].frame_rate_den);
+	OUTPUT:
+		RETVAL
+
+void
+find(tl, type)
+	PerlVLC_track_list_t *tl
+	int type
+	INIT:
+		unsigned i;
+	PPCODE:
+		for (i= 0; i < tl->count; i++)
+			if (tl->track[i].type == type)
+				mXPUSHu(i);
+
+MODULE = VideoLAN::LibVLC              PACKAGE = VideoLAN::LibVLC::SharedSlab
+
+PerlVLC_slab_t *
+new(classname, slot_size, slot_count)
+	SV *classname
+	UV slot_size
+	unsigned slot_count
+	CODE:
+		(void)classname;
+		RETVAL= PerlVLC_slab_new(slot_size, slot_count);
+	OUTPUT:
+		RETVAL
+
+UV
+slot_size(slab)
+	PerlVLC_slab_t *slab
+	ALIAS:
+		slot_count = 1
+	CODE:
+		RETVAL= ix == 0? slab->slot_size : slab->slot_count;
+	OUTPUT:
+		RETVAL
+
+SV *
+slot(slab, slot, offset= 0, len= ~(UV)0, readonly= 0)
+	PerlVLC_slab_t *slab
+	unsigned slot
+	UV offset
+	UV len
+	bool readonly
+	CODE:
+		if (len == ~(UV)0)
+			len= offset < slab->slot_size? slab->slot_size - offset : 0;
+		RETVAL= newRV_noinc(PerlVLC_slab_slot_scalar(slab, slot, offset, len, readonly));
+	OUTPUT:
+		RETVAL
+
+MODULE = VideoLAN::LibVLC              PACKAGE = VideoLAN::LibVLC::VideoWriter
+
+PerlVLC_writer_t *
+_new(classname, fd, format, y4m_params, queue_size, event_fd, cb_id)
+	SV *classname
+	int fd
+	int format
+	const char *y4m_params
+	unsigned queue_size
+	int event_fd
+	int cb_id
+	CODE:
+		(void)classname;
+		RETVAL= PerlVLC_writer_new(fd, format, y4m_params, queue_size, event_fd, cb_id);
+	OUTPUT:
+		RETVAL
+
+UV
+_write(w, pic)
+	PerlVLC_writer_t *w
+	PerlVLC_picture_t *pic
+	CODE:
+		RETVAL= PerlVLC_writer_write(w, pic)? PTR2UV(pic) : 0;
+	OUTPUT:
+		RETVAL
+
+void
+_unposted(w)
+	PerlVLC_writer_t *w
+	INIT:
+		PerlVLC_picture_t **pics;
+		unsigned n, i;
+	PPCODE:
+		n= PerlVLC_writer_take_unposted(w, &pics);
+		EXTEND(SP, n);
+		for (i= 0; i < n; i++)
+			PUSHs(sv_2mortal(newSVuv(PTR2UV(pics[i]))));
+		free(pics);
+
+bool
+_is_clone(self)
+	SV *self
+	CODE:
+		RETVAL= PerlVLC_is_clone(self, &PerlVLC_writer_mg_vtbl);
+	OUTPUT:
+		RETVAL
+
+void
+_wait(w)
+	PerlVLC_writer_t *w
+	ALIAS:
+		_stop = 1
+	PPCODE:
+		if (ix == 0) PerlVLC_writer_wait(w);
+		else PerlVLC_writer_stop(w);
+
+SV *
+error(w)
+	PerlVLC_writer_t *w
+	CODE:
+		RETVAL= w->error? newSVpv(strerror(w->error), 0) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+SV *
+stats(w)
+	PerlVLC_writer_t *w
+	INIT:
+		HV *hv;
+		unsigned queued= 0;
+	CODE:
+		if (w->threaded) {
+			pthread_mutex_lock(&w->mutex);
+			queued= w->queue_count;
+			pthread_mutex_unlock(&w->mutex);
+		}
+		hv= newHV();
+		hv_stores(hv, "frames",  newSVuv(w->frames));
+		hv_stores(hv, "bytes",   newSVnv((NV) w->bytes));
+		hv_stores(hv, "skipped", newSVuv(w->skipped));
+		hv_stores(hv, "queued",  newSVuv(queued));
+		RETVAL= newRV_noinc((SV*) hv);
+	OUTPUT:
+		RETVAL
+
 BOOT:
 # BEGIN GENERATED BOOT CONSTANTS
   HV* stash= gv_stashpv("VideoLAN::LibVLC", GV_ADD);
@@ -770,6 +1929,32 @@ BOOT:
   newCONSTSUB(stash, "PERLVLC_MSG_VIDEO_DISPLAY_EVENT" , newSViv(PERLVLC_MSG_VIDEO_DISPLAY_EVENT));
   newCONSTSUB(stash, "PERLVLC_MSG_VIDEO_FORMAT_EVENT"  , newSViv(PERLVLC_MSG_VIDEO_FORMAT_EVENT ));
   newCONSTSUB(stash, "PERLVLC_MSG_VIDEO_CLEANUP_EVENT" , newSViv(PERLVLC_MSG_VIDEO_CLEANUP_EVENT));
+  newCONSTSUB(stash, "PERLVLC_MSG_MEDIA_STREAM_LOW"    , newSViv(PERLVLC_MSG_MEDIA_STREAM_LOW   ));
+  newCONSTSUB(stash, "PERLVLC_MSG_AUDIO_LOUDNESS_EVENT", newSViv(PERLVLC_MSG_AUDIO_LOUDNESS_EVENT));
+  newCONSTSUB(stash, "PERLVLC_MSG_PICTURE_RELEASED"    , newSViv(PERLVLC_MSG_PICTURE_RELEASED   ));
+  newCONSTSUB(stash, "PERLVLC_MSG_VIDEO_WRITTEN"       , newSViv(PERLVLC_MSG_VIDEO_WRITTEN      ));
+  newCONSTSUB(stash, "PERLVLC_MSG_PICTURE_ENCODED"     , newSViv(PERLVLC_MSG_PICTURE_ENCODED    ));
+  newCONSTSUB(stash, "PERLVLC_MSG_MEDIA_STATS"         , newSViv(PERLVLC_MSG_MEDIA_STATS        ));
+  newCONSTSUB(stash, "PERLVLC_MSG_VIDEO_FORMAT_ANSWERED", newSViv(PERLVLC_MSG_VIDEO_FORMAT_ANSWERED));
+  newCONSTSUB(stash, "PERLVLC_PRIORITY_DECODER"        , newSViv(PERLVLC_PRIORITY_DECODER       ));
+  newCONSTSUB(stash, "PERLVLC_PRIORITY_PICTURE"        , newSViv(PERLVLC_PRIORITY_PICTURE       ));
+  newCONSTSUB(stash, "PERLVLC_PRIORITY_EVENT"          , newSViv(PERLVLC_PRIORITY_EVENT         ));
+  newCONSTSUB(stash, "PERLVLC_PRIORITY_LOG"            , newSViv(PERLVLC_PRIORITY_LOG           ));
+  newCONSTSUB(stash, "PERLVLC_PRIORITY_CLASSES"        , newSViv(PERLVLC_PRIORITY_CLASSES       ));
+  newCONSTSUB(stash, "PERLVLC_LOCK_SCRATCH"            , newSViv(PERLVLC_LOCK_SCRATCH           ));
+  newCONSTSUB(stash, "PERLVLC_LOCK_NULL"               , newSViv(PERLVLC_LOCK_NULL              ));
+  newCONSTSUB(stash, "PERLVLC_ENCODE_PNG"              , newSViv(PERLVLC_ENCODE_PNG             ));
+  newCONSTSUB(stash, "PERLVLC_ENCODE_PPM"              , newSViv(PERLVLC_ENCODE_PPM             ));
+#ifdef PERLVLC_FAKE_LIBVLC
+  newCONSTSUB(stash, "PERLVLC_FAKE_LIBVLC"             , newSViv(1));
+#else
+  newCONSTSUB(stash, "PERLVLC_FAKE_LIBVLC"             , newSViv(0));
+#endif
+#ifdef PERLVLC_HAVE_ZLIB
+  newCONSTSUB(stash, "PERLVLC_HAVE_ZLIB"               , newSViv(1));
+#else
+  newCONSTSUB(stash, "PERLVLC_HAVE_ZLIB"               , newSViv(0));
+#endif
   newCONSTSUB(stash, "PERLVLC_PLANE_PITCH_MUL"         , newSViv(PERLVLC_PLANE_PITCH_MUL        ));
   newCONSTSUB(stash, "PERLVLC_PLANE_PITCH_MASK"        , newSViv(PERLVLC_PLANE_PITCH_MASK       ));
   newCONSTSUB(stash, "PERLVLC_PICTURE_PLANES"          , newSViv(PERLVLC_PICTURE_PLANES         ));
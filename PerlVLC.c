@@ -6,7 +6,22 @@
 #include <vlc/libvlc_version.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <math.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#ifdef PERLVLC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 #include "PerlVLC.h"
 
@@ -34,6 +49,20 @@ static void PerlVLC_cb_log_error(const char *fmt, ...);
 static void* PerlVLC_video_lock_cb(void *data, void **planes);
 static void PerlVLC_video_unlock_cb(void *data, void *picture, void * const *planes);
 static void PerlVLC_video_display_cb(void *data, void *picture);
+static void PerlVLC_loudness_free(PerlVLC_loudness_t *m);
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 30000)
+static int PerlVLC_media_buffer_open_cb(void *opaque, void **datap, uint64_t *sizep);
+static ssize_t PerlVLC_media_buffer_read_cb(void *data, unsigned char *buf, size_t len);
+static int PerlVLC_media_buffer_seek_cb(void *data, uint64_t offset);
+static void PerlVLC_media_buffer_close_cb(void *data);
+static int PerlVLC_media_stream_open_cb(void *opaque, void **datap, uint64_t *sizep);
+static ssize_t PerlVLC_media_stream_read_cb(void *data, unsigned char *buf, size_t len);
+static void PerlVLC_media_stream_close_cb(void *data);
+#endif
+static void PerlVLC_media_stream_release(PerlVLC_media_stream_t *st);
+
+/* mg_private of an object's magic once it has been cloned into another iThread */
+#define PERLVLC_MG_CLONED 1
 
 static SV* PerlVLC_set_mg(SV *obj, MGVTBL *mg_vtbl, void *ptr) {
 	MAGIC *mg= NULL;
@@ -48,7 +77,10 @@ static SV* PerlVLC_set_mg(SV *obj, MGVTBL *mg_vtbl, void *ptr) {
 			return obj;
 		}
 	}
-	sv_magicext(SvRV(obj), NULL, PERL_MAGIC_ext, mg_vtbl, (const char *) ptr, 0);
+	mg= sv_magicext(SvRV(obj), NULL, PERL_MAGIC_ext, mg_vtbl, (const char *) ptr, 0);
+#ifdef USE_ITHREADS
+	mg->mg_flags |= MGf_DUP;
+#endif
 	return obj;
 }
 
@@ -56,13 +88,26 @@ void* PerlVLC_get_mg(SV *obj, MGVTBL *mg_vtbl) {
 	MAGIC *mg= NULL;
 	if (sv_isobject(obj)) {
 		for (mg = SvMAGIC(SvRV(obj)); mg; mg = mg->mg_moremagic) {
-			if (mg->mg_type == PERL_MAGIC_ext && mg->mg_virtual == mg_vtbl)
+			if (mg->mg_type == PERL_MAGIC_ext && mg->mg_virtual == mg_vtbl) {
+				if (!mg->mg_ptr && mg->mg_private == PERLVLC_MG_CLONED)
+					croak("Can't share VLC objects across perl iThreads");
 				return (void*) mg->mg_ptr;
+			}
 		}
 	}
 	return NULL;
 }
 
+/* True if the object's magic is the empty placeholder of an iThread clone */
+bool PerlVLC_is_clone(SV *obj, MGVTBL *mg_vtbl) {
+	MAGIC *mg;
+	if (sv_isobject(obj))
+		for (mg = SvMAGIC(SvRV(obj)); mg; mg = mg->mg_moremagic)
+			if (mg->mg_type == PERL_MAGIC_ext && mg->mg_virtual == mg_vtbl)
+				return !mg->mg_ptr && mg->mg_private == PERLVLC_MG_CLONED;
+	return false;
+}
+
 /* Given a VLC instance object, wrap it with a PerlVLC_vlc struct and then wrap that with
  * a blessed HV.  Return a ref to the HV.
  */
@@ -77,6 +122,7 @@ SV * PerlVLC_wrap_instance(libvlc_instance_t *instance) {
 	vlc->instance= instance;
 	vlc->event_pipe[0]= -1;
 	vlc->event_pipe[1]= -1;
+	vlc->record_fd= -1;
 	PerlVLC_set_instance_mg(self, vlc);
 	return self;
 }
@@ -85,6 +131,11 @@ int PerlVLC_instance_mg_free(pTHX_ SV *inst_sv, MAGIC *mg) {
 	PerlVLC_vlc_t *vlc= (PerlVLC_vlc_t*) mg->mg_ptr;
 	PERLVLC_TRACE("PerlVLC_instance_mg_free(%p)", vlc);
 	if (!vlc) return 0;
+	/* The encoder and stats sampler must not post to the event pipe after perl closes it */
+	if (vlc->event_pipe[1] >= 0) {
+		PerlVLC_encode_cancel(vlc, (HV*) inst_sv);
+		PerlVLC_stats_cancel(vlc);
+	}
 	/* Then release the reference to the player, which may free it right now,
 	 * or maybe not.  libvlc doesn't let us look at the reference count.
 	 */
@@ -96,20 +147,432 @@ int PerlVLC_instance_mg_free(pTHX_ SV *inst_sv, MAGIC *mg) {
 	return 0;
 }
 
-/* Given a VLC media object, wrap it with a blessed HV.  Return a ref to the HV.
+/* Wrap a PerlVLC_media struct with a blessed HV.  Return a ref to the HV. */
+static SV * PerlVLC_wrap_media_struct(PerlVLC_media_t *mwrap) {
+	SV *self= newRV_noinc((SV*)newHV());
+	sv_bless(self, gv_stashpv("VideoLAN::LibVLC::Media", GV_ADD));
+	PerlVLC_set_media_mg(self, mwrap);
+	return self;
+}
+
+/* Given a VLC media object, wrap it with a PerlVLC_media struct and then wrap that with
+ * a blessed HV.  Return a ref to the HV.
  */
 SV * PerlVLC_wrap_media(libvlc_media_t *media) {
+	PerlVLC_media_t *mwrap;
 	PERLVLC_TRACE("PerlVLC_wrap_media(%p)", media);
-    return PerlVLC_set_media_mg(
-		sv_bless(newRV_noinc((SV*)newHV()), gv_stashpv("VideoLAN::LibVLC::Media", GV_ADD)),
-		media
-	);
+	if (!media) return &PL_sv_undef;
+	Newxz(mwrap, 1, PerlVLC_media_t);
+	mwrap->media= media;
+	return PerlVLC_wrap_media_struct(mwrap);
 }
 
 int PerlVLC_media_mg_free(pTHX_ SV *media_sv, MAGIC *mg) {
-	libvlc_media_t *media= (libvlc_media_t*) mg->mg_ptr;
-	PERLVLC_TRACE("libvlc_media_release(%p)", media);
-	libvlc_media_release(media);
+	PerlVLC_media_t *mwrap= (PerlVLC_media_t*) mg->mg_ptr;
+	PERLVLC_TRACE("PerlVLC_media_mg_free(%p)", mwrap);
+	if (!mwrap) return 0;
+	PERLVLC_TRACE("libvlc_media_release(%p)", mwrap->media);
+	libvlc_media_release(mwrap->media);
+	/* If VLC is still streaming from the buffer, it is too late to do anything about it.
+	 * MediaPlayer holds a reference to the Media object to prevent this.
+	 * A fed stream is refcounted instead, so an input thread still reading it keeps it alive.
+	 */
+	if (mwrap->buffer_sv) {
+		if (!mwrap->buffer_sv_was_readonly)
+			SvREADONLY_off(mwrap->buffer_sv);
+		SvREFCNT_dec(mwrap->buffer_sv);
+	}
+	if (mwrap->mmap_addr)
+		munmap(mwrap->mmap_addr, mwrap->buffer_len);
+	if (mwrap->stream) {
+		PerlVLC_media_stream_finish(mwrap->stream, 1);
+		PerlVLC_media_stream_release(mwrap->stream);
+	}
+	Safefree(mwrap);
+	return 0;
+}
+
+/* Map an entire file read-only.  Croaks on failure, including for empty files. */
+static void * PerlVLC_mmap_readonly(const char *path, size_t *len_out) {
+	struct stat st;
+	void *addr;
+	int fd, err;
+
+	if ((fd= open(path, O_RDONLY)) < 0)
+		croak("open(%s): %s", path, strerror(errno));
+	if (fstat(fd, &st) < 0) {
+		err= errno;
+		close(fd);
+		croak("stat(%s): %s", path, strerror(err));
+	}
+	if (!st.st_size) {
+		close(fd);
+		croak("Can't mmap empty file %s", path);
+	}
+	addr= mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err= errno;
+	close(fd);
+	if (addr == MAP_FAILED)
+		croak("mmap(%s): %s", path, strerror(err));
+	*len_out= st.st_size;
+	return addr;
+}
+
+static void PerlVLC_mmap_scalar_free(SV *var, void *address, size_t length, buffer_scalar_callback_data_t cbdata) {
+	munmap(address, length);
+}
+
+/* Return a new read-only scalar whose string buffer is a memory map of the file. */
+SV * PerlVLC_mmap_file_scalar(const char *path) {
+	size_t len;
+	void *addr= PerlVLC_mmap_readonly(path, &len);
+	SV *sv= buffer_scalar_wrap(aTHX_ newSV(0), addr, len, BUFFER_SCALAR_READONLY, NULL, PerlVLC_mmap_scalar_free);
+	SvREADONLY_on(sv);
+	return sv;
+}
+
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 30000)
+
+/* Create a media object that streams from the string buffer of a perl scalar.
+ * The scalar is marked read-only for the lifetime of the media so that perl can't
+ * reallocate the buffer out from under the decoder thread.
+ */
+SV * PerlVLC_media_new_buffer(PerlVLC_vlc_t *vlc, SV *buffer) {
+	PerlVLC_media_t *mwrap;
+	STRLEN len;
+	const char *addr;
+
+	if (!SvOK(buffer))
+		croak("buffer must be a defined scalar");
+	addr= SvPVbyte(buffer, len);
+	Newxz(mwrap, 1, PerlVLC_media_t);
+	mwrap->media= libvlc_media_new_callbacks(vlc->instance,
+		PerlVLC_media_buffer_open_cb,
+		PerlVLC_media_buffer_read_cb,
+		PerlVLC_media_buffer_seek_cb,
+		PerlVLC_media_buffer_close_cb,
+		mwrap);
+	if (!mwrap->media) {
+		Safefree(mwrap);
+		croak("libvlc_media_new_callbacks failed");
+	}
+	mwrap->buffer= addr;
+	mwrap->buffer_len= len;
+	mwrap->buffer_sv= SvREFCNT_inc(buffer);
+	mwrap->buffer_sv_was_readonly= SvREADONLY(buffer)? 1 : 0;
+	SvREADONLY_on(buffer);
+	return PerlVLC_wrap_media_struct(mwrap);
+}
+
+/* Create a media object that streams from a read-only memory map of a file */
+SV * PerlVLC_media_new_mmap(PerlVLC_vlc_t *vlc, const char *path) {
+	PerlVLC_media_t *mwrap;
+	size_t len;
+	void *addr= PerlVLC_mmap_readonly(path, &len);
+
+	madvise(addr, len, MADV_SEQUENTIAL);
+	Newxz(mwrap, 1, PerlVLC_media_t);
+	mwrap->media= libvlc_media_new_callbacks(vlc->instance,
+		PerlVLC_media_buffer_open_cb,
+		PerlVLC_media_buffer_read_cb,
+		PerlVLC_media_buffer_seek_cb,
+		PerlVLC_media_buffer_close_cb,
+		mwrap);
+	if (!mwrap->media) {
+		munmap(addr, len);
+		Safefree(mwrap);
+		croak("libvlc_media_new_callbacks failed");
+	}
+	mwrap->buffer= (const char*) addr;
+	mwrap->buffer_len= len;
+	mwrap->mmap_addr= addr;
+	return PerlVLC_wrap_media_struct(mwrap);
+}
+
+/* Create a media object that reads from a ring buffer which perl feeds incrementally.
+ * The stream is not seekable, and its total size is unknown.
+ */
+SV * PerlVLC_media_new_stream(PerlVLC_vlc_t *vlc, size_t size, size_t low_water) {
+	PerlVLC_media_t *mwrap;
+	PerlVLC_media_stream_t *st;
+
+	if (!size)
+		croak("stream buffer_size must be greater than zero");
+	if (low_water >= size)
+		croak("stream low_water must be less than buffer_size");
+	Newxz(st, 1, PerlVLC_media_stream_t);
+	Newx(st->ring, size, char);
+	st->size= size;
+	st->low_water= low_water;
+	st->event_pipe= -1;
+	st->refcount= 1;
+	pthread_mutex_init(&st->mutex, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	Newxz(mwrap, 1, PerlVLC_media_t);
+	mwrap->stream= st;
+	mwrap->media= libvlc_media_new_callbacks(vlc->instance,
+		PerlVLC_media_stream_open_cb,
+		PerlVLC_media_stream_read_cb,
+		NULL, /* not seekable */
+		PerlVLC_media_stream_close_cb,
+		st);
+	if (!mwrap->media) {
+		pthread_cond_destroy(&st->cond);
+		pthread_mutex_destroy(&st->mutex);
+		Safefree(st->ring);
+		Safefree(st);
+		Safefree(mwrap);
+		croak("libvlc_media_new_callbacks failed");
+	}
+	return PerlVLC_wrap_media_struct(mwrap);
+}
+
+/* Append as much of data as will fit into the ring buffer, and wake the reader.
+ * Returns the number of bytes accepted.
+ */
+size_t PerlVLC_media_stream_feed(PerlVLC_media_stream_t *st, const char *data, size_t len) {
+	size_t n, tail, chunk;
+	pthread_mutex_lock(&st->mutex);
+	n= st->size - st->fill;
+	if (n > len) n= len;
+	tail= (st->head + st->fill) % st->size;
+	chunk= st->size - tail;
+	if (chunk > n) chunk= n;
+	memcpy(st->ring + tail, data, chunk);
+	if (n > chunk)
+		memcpy(st->ring, data + chunk, n - chunk);
+	st->fill += n;
+	st->total_fed += n;
+	if (st->fill > st->low_water)
+		st->low_water_sent= 0;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->mutex);
+	return n;
+}
+
+/* Mark the end of the stream.  With 'close', the reader stops immediately instead of
+ * draining what remains in the buffer.
+ */
+void PerlVLC_media_stream_finish(PerlVLC_media_stream_t *st, bool close) {
+	pthread_mutex_lock(&st->mutex);
+	st->eof= 1;
+	if (close) st->closed= 1;
+	pthread_cond_broadcast(&st->cond);
+	pthread_mutex_unlock(&st->mutex);
+}
+
+/* Drop one reference, and free the ring when neither perl nor a VLC reader holds it */
+static void PerlVLC_media_stream_release(PerlVLC_media_stream_t *st) {
+	int refs;
+	pthread_mutex_lock(&st->mutex);
+	refs= --st->refcount;
+	pthread_mutex_unlock(&st->mutex);
+	if (refs) return;
+	pthread_cond_destroy(&st->cond);
+	pthread_mutex_destroy(&st->mutex);
+	Safefree(st->ring);
+	Safefree(st);
+}
+
+#else
+
+SV * PerlVLC_media_new_buffer(PerlVLC_vlc_t *vlc, SV *buffer) {
+	croak("Media from buffer requires LibVLC 3.0");
+	return NULL;
+}
+
+SV * PerlVLC_media_new_mmap(PerlVLC_vlc_t *vlc, const char *path) {
+	croak("Media from mmap requires LibVLC 3.0");
+	return NULL;
+}
+
+SV * PerlVLC_media_new_stream(PerlVLC_vlc_t *vlc, size_t size, size_t low_water) {
+	croak("Media from stream requires LibVLC 3.0");
+	return NULL;
+}
+
+size_t PerlVLC_media_stream_feed(PerlVLC_media_stream_t *st, const char *data, size_t len) {
+	return 0;
+}
+
+void PerlVLC_media_stream_finish(PerlVLC_media_stream_t *st, bool close) {
+}
+
+static void PerlVLC_media_stream_release(PerlVLC_media_stream_t *st) {
+}
+
+#endif
+
+/*------------------------------------------------------------------------------------------------
+ * Track Info
+ *
+ * libvlc returns track info as an array of separately allocated structs, each pointing to
+ * another allocation for the audio/video/subtitle details.  Flatten all of that into one
+ * block owned by a TrackList object, with the strings packed after the array.
+ */
+
+static PerlVLC_track_list_t * PerlVLC_track_list_alloc(unsigned count, size_t str_len) {
+	PerlVLC_track_list_t *tl;
+	size_t head_len= sizeof(PerlVLC_track_list_t) + count * sizeof(PerlVLC_track_t);
+	Newxc(tl, head_len + str_len, char, PerlVLC_track_list_t);
+	Zero(tl, head_len, char);
+	tl->count= count;
+	return tl;
+}
+
+/* Copy a string into the string area of a track list and advance the cursor */
+static const char * PerlVLC_track_list_strcpy(char **cursor, const char *str, size_t len) {
+	char *ret= *cursor;
+	memcpy(ret, str, len);
+	ret[len]= '\0';
+	*cursor += len + 1;
+	return ret;
+}
+
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20100)
+
+/* Returns a new track list, which is empty if the media has not been parsed. */
+PerlVLC_track_list_t * PerlVLC_track_list_from_media(libvlc_media_t *media) {
+	libvlc_media_track_t **tracks= NULL, *src;
+	PerlVLC_track_list_t *tl;
+	PerlVLC_track_t *dst;
+	const char *encoding;
+	unsigned i, n;
+	size_t str_len= 0;
+	char *str;
+	
+	n= libvlc_media_tracks_get(media, &tracks);
+	for (i= 0; i < n; i++) {
+		src= tracks[i];
+		if (src->psz_language) str_len += strlen(src->psz_language) + 1;
+		if (src->psz_description) str_len += strlen(src->psz_description) + 1;
+		if (src->i_type == libvlc_track_text && src->subtitle && src->subtitle->psz_encoding)
+			str_len += strlen(src->subtitle->psz_encoding) + 1;
+	}
+	tl= PerlVLC_track_list_alloc(n, str_len);
+	str= (char*) (tl->track + n);
+	for (i= 0; i < n; i++) {
+		src= tracks[i];
+		dst= tl->track + i;
+		dst->codec= src->i_codec;
+		dst->original_fourcc= src->i_original_fourcc;
+		dst->id= src->i_id;
+		dst->type= src->i_type;
+		dst->profile= src->i_profile;
+		dst->level= src->i_level;
+		dst->bitrate= src->i_bitrate;
+		if (src->psz_language)
+			dst->language= PerlVLC_track_list_strcpy(&str, src->psz_language, strlen(src->psz_language));
+		if (src->psz_description)
+			dst->description= PerlVLC_track_list_strcpy(&str, src->psz_description, strlen(src->psz_description));
+		if (src->i_type == libvlc_track_audio && src->audio) {
+			dst->channels= src->audio->i_channels;
+			dst->rate= src->audio->i_rate;
+		}
+		else if (src->i_type == libvlc_track_video && src->video) {
+			dst->width= src->video->i_width;
+			dst->height= src->video->i_height;
+			dst->sar_num= src->video->i_sar_num;
+			dst->sar_den= src->video->i_sar_den;
+			dst->frame_rate_num= src->video->i_frame_rate_num;
+			dst->frame_rate_den= src->video->i_frame_rate_den;
+		}
+		else if (src->i_type == libvlc_track_text && src->subtitle && (encoding= src->subtitle->psz_encoding))
+			dst->encoding= PerlVLC_track_list_strcpy(&str, encoding, strlen(encoding));
+	}
+	if (tracks)
+		libvlc_media_tracks_release(tracks, n);
+	return tl;
+}
+
+#else
+
+PerlVLC_track_list_t * PerlVLC_track_list_from_media(libvlc_media_t *media) {
+	croak("Track info requires LibVLC 2.1");
+	return NULL;
+}
+
+#endif
+
+static uint32_t PerlVLC_fourcc_from_sv(SV *sv) {
+	STRLEN len;
+	const char *str= SvPV(sv, len);
+	if (len != 4) croak("Expected 4-character codec name");
+	return (uint32_t)(U8)str[0] | ((uint32_t)(U8)str[1] << 8)
+		| ((uint32_t)(U8)str[2] << 16) | ((uint32_t)(U8)str[3] << 24);
+}
+
+/* Build a track list from an array of hashrefs of the same fields as the accessors, such as
+ * those saved in a probe cache.
+ */
+PerlVLC_track_list_t * PerlVLC_track_list_from_av(AV *tracks) {
+	PerlVLC_track_list_t *tl;
+	PerlVLC_track_t *dst;
+	SV **item, *field;
+	HV *hv;
+	unsigned i, n= av_len(tracks) + 1;
+	size_t str_len= 0, len;
+	const char *pv;
+	char *str;
+	
+	for (i= 0; i < n; i++) {
+		item= av_fetch(tracks, i, 0);
+		if (!item || !*item || !SvROK(*item) || SvTYPE(SvRV(*item)) != SVt_PVHV)
+			croak("Expected arrayref of hashrefs");
+		hv= (HV*) SvRV(*item);
+		if ((field= fetch_if_defined(hv, "language"))) { SvPV(field, len); str_len += len + 1; }
+		if ((field= fetch_if_defined(hv, "description"))) { SvPV(field, len); str_len += len + 1; }
+		if ((field= fetch_if_defined(hv, "encoding"))) { SvPV(field, len); str_len += len + 1; }
+	}
+	tl= PerlVLC_track_list_alloc(n, str_len);
+	str= (char*) (tl->track + n);
+	for (i= 0; i < n; i++) {
+		hv= (HV*) SvRV(*av_fetch(tracks, i, 0));
+		dst= tl->track + i;
+		dst->type= libvlc_track_unknown;
+		if ((field= fetch_if_defined(hv, "codec"))) dst->codec= PerlVLC_fourcc_from_sv(field);
+		if ((field= fetch_if_defined(hv, "original_fourcc"))) dst->original_fourcc= PerlVLC_fourcc_from_sv(field);
+		if ((field= fetch_if_defined(hv, "id"))) dst->id= SvIV(field);
+		if ((field= fetch_if_defined(hv, "type"))) dst->type= SvIV(field);
+		if ((field= fetch_if_defined(hv, "profile"))) dst->profile= SvIV(field);
+		if ((field= fetch_if_defined(hv, "level"))) dst->level= SvIV(field);
+		if ((field= fetch_if_defined(hv, "bitrate"))) dst->bitrate= SvUV(field);
+		if ((field= fetch_if_defined(hv, "channels"))) dst->channels= SvUV(field);
+		if ((field= fetch_if_defined(hv, "rate"))) dst->rate= SvUV(field);
+		if ((field= fetch_if_defined(hv, "width"))) dst->width= SvUV(field);
+		if ((field= fetch_if_defined(hv, "height"))) dst->height= SvUV(field);
+		if ((field= fetch_if_defined(hv, "sar_num"))) dst->sar_num= SvUV(field);
+		if ((field= fetch_if_defined(hv, "sar_den"))) dst->sar_den= SvUV(field);
+		if ((field= fetch_if_defined(hv, "frame_rate_num"))) dst->frame_rate_num= SvUV(field);
+		if ((field= fetch_if_defined(hv, "frame_rate_den"))) dst->frame_rate_den= SvUV(field);
+		if ((field= fetch_if_defined(hv, "language"))) {
+			pv= SvPV(field, len);
+			dst->language= PerlVLC_track_list_strcpy(&str, pv, len);
+		}
+		if ((field= fetch_if_defined(hv, "description"))) {
+			pv= SvPV(field, len);
+			dst->description= PerlVLC_track_list_strcpy(&str, pv, len);
+		}
+		if ((field= fetch_if_defined(hv, "encoding"))) {
+			pv= SvPV(field, len);
+			dst->encoding= PerlVLC_track_list_strcpy(&str, pv, len);
+		}
+	}
+	return tl;
+}
+
+SV * PerlVLC_wrap_track_list(PerlVLC_track_list_t *tl) {
+	SV *self;
+	if (!tl) return &PL_sv_undef;
+	self= newRV_noinc((SV*)newHV());
+	sv_bless(self, gv_stashpv("VideoLAN::LibVLC::TrackList", GV_ADD));
+	PerlVLC_set_track_list_mg(self, tl);
+	return self;
+}
+
+int PerlVLC_track_list_mg_free(pTHX_ SV *tl_sv, MAGIC *mg) {
+	PerlVLC_track_list_t *tl= (PerlVLC_track_list_t*) mg->mg_ptr;
+	if (tl) Safefree(tl);
 	return 0;
 }
 
@@ -128,6 +591,11 @@ SV * PerlVLC_wrap_media_player(libvlc_media_player_t *player) {
 	playerinfo->event_pipe= -1;
 	playerinfo->vbuf_pipe[0]= -1;
 	playerinfo->vbuf_pipe[1]= -1;
+	playerinfo->lock_timeout_ms= -1;
+	playerinfo->lock_policy= PERLVLC_LOCK_SCRATCH;
+	playerinfo->clock.time_ms= -1;
+	playerinfo->clock.position= -1;
+	playerinfo->clock.rate= 1;
 	PerlVLC_set_media_player_mg(self, playerinfo);
 	return self;
 }
@@ -138,6 +606,10 @@ int PerlVLC_media_player_mg_free(pTHX_ SV *player_sv, MAGIC* mg) {
 	int i;
 	PERLVLC_TRACE("PerlVLC_media_player_mg_free(%p)", mpinfo);
 	if (!mpinfo) return 0;
+	/* The clock's event callback points at mpinfo */
+	PerlVLC_clock_detach(mpinfo);
+	if (mpinfo->stats_sampled)
+		PerlVLC_stats_remove(mpinfo->player);
 	/* Make sure playback has stopped before releasing player.
 	 * Also make sure the player isn't blocked inside a callback
 	 * waiting for input from us.
@@ -152,6 +624,10 @@ int PerlVLC_media_player_mg_free(pTHX_ SV *player_sv, MAGIC* mg) {
 		 */
 		libvlc_video_set_callbacks(mpinfo->player, PerlVLC_video_lock_cb, NULL, NULL, NULL);
 	}
+	else if (mpinfo->loudness) {
+		PERLVLC_TRACE("libvlc_media_player_stop(); # for loudness meter");
+		libvlc_media_player_stop(mpinfo->player);
+	}
 	/* Then release the reference to the player, which may free it right now,
 	 * or maybe not.  libvlc doesn't let us look at the reference count.
 	 */
@@ -159,11 +635,22 @@ int PerlVLC_media_player_mg_free(pTHX_ SV *player_sv, MAGIC* mg) {
 	libvlc_media_player_release(mpinfo->player);
 	/* VLC shouldn't have any more picture objects at this point. */
 	for (i= 0; i < mpinfo->picture_count; i++) {
-		mpinfo->pictures[i]->held_by_vlc= 0;
+		PerlVLC_picture_set_held(mpinfo->pictures[i], 0);
 		mpinfo->pictures[i]->trace_destruction= mpinfo->trace_pictures;
 		sv_2mortal((SV*) mpinfo->pictures[i]->self_hv); /* release our hidden reference to the perl objects */
 	}
 	if (mpinfo->pictures) Safefree(mpinfo->pictures);
+	/* and those of a format policy that perl never got around to adopting */
+	for (i= 0; i < PERLVLC_POLICY_PICTURES; i++)
+		if (mpinfo->native_pictures[i]) {
+			PerlVLC_picture_set_held(mpinfo->native_pictures[i], 0);
+			PerlVLC_picture_destroy(mpinfo->native_pictures[i]);
+		}
+	/* allocated by the video thread, which is gone now */
+	for (i= 0; i < PERLVLC_SCRATCH_SLOTS; i++)
+		if (mpinfo->scratch[i].buf) free(mpinfo->scratch[i].buf);
+	/* The audio thread is gone along with playback */
+	if (mpinfo->loudness) PerlVLC_loudness_free(mpinfo->loudness);
 	/* Now it should be safe to free mpinfo */
 	PERLVLC_TRACE("free(mpinfo=%p)", mpinfo);
 	Safefree(mpinfo);
@@ -221,6 +708,364 @@ void PerlVLC_picture_format_init_from_hv(PerlVLC_picture_format_t *format, HV *h
 		else
 			format->lines[0]= SvIV(field);
 	}
+	/* fill in whatever the caller left out, if the chroma is one we know */
+	PerlVLC_picture_format_fill_layout(format);
+}
+
+/* Plane layouts of the chromas VLC can render natively.  Each plane has a number of bytes
+ * per sample, and the horizontal and vertical subsampling of that plane.  Packed 4:2:2
+ * formats like YUY2 are one sample of 4 bytes per 2 pixels.
+ */
+static const PerlVLC_chroma_layout_t PerlVLC_chroma_layouts[]= {
+	/* 8-bit planar YUV */
+	{ "I420", 3, {{ 1, 1, 1 }, { 1, 2, 2 }, { 1, 2, 2 }} },
+	{ "IYUV", 3, {{ 1, 1, 1 }, { 1, 2, 2 }, { 1, 2, 2 }} },
+	{ "J420", 3, {{ 1, 1, 1 }, { 1, 2, 2 }, { 1, 2, 2 }} },
+	{ "YV12", 3, {{ 1, 1, 1 }, { 1, 2, 2 }, { 1, 2, 2 }} },
+	{ "I422", 3, {{ 1, 1, 1 }, { 1, 2, 1 }, { 1, 2, 1 }} },
+	{ "J422", 3, {{ 1, 1, 1 }, { 1, 2, 1 }, { 1, 2, 1 }} },
+	{ "YV16", 3, {{ 1, 1, 1 }, { 1, 2, 1 }, { 1, 2, 1 }} },
+	{ "I444", 3, {{ 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 1 }} },
+	{ "J444", 3, {{ 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 1 }} },
+	{ "YV24", 3, {{ 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 1 }} },
+	{ "I411", 3, {{ 1, 1, 1 }, { 1, 4, 1 }, { 1, 4, 1 }} },
+	{ "I410", 3, {{ 1, 1, 1 }, { 1, 4, 4 }, { 1, 4, 4 }} },
+	{ "YVU9", 3, {{ 1, 1, 1 }, { 1, 4, 4 }, { 1, 4, 4 }} },
+	/* high bit depth planar YUV, 16 bits per sample */
+	{ "I0AL", 3, {{ 2, 1, 1 }, { 2, 2, 2 }, { 2, 2, 2 }} },
+	{ "I0AB", 3, {{ 2, 1, 1 }, { 2, 2, 2 }, { 2, 2, 2 }} },
+	{ "I2AL", 3, {{ 2, 1, 1 }, { 2, 2, 1 }, { 2, 2, 1 }} },
+	{ "I4AL", 3, {{ 2, 1, 1 }, { 2, 1, 1 }, { 2, 1, 1 }} },
+	/* semi-planar YUV, interleaved chroma */
+	{ "NV12", 2, {{ 1, 1, 1 }, { 2, 2, 2 }} },
+	{ "NV21", 2, {{ 1, 1, 1 }, { 2, 2, 2 }} },
+	{ "NV16", 2, {{ 1, 1, 1 }, { 2, 2, 1 }} },
+	{ "NV61", 2, {{ 1, 1, 1 }, { 2, 2, 1 }} },
+	{ "NV24", 2, {{ 1, 1, 1 }, { 2, 1, 1 }} },
+	{ "P010", 2, {{ 2, 1, 1 }, { 4, 2, 2 }} },
+	{ "P016", 2, {{ 2, 1, 1 }, { 4, 2, 2 }} },
+	/* packed YUV */
+	{ "YUY2", 1, {{ 4, 2, 1 }} },
+	{ "YUYV", 1, {{ 4, 2, 1 }} },
+	{ "YVYU", 1, {{ 4, 2, 1 }} },
+	{ "UYVY", 1, {{ 4, 2, 1 }} },
+	{ "VYUY", 1, {{ 4, 2, 1 }} },
+	/* greyscale and RGB */
+	{ "GREY", 1, {{ 1, 1, 1 }} },
+	{ "Y800", 1, {{ 1, 1, 1 }} },
+	{ "GR16", 1, {{ 2, 1, 1 }} },
+	{ "RV15", 1, {{ 2, 1, 1 }} },
+	{ "RV16", 1, {{ 2, 1, 1 }} },
+	{ "RV24", 1, {{ 3, 1, 1 }} },
+	{ "RV32", 1, {{ 4, 1, 1 }} },
+	{ "RGBA", 1, {{ 4, 1, 1 }} },
+	{ "BGRA", 1, {{ 4, 1, 1 }} },
+	{ "ARGB", 1, {{ 4, 1, 1 }} },
+	{ "RGBX", 1, {{ 4, 1, 1 }} },
+	{ "BGRX", 1, {{ 4, 1, 1 }} },
+};
+
+const PerlVLC_chroma_layout_t* PerlVLC_chroma_layout_find(const char *chroma) {
+	int i;
+	for (i= 0; i < sizeof(PerlVLC_chroma_layouts)/sizeof(*PerlVLC_chroma_layouts); i++)
+		if (memcmp(PerlVLC_chroma_layouts[i].chroma, chroma, 4) == 0)
+			return &PerlVLC_chroma_layouts[i];
+	return NULL;
+}
+
+/* Set pitch[] and lines[] for each plane of the chroma that doesn't have them yet.
+ * Pitches are rounded up to PERLVLC_PLANE_PITCH_MUL and subsampled dimensions round up,
+ * so odd sizes still cover every pixel.  Returns the number of planes, or 0 if the chroma
+ * is unknown (in which case nothing is changed).
+ */
+int PerlVLC_picture_format_fill_layout(PerlVLC_picture_format_t *format) {
+	const PerlVLC_chroma_layout_t *layout= PerlVLC_chroma_layout_find(format->chroma);
+	int i;
+	if (!layout)
+		return 0;
+	for (i= 0; i < layout->planes; i++) {
+		if (!format->pitch[i])
+			format->pitch[i]= ((format->width + layout->plane[i].w_div - 1) / layout->plane[i].w_div
+				* layout->plane[i].bytes + PERLVLC_PLANE_PITCH_MASK) & ~PERLVLC_PLANE_PITCH_MASK;
+		if (!format->lines[i])
+			format->lines[i]= (format->height + layout->plane[i].h_div - 1) / layout->plane[i].h_div;
+	}
+	return layout->planes;
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Plane allocators
+ *
+ * Pictures that allocate their own planes use one of these.  Newx is the historic default.
+ * For large frames, the decoder's first pass over fresh memory takes a page fault per 4K,
+ * and dozens of 4K/8K buffers put pressure on the TLB, so the others let the user pay
+ * for that up front (prefault), ask for 2MB pages, or keep the pages from being swapped.
+ * Perl iThreads and the video thread (for a format policy) all allocate, so the counters
+ * and the process-wide default are only accessed atomically.
+ */
+
+PerlVLC_alloc_stats_t PerlVLC_alloc_stats[PERLVLC_ALLOC_BACKENDS];
+const char *PerlVLC_alloc_names[PERLVLC_ALLOC_BACKENDS]= { "newx", "memalign", "mmap", "hugepage" };
+int PerlVLC_plane_alloc_default= PERLVLC_ALLOC_NEWX;
+
+/* Apply the keys 'alloc', 'prefault', and 'mlock' of a hash to an allocator setting */
+int PerlVLC_plane_alloc_from_hv(HV *hv, int alloc) {
+	SV *field;
+	const char *name;
+	int i;
+	if ((field= fetch_if_defined(hv, "alloc"))) {
+		name= SvPV_nolen(field);
+		for (i= 0; i < PERLVLC_ALLOC_BACKENDS; i++)
+			if (strcmp(name, PerlVLC_alloc_names[i]) == 0)
+				break;
+		if (i >= PERLVLC_ALLOC_BACKENDS)
+			croak("Unknown plane allocator '%s'", name);
+		alloc= (alloc & ~PERLVLC_ALLOC_BACKEND_MASK) | i;
+	}
+	if ((field= fetch_if_defined(hv, "prefault")))
+		alloc= SvTRUE(field)? (alloc | PERLVLC_ALLOC_PREFAULT) : (alloc & ~PERLVLC_ALLOC_PREFAULT);
+	if ((field= fetch_if_defined(hv, "mlock")))
+		alloc= SvTRUE(field)? (alloc | PERLVLC_ALLOC_MLOCK) : (alloc & ~PERLVLC_ALLOC_MLOCK);
+	return alloc;
+}
+
+static long PerlVLC_page_faults() {
+	struct rusage ru;
+#ifdef RUSAGE_THREAD
+	if (getrusage(RUSAGE_THREAD, &ru) != 0)
+#endif
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return ru.ru_minflt + ru.ru_majflt;
+}
+
+/* Length of the mapping for the mmap backends, which munmap needs to know again later */
+static size_t PerlVLC_plane_map_len(int backend, size_t len) {
+	size_t unit= backend == PERLVLC_ALLOC_HUGEPAGE? PERLVLC_HUGEPAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+	return (len + unit - 1) & ~(unit - 1);
+}
+
+/* Allocate a plane of 'len' bytes.  Returns the aligned address to give to VLC, and
+ * stores the address to free in *base.  Returns NULL if out of memory.
+ */
+void* PerlVLC_plane_alloc(int alloc, size_t len, void **base) {
+	int backend= alloc & PERLVLC_ALLOC_BACKEND_MASK;
+	PerlVLC_alloc_stats_t *st= &PerlVLC_alloc_stats[backend];
+	size_t map_len, page= (size_t) sysconf(_SC_PAGESIZE), ofs, live, peak;
+	long faults= PerlVLC_page_faults();
+	char *mem= NULL, *ret;
+
+	switch (backend) {
+	case PERLVLC_ALLOC_NEWX:
+		Newx(mem, len + PERLVLC_PLANE_PITCH_MASK /* extra for alignment */, char);
+		ret= PERLVLC_ALIGN_PLANE(mem);
+		break;
+	case PERLVLC_ALLOC_MEMALIGN:
+		if (posix_memalign((void**) &mem, PERLVLC_PLANE_PITCH_MUL, len) != 0)
+			return NULL;
+		ret= mem;
+		break;
+	case PERLVLC_ALLOC_MMAP:
+		map_len= PerlVLC_plane_map_len(backend, len);
+		if ((mem= mmap(NULL, map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+			return NULL;
+		ret= mem;
+		break;
+	case PERLVLC_ALLOC_HUGEPAGE:
+		/* over-map by one huge page, then trim both ends so the mapping is 2MB aligned */
+		map_len= PerlVLC_plane_map_len(backend, len);
+		if ((mem= mmap(NULL, map_len + PERLVLC_HUGEPAGE_SIZE, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+			return NULL;
+		ofs= (PERLVLC_HUGEPAGE_SIZE - ((uintptr_t) mem & (PERLVLC_HUGEPAGE_SIZE-1))) & (PERLVLC_HUGEPAGE_SIZE-1);
+		if (ofs) munmap(mem, ofs);
+		if (PERLVLC_HUGEPAGE_SIZE - ofs) munmap(mem + ofs + map_len, PERLVLC_HUGEPAGE_SIZE - ofs);
+		mem += ofs;
+#ifdef MADV_HUGEPAGE
+		if (madvise(mem, map_len, MADV_HUGEPAGE) != 0)
+#endif
+			__atomic_add_fetch(&st->failures, 1, __ATOMIC_RELAXED);
+		ret= mem;
+		break;
+	default:
+		croak("BUG: invalid plane allocator %d", alloc);
+	}
+	if (alloc & PERLVLC_ALLOC_PREFAULT) {
+		/* write, not read, or the kernel just maps the zero page */
+		for (ofs= 0; ofs < len; ofs += page)
+			((volatile char*) ret)[ofs]= 0;
+		if (len) ((volatile char*) ret)[len-1]= 0;
+	}
+	if ((alloc & PERLVLC_ALLOC_MLOCK) && mlock(ret, len) != 0)
+		__atomic_add_fetch(&st->failures, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->faults, PerlVLC_page_faults() - faults, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->allocs, 1, __ATOMIC_RELAXED);
+	live= __atomic_add_fetch(&st->bytes_live, len, __ATOMIC_RELAXED);
+	peak= __atomic_load_n(&st->bytes_peak, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&st->bytes_peak, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+	*base= mem;
+	return ret;
+}
+
+void PerlVLC_plane_free(int alloc, void *base, size_t len) {
+	int backend= alloc & PERLVLC_ALLOC_BACKEND_MASK;
+	PerlVLC_alloc_stats_t *st= &PerlVLC_alloc_stats[backend];
+	switch (backend) {
+	case PERLVLC_ALLOC_NEWX:
+		/* the same range that PerlVLC_plane_alloc locked */
+		if (alloc & PERLVLC_ALLOC_MLOCK) munlock(PERLVLC_ALIGN_PLANE(base), len);
+		Safefree(base);
+		break;
+	case PERLVLC_ALLOC_MEMALIGN:
+		if (alloc & PERLVLC_ALLOC_MLOCK) munlock(base, len);
+		free(base);
+		break;
+	default:
+		/* munmap drops any locks */
+		munmap(base, PerlVLC_plane_map_len(backend, len));
+	}
+	__atomic_add_fetch(&st->frees, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&st->bytes_live, len, __ATOMIC_RELAXED);
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Picture memory budget
+ *
+ * Every picture adds its plane bytes to PerlVLC_budget when created and removes them when
+ * destroyed, which may happen in any iThread, so the counters are under a mutex.  Pictures
+ * that allocate their planes are refused once the allocated total would pass the limit, or
+ * wait up to wait_ms for other threads to free some.  Pictures of negative priority are
+ * refused 'reserve' bytes sooner, so they get fewer buffers when memory is short.
+ */
+
+PerlVLC_budget_t PerlVLC_budget;
+static pthread_mutex_t PerlVLC_budget_mutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PerlVLC_budget_cond= PTHREAD_COND_INITIALIZER;
+
+static size_t PerlVLC_budget_limit(int priority) {
+	size_t limit= PerlVLC_budget.limit;
+	if (limit && priority < 0)
+		limit= limit > PerlVLC_budget.reserve? limit - PerlVLC_budget.reserve : 1;
+	return limit;
+}
+
+void PerlVLC_budget_set(size_t limit, size_t reserve, unsigned wait_ms) {
+	pthread_mutex_lock(&PerlVLC_budget_mutex);
+	PerlVLC_budget.limit= limit;
+	PerlVLC_budget.reserve= reserve;
+	PerlVLC_budget.wait_ms= wait_ms;
+	/* a larger limit may let waiting threads proceed */
+	pthread_cond_broadcast(&PerlVLC_budget_cond);
+	pthread_mutex_unlock(&PerlVLC_budget_mutex);
+}
+
+/* Start the peak over from the current usage, and clear the refusal and wait counts */
+void PerlVLC_budget_reset_stats() {
+	pthread_mutex_lock(&PerlVLC_budget_mutex);
+	PerlVLC_budget.bytes_peak= PerlVLC_budget.bytes;
+	PerlVLC_budget.refused= PerlVLC_budget.waits= 0;
+	pthread_mutex_unlock(&PerlVLC_budget_mutex);
+}
+
+/* Number of pictures of 'bytes' (up to 'want') that fit in the budget right now */
+int PerlVLC_budget_fit(size_t bytes, int priority, int want) {
+	size_t limit;
+	int n= want;
+	pthread_mutex_lock(&PerlVLC_budget_mutex);
+	limit= PerlVLC_budget_limit(priority);
+	if (limit && bytes)
+		n= limit <= PerlVLC_budget.alloc_bytes? 0
+			: (limit - PerlVLC_budget.alloc_bytes) / bytes < (size_t) want? (limit - PerlVLC_budget.alloc_bytes) / bytes
+			: want;
+	pthread_mutex_unlock(&PerlVLC_budget_mutex);
+	return n;
+}
+
+/* Count a new picture.  Returns false (and counts a refusal) if its allocated planes don't
+ * fit, after waiting if configured and 'may_wait'.  *used and *limit_out describe the refusal.
+ */
+static bool PerlVLC_budget_try(size_t bytes, size_t alloc_bytes, int priority, bool may_wait, size_t *used, size_t *limit_out) {
+	struct timespec deadline;
+	size_t limit;
+	bool waited= false;
+	pthread_mutex_lock(&PerlVLC_budget_mutex);
+	while (alloc_bytes && (limit= PerlVLC_budget_limit(priority))
+		&& PerlVLC_budget.alloc_bytes + alloc_bytes > limit
+	) {
+		if (!waited && may_wait && PerlVLC_budget.wait_ms) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += PerlVLC_budget.wait_ms / 1000;
+			deadline.tv_nsec += (PerlVLC_budget.wait_ms % 1000) * 1000000;
+			if (deadline.tv_nsec >= 1000000000) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000; }
+			PerlVLC_budget.waits++;
+			waited= true;
+		}
+		if (!waited || pthread_cond_timedwait(&PerlVLC_budget_cond, &PerlVLC_budget_mutex, &deadline) == ETIMEDOUT) {
+			*used= PerlVLC_budget.alloc_bytes;
+			*limit_out= limit;
+			PerlVLC_budget.refused++;
+			pthread_mutex_unlock(&PerlVLC_budget_mutex);
+			return false;
+		}
+	}
+	PerlVLC_budget.alloc_bytes += alloc_bytes;
+	if ((PerlVLC_budget.bytes += bytes) > PerlVLC_budget.bytes_peak)
+		PerlVLC_budget.bytes_peak= PerlVLC_budget.bytes;
+	PerlVLC_budget.pictures++;
+	pthread_mutex_unlock(&PerlVLC_budget_mutex);
+	return true;
+}
+
+/* Same, but croaks if refused */
+static void PerlVLC_budget_acquire(size_t bytes, size_t alloc_bytes, int priority) {
+	size_t used, limit;
+	if (!PerlVLC_budget_try(bytes, alloc_bytes, priority, true, &used, &limit))
+		croak("Picture memory budget exceeded: %lu bytes needed, %lu of %lu in use",
+			(unsigned long) alloc_bytes, (unsigned long) used, (unsigned long) limit);
+}
+
+static void PerlVLC_budget_release(size_t bytes, size_t alloc_bytes) {
+	pthread_mutex_lock(&PerlVLC_budget_mutex);
+	PerlVLC_budget.alloc_bytes -= alloc_bytes;
+	PerlVLC_budget.bytes -= bytes;
+	PerlVLC_budget.pictures--;
+	if (alloc_bytes)
+		pthread_cond_broadcast(&PerlVLC_budget_cond);
+	pthread_mutex_unlock(&PerlVLC_budget_mutex);
+}
+
+/* Set held_by_vlc, and count the picture's bytes as held by the video thread while it is.
+ * The format callback returns pictures from the video thread, so this is atomic.
+ */
+void PerlVLC_picture_set_held(PerlVLC_picture_t *pic, int held) {
+	if (!pic->held_by_vlc == !held) return;
+	pic->held_by_vlc= held;
+	if (held) __atomic_add_fetch(&PerlVLC_budget.vlc_bytes, pic->bytes, __ATOMIC_RELAXED);
+	else      __atomic_sub_fetch(&PerlVLC_budget.vlc_bytes, pic->bytes, __ATOMIC_RELAXED);
+}
+
+/* Read a UV or arrayref of up to 3 UVs into dest[].  Returns dest[0] */
+static UV PerlVLC_picture_unpack_uv(SV *field, const char *name, UV *dest) {
+	AV *av;
+	SV **item;
+	int i;
+	if (SvROK(field) && SvTYPE(SvRV(field)) == SVt_PVAV) {
+		av= (AV*) SvRV(field);
+		for (i= 0; i < PERLVLC_PICTURE_PLANES && i <= av_len(av); i++) {
+			item= av_fetch(av, i, 0);
+			/* allow undef for unused planes */
+			if (item && *item && SvOK(*item)) {
+				if (!looks_like_number(*item))
+					croak("Invalid %s->[%d]", name, i);
+				dest[i]= SvUV(*item);
+			}
+		}
+	}
+	else if (looks_like_number(field))
+		dest[0]= SvUV(field);
+	else
+		croak("Invalid %s, must be an integer or arrayref of integers", name);
+	return dest[0];
 }
 
 /* This function constructs a PerlVLC_picture_t from a hashref that looks like:
@@ -231,18 +1076,29 @@ void PerlVLC_picture_format_init_from_hv(PerlVLC_picture_format_t *format, HV *h
  *   pitch => $v || [ $v0, $v1, $v2 ],
  *   lines => $v || [ $v0, $v1, $v2 ],
  *   plane => \$buffer || [ \$buf0, \$buf1, \$buf2 ]
+ *   -or-
+ *   address => $a || [ $a0, $a1, $a2 ],
+ *   length  => $n || [ $n0, $n1, $n2 ],
+ *   owner   => $obj,
  * }
  *
  * The plane buffer is optional.  If not specified, a buffer will be allocated.
+ * 'address' is raw memory owned by someone else (like a mapped GL buffer) and 'owner'
+ * is any value that keeps it valid, held until the picture is destroyed.
  */
 PerlVLC_picture_t* PerlVLC_picture_new_from_hash(SV *args) {
 	PerlVLC_picture_t self, *ret;
 	HV *hash;
 	SV **item, *field;
 	AV *av;
+	UV address[PERLVLC_PICTURE_PLANES]= { 0 }, length[PERLVLC_PICTURE_PLANES]= { 0 };
+	size_t need;
 	int i;
 	memset(&self, 0, sizeof(self));
+	self.home= PERL_GET_THX;
+	self.return_fd= -1;
 	PERLVLC_TRACE("PerlVLC_picture_new_from_hash");
+	PerlVLC_picture_reap_orphans();
 
 	if (!SvROK(args) || SvTYPE(SvRV(args)) != SVt_PVHV)
 		croak("Expected hashref");
@@ -269,6 +1125,16 @@ PerlVLC_picture_t* PerlVLC_picture_new_from_hash(SV *args) {
 			self.plane_buffer_sv[0]= SvRV(field);
 		}
 	}
+	if ((field= fetch_if_defined(hash, "address"))) {
+		if (self.plane_buffer_sv[0])
+			croak("Can't specify both 'plane' and 'address'");
+		if (!PerlVLC_picture_unpack_uv(field, "address", address))
+			croak("Invalid address, must be a non-zero integer");
+		if ((field= fetch_if_defined(hash, "length")))
+			PerlVLC_picture_unpack_uv(field, "length", length);
+		else
+			length[0]= length[1]= length[2]= (UV) -1;
+	}
 	/* If pitch and lines are not set on plane[0], come up with some defaults.
 	 * If it is supposed to be a multi-plane image and those pitches/lines aren't
 	 * set, the user gets to keep the pieces.
@@ -276,25 +1142,63 @@ PerlVLC_picture_t* PerlVLC_picture_new_from_hash(SV *args) {
 	if (!self.format.pitch[0] || !self.format.lines[0]) {
 		if (self.plane_buffer_sv[0])
 			croak("'pitch' and 'lines' must be set when using scalar ref as buffer");
+		else if (address[0])
+			croak("'pitch' and 'lines' must be set when using an address as buffer");
 		else {
 			if (!self.format.pitch[0]) self.format.pitch[0]= (self.format.width + PERLVLC_PLANE_PITCH_MASK) & ~PERLVLC_PLANE_PITCH_MASK;
 			if (!self.format.lines[0]) self.format.lines[0]= self.format.height;
 		}
 	}
 
+	/* Check that supplied buffers are big enough, before allocating anything */
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+		need= (size_t) self.format.pitch[i] * self.format.lines[i];
+		if (self.plane_buffer_sv[i] && SvCUR(self.plane_buffer_sv[i]) < need)
+			croak("plane->[%d] holds %ld bytes but pitch*lines is %ld",
+				i, (long) SvCUR(self.plane_buffer_sv[i]), (long) need);
+		if (address[i] && length[i] < need)
+			croak("length->[%d] is %ld bytes but pitch*lines is %ld",
+				i, (long) length[i], (long) need);
+		if (need && address[0] && !address[i])
+			croak("address->[%d] is required for pitch*lines of %ld", i, (long) need);
+	}
+
+	self.alloc= PerlVLC_plane_alloc_from_hv(hash, __atomic_load_n(&PerlVLC_plane_alloc_default, __ATOMIC_RELAXED));
+	if ((field= fetch_if_defined(hash, "priority")))
+		self.priority= SvIV(field);
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+		need= (size_t) self.format.pitch[i] * self.format.lines[i];
+		self.bytes += need;
+		if (!self.plane_buffer_sv[i] && !address[i])
+			self.alloc_bytes += need;
+	}
+	PerlVLC_budget_acquire(self.bytes, self.alloc_bytes, self.priority);
+
 	/* now make a copy into dynamic memory */
 	Newx(ret, 1, PerlVLC_picture_t);
 	memcpy(ret, &self, sizeof(PerlVLC_picture_t));
 	/* and increment any ref counts to the buffers we are holding onto, and allocate
 	 * the buffers that weren't supplied. */
 	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
-		if (ret->plane_buffer_sv[i])
+		if (ret->plane_buffer_sv[i]) {
 			SvREFCNT_inc(ret->plane_buffer_sv[i]);
-		else if (ret->format.pitch[i] && ret->format.lines[i])
-			Newx(ret->plane[i], ret->format.pitch[i] * ret->format.lines[i]
-				+ PERLVLC_PLANE_PITCH_MASK /* extra for alignment */, char);
+			ret->plane_ptr[i]= SvPVX(ret->plane_buffer_sv[i]);
+		}
+		else if (address[i])
+			ret->plane_ptr[i]= INT2PTR(void*, address[i]);
+	}
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+		need= (size_t) ret->format.pitch[i] * ret->format.lines[i];
+		if (need && !ret->plane_ptr[i]
+			&& !(ret->plane_ptr[i]= PerlVLC_plane_alloc(ret->alloc, need, &ret->plane[i]))
+		) {
+			PerlVLC_picture_destroy(ret);
+			croak("Can't allocate %ld bytes for plane %d", (long) need, i);
+		}
 	}
-	PERLVLC_TRACE("plane pointers: %p %p %p", ret->plane[0], ret->plane[1], ret->plane[2]);
+	if (address[0] && (field= fetch_if_defined(hash, "owner")))
+		ret->owner= newSVsv(field);
+	PERLVLC_TRACE("plane pointers: %p %p %p", ret->plane_ptr[0], ret->plane_ptr[1], ret->plane_ptr[2]);
 	return ret;
 }
 
@@ -310,6 +1214,7 @@ SV * PerlVLC_wrap_picture(PerlVLC_picture_t *pic) {
 		sv_bless(self, gv_stashpv("VideoLAN::LibVLC::Picture", GV_ADD));
 		/* after this, when the HV goes out of scope it calls the mg_free (our destructor) */
 		PerlVLC_set_picture_mg(self, pic);
+		__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
 		PERLVLC_TRACE("added new SV (refcnt=%d) to new HV (refcnt=%d)", SvREFCNT(self), SvREFCNT((SV*)pic->self_hv));
 	} else {
 		self= newRV_inc((SV*) pic->self_hv);
@@ -318,23 +1223,148 @@ SV * PerlVLC_wrap_picture(PerlVLC_picture_t *pic) {
 	return self;
 }
 
-/* This shouldn't get called until the self_hv goes out of scope */
+static pthread_mutex_t PerlVLC_orphans_mutex= PTHREAD_MUTEX_INITIALIZER;
+static PerlVLC_picture_t *PerlVLC_orphans= NULL;
+
+/* Drop one reference.  The last one frees the picture, unless this is a thread other than the
+ * one that created it.  Only that thread may free the perl parts, so the picture is sent back
+ * through the event pipe of the player it was last queued to, for the player to adopt.  If it
+ * was never queued, it waits for PerlVLC_picture_reap_orphans in the home thread.
+ */
+static void PerlVLC_picture_send_home(PerlVLC_picture_t *pic);
+static void PerlVLC_picture_release(PerlVLC_picture_t *pic) {
+	if (__atomic_sub_fetch(&pic->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	if (pic->home == PERL_GET_THX)
+		PerlVLC_picture_destroy(pic);
+	else if (pic->return_fd >= 0)
+		PerlVLC_picture_send_home(pic);
+	else {
+		pthread_mutex_lock(&PerlVLC_orphans_mutex);
+		pic->next_orphan= PerlVLC_orphans;
+		PerlVLC_orphans= pic;
+		pthread_mutex_unlock(&PerlVLC_orphans_mutex);
+	}
+}
+
+/* Free the orphaned pictures that belong to this thread */
+void PerlVLC_picture_reap_orphans() {
+	PerlVLC_picture_t **pp, *pic, *mine= NULL;
+	pthread_mutex_lock(&PerlVLC_orphans_mutex);
+	for (pp= &PerlVLC_orphans; (pic= *pp); )
+		if (pic->home == PERL_GET_THX) {
+			*pp= pic->next_orphan;
+			pic->next_orphan= mine;
+			mine= pic;
+		}
+		else pp= &pic->next_orphan;
+	pthread_mutex_unlock(&PerlVLC_orphans_mutex);
+	while ((pic= mine)) {
+		mine= pic->next_orphan;
+		PerlVLC_picture_destroy(pic);
+	}
+}
+
+/* Called when any perl object of the picture goes out of scope, in any thread */
 int PerlVLC_picture_mg_free(pTHX_ SV *picture_sv, MAGIC *mg) {
 	PerlVLC_picture_t *pic= (PerlVLC_picture_t*) mg->mg_ptr;
 	PERLVLC_TRACE("PerlVLC_picture_mg_free(%p)", pic);
 	if (pic) {
-		pic->self_hv= NULL;
-		PerlVLC_picture_destroy(pic);
+		if (pic->self_hv == (HV*) picture_sv)
+			pic->self_hv= NULL;
+		PerlVLC_picture_release(pic);
+	}
+	return 0;
+}
+
+/* A clone of a picture object in a new iThread is another reference to the same planes,
+ * as long as none of them belong to perl scalars of this thread.  Otherwise the clone is
+ * left without a picture.
+ */
+static int PerlVLC_picture_mg_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param) {
+	PerlVLC_picture_t *pic= (PerlVLC_picture_t*) mg->mg_ptr;
+	if (pic) {
+		if (pic->owner || pic->plane_buffer_sv[0] || pic->plane_buffer_sv[1] || pic->plane_buffer_sv[2]) {
+			mg->mg_ptr= NULL;
+			mg->mg_private= PERLVLC_MG_CLONED;
+		}
+		else
+			__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
 	}
 	return 0;
 }
 
+/* A plane() scalar aliases the plane memory, so it holds a reference to the picture, and
+ * a clone of it in a new iThread takes another, like a clone of the picture object.
+ */
+static void PerlVLC_plane_scalar_free(SV *var, void *address, size_t length, buffer_scalar_callback_data_t cbdata) {
+	PerlVLC_picture_release((PerlVLC_picture_t*) cbdata[0]);
+}
+
+static bool PerlVLC_plane_scalar_dup(void *address, size_t length, buffer_scalar_callback_data_t cbdata) {
+	PerlVLC_picture_t *pic= (PerlVLC_picture_t*) cbdata[0];
+	if (pic->owner || pic->plane_buffer_sv[0] || pic->plane_buffer_sv[1] || pic->plane_buffer_sv[2])
+		return false;
+	__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+SV * PerlVLC_picture_plane_scalar(PerlVLC_picture_t *pic, int idx) {
+	buffer_scalar_callback_data_t cbdata;
+	SV *sv;
+	cbdata[0]= (intptr_t) pic;
+	sv= buffer_scalar_wrap(aTHX_ newSV(0), pic->plane_ptr[idx],
+		(size_t) pic->format.pitch[idx] * pic->format.lines[idx], 0, cbdata, PerlVLC_plane_scalar_free);
+	buffer_scalar_set_dup(aTHX_ sv, PerlVLC_plane_scalar_dup);
+	__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
+	return sv;
+}
+
+/* Add a reference for another thread to claim with PerlVLC_picture_from_handle.
+ * The handle is just the address, so that it can pass through Thread::Queue.
+ */
+UV PerlVLC_picture_share(PerlVLC_picture_t *pic) {
+	if (pic->owner || pic->plane_buffer_sv[0] || pic->plane_buffer_sv[1] || pic->plane_buffer_sv[2])
+		croak("Can't share picture %d; its planes belong to perl scalars of this thread", pic->id);
+	if (pic->held_by_vlc)
+		croak("Can't share picture %d while it is held by the decoder", pic->id);
+	__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pic->handles, 1, __ATOMIC_RELEASE);
+	return PTR2UV(pic);
+}
+
+/* Claim the reference of a handle, returning a new Picture object of this thread.
+ * In the thread that created the picture, this is the same object as before, if it exists.
+ */
+SV * PerlVLC_picture_from_handle(UV handle) {
+	PerlVLC_picture_t *pic= INT2PTR(PerlVLC_picture_t*, handle);
+	SV *self;
+	int n;
+	if (!pic)
+		croak("Invalid picture handle");
+	n= __atomic_load_n(&pic->handles, __ATOMIC_ACQUIRE);
+	do {
+		if (n <= 0)
+			croak("Picture handle was already claimed");
+	} while (!__atomic_compare_exchange_n(&pic->handles, &n, n-1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	if (pic->home == PERL_GET_THX) {
+		self= PerlVLC_wrap_picture(pic); /* adds a ref if it made a new self_hv */
+		PerlVLC_picture_release(pic);
+		return self;
+	}
+	/* the handle's reference now belongs to this object */
+	self= newRV_noinc((SV*) newHV());
+	sv_bless(self, gv_stashpv("VideoLAN::LibVLC::Picture", GV_ADD));
+	PerlVLC_set_picture_mg(self, pic);
+	return self;
+}
+
 void PerlVLC_picture_destroy(PerlVLC_picture_t *pic) {
 	int i;
 	PERLVLC_TRACE("PerlVLC_picture_destroy(%p)", pic);
 	if (pic->held_by_vlc)
 		warn("BUG: Picture object destroyed while VLC still has access to it!");
-	if (pic->self_hv)
+	if (pic->self_hv || pic->refs)
 		croak("BUG: Picture object destroyed while Perl still has access to it!");
 	if (pic->trace_destruction)
 		PerlVLC_cb_log_error("picture %d: free [%p,%p,%p] or release ref [%p,%p,%p]",
@@ -346,20 +1376,134 @@ void PerlVLC_picture_destroy(PerlVLC_picture_t *pic) {
 		if (pic->plane_buffer_sv[i])
 			SvREFCNT_dec(pic->plane_buffer_sv[i]);
 		else if (pic->plane[i])
-			Safefree(pic->plane[i]);
+			PerlVLC_plane_free(pic->alloc, pic->plane[i], (size_t) pic->format.pitch[i] * pic->format.lines[i]);
 	}
-	Safefree(pic);
+	if (pic->owner)
+		SvREFCNT_dec(pic->owner);
+	PerlVLC_picture_set_held(pic, 0);
+	PerlVLC_budget_release(pic->bytes, pic->alloc_bytes);
+	if (pic->native) free(pic);
+	else Safefree(pic);
 }
 
-/*------------------------------------------------------------------------------------------------
- * Callback system.
- *
- * The callbacks work by writing messages to a pipe (socket actually, to avoid SIGPIPE issues)
- * which the main perl thread reads and dispatches to coderefs.
- *
- * All messages start with a little header struct that frames the messages for reliable transfer.
+/* Allocate a picture and its planes on the video thread, with no perl involved.  Returns
+ * NULL if the budget or the allocator refuses.  'home' is set when perl adopts it.
  */
-
+static PerlVLC_picture_t* PerlVLC_picture_new_native(const PerlVLC_picture_format_t *format, int alloc, int priority, int id) {
+	PerlVLC_picture_t *pic;
+	size_t need, used, limit;
+	int i;
+	if (!(pic= (PerlVLC_picture_t*) calloc(1, sizeof(PerlVLC_picture_t))))
+		return NULL;
+	pic->native= true;
+	pic->id= id;
+	pic->format= *format;
+	pic->return_fd= -1;
+	pic->priority= priority;
+	/* Newx is perl's, so use posix_memalign in its place */
+	if ((alloc & PERLVLC_ALLOC_BACKEND_MASK) == PERLVLC_ALLOC_NEWX)
+		alloc= (alloc & ~PERLVLC_ALLOC_BACKEND_MASK) | PERLVLC_ALLOC_MEMALIGN;
+	pic->alloc= alloc;
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++)
+		pic->bytes += (size_t) format->pitch[i] * format->lines[i];
+	pic->alloc_bytes= pic->bytes;
+	if (!PerlVLC_budget_try(pic->bytes, pic->alloc_bytes, priority, false, &used, &limit)) {
+		free(pic);
+		return NULL;
+	}
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+		need= (size_t) format->pitch[i] * format->lines[i];
+		if (need && !(pic->plane_ptr[i]= PerlVLC_plane_alloc(alloc, need, &pic->plane[i]))) {
+			while (--i >= 0)
+				if (pic->plane[i])
+					PerlVLC_plane_free(alloc, pic->plane[i], (size_t) format->pitch[i] * format->lines[i]);
+			PerlVLC_budget_release(pic->bytes, pic->alloc_bytes);
+			free(pic);
+			return NULL;
+		}
+	}
+	return pic;
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Shared memory slabs
+ */
+
+PerlVLC_slab_t * PerlVLC_slab_new(size_t slot_size, unsigned slot_count) {
+	PerlVLC_slab_t *slab;
+	void *addr;
+	size_t len;
+
+	if (!slot_size || !slot_count)
+		croak("slot_size and slot_count must be nonzero");
+	slot_size= (slot_size + PERLVLC_PLANE_PITCH_MASK) & ~(size_t)PERLVLC_PLANE_PITCH_MASK;
+	if (slot_size > ((size_t)-1) / slot_count)
+		croak("slab size overflows");
+	len= slot_size * slot_count;
+	addr= mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		croak("mmap(%lu bytes shared): %s", (unsigned long) len, strerror(errno));
+	Newxz(slab, 1, PerlVLC_slab_t);
+	slab->base= (char*) addr;
+	slab->map_len= len;
+	slab->slot_size= slot_size;
+	slab->slot_count= slot_count;
+	slab->refcnt= 1;
+	return slab;
+}
+
+static void PerlVLC_slab_release(PerlVLC_slab_t *slab) {
+	if (--slab->refcnt > 0)
+		return;
+	munmap(slab->base, slab->map_len);
+	Safefree(slab);
+}
+
+SV * PerlVLC_wrap_slab(PerlVLC_slab_t *slab) {
+	SV *self;
+	if (!slab) return &PL_sv_undef;
+	self= newRV_noinc((SV*) newHV());
+	sv_bless(self, gv_stashpv("VideoLAN::LibVLC::SharedSlab", GV_ADD));
+	PerlVLC_set_slab_mg(self, slab);
+	return self;
+}
+
+int PerlVLC_slab_mg_free(pTHX_ SV *slab_sv, MAGIC *mg) {
+	PerlVLC_slab_t *slab= (PerlVLC_slab_t*) mg->mg_ptr;
+	if (slab) PerlVLC_slab_release(slab);
+	return 0;
+}
+
+static void PerlVLC_slab_scalar_free(SV *var, void *address, size_t length, buffer_scalar_callback_data_t cbdata) {
+	PerlVLC_slab_release((PerlVLC_slab_t*) cbdata[0]);
+}
+
+/* Return a new scalar whose string buffer is a range of bytes within one slot */
+SV * PerlVLC_slab_slot_scalar(PerlVLC_slab_t *slab, unsigned slot, size_t offset, size_t len, bool readonly) {
+	buffer_scalar_callback_data_t cbdata;
+	SV *sv;
+	if (slot >= slab->slot_count)
+		croak("slot %u out of range (slot_count=%u)", slot, slab->slot_count);
+	if (offset > slab->slot_size || len > slab->slot_size - offset)
+		croak("range %lu+%lu exceeds slot_size %lu",
+			(unsigned long) offset, (unsigned long) len, (unsigned long) slab->slot_size);
+	cbdata[0]= (intptr_t) slab;
+	sv= buffer_scalar_wrap(aTHX_ newSV(0), slab->base + slab->slot_size * slot + offset, len,
+		readonly? BUFFER_SCALAR_READONLY : 0, cbdata, PerlVLC_slab_scalar_free);
+	slab->refcnt++;
+	if (readonly) SvREADONLY_on(sv);
+	return sv;
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Callback system.
+ *
+ * The callbacks work by writing messages to a pipe (socket actually, to avoid SIGPIPE issues)
+ * which the main perl thread reads and dispatches to coderefs.
+ *
+ * All messages start with a little header struct that frames the messages for reliable transfer.
+ */
+
 /* changes here should be kept in sync with PERLVLC_MSG_BUFFER_SIZE in header */
 #define PERLVLC_MSG_HEADER \
 	uint32_t event_id; \
@@ -393,15 +1537,180 @@ typedef struct PerlVLC_Message_ImgFmt {
 	unsigned alloc_count;
 } PerlVLC_Message_ImgFmt_t;
 
+/* The format callback answered from the format policy, with the pictures it allocated */
+typedef struct PerlVLC_Message_FormatAnswered {
+	PERLVLC_MSG_HEADER
+	PerlVLC_picture_format_t format;
+	unsigned alloc_count;
+	uint32_t format_after_us;
+	PerlVLC_picture_t *pictures[PERLVLC_POLICY_PICTURES];
+} PerlVLC_Message_FormatAnswered_t;
+
+typedef struct PerlVLC_Message_StreamLevel {
+	PERLVLC_MSG_HEADER
+	uint64_t buffered;
+	uint64_t total_read;
+} PerlVLC_Message_StreamLevel_t;
+
+typedef struct PerlVLC_Message_Loudness {
+	PERLVLC_MSG_HEADER
+	PerlVLC_loudness_summary_t summary;
+} PerlVLC_Message_Loudness_t;
+
+typedef struct PerlVLC_Message_Encoded {
+	PERLVLC_MSG_HEADER
+	PerlVLC_picture_t *picture;
+	uint32_t job_id;
+	int32_t error;
+	uint64_t bytes;
+} PerlVLC_Message_Encoded_t;
+
+typedef struct PerlVLC_Message_Stats {
+	PERLVLC_MSG_HEADER
+	PerlVLC_stats_sample_t sample;
+} PerlVLC_Message_Stats_t;
+
+static uint64_t PerlVLC_monotonic_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int PerlVLC_message_priority(const void *buffer, int msglen) {
+	const PerlVLC_Message_t *msg= (const PerlVLC_Message_t*) buffer;
+	if (msglen < sizeof(PerlVLC_Message_t))
+		return PERLVLC_PRIORITY_EVENT;
+	switch (msg->event_id) {
+	case PERLVLC_MSG_VIDEO_FORMAT_EVENT:
+	case PERLVLC_MSG_VIDEO_FORMAT_ANSWERED:
+	case PERLVLC_MSG_VIDEO_CLEANUP_EVENT: /* must not fall behind the next format */
+	case PERLVLC_MSG_VIDEO_LOCK_EVENT:
+		return PERLVLC_PRIORITY_DECODER;
+	case PERLVLC_MSG_VIDEO_DISPLAY_EVENT:
+	case PERLVLC_MSG_VIDEO_UNLOCK_EVENT:
+	case PERLVLC_MSG_VIDEO_TRADE_PICTURE:
+	case PERLVLC_MSG_PICTURE_RELEASED:
+	case PERLVLC_MSG_VIDEO_WRITTEN:
+	case PERLVLC_MSG_PICTURE_ENCODED:
+		return PERLVLC_PRIORITY_PICTURE;
+	case PERLVLC_MSG_LOG:
+		return PERLVLC_PRIORITY_LOG;
+	default:
+		return PERLVLC_PRIORITY_EVENT;
+	}
+}
+
+/* Read up to 'max' waiting messages without blocking, and push each (still packed) onto
+ * the arrayref in 'queues' for its priority class.  Log messages beyond 'log_limit' queued
+ * are counted and discarded, so a flood of logs can't grow the backlog without bound.
+ * Returns the number of messages queued.
+ */
+int PerlVLC_recv_prioritized(PerlVLC_vlc_t *vlc, AV *queues, int max, int log_limit) {
+	char buf[PERLVLC_MSG_BUFFER_SIZE];
+	AV *q[PERLVLC_PRIORITY_CLASSES];
+	SV **item;
+	int i, got, prio, n= 0;
+
+	for (i= 0; i < PERLVLC_PRIORITY_CLASSES; i++) {
+		item= av_fetch(queues, i, 0);
+		if (!item || !SvROK(*item) || SvTYPE(SvRV(*item)) != SVt_PVAV)
+			croak("Expected arrayref of %d arrayrefs", PERLVLC_PRIORITY_CLASSES);
+		q[i]= (AV*) SvRV(*item);
+	}
+	PerlVLC_picture_reap_orphans();
+	while (n < max && (got= recv(vlc->event_pipe[0], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		if (vlc->record_fd >= 0)
+			PerlVLC_record_message(vlc, buf, got);
+		prio= PerlVLC_message_priority(buf, got);
+		if (prio == PERLVLC_PRIORITY_LOG && log_limit >= 0 && av_len(q[prio]) + 1 >= log_limit) {
+			vlc->log_dropped++;
+			continue;
+		}
+		av_push(q[prio], newSVpvn(buf, got));
+		n++;
+	}
+	return n;
+}
+
+/* Start copying every message read from the event pipe to 'fd', after writing the file header.
+ * Returns false if the header couldn't be written.
+ */
+bool PerlVLC_record_start(PerlVLC_vlc_t *vlc, int fd) {
+	char header[PERLVLC_RECORD_HEADER_SIZE];
+	uint32_t ptr_size= sizeof(void*), buffer_size= PERLVLC_MSG_BUFFER_SIZE;
+	memcpy(header, PERLVLC_RECORD_MAGIC, 8);
+	memcpy(header+8, &ptr_size, 4);
+	memcpy(header+12, &buffer_size, 4);
+	if (write(fd, header, sizeof(header)) != sizeof(header))
+		return false;
+	vlc->record_fd= fd;
+	vlc->record_last_us= PerlVLC_monotonic_us();
+	return true;
+}
+
+/* Append one message to the recording, prefixed with the microseconds since the previous one.
+ * A failed write ends the recording rather than croaking in the middle of dispatch.
+ */
+void PerlVLC_record_message(PerlVLC_vlc_t *vlc, const void *buffer, int msglen) {
+	PerlVLC_record_header_t hdr;
+	struct iovec iov[2];
+	uint64_t now= PerlVLC_monotonic_us(), delta= now - vlc->record_last_us;
+	hdr.delta_us= delta > UINT32_MAX? UINT32_MAX : (uint32_t) delta;
+	hdr.len= msglen;
+	vlc->record_last_us= now;
+	iov[0].iov_base= &hdr;
+	iov[0].iov_len= sizeof(hdr);
+	iov[1].iov_base= (void*) buffer;
+	iov[1].iov_len= msglen;
+	if (writev(vlc->record_fd, iov, 2) != sizeof(hdr) + msglen) {
+		warn("Message recording stopped: %s", strerror(errno));
+		vlc->record_fd= -1;
+	}
+}
+
+/* Point a recorded message at a new callback, and for messages that carry a picture, a new
+ * picture.  callback_id < 0 or picture == NULL leave that field alone.
+ */
+void PerlVLC_message_rewrite(void *buffer, int msglen, int callback_id, void *picture) {
+	PerlVLC_Message_t *msg= (PerlVLC_Message_t*) buffer;
+	if (msglen < sizeof(PerlVLC_Message_t))
+		croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_t));
+	if (callback_id >= 0)
+		msg->callback_id= callback_id;
+	if (picture) {
+		if (msglen < sizeof(PerlVLC_Message_TradePicture_t) || PerlVLC_message_priority(buffer, msglen) != PERLVLC_PRIORITY_PICTURE)
+			croak("Message %d does not carry a picture", msg->event_id);
+		((PerlVLC_Message_TradePicture_t*) msg)->picture= (PerlVLC_picture_t*) picture;
+	}
+}
+
+void PerlVLC_format_to_hv(HV *ret, const PerlVLC_picture_format_t *format) {
+	AV *pitch, *lines;
+	int i;
+	hv_stores(ret, "chroma", newSVpvn(format->chroma, 4));
+	hv_stores(ret, "width", newSViv(format->width));
+	hv_stores(ret, "height", newSViv(format->height));
+	hv_stores(ret, "pitch", newRV_noinc((SV*) (pitch= newAV())));
+	hv_stores(ret, "lines", newRV_noinc((SV*) (lines= newAV())));
+	for (i= 0; i < 3; i++) {
+		av_push(pitch, newSViv(format->pitch[i]));
+		av_push(lines, newSViv(format->lines[i]));
+	}
+}
+
 SV* PerlVLC_inflate_message(void *buffer, int msglen) {
 	HV *ret= (HV*) sv_2mortal((SV*) newHV());
-	AV *pitch, *lines;
+	AV *pics;
 	char *pos, *lim;
 	int i;
 	PerlVLC_Message_t *msg= (PerlVLC_Message_t*) buffer;
 	PerlVLC_Message_LogMsg_t *logmsg;
 	PerlVLC_Message_TradePicture_t *picmsg;
+	PerlVLC_Message_Encoded_t *encmsg;
 	PerlVLC_Message_ImgFmt_t *fmtmsg;
+	PerlVLC_Message_FormatAnswered_t *ansmsg;
+	PerlVLC_Message_StreamLevel_t *lvlmsg;
+	PerlVLC_Message_Loudness_t *loudmsg;
 
 	if (msglen < sizeof(PerlVLC_Message_t))
 		croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_t));
@@ -449,6 +1758,7 @@ SV* PerlVLC_inflate_message(void *buffer, int msglen) {
 	case PERLVLC_MSG_VIDEO_TRADE_PICTURE:
 	case PERLVLC_MSG_VIDEO_UNLOCK_EVENT:
 	case PERLVLC_MSG_VIDEO_DISPLAY_EVENT:
+	case PERLVLC_MSG_VIDEO_WRITTEN:
 			if (msglen < sizeof(PerlVLC_Message_TradePicture_t))
 				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_TradePicture_t));
 			picmsg= (PerlVLC_Message_TradePicture_t *) msg;
@@ -458,19 +1768,69 @@ SV* PerlVLC_inflate_message(void *buffer, int msglen) {
 			hv_stores(ret, "picture", newSVuv((intptr_t) picmsg->picture));
 		}
 		if (0) {
+	case PERLVLC_MSG_PICTURE_RELEASED:
+			if (msglen < sizeof(PerlVLC_Message_TradePicture_t))
+				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_TradePicture_t));
+			/* No thread has a reference any more, so this one takes it over, even if the
+			 * player is gone and nobody dispatches the event. */
+			picmsg= (PerlVLC_Message_TradePicture_t *) msg;
+			hv_stores(ret, "picture", PerlVLC_wrap_picture(picmsg->picture));
+		}
+		if (0) {
+	case PERLVLC_MSG_PICTURE_ENCODED:
+			if (msglen < sizeof(PerlVLC_Message_Encoded_t))
+				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_Encoded_t));
+			encmsg= (PerlVLC_Message_Encoded_t *) msg;
+			/* The job's reference to a held picture passes to the perl object */
+			if (encmsg->picture) {
+				hv_stores(ret, "picture", PerlVLC_wrap_picture(encmsg->picture));
+				PerlVLC_picture_release(encmsg->picture);
+			}
+			hv_stores(ret, "job", newSVuv(encmsg->job_id));
+			hv_stores(ret, "bytes", newSVuv(encmsg->bytes));
+			if (encmsg->error)
+				hv_stores(ret, "error", newSVpv(strerror(encmsg->error), 0));
+		}
+		if (0) {
 	case PERLVLC_MSG_VIDEO_FORMAT_EVENT:
 			if (msglen < sizeof(PerlVLC_Message_ImgFmt_t))
 				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_TradePicture_t));
 			fmtmsg= (PerlVLC_Message_ImgFmt_t *) msg;
-			hv_stores(ret, "chroma", newSVpvn(fmtmsg->format.chroma, 4));
-			hv_stores(ret, "width", newSViv(fmtmsg->format.width));
-			hv_stores(ret, "height", newSViv(fmtmsg->format.height));
-			hv_stores(ret, "pitch", newRV((SV*) (pitch= newAV())));
-			hv_stores(ret, "lines", newRV((SV*) (lines= newAV())));
-			for (i= 0; i < 3; i++) {
-				av_push(pitch, newSViv(fmtmsg->format.pitch[i]));
-				av_push(lines, newSViv(fmtmsg->format.lines[i]));
-			}
+			PerlVLC_format_to_hv(ret, &fmtmsg->format);
+		}
+		if (0) {
+	case PERLVLC_MSG_VIDEO_FORMAT_ANSWERED:
+			if (msglen < sizeof(PerlVLC_Message_FormatAnswered_t))
+				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_FormatAnswered_t));
+			ansmsg= (PerlVLC_Message_FormatAnswered_t *) msg;
+			PerlVLC_format_to_hv(ret, &ansmsg->format);
+			hv_stores(ret, "alloc_count", newSVuv(ansmsg->alloc_count));
+			hv_stores(ret, "format_after", newSVnv(ansmsg->format_after_us * .000001));
+			/* Like other pictures, these are addresses until the player adopts them */
+			hv_stores(ret, "pictures", newRV_noinc((SV*) (pics= newAV())));
+			for (i= 0; i < ansmsg->alloc_count && i < PERLVLC_POLICY_PICTURES; i++)
+				av_push(pics, newSVuv((intptr_t) ansmsg->pictures[i]));
+		}
+		if (0) {
+	case PERLVLC_MSG_MEDIA_STREAM_LOW:
+			if (msglen < sizeof(PerlVLC_Message_StreamLevel_t))
+				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_StreamLevel_t));
+			lvlmsg= (PerlVLC_Message_StreamLevel_t *) msg;
+			hv_stores(ret, "buffered", newSVuv(lvlmsg->buffered));
+			hv_stores(ret, "total_read", newSVnv((NV) lvlmsg->total_read));
+		}
+		if (0) {
+	case PERLVLC_MSG_MEDIA_STATS:
+			if (msglen < sizeof(PerlVLC_Message_Stats_t))
+				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_Stats_t));
+			PerlVLC_stats_sample_to_hv(&((PerlVLC_Message_Stats_t *) msg)->sample, ret);
+		}
+		if (0) {
+	case PERLVLC_MSG_AUDIO_LOUDNESS_EVENT:
+			if (msglen < sizeof(PerlVLC_Message_Loudness_t))
+				croak("Message too short (%d < %ld)", msglen, sizeof(PerlVLC_Message_Loudness_t));
+			loudmsg= (PerlVLC_Message_Loudness_t *) msg;
+			PerlVLC_loudness_summary_to_hv(&loudmsg->summary, ret);
 		}
 	default:
 		hv_stores(ret, "callback_id", newSViv(msg->callback_id));
@@ -569,6 +1929,119 @@ void PerlVLC_set_log_cb(PerlVLC_vlc_t *vlc, int callback_id) {
 #endif
 }
 
+/*------------------------------------------------------------------------------------------------
+ * Media Input Callbacks
+ *
+ * LibVLC 3.0 can read media through a set of open/read/seek/close callbacks.  For media that
+ * is already in memory (a perl scalar or a mmap'd file) these run entirely in C on the input
+ * thread, with no round trip to perl, and seeking is just an assignment.
+ */
+
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 30000)
+
+/* VLC may open the media more than once (such as for parsing and then for playback)
+ * so each open gets its own read position.  These run in VLC's threads, so use plain
+ * malloc rather than perl's allocator.
+ */
+typedef struct PerlVLC_media_buffer_cursor {
+	PerlVLC_media_t *mwrap;
+	size_t pos;
+} PerlVLC_media_buffer_cursor_t;
+
+static int PerlVLC_media_buffer_open_cb(void *opaque, void **datap, uint64_t *sizep) {
+	PerlVLC_media_buffer_cursor_t *cur= (PerlVLC_media_buffer_cursor_t*) malloc(sizeof(*cur));
+	if (!cur) {
+		PerlVLC_cb_log_error("media buffer open: out of memory");
+		*datap= NULL;
+		return -1;
+	}
+	cur->mwrap= (PerlVLC_media_t*) opaque;
+	cur->pos= 0;
+	*datap= cur;
+	*sizep= cur->mwrap->buffer_len;
+	return 0;
+}
+
+static ssize_t PerlVLC_media_buffer_read_cb(void *data, unsigned char *buf, size_t len) {
+	PerlVLC_media_buffer_cursor_t *cur= (PerlVLC_media_buffer_cursor_t*) data;
+	size_t avail= cur->mwrap->buffer_len - cur->pos;
+	if (len > avail) len= avail;
+	memcpy(buf, cur->mwrap->buffer + cur->pos, len);
+	cur->pos += len;
+	return len;
+}
+
+static int PerlVLC_media_buffer_seek_cb(void *data, uint64_t offset) {
+	PerlVLC_media_buffer_cursor_t *cur= (PerlVLC_media_buffer_cursor_t*) data;
+	if (offset > cur->mwrap->buffer_len)
+		return -1;
+	cur->pos= offset;
+	return 0;
+}
+
+static void PerlVLC_media_buffer_close_cb(void *data) {
+	free(data);
+}
+
+/* A fed stream has only one read position, so re-opening (such as parsing and then playing)
+ * continues from wherever the previous reader left off.
+ */
+static int PerlVLC_media_stream_open_cb(void *opaque, void **datap, uint64_t *sizep) {
+	PerlVLC_media_stream_t *st= (PerlVLC_media_stream_t*) opaque;
+	pthread_mutex_lock(&st->mutex);
+	++st->refcount;
+	pthread_mutex_unlock(&st->mutex);
+	*datap= st;
+	*sizep= UINT64_MAX; /* unknown */
+	return 0;
+}
+
+static void PerlVLC_media_stream_close_cb(void *data) {
+	PerlVLC_media_stream_release((PerlVLC_media_stream_t*) data);
+}
+
+/* Wait until there is data in the ring, then copy out as much as is available.
+ * The low-water event is sent at most once each time the buffer drains below the mark,
+ * and never while holding the mutex, since perl might be blocked on the mutex in 'feed'
+ * and unable to empty the event pipe.
+ */
+static ssize_t PerlVLC_media_stream_read_cb(void *data, unsigned char *buf, size_t len) {
+	PerlVLC_media_stream_t *st= (PerlVLC_media_stream_t*) data;
+	PerlVLC_Message_StreamLevel_t msg;
+	size_t n, chunk;
+
+	pthread_mutex_lock(&st->mutex);
+	while (1) {
+		if (st->fill <= st->low_water && !st->low_water_sent && !st->eof && st->event_pipe >= 0) {
+			st->low_water_sent= 1;
+			msg.event_id= PERLVLC_MSG_MEDIA_STREAM_LOW;
+			msg.callback_id= st->callback_id;
+			msg.buffered= st->fill;
+			msg.total_read= st->total_read;
+			pthread_mutex_unlock(&st->mutex);
+			if (send(st->event_pipe, &msg, sizeof(msg), 0) <= 0)
+				PerlVLC_cb_log_error("BUG: Media stream can't send event");
+			pthread_mutex_lock(&st->mutex);
+		}
+		if (st->fill || st->eof || st->closed)
+			break;
+		pthread_cond_wait(&st->cond, &st->mutex);
+	}
+	n= st->closed? 0 : st->fill < len? st->fill : len;
+	chunk= st->size - st->head;
+	if (chunk > n) chunk= n;
+	memcpy(buf, st->ring + st->head, chunk);
+	if (n > chunk)
+		memcpy(buf + chunk, st->ring, n - chunk);
+	st->head= (st->head + n) % st->size;
+	st->fill -= n;
+	st->total_read += n;
+	pthread_mutex_unlock(&st->mutex);
+	return n;
+}
+
+#endif
+
 /*------------------------------------------------------------------------------------------------
  * Video Callbacks
  *
@@ -578,24 +2051,87 @@ void PerlVLC_set_log_cb(PerlVLC_vlc_t *vlc, int callback_id) {
  *
  */
 
+/* Wait for the vbuf pipe to be readable, up to the player's lock timeout.
+ * Returns false if the timeout expired.
+ */
+static bool PerlVLC_video_lock_wait(PerlVLC_player_t *mpinfo) {
+	struct pollfd pfd;
+	uint64_t start, waited;
+	int ret;
+
+	pfd.fd= mpinfo->vbuf_pipe[0];
+	pfd.events= POLLIN;
+	/* The common case, a picture was queued in advance, costs no clock reads */
+	if (poll(&pfd, 1, 0) > 0)
+		return true;
+	start= PerlVLC_monotonic_us();
+	while ((ret= poll(&pfd, 1, mpinfo->lock_timeout_ms)) < 0 && errno == EINTR) {}
+	waited= PerlVLC_monotonic_us() - start;
+	mpinfo->lock_stats.wait_total_us += waited;
+	if (waited > mpinfo->lock_stats.wait_max_us)
+		mpinfo->lock_stats.wait_max_us= waited;
+	/* on error, let recv report it */
+	return ret != 0;
+}
+
+/* Point the planes into a free scratch slot, sized for the current format.  Returns NULL
+ * if the decoder already holds every slot.
+ */
+static void* PerlVLC_video_lock_scratch(PerlVLC_player_t *mpinfo, void **planes) {
+	PerlVLC_picture_format_t *fmt= &mpinfo->current_format;
+	struct PerlVLC_scratch *slot= NULL;
+	size_t need= 0, ofs[PERLVLC_PICTURE_PLANES];
+	int i;
+	for (i= 0; i < PERLVLC_SCRATCH_SLOTS && !slot; i++)
+		if (!__atomic_load_n(&mpinfo->scratch[i].busy, __ATOMIC_ACQUIRE))
+			slot= &mpinfo->scratch[i];
+	if (!slot)
+		return NULL;
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+		ofs[i]= need;
+		need += ((size_t) fmt->pitch[i] * fmt->lines[i] + PERLVLC_PLANE_PITCH_MASK) & ~(size_t)PERLVLC_PLANE_PITCH_MASK;
+	}
+	if (need > slot->len) {
+		free(slot->buf);
+		slot->len= 0;
+		if (!(slot->buf= malloc(need + PERLVLC_PLANE_PITCH_MASK)))
+			return NULL;
+		slot->len= need;
+	}
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++)
+		planes[i]= (char*) PERLVLC_ALIGN_PLANE(slot->buf) + ofs[i];
+	__atomic_store_n(&slot->busy, 1, __ATOMIC_RELEASE);
+	return slot;
+}
+#define PERLVLC_IS_SCRATCH_PICTURE(mpinfo, picture) \
+	((void*) (mpinfo)->scratch <= (picture) && (picture) < (void*) ((mpinfo)->scratch + PERLVLC_SCRATCH_SLOTS))
+
 /* The VLC decoder calls this when it has a new frame of video to decode.
  * It asks us to fill in the values for planes[0..2], normally to a pre-allocated
  * buffer.  We have to wait for a round trip to the user (unless next buffer is
  * already in the pipe).  We then return a value for 'picture' which gets passed
  * back to us during unlock_cb and display_cb.
+ *
+ * If the user doesn't supply a picture within lock_timeout_ms, the decoder gets either
+ * the scratch buffer (and the frame is never reported to perl) or NULL.  A picture that
+ * arrives late just waits in the pipe for the next lock.
  */
 static void* PerlVLC_video_lock_cb(void *opaque, void **planes) {
 	PerlVLC_player_t *mpinfo= (PerlVLC_player_t*) opaque;
 	PerlVLC_picture_t *picture;
+	void *ret;
 	int i;
 	PerlVLC_Message_t lock_msg;
 	PerlVLC_Message_TradePicture_t pic_msg;
+	uint64_t sequence;
 
 	if (!mpinfo) {
 		/* If this happens, it is a bug, and probably going to kil the program.  Warn loudly. */
 		PerlVLC_cb_log_error("BUG: Video callback received NULL opaque pointer\n");
 	}
 	else {
+		/* Every lock takes a number, so frames that don't reach perl leave a gap */
+		sequence= ++mpinfo->lock_sequence;
 		/* Write message to LibVLC instance that the callback is ready and needs data */
 		lock_msg.callback_id= mpinfo->callback_id;
 		lock_msg.event_id= PERLVLC_MSG_VIDEO_LOCK_EVENT;
@@ -606,9 +2142,24 @@ static void* PerlVLC_video_lock_cb(void *opaque, void **planes) {
 		}
 		
 		i= 0;
+		mpinfo->lock_stats.locks++;
 		if (mpinfo->trace_pictures)
 			PerlVLC_cb_log_error("video thread wants picture");
-		if (recv(mpinfo->vbuf_pipe[0], &pic_msg, sizeof(pic_msg), 0) <= 0) {
+		if (mpinfo->lock_timeout_ms >= 0 && !PerlVLC_video_lock_wait(mpinfo)) {
+			mpinfo->lock_stats.timeouts++;
+			if (mpinfo->lock_policy == PERLVLC_LOCK_SCRATCH
+				&& (ret= PerlVLC_video_lock_scratch(mpinfo, planes))
+			) {
+				mpinfo->lock_stats.scratch++;
+				if (mpinfo->trace_pictures)
+					PerlVLC_cb_log_error("video thread timed out, decoding into scratch buffer");
+				return ret;
+			}
+			mpinfo->lock_stats.null++;
+			if (mpinfo->trace_pictures)
+				PerlVLC_cb_log_error("video thread timed out, returning NULL");
+		}
+		else if (recv(mpinfo->vbuf_pipe[0], &pic_msg, sizeof(pic_msg), 0) <= 0) {
 			/* Should never happen, but could if pipe was closed before video thread stopped. */
 			PerlVLC_cb_log_error("BUG: Video callback can't receive picture\n");
 		}
@@ -619,9 +2170,12 @@ static void* PerlVLC_video_lock_cb(void *opaque, void **planes) {
 		}
 		else {
 			picture= pic_msg.picture;
+			picture->sequence= sequence;
+			picture->lock_us= PerlVLC_monotonic_us();
+			picture->unlock_us= picture->display_us= 0;
+			picture->media_time_ms= -1;
 			for (i= 0; i < 3; i++)
-				planes[i]= picture->plane_buffer_sv[i]? SvPVX(picture->plane_buffer_sv[i])
-					: PERLVLC_ALIGN_PLANE(picture->plane[i]); /* alignment to 32-bytes */
+				planes[i]= picture->plane_ptr[i];
 			if (mpinfo->trace_pictures)
 				PerlVLC_cb_log_error("video thread got picture %d (%p,%p,%p)", picture->id, planes[0], planes[1], planes[2]);
 			return picture;
@@ -645,6 +2199,16 @@ static void PerlVLC_video_unlock_cb(void *opaque, void *picture, void * const *p
 		PerlVLC_cb_log_error("BUG: Video unlock callback received NULL opaque pointer");
 		return;
 	}
+	/* Frames from a lock that timed out are dropped, and VLC is done with the slot */
+	if (!picture)
+		return;
+	if (PERLVLC_IS_SCRATCH_PICTURE(mpinfo, picture)) {
+		__atomic_store_n(&((struct PerlVLC_scratch*) picture)->busy, 0, __ATOMIC_RELEASE);
+		return;
+	}
+	((PerlVLC_picture_t *) picture)->unlock_us= PerlVLC_monotonic_us();
+	if (!mpinfo->unlock_events)
+		return;
 	pic_msg.callback_id= mpinfo->callback_id;
 	pic_msg.event_id= PERLVLC_MSG_VIDEO_UNLOCK_EVENT;
 	pic_msg.picture= (PerlVLC_picture_t *) picture;
@@ -655,6 +2219,42 @@ static void PerlVLC_video_unlock_cb(void *opaque, void *picture, void * const *p
 		PerlVLC_cb_log_error("BUG: Video unlock callback can't send event");
 }
 
+/* Perl calls this as it asks libvlc to seek, and the first frame displayed afterward ends
+ * the measurement of the seek's latency.
+ */
+void PerlVLC_seek_start(PerlVLC_player_t *mpinfo, bool keyframe) {
+	mpinfo->lock_stats.seeks++;
+	if (keyframe) mpinfo->lock_stats.keyframe_seeks++;
+	__atomic_store_n(&mpinfo->seek_start_us, PerlVLC_monotonic_us(), __ATOMIC_RELEASE);
+}
+
+static void PerlVLC_seek_done(PerlVLC_player_t *mpinfo) {
+	uint64_t start, waited;
+	if (!__atomic_load_n(&mpinfo->seek_start_us, __ATOMIC_RELAXED)) return;
+	if (!(start= __atomic_exchange_n(&mpinfo->seek_start_us, 0, __ATOMIC_ACQ_REL))) return;
+	waited= PerlVLC_monotonic_us() - start;
+	mpinfo->lock_stats.seeks_done++;
+	mpinfo->lock_stats.seek_last_us= waited;
+	mpinfo->lock_stats.seek_total_us += waited;
+	if (waited > mpinfo->lock_stats.seek_max_us)
+		mpinfo->lock_stats.seek_max_us= waited;
+}
+
+/* Perl calls this as it starts playback, and the first frame displayed afterward measures
+ * the time to first frame.
+ */
+void PerlVLC_play_start(PerlVLC_player_t *mpinfo) {
+	mpinfo->format_after_us= mpinfo->first_frame_after_us= 0;
+	__atomic_store_n(&mpinfo->play_start_us, PerlVLC_monotonic_us(), __ATOMIC_RELEASE);
+}
+
+static void PerlVLC_play_done(PerlVLC_player_t *mpinfo) {
+	uint64_t start;
+	if (!__atomic_load_n(&mpinfo->play_start_us, __ATOMIC_RELAXED)) return;
+	if (!(start= __atomic_exchange_n(&mpinfo->play_start_us, 0, __ATOMIC_ACQ_REL))) return;
+	mpinfo->first_frame_after_us= PerlVLC_monotonic_us() - start;
+}
+
 /* The VLC decoder calls this when it is time to display one of the pictures.
  * The 'picture' argument is whatever we returned in video_lock_cb when this picture
  * was locked/filled, but display order might be different from fill order.
@@ -662,14 +2262,25 @@ static void PerlVLC_video_unlock_cb(void *opaque, void *picture, void * const *p
 static void PerlVLC_video_display_cb(void *opaque, void *picture) {
 	PerlVLC_player_t *mpinfo= (PerlVLC_player_t*) opaque;
 	PerlVLC_Message_TradePicture_t pic_msg;
+	PerlVLC_clock_t clock;
 	if (!mpinfo) {
 		/* If this happens, it is a bug, and probably going to kil the program.  Warn loudly. */
 		PerlVLC_cb_log_error("BUG: Video unlock callback received NULL opaque pointer");
 		return;
 	}
+	PerlVLC_seek_done(mpinfo);
+	PerlVLC_play_done(mpinfo);
+	if (!picture || PERLVLC_IS_SCRATCH_PICTURE(mpinfo, picture))
+		return;
 	pic_msg.callback_id= mpinfo->callback_id;
 	pic_msg.event_id= PERLVLC_MSG_VIDEO_DISPLAY_EVENT;
 	pic_msg.picture= (PerlVLC_picture_t *) picture;
+	/* The stamps travel with the picture, which perl reads after this message */
+	pic_msg.picture->display_us= PerlVLC_monotonic_us();
+	if (mpinfo->clock_attached) {
+		PerlVLC_clock_read(mpinfo, &clock);
+		pic_msg.picture->media_time_ms= clock.time_ms;
+	}
 	if (mpinfo->trace_pictures)
 		PerlVLC_cb_log_error("video thread says display picture %d", pic_msg.picture->id);
 	if (send(mpinfo->event_pipe, &pic_msg, sizeof(pic_msg), 0) <= 0)
@@ -677,11 +2288,187 @@ static void PerlVLC_video_display_cb(void *opaque, void *picture) {
 		PerlVLC_cb_log_error("BUG: Video unlock callback can't send event");
 }
 
+/* Remove a picture from the ones allocated for the format policy, which perl adopts while
+ * the video thread may be freeing them on another format change.  Only one of them wins.
+ */
+static bool PerlVLC_native_picture_claim(PerlVLC_player_t *mpinfo, PerlVLC_picture_t *pic) {
+	PerlVLC_picture_t *expect;
+	int i;
+	for (i= 0; i < PERLVLC_POLICY_PICTURES; i++) {
+		expect= pic;
+		if (__atomic_compare_exchange_n(&mpinfo->native_pictures[i], &expect, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return true;
+	}
+	return false;
+}
+
+/* Read a format policy from a hash of chroma (a string or arrayref of them), max_width,
+ * max_height, align, alloc_count, priority, and the plane allocator options.
+ */
+void PerlVLC_format_policy_from_hv(PerlVLC_format_policy_t *policy, HV *hv) {
+	SV *field, **item;
+	AV *list= NULL;
+	STRLEN len;
+	const char *str;
+	int i, n;
+	memset(policy, 0, sizeof(*policy));
+	if ((field= fetch_if_defined(hv, "chroma"))) {
+		if (SvROK(field) && SvTYPE(SvRV(field)) == SVt_PVAV)
+			list= (AV*) SvRV(field);
+		n= list? av_len(list) + 1 : 1;
+		if (n > PERLVLC_POLICY_CHROMAS)
+			croak("At most %d chromas in a format policy", PERLVLC_POLICY_CHROMAS);
+		for (i= 0; i < n; i++) {
+			if (list) {
+				if (!(item= av_fetch(list, i, 0)) || !*item || !SvOK(*item))
+					croak("Undefined chroma in format policy");
+				field= *item;
+			}
+			str= SvPV(field, len);
+			if (len != 4)
+				croak("Chroma must be 4 characters");
+			memcpy(policy->chroma[i], str, 4);
+		}
+		policy->chroma_count= n;
+	}
+	if ((field= fetch_if_defined(hv, "max_width")))   policy->max_width= SvUV(field);
+	if ((field= fetch_if_defined(hv, "max_height")))  policy->max_height= SvUV(field);
+	if ((field= fetch_if_defined(hv, "align")))       policy->align= SvUV(field);
+	if ((field= fetch_if_defined(hv, "alloc_count"))) policy->alloc_count= SvUV(field);
+	if ((field= fetch_if_defined(hv, "priority")))    policy->priority= SvIV(field);
+	if (policy->align > 4096)
+		croak("Pitch alignment %u is too large", policy->align);
+	policy->alloc= PerlVLC_plane_alloc_from_hv(hv, __atomic_load_n(&PerlVLC_plane_alloc_default, __ATOMIC_RELAXED));
+	policy->enabled= true;
+}
+
+/* Decide the format from a format policy, given the native format in *format.
+ * The native chroma is kept if listed (or if the list is empty).  Returns false if the
+ * chosen chroma has no known plane layout.
+ */
+bool PerlVLC_format_policy_apply(const PerlVLC_format_policy_t *policy, PerlVLC_picture_format_t *format) {
+	const PerlVLC_chroma_layout_t *layout= NULL;
+	unsigned align= policy->align? policy->align : PERLVLC_PLANE_PITCH_MUL, w, h, row;
+	double scale= 1;
+	int i;
+	for (i= 0; i < policy->chroma_count; i++)
+		if (memcmp(policy->chroma[i], format->chroma, 4) == 0)
+			break;
+	if (policy->chroma_count && i >= policy->chroma_count) {
+		/* not listed, so VLC converts to the first one that has a layout */
+		for (i= 0; i < policy->chroma_count; i++)
+			if ((layout= PerlVLC_chroma_layout_find(policy->chroma[i]))) {
+				memcpy(format->chroma, policy->chroma[i], 4);
+				break;
+			}
+	}
+	else layout= PerlVLC_chroma_layout_find(format->chroma);
+	if (!layout)
+		return false;
+	/* Scale down to fit, keeping the aspect, to even dimensions for subsampled chromas */
+	if (policy->max_width && format->width > policy->max_width)
+		scale= (double) policy->max_width / format->width;
+	if (policy->max_height && format->height * scale > policy->max_height)
+		scale= (double) policy->max_height / format->height;
+	if (scale < 1) {
+		w= (unsigned) (format->width * scale);
+		h= (unsigned) (format->height * scale);
+		format->width= w > 2? w & ~1u : 2;
+		format->height= h > 2? h & ~1u : 2;
+	}
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+		format->pitch[i]= format->lines[i]= 0;
+		if (i < layout->planes) {
+			row= (format->width + layout->plane[i].w_div - 1) / layout->plane[i].w_div * layout->plane[i].bytes;
+			format->pitch[i]= (row + align - 1) / align * align;
+			format->lines[i]= (format->height + layout->plane[i].h_div - 1) / layout->plane[i].h_div;
+		}
+	}
+	return true;
+}
+
+/* Answer the format callback from the player's format policy: allocate the pictures, give
+ * them to the lock callback through vbuf_pipe, and tell perl to adopt them.  Returns the
+ * number of pictures, or 0 to ask perl instead (no usable chroma, or no room in the budget
+ * or in native_pictures).
+ */
+static unsigned PerlVLC_video_format_from_policy(PerlVLC_player_t *mpinfo, PerlVLC_picture_format_t *format) {
+	PerlVLC_format_policy_t *policy= &mpinfo->format_policy;
+	PerlVLC_Message_FormatAnswered_t msg;
+	PerlVLC_Message_TradePicture_t pic_msg;
+	PerlVLC_picture_t *expect;
+	unsigned n, i, stored, want= policy->alloc_count? policy->alloc_count : 8;
+	uint64_t start;
+
+	if (!PerlVLC_format_policy_apply(policy, format))
+		return 0;
+	if (want > PERLVLC_POLICY_PICTURES) want= PERLVLC_POLICY_PICTURES;
+	memset(&msg, 0, sizeof(msg));
+	for (n= 0; n < want; n++)
+		if (!(msg.pictures[n]= PerlVLC_picture_new_native(format, policy->alloc, policy->priority, n+1)))
+			break;
+	if (!n)
+		return 0;
+	/* Pictures queued for the old format go back to perl, which frees those that don't fit.
+	 * Those of an earlier answer that perl hasn't adopted yet are still ours to free.
+	 */
+	while (recv(mpinfo->vbuf_pipe[0], &pic_msg, sizeof(pic_msg), MSG_DONTWAIT) == sizeof(pic_msg)) {
+		if (pic_msg.event_id != PERLVLC_MSG_VIDEO_TRADE_PICTURE)
+			continue;
+		PerlVLC_picture_set_held(pic_msg.picture, 0);
+		if (PerlVLC_native_picture_claim(mpinfo, pic_msg.picture)) {
+			PerlVLC_picture_destroy(pic_msg.picture);
+			continue;
+		}
+		pic_msg.callback_id= mpinfo->callback_id;
+		if (send(mpinfo->event_pipe, &pic_msg, sizeof(pic_msg), 0) < sizeof(pic_msg))
+			PerlVLC_cb_log_error("BUG: format_callback: Can't return picture to player");
+	}
+	/* Pictures of an earlier answer that VLC displayed before perl adopted them keep their
+	 * slots, so the new ones only take empty slots, and those that don't fit are freed.
+	 */
+	for (i= 0, stored= 0; i < PERLVLC_POLICY_PICTURES && stored < n; i++) {
+		expect= NULL;
+		if (__atomic_compare_exchange_n(&mpinfo->native_pictures[i], &expect, msg.pictures[stored], 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			stored++;
+	}
+	while (n > stored) {
+		PerlVLC_picture_destroy(msg.pictures[--n]);
+		msg.pictures[n]= NULL;
+	}
+	if (!n)
+		return 0;
+	mpinfo->current_format= *format;
+	pic_msg.event_id= PERLVLC_MSG_VIDEO_TRADE_PICTURE;
+	pic_msg.callback_id= 0;
+	for (i= 0; i < n; i++) {
+		PerlVLC_picture_set_held(msg.pictures[i], 1);
+		msg.pictures[i]->return_fd= mpinfo->event_pipe;
+		msg.pictures[i]->return_callback_id= mpinfo->callback_id;
+		pic_msg.picture= msg.pictures[i];
+		if (send(mpinfo->vbuf_pipe[1], &pic_msg, sizeof(pic_msg), 0) < sizeof(pic_msg))
+			PerlVLC_cb_log_error("BUG: format_callback: Can't queue picture %d", i+1);
+	}
+	msg.callback_id= mpinfo->callback_id;
+	msg.event_id= PERLVLC_MSG_VIDEO_FORMAT_ANSWERED;
+	msg.format= *format;
+	msg.alloc_count= n;
+	if ((start= __atomic_load_n(&mpinfo->play_start_us, __ATOMIC_ACQUIRE)))
+		msg.format_after_us= mpinfo->format_after_us= PerlVLC_monotonic_us() - start;
+	if (send(mpinfo->event_pipe, &msg, sizeof(msg), 0) < sizeof(msg))
+		PerlVLC_cb_log_error("BUG: format_callback: Can't send format to player");
+	if (mpinfo->trace_pictures)
+		PerlVLC_cb_log_error("format_cb: policy gave chroma=%.4s width=%d height=%d pitch=[%d,%d,%d] lines=[%d,%d,%d] alloc_count=%d",
+			format->chroma, format->width, format->height, format->pitch[0], format->pitch[1], format->pitch[2],
+			format->lines[0], format->lines[1], format->lines[2], n);
+	return n;
+}
+
 /* The VLC decoder calls this when it knows the format of the media.
  * We relay this to the main thread where the user may opt to change some of the parameters,
  * and where the user should prepare the rendering buffers.
  * The user sends back the count of buffers allocated (why do they need that?) and any modifications
- * to these arguments.
+ * to these arguments.  With a format policy, this thread answers on its own.
  */
 static unsigned PerlVLC_video_format_cb(void **opaque_p, char *chroma_p, unsigned *width_p, unsigned *height_p, unsigned *pitch, unsigned *lines) {
 	PerlVLC_player_t *mpinfo= (PerlVLC_player_t*) *opaque_p;
@@ -690,7 +2477,10 @@ static unsigned PerlVLC_video_format_cb(void **opaque_p, char *chroma_p, unsigne
 		PerlVLC_Message_ImgFmt_t fmt_msg;
 		PerlVLC_Message_TradePicture_t pic_msg;
 	} msg;
+	PerlVLC_picture_format_t format;
+	unsigned n;
 	int i, got;
+	uint64_t start;
 
 	if (!mpinfo) {
 		/* If this happens, it is a bug, and probably going to kil the program.  Warn loudly. */
@@ -700,6 +2490,24 @@ static unsigned PerlVLC_video_format_cb(void **opaque_p, char *chroma_p, unsigne
 	if (mpinfo->trace_pictures)
 		PerlVLC_cb_log_error("format_cb: vlc gave chroma=%.4s width=%d height=%d pitch=[%d,%d,%d] lines=[%d,%d,%d]",
 			chroma_p, *width_p, *height_p, pitch[0], pitch[1], pitch[2], lines[0], lines[1], lines[2]);
+	if (mpinfo->format_policy.enabled) {
+		memset(&format, 0, sizeof(format));
+		memcpy(format.chroma, chroma_p, 4);
+		format.width= *width_p;
+		format.height= *height_p;
+		if ((n= PerlVLC_video_format_from_policy(mpinfo, &format))) {
+			memcpy(chroma_p, format.chroma, 4);
+			*width_p= format.width;
+			*height_p= format.height;
+			for (i= 0; i < 3; i++) {
+				pitch[i]= format.pitch[i];
+				lines[i]= format.lines[i];
+			}
+			return n;
+		}
+	}
+	if ((start= __atomic_load_n(&mpinfo->play_start_us, __ATOMIC_ACQUIRE)))
+		mpinfo->format_after_us= PerlVLC_monotonic_us() - start;
 	
 	/* Pack up arguments */
 	memset(&msg.fmt_msg, 0, sizeof(msg.fmt_msg));
@@ -733,7 +2541,7 @@ static unsigned PerlVLC_video_format_cb(void **opaque_p, char *chroma_p, unsigne
 		else if (got == sizeof(msg.pic_msg) && msg.msg.event_id == PERLVLC_MSG_VIDEO_TRADE_PICTURE) {
 			if (mpinfo->trace_pictures)
 				PerlVLC_cb_log_error("format_cb: returning picture %d unused", msg.pic_msg.picture->id);
-			msg.pic_msg.picture->held_by_vlc= 0;
+			PerlVLC_picture_set_held(msg.pic_msg.picture, 0);
 			if (send(mpinfo->event_pipe, &msg.pic_msg, sizeof(msg.pic_msg), 0) < sizeof(msg.pic_msg))
 				PerlVLC_cb_log_error("BUG: format_callback: Can't return picture to player");
 		}
@@ -787,10 +2595,11 @@ void PerlVLC_enable_video_callbacks(PerlVLC_player_t *mpinfo, int which) {
 	libvlc_video_set_callbacks(
 		mpinfo->player,
 		PerlVLC_video_lock_cb,
-		which & PERLVLC_VIDEO_CALLBACK_UNLOCK? PerlVLC_video_unlock_cb : NULL,
+		PerlVLC_video_unlock_cb, /* always, to stamp the unlock time */
 		PerlVLC_video_display_cb,
 		mpinfo
 	);
+	mpinfo->unlock_events= (which & PERLVLC_VIDEO_CALLBACK_UNLOCK) != 0;
 	mpinfo->video_cb_installed= 1;
 #if (LIBVLC_VERSION_MAJOR >= 2)
 	if (which & (PERLVLC_VIDEO_CALLBACK_FORMAT|PERLVLC_VIDEO_CALLBACK_CLEANUP)) {
@@ -866,6 +2675,22 @@ int PerlVLC_player_add_picture(PerlVLC_player_t *player, PerlVLC_picture_t *pic)
 	return 1;
 }
 
+/* Take over a picture allocated by the video thread for a format policy.  It becomes a perl
+ * object of this thread, held by the player like those from queue_picture.  Returns false
+ * for an address that is no longer pending, such as one the video thread already freed
+ * on a second format change.
+ */
+bool PerlVLC_player_adopt_picture(PerlVLC_player_t *player, PerlVLC_picture_t *pic) {
+	SV *self;
+	if (!PerlVLC_native_picture_claim(player, pic))
+		return false;
+	pic->home= PERL_GET_THX;
+	self= PerlVLC_wrap_picture(pic);
+	PerlVLC_player_add_picture(player, pic);
+	SvREFCNT_dec(self);
+	return true;
+}
+
 /* Remove a specific picture from the list held by this object.  Dies if the picture
  * doesn't belong to this object.
  */
@@ -890,6 +2715,16 @@ static void warn_format_details(const char *prefix, PerlVLC_picture_format_t *fm
 		fmt->pitch[0], fmt->pitch[1], fmt->pitch[2], fmt->lines[0], fmt->lines[1], fmt->lines[2]);
 }
 
+/* Return a picture to the player it was last queued to, from another thread */
+static void PerlVLC_picture_send_home(PerlVLC_picture_t *pic) {
+	PerlVLC_Message_TradePicture_t msg;
+	msg.event_id= PERLVLC_MSG_PICTURE_RELEASED;
+	msg.callback_id= pic->return_callback_id;
+	msg.picture= pic;
+	if (send(pic->return_fd, &msg, sizeof(msg), 0) != sizeof(msg))
+		PerlVLC_cb_log_error("picture %d: can't return to its player: %s", pic->id, strerror(errno));
+}
+
 /* Makes sure VLC thread has at least N pictures assigned for it to use.
  * Dies if pipe is not opened yet or if it fails to write to the pipe.
  * Returns the number of pictures assigned to VLC.
@@ -897,18 +2732,25 @@ static void warn_format_details(const char *prefix, PerlVLC_picture_format_t *fm
 void PerlVLC_player_send_picture(PerlVLC_player_t *player, PerlVLC_picture_t *pic) {
 	PERLVLC_TRACE("PerlVLC_player_send_picture");
 	PerlVLC_Message_TradePicture_t msg;
-	int wrote;
+	int wrote, i;
 	if (player->vbuf_pipe[1] < 0)
 		carp_croak("Queue is not initialized");
 	if (player->need_format_response)
 		carp_croak("Can't queue picture until after format response");
 	if (pic->held_by_vlc)
 		carp_croak("Picture %d was already sent to video thread", pic->id);
+	if (__atomic_load_n(&pic->refs, __ATOMIC_ACQUIRE) > 1)
+		carp_croak("Picture %d is still in use by another thread", pic->id);
 	if (memcmp(&pic->format, &player->current_format, sizeof(PerlVLC_picture_format_t))) {
 		warn_format_details("picture format", &pic->format);
 		warn_format_details("v-codec format", &player->current_format);
 		carp_croak("Picture %d does not match current video format", pic->id);
 	}
+	/* The video thread only sees plane_ptr, so make sure the scalars haven't moved */
+	for (i= 0; i < PERLVLC_PICTURE_PLANES; i++)
+		if (pic->plane_buffer_sv[i] && (SvPVX(pic->plane_buffer_sv[i]) != pic->plane_ptr[i]
+			|| SvCUR(pic->plane_buffer_sv[i]) < (STRLEN) pic->format.pitch[i] * pic->format.lines[i]))
+			carp_croak("Picture %d plane %d scalar was reallocated or shortened since the picture was created", pic->id, i);
 	msg.event_id= PERLVLC_MSG_VIDEO_TRADE_PICTURE;
 	msg.picture= pic;
 	if (player->trace_pictures)
@@ -916,37 +2758,1860 @@ void PerlVLC_player_send_picture(PerlVLC_player_t *player, PerlVLC_picture_t *pi
 	wrote= send(player->vbuf_pipe[1], &msg, sizeof(msg), 0);
 	if (wrote != sizeof(msg))
 		carp_croak("Failed to send picture to VLC thread");
-	pic->held_by_vlc= 1;
+	PerlVLC_picture_set_held(pic, 1);
+	pic->return_fd= player->event_pipe;
+	pic->return_callback_id= player->callback_id;
 }
 
 /*------------------------------------------------------------------------------------------------
- * Set up the vtable structs for applying magic
+ * Loudness Meter
+ *
+ * An audio sink implementing EBU R128 / ITU-R BS.1770-4 measurement.  VLC converts the audio to
+ * interleaved float samples at the requested rate and channel count, and the play callback runs
+ * the K-weighting filters, gating-block accumulation and true-peak interpolation directly on
+ * the audio thread.  Gated loudness is computed from histograms of block loudness (0.1 LU
+ * resolution) so memory use doesn't grow with the length of the media.
  */
 
-static int PerlVLC_mg_nodup(pTHX_ MAGIC *mg, CLONE_PARAMS *param) {
-	croak("Can't share VLC objects across perl iThreads");
-	return 0;
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20000)
+
+static double PerlVLC_loudness_bin_energy[PERLVLC_LOUDNESS_HIST_BINS];
+
+#define PERLVLC_LUFS(energy) (-0.691 + 10 * log10(energy))
+
+static void PerlVLC_loudness_hist_add(uint32_t *hist, double *sums, double energy) {
+	double lufs= PERLVLC_LUFS(energy);
+	int bin;
+	if (!(lufs >= -70)) return; /* absolute gate, also rejects NaN and silence */
+	bin= (int)((lufs + 70) * 10);
+	if (bin >= PERLVLC_LOUDNESS_HIST_BINS) bin= PERLVLC_LOUDNESS_HIST_BINS-1;
+	hist[bin]++;
+	if (sums) sums[bin] += energy;
 }
-#ifdef MGf_LOCAL
-static int PerlVLC_mg_nolocal(pTHX_ SV *var, MAGIC* mg) {
-	croak("Can't share VLC objects across perl iThreads");
-	return 0;
+
+/* Index of the first bin whose loudness is at or above 'lufs' */
+static int PerlVLC_loudness_bin_at(double lufs) {
+	int bin= (int) ceil((lufs + 70) * 10 - 0.5);
+	return bin < 0? 0 : bin > PERLVLC_LOUDNESS_HIST_BINS? PERLVLC_LOUDNESS_HIST_BINS : bin;
 }
-#endif
 
-MGVTBL PerlVLC_instance_mg_vtbl= {
-	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
-	PerlVLC_instance_mg_free,
-	0, PerlVLC_mg_nodup
-#ifdef MGf_LOCAL
-	, PerlVLC_mg_nolocal
-#endif
-};
-MGVTBL PerlVLC_media_mg_vtbl= {
-	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
-	PerlVLC_media_mg_free,
-	0, PerlVLC_mg_nodup
-#ifdef MGf_LOCAL
+/* Mean energy of the histogram from bin 'start' onward, and the number of blocks counted.
+ * Uses the exact energy sums if available, else the bin centers.
+ */
+static double PerlVLC_loudness_hist_mean(const uint32_t *hist, const double *sums, int start, uint64_t *count_out) {
+	double sum= 0;
+	uint64_t count= 0;
+	int i;
+	for (i= start; i < PERLVLC_LOUDNESS_HIST_BINS; i++) {
+		sum += sums? sums[i] : hist[i] * PerlVLC_loudness_bin_energy[i];
+		count += hist[i];
+	}
+	if (count_out) *count_out= count;
+	return count? sum / count : 0;
+}
+
+/* Integrated loudness: the mean of blocks above the absolute gate sets a relative gate 10 LU
+ * below it, and the result is the mean of blocks above both.
+ */
+static double PerlVLC_loudness_integrated(PerlVLC_loudness_t *m) {
+	double mean= PerlVLC_loudness_hist_mean(m->block_hist, m->block_energy, 0, NULL);
+	if (!mean) return -INFINITY;
+	mean= PerlVLC_loudness_hist_mean(m->block_hist, m->block_energy,
+		PerlVLC_loudness_bin_at(PERLVLC_LUFS(mean) - 10), NULL);
+	return mean? PERLVLC_LUFS(mean) : -INFINITY;
+}
+
+/* Loudness range (EBU Tech 3342): the spread between the 10th and 95th percentile of
+ * short-term loudness, after a relative gate 20 LU below their mean.
+ */
+static double PerlVLC_loudness_range(PerlVLC_loudness_t *m) {
+	double mean= PerlVLC_loudness_hist_mean(m->short_hist, NULL, 0, NULL), lo= 0, hi= 0;
+	uint64_t count, cum= 0;
+	int i, start;
+	if (!mean) return 0;
+	start= PerlVLC_loudness_bin_at(PERLVLC_LUFS(mean) - 20);
+	PerlVLC_loudness_hist_mean(m->short_hist, NULL, start, &count);
+	if (!count) return 0;
+	for (i= start; i < PERLVLC_LOUDNESS_HIST_BINS; i++) {
+		if (cum <= count * 0.10 && cum + m->short_hist[i] > count * 0.10)
+			lo= -70 + (i + 0.5) * 0.1;
+		cum += m->short_hist[i];
+		if (cum > count * 0.95) {
+			hi= -70 + (i + 0.5) * 0.1;
+			break;
+		}
+	}
+	return hi - lo;
+}
+
+static double PerlVLC_loudness_window(PerlVLC_loudness_t *m, unsigned n) {
+	double sum= 0;
+	unsigned i;
+	for (i= 0; i < n; i++)
+		sum += m->sub_energy[(m->sub_count - 1 - i) % PERLVLC_LOUDNESS_SHORT_TERM];
+	return sum / n;
+}
+
+/* Caller must hold the mutex */
+static void PerlVLC_loudness_summarize(PerlVLC_loudness_t *m, PerlVLC_loudness_summary_t *out) {
+	out->momentary= m->sub_count >= 4? PERLVLC_LUFS(m->momentary) : -INFINITY;
+	out->short_term= m->sub_count >= PERLVLC_LOUDNESS_SHORT_TERM? PERLVLC_LUFS(m->short_term) : -INFINITY;
+	out->integrated= PerlVLC_loudness_integrated(m);
+	out->range= PerlVLC_loudness_range(m);
+	out->true_peak= m->tp_factor > 1 && m->true_peak > m->sample_peak? m->true_peak : m->sample_peak;
+	out->sample_peak= m->sample_peak;
+	out->samples= m->samples;
+	out->final= 0;
+}
+
+void PerlVLC_loudness_get_summary(PerlVLC_loudness_t *m, PerlVLC_loudness_summary_t *out) {
+	pthread_mutex_lock(&m->mutex);
+	PerlVLC_loudness_summarize(m, out);
+	pthread_mutex_unlock(&m->mutex);
+}
+
+/* Summaries are only informational, so don't block the audio thread if perl has fallen
+ * behind on reading the event pipe; the final values can always be read from the meter.
+ */
+static void PerlVLC_loudness_post(PerlVLC_loudness_t *m, bool final) {
+	PerlVLC_Message_Loudness_t msg;
+	if (m->event_pipe < 0) return;
+	memset(&msg, 0, sizeof(msg));
+	msg.event_id= PERLVLC_MSG_AUDIO_LOUDNESS_EVENT;
+	msg.callback_id= m->callback_id;
+	PerlVLC_loudness_summarize(m, &msg.summary);
+	msg.summary.final= final;
+	if (send(m->event_pipe, &msg, sizeof(msg), MSG_DONTWAIT) <= 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		PerlVLC_cb_log_error("BUG: Loudness meter can't send event");
+}
+
+static void PerlVLC_loudness_end_subblock(PerlVLC_loudness_t *m) {
+	m->sub_energy[m->sub_count % PERLVLC_LOUDNESS_SHORT_TERM]= m->sub_sum / m->sub_len;
+	m->sub_count++;
+	m->sub_sum= 0;
+	m->sub_pos= 0;
+	if (m->sub_count >= 4) {
+		m->momentary= PerlVLC_loudness_window(m, 4);
+		PerlVLC_loudness_hist_add(m->block_hist, m->block_energy, m->momentary);
+	}
+	if (m->sub_count >= PERLVLC_LOUDNESS_SHORT_TERM) {
+		m->short_term= PerlVLC_loudness_window(m, PERLVLC_LOUDNESS_SHORT_TERM);
+		PerlVLC_loudness_hist_add(m->short_hist, NULL, m->short_term);
+	}
+	if (m->interval && m->sub_count % m->interval == 0)
+		PerlVLC_loudness_post(m, 0);
+}
+
+/* Direct form II transposed */
+#define PERLVLC_BIQUAD(b, a, z, x, y) do { \
+	y= b[0] * x + z[0]; \
+	z[0]= b[1] * x - a[1] * y + z[1]; \
+	z[1]= b[2] * x - a[2] * y; \
+	} while (0)
+
+static void PerlVLC_loudness_play_cb(void *data, const void *samples, unsigned count, int64_t pts) {
+	PerlVLC_loudness_t *m= (PerlVLC_loudness_t*) data;
+	const float *frame= (const float*) samples;
+	unsigned i, c, p, k, pos;
+	double x, y, sum, peak, tp;
+	const double *coef;
+
+	pthread_mutex_lock(&m->mutex);
+	for (i= 0; i < count; i++, frame += m->channels) {
+		sum= 0;
+		peak= m->sample_peak;
+		tp= m->true_peak;
+		if (m->tp_factor > 1)
+			m->tp_pos= (m->tp_pos + 1) % PERLVLC_TRUE_PEAK_TAPS;
+		for (c= 0; c < m->channels; c++) {
+			x= frame[c];
+			if (fabs(x) > peak) peak= fabs(x);
+			PERLVLC_BIQUAD(m->shelf_b, m->shelf_a, m->shelf_z[c], x, y);
+			x= y;
+			PERLVLC_BIQUAD(m->hp_b, m->hp_a, m->hp_z[c], x, y);
+			sum += m->weight[c] * y * y;
+			if (m->tp_factor > 1) {
+				m->tp_hist[c][m->tp_pos]= frame[c];
+				for (p= 0; p < m->tp_factor; p++) {
+					coef= m->tp_coef + p;
+					y= 0;
+					for (k= 0, pos= m->tp_pos; k < PERLVLC_TRUE_PEAK_TAPS; k++, coef += m->tp_factor) {
+						y += *coef * m->tp_hist[c][pos];
+						pos= pos? pos - 1 : PERLVLC_TRUE_PEAK_TAPS - 1;
+					}
+					if (fabs(y) > tp) tp= fabs(y);
+				}
+			}
+		}
+		m->sample_peak= peak;
+		m->true_peak= tp;
+		m->sub_sum += sum;
+		if (++m->sub_pos >= m->sub_len)
+			PerlVLC_loudness_end_subblock(m);
+	}
+	m->samples += count;
+	pthread_mutex_unlock(&m->mutex);
+}
+
+/* A flush happens on seek.  Discard filter state and the partial sub-block so the
+ * discontinuity doesn't ring through the measurement.
+ */
+static void PerlVLC_loudness_flush_cb(void *data, int64_t pts) {
+	PerlVLC_loudness_t *m= (PerlVLC_loudness_t*) data;
+	pthread_mutex_lock(&m->mutex);
+	memset(m->shelf_z, 0, sizeof(m->shelf_z));
+	memset(m->hp_z, 0, sizeof(m->hp_z));
+	memset(m->tp_hist, 0, sizeof(m->tp_hist));
+	m->sub_sum= 0;
+	m->sub_pos= 0;
+	pthread_mutex_unlock(&m->mutex);
+}
+
+static void PerlVLC_loudness_drain_cb(void *data) {
+	PerlVLC_loudness_t *m= (PerlVLC_loudness_t*) data;
+	pthread_mutex_lock(&m->mutex);
+	PerlVLC_loudness_post(m, 1);
+	pthread_mutex_unlock(&m->mutex);
+}
+
+/* Filter coefficients from BS.1770, re-derived for sample rates other than 48KHz
+ * the same way as libebur128.
+ */
+static void PerlVLC_loudness_init_filters(PerlVLC_loudness_t *m) {
+	double f0, G, Q, K, Vh, Vb, a0;
+	unsigned n, taps;
+	double t, w;
+
+	f0= 1681.974450955533;
+	G= 3.999843853973347;
+	Q= 0.7071752369554196;
+	K= tan(M_PI * f0 / m->rate);
+	Vh= pow(10.0, G / 20.0);
+	Vb= pow(Vh, 0.4996667741545416);
+	a0= 1.0 + K / Q + K * K;
+	m->shelf_b[0]= (Vh + Vb * K / Q + K * K) / a0;
+	m->shelf_b[1]= 2.0 * (K * K - Vh) / a0;
+	m->shelf_b[2]= (Vh - Vb * K / Q + K * K) / a0;
+	m->shelf_a[0]= 1.0;
+	m->shelf_a[1]= 2.0 * (K * K - 1.0) / a0;
+	m->shelf_a[2]= (1.0 - K / Q + K * K) / a0;
+
+	f0= 38.13547087602444;
+	Q= 0.5003270373238773;
+	K= tan(M_PI * f0 / m->rate);
+	a0= 1.0 + K / Q + K * K;
+	m->hp_b[0]= 1.0;
+	m->hp_b[1]= -2.0;
+	m->hp_b[2]= 1.0;
+	m->hp_a[0]= 1.0;
+	m->hp_a[1]= 2.0 * (K * K - 1.0) / a0;
+	m->hp_a[2]= (1.0 - K / Q + K * K) / a0;
+
+	/* True peak needs the signal reconstructed to at least 192KHz.  The interpolator is a
+	 * Hann-windowed sinc with its cutoff at the original Nyquist frequency, split into
+	 * tp_factor phases of PERLVLC_TRUE_PEAK_TAPS taps.
+	 */
+	m->tp_factor= m->rate < 96000? 4 : m->rate < 192000? 2 : 1;
+	taps= m->tp_factor * PERLVLC_TRUE_PEAK_TAPS;
+	for (n= 0; n < taps && m->tp_factor > 1; n++) {
+		t= ((double) n - (taps - 1) / 2.0) / m->tp_factor;
+		w= 0.5 - 0.5 * cos(2 * M_PI * (n + 1) / (taps + 1));
+		m->tp_coef[n]= (t == 0? 1.0 : sin(M_PI * t) / (M_PI * t)) * w;
+	}
+
+	if (!PerlVLC_loudness_bin_energy[0])
+		for (n= 0; n < PERLVLC_LOUDNESS_HIST_BINS; n++)
+			PerlVLC_loudness_bin_energy[n]= pow(10.0, (-70 + (n + 0.5) * 0.1 + 0.691) / 10.0);
+}
+
+static void PerlVLC_loudness_free(PerlVLC_loudness_t *m) {
+	pthread_mutex_destroy(&m->mutex);
+	Safefree(m);
+}
+
+static PerlVLC_loudness_t* PerlVLC_loudness_new(unsigned rate, unsigned channels,
+	const double *weights, unsigned speed, unsigned interval
+) {
+	PerlVLC_loudness_t *m;
+	unsigned c;
+	if (!rate || rate > 384000)
+		croak("Unsupported sample rate %u", rate);
+	if (!channels || channels > PERLVLC_LOUDNESS_MAX_CHANNELS)
+		croak("Loudness meter supports 1 to %d channels", PERLVLC_LOUDNESS_MAX_CHANNELS);
+	if (!speed)
+		croak("speed must be a positive integer");
+	Newxz(m, 1, PerlVLC_loudness_t);
+	if (pthread_mutex_init(&m->mutex, NULL)) {
+		Safefree(m);
+		croak("pthread_mutex_init failed");
+	}
+	m->event_pipe= -1;
+	m->rate= rate;
+	m->channels= channels;
+	m->speed= speed;
+	m->interval= interval;
+	m->sub_len= rate / 10;
+	for (c= 0; c < channels; c++)
+		m->weight[c]= weights? weights[c] : 1.0;
+	PerlVLC_loudness_init_filters(m);
+	return m;
+}
+
+/* Meter a buffer of interleaved float samples on a meter of its own, for testing the
+ * measurement without an audio output.
+ */
+void PerlVLC_loudness_measure(unsigned rate, unsigned channels, const float *samples, unsigned frames,
+	PerlVLC_loudness_summary_t *out
+) {
+	PerlVLC_loudness_t *m= PerlVLC_loudness_new(rate, channels, NULL, 1, 0);
+	PerlVLC_loudness_play_cb(m, samples, frames, 0);
+	PerlVLC_loudness_summarize(m, out);
+	PerlVLC_loudness_free(m);
+}
+
+void PerlVLC_enable_loudness_meter(PerlVLC_player_t *mpinfo, unsigned rate, unsigned channels,
+	const double *weights, unsigned speed, unsigned interval
+) {
+	PerlVLC_loudness_t *m= PerlVLC_loudness_new(rate, channels, weights, speed, interval);
+	m->event_pipe= mpinfo->event_pipe;
+	m->callback_id= mpinfo->callback_id;
+	/* The player is not playing (checked by caller) so the old meter, if any, is idle */
+	if (mpinfo->loudness)
+		PerlVLC_loudness_free(mpinfo->loudness);
+	mpinfo->loudness= m;
+	libvlc_audio_set_callbacks(mpinfo->player, PerlVLC_loudness_play_cb, NULL, NULL,
+		PerlVLC_loudness_flush_cb, PerlVLC_loudness_drain_cb, m);
+	libvlc_audio_set_format(mpinfo->player, "FL32", rate * speed, channels);
+}
+
+#else
+
+void PerlVLC_enable_loudness_meter(PerlVLC_player_t *mpinfo, unsigned rate, unsigned channels,
+	const double *weights, unsigned speed, unsigned interval
+) {
+	croak("Audio callbacks require LibVLC 2.0");
+}
+
+void PerlVLC_loudness_get_summary(PerlVLC_loudness_t *m, PerlVLC_loudness_summary_t *out) {
+	memset(out, 0, sizeof(*out));
+}
+
+void PerlVLC_loudness_measure(unsigned rate, unsigned channels, const float *samples, unsigned frames,
+	PerlVLC_loudness_summary_t *out
+) {
+	croak("Audio callbacks require LibVLC 2.0");
+}
+
+static void PerlVLC_loudness_free(PerlVLC_loudness_t *m) {
+	Safefree(m);
+}
+
+#endif
+
+/* Unmeasured loudness is reported as undef rather than -inf, and peaks are converted to
+ * decibels relative to full scale.
+ */
+void PerlVLC_loudness_summary_to_hv(PerlVLC_loudness_summary_t *summary, HV *hv) {
+	hv_stores(hv, "momentary", isinf(summary->momentary)? newSV(0) : newSVnv(summary->momentary));
+	hv_stores(hv, "short_term", isinf(summary->short_term)? newSV(0) : newSVnv(summary->short_term));
+	hv_stores(hv, "integrated", isinf(summary->integrated)? newSV(0) : newSVnv(summary->integrated));
+	hv_stores(hv, "range", newSVnv(summary->range));
+	hv_stores(hv, "true_peak", summary->true_peak > 0? newSVnv(20 * log10(summary->true_peak)) : newSV(0));
+	hv_stores(hv, "sample_peak", summary->sample_peak > 0? newSVnv(20 * log10(summary->sample_peak)) : newSV(0));
+	hv_stores(hv, "samples", newSVnv((NV) summary->samples));
+	hv_stores(hv, "final", newSViv(summary->final));
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Thread affinity
+ *
+ * VLC creates its decoder and output threads internally, so the only handle perl has on
+ * them is their kernel thread id (from /proc/self/task).  These are Linux-only.
+ */
+
+/* Push the CPUs that thread 'tid' (0 = calling thread) may run on onto 'out'.
+ * Returns false if not supported or the thread doesn't exist.
+ */
+bool PerlVLC_thread_get_affinity(int tid, AV *out) {
+#if defined(__linux__) && defined(CPU_ISSET)
+	cpu_set_t set;
+	int i;
+	if (sched_getaffinity(tid, sizeof(set), &set) != 0)
+		return false;
+	for (i= 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &set))
+			av_push(out, newSViv(i));
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* Restrict thread 'tid' to the CPU numbers listed in 'cpus'.
+ * Returns false if not supported, the thread is gone, or the set is empty or invalid.
+ */
+bool PerlVLC_thread_set_affinity(int tid, AV *cpus) {
+#if defined(__linux__) && defined(CPU_SET)
+	cpu_set_t set;
+	SV **item;
+	IV cpu;
+	int i, n= 0;
+	CPU_ZERO(&set);
+	for (i= 0; i <= av_len(cpus); i++) {
+		if ((item= av_fetch(cpus, i, 0)) && *item && SvOK(*item)) {
+			cpu= SvIV(*item);
+			if (cpu < 0 || cpu >= CPU_SETSIZE)
+				croak("Invalid CPU number %ld", (long) cpu);
+			CPU_SET(cpu, &set);
+			n++;
+		}
+	}
+	return n && sched_setaffinity(tid, sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Keyframe index
+ *
+ * libvlc can't say where the keyframes are, so read them from the sample table of MP4/MOV
+ * files (the ISO base media file format), which lists the sync samples of each track.
+ * Other containers, and fragmented MP4, have no such table and get no index.
+ */
+
+static uint32_t PerlVLC_be32(const uint8_t *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint64_t PerlVLC_be64(const uint8_t *p) {
+	return ((uint64_t) PerlVLC_be32(p) << 32) | PerlVLC_be32(p+4);
+}
+
+/* Find the first box of 'type' in [p, end).  Returns the start of its contents and sets
+ * *box_end, or returns NULL.  Searching again from *box_end finds the next one.
+ */
+static const uint8_t* PerlVLC_mp4_box(const uint8_t *p, const uint8_t *end, const char *type, const uint8_t **box_end) {
+	uint64_t size, hdr;
+	while (p && end - p >= 8) {
+		size= PerlVLC_be32(p);
+		hdr= 8;
+		if (size == 1) {
+			if (end - p < 16) return NULL;
+			size= PerlVLC_be64(p+8);
+			hdr= 16;
+		}
+		else if (size == 0)
+			size= end - p;
+		if (size < hdr || size > (uint64_t) (end - p))
+			return NULL;
+		if (memcmp(p+4, type, 4) == 0) {
+			*box_end= p + size;
+			return p + hdr;
+		}
+		p += size;
+	}
+	return NULL;
+}
+
+/* The contents of box 'type' inside a box, or NULL.  Sets *end to the end of it. */
+static const uint8_t* PerlVLC_mp4_child(const uint8_t *p, const uint8_t **end, const char *type) {
+	return p? PerlVLC_mp4_box(p, *end, type, end) : NULL;
+}
+
+/* Timescale of a mvhd or mdhd box, which is after the version, flags, and two timestamps */
+static uint32_t PerlVLC_mp4_timescale(const uint8_t *p, const uint8_t *end) {
+	size_t ofs= p && end - p >= 4 && p[0] == 1? 20 : 12;
+	return p && end - p >= ofs + 4? PerlVLC_be32(p + ofs) : 0;
+}
+
+/* Push the presentation time (ms) of each sync sample of the first video track of an MP4
+ * or MOV file onto 'out'.  Returns false if the file has no such track with a sample table.
+ */
+bool PerlVLC_mp4_keyframes(const char *path, AV *out) {
+	const uint8_t *file, *file_end, *moov, *moov_end, *trak, *trak_end, *p, *p_end,
+		*stbl= NULL, *stbl_end, *stts, *stts_end, *stss= NULL, *stss_end, *ctts= NULL, *ctts_end,
+		*elst= NULL, *elst_end= NULL;
+	uint32_t movie_scale, scale= 0, n_stts, n_stss= 0, n_ctts= 0, i, si, ci, count, cstart, k, n_samples;
+	uint64_t start, dts, empty= 0;
+	int64_t media_start= 0, pts, ofs;
+	size_t len, esize;
+	file= (const uint8_t*) PerlVLC_mmap_readonly(path, &len);
+	file_end= file + len;
+	/* moov, then each trak until one whose handler is 'vide' */
+	moov_end= file_end;
+	if (!(moov= PerlVLC_mp4_box(file, file_end, "moov", &moov_end)))
+		goto fail;
+	p_end= moov_end;
+	movie_scale= PerlVLC_mp4_timescale(p= PerlVLC_mp4_child(moov, &p_end, "mvhd"), p_end);
+	for (trak= moov; (trak= PerlVLC_mp4_box(trak, moov_end, "trak", &trak_end)); trak= trak_end) {
+		p_end= trak_end;
+		p= PerlVLC_mp4_child(PerlVLC_mp4_child(trak, &p_end, "mdia"), &p_end, "hdlr");
+		if (!p || p_end - p < 12 || memcmp(p+8, "vide", 4) != 0)
+			continue;
+		p_end= trak_end;
+		p= PerlVLC_mp4_child(trak, &p_end, "mdia");
+		stbl_end= p_end;
+		stbl= PerlVLC_mp4_child(PerlVLC_mp4_child(p, &stbl_end, "minf"), &stbl_end, "stbl");
+		p_end= trak_end;
+		scale= PerlVLC_mp4_timescale(p= PerlVLC_mp4_child(PerlVLC_mp4_child(trak, &p_end, "mdia"), &p_end, "mdhd"), p_end);
+		elst_end= trak_end;
+		elst= PerlVLC_mp4_child(PerlVLC_mp4_child(trak, &elst_end, "edts"), &elst_end, "elst");
+		break;
+	}
+	if (!stbl || !scale)
+		goto fail;
+	stts_end= stss_end= ctts_end= stbl_end;
+	stts= PerlVLC_mp4_child(stbl, &stts_end, "stts");
+	stss= PerlVLC_mp4_child(stbl, &stss_end, "stss");
+	ctts= PerlVLC_mp4_child(stbl, &ctts_end, "ctts");
+	/* Each table is version/flags, entry count, then the entries */
+	if (!stts || stts_end - stts < 8 || (n_stts= PerlVLC_be32(stts+4)) > (stts_end - stts - 8) / 8)
+		goto fail;
+	if (stss && (stss_end - stss < 8 || (n_stss= PerlVLC_be32(stss+4)) > (stss_end - stss - 8) / 4))
+		goto fail;
+	if (ctts && (ctts_end - ctts < 8 || (n_ctts= PerlVLC_be32(ctts+4)) > (ctts_end - ctts - 8) / 8))
+		ctts= NULL;
+	/* Empty edits delay the track (in the movie timescale); the first real edit says where in
+	 * the track presentation starts, which for B-frames usually cancels the ctts offset.
+	 */
+	if (elst && elst_end - elst >= 8 && movie_scale) {
+		esize= elst[0] == 1? 20 : 12;
+		for (i= 0, p= elst + 8; i < PerlVLC_be32(elst+4) && elst_end - p >= esize; i++, p += esize) {
+			ofs= esize == 20? (int64_t) PerlVLC_be64(p+8) : (int32_t) PerlVLC_be32(p+4);
+			if (ofs >= 0) {
+				media_start= ofs;
+				break;
+			}
+			empty += esize == 20? PerlVLC_be64(p) : PerlVLC_be32(p);
+		}
+	}
+	for (n_samples= 0, i= 0; i < n_stts; i++)
+		n_samples += PerlVLC_be32(stts + 8 + i*8);
+	/* Walk the sync sample numbers (1-based, ascending) alongside the runs of stts and ctts.
+	 * Without stss, every sample is a sync sample.
+	 */
+	start= 1; dts= 0; si= 0; ci= 0; cstart= 1;
+	for (i= 0; i < (stss? n_stss : n_samples); i++) {
+		k= stss? PerlVLC_be32(stss + 8 + i*4) : i + 1;
+		if (k < start) continue;
+		while (si < n_stts && k >= start + (count= PerlVLC_be32(stts + 8 + si*8))) {
+			dts += (uint64_t) count * PerlVLC_be32(stts + 12 + si*8);
+			start += count;
+			si++;
+		}
+		if (si >= n_stts) break;
+		pts= dts + (uint64_t) (k - start) * PerlVLC_be32(stts + 12 + si*8);
+		if (ctts) {
+			while (ci < n_ctts && k >= cstart + PerlVLC_be32(ctts + 8 + ci*8))
+				cstart += PerlVLC_be32(ctts + 8 + ci++*8);
+			if (ci < n_ctts)
+				pts += (int32_t) PerlVLC_be32(ctts + 12 + ci*8);
+		}
+		/* Round up: a time even 1ms early would seek to the keyframe before this one */
+		pts= (pts - media_start) * 1000;
+		pts= (pts > 0? (pts + scale - 1) / scale : pts / scale)
+			+ (movie_scale? (int64_t) ((empty * 1000 + movie_scale - 1) / movie_scale) : 0);
+		av_push(out, newSViv(pts > 0? pts : 0));
+	}
+	munmap((void*) file, len);
+	return true;
+fail:
+	munmap((void*) file, len);
+	return false;
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Playback clock
+ *
+ * libvlc_media_player_get_time and the other getters lock the player and its input.  The
+ * clock instead listens to the player's events and keeps a snapshot that perl reads with a
+ * few plain loads.  libvlc only reports the time a few times per second, so while playing,
+ * readers advance it by the monotonic time elapsed since the last report.
+ */
+
+static const libvlc_event_type_t PerlVLC_clock_events[]= {
+	libvlc_MediaPlayerOpening,
+	libvlc_MediaPlayerPlaying,
+	libvlc_MediaPlayerPaused,
+	libvlc_MediaPlayerStopped,
+	libvlc_MediaPlayerEndReached,
+	libvlc_MediaPlayerEncounteredError,
+	libvlc_MediaPlayerTimeChanged,
+	libvlc_MediaPlayerPositionChanged,
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20200)
+	libvlc_MediaPlayerLengthChanged,
+#endif
+};
+#define PERLVLC_CLOCK_EVENT_COUNT (sizeof(PerlVLC_clock_events)/sizeof(PerlVLC_clock_events[0]))
+
+static void PerlVLC_clock_write_begin(PerlVLC_clock_t *c) {
+	uint32_t seq= __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+	while ((seq & 1) || !__atomic_compare_exchange_n(&c->seq, &seq, seq+1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		if (seq & 1) {
+			sched_yield();
+			seq= __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void PerlVLC_clock_write_end(PerlVLC_clock_t *c) {
+	__atomic_store_n(&c->seq, c->seq+1, __ATOMIC_RELEASE);
+}
+
+/* The time in ms at monotonic time 'now', or -1 */
+static int64_t PerlVLC_clock_time_at(const PerlVLC_clock_t *c, uint64_t now) {
+	int64_t t= c->time_ms;
+	if (c->state == libvlc_Playing && t >= 0 && now > c->base_us) {
+		t += (int64_t) ((now - c->base_us) * c->rate * .001);
+		if (c->length_ms > 0 && t > c->length_ms)
+			t= c->length_ms;
+	}
+	return t;
+}
+
+/* Runs on the libvlc event thread */
+void PerlVLC_clock_event_cb(const libvlc_event_t *event, void *opaque) {
+	PerlVLC_clock_t *c= &((PerlVLC_player_t*) opaque)->clock;
+	uint64_t now= PerlVLC_monotonic_us();
+	PerlVLC_clock_write_begin(c);
+	switch (event->type) {
+	case libvlc_MediaPlayerTimeChanged:
+		c->time_ms= event->u.media_player_time_changed.new_time;
+		c->base_us= now;
+		break;
+	case libvlc_MediaPlayerPositionChanged:
+		c->position= event->u.media_player_position_changed.new_position;
+		break;
+#if ((LIBVLC_VERSION_MAJOR * 10000 + LIBVLC_VERSION_MINOR * 100 + LIBVLC_VERSION_REVISION) >= 20200)
+	case libvlc_MediaPlayerLengthChanged:
+		c->length_ms= event->u.media_player_length_changed.new_length;
+		break;
+#endif
+	case libvlc_MediaPlayerOpening:
+		c->state= libvlc_Opening;
+		break;
+	case libvlc_MediaPlayerPlaying:
+		c->state= libvlc_Playing;
+		c->base_us= now;
+		break;
+	/* Stop advancing, at the time reached so far */
+	case libvlc_MediaPlayerPaused:
+	case libvlc_MediaPlayerEndReached:
+		c->time_ms= PerlVLC_clock_time_at(c, now);
+		c->base_us= now;
+		c->state= event->type == libvlc_MediaPlayerPaused? libvlc_Paused : libvlc_Ended;
+		break;
+	case libvlc_MediaPlayerStopped:
+	case libvlc_MediaPlayerEncounteredError:
+		c->time_ms= -1;
+		c->position= -1;
+		c->state= event->type == libvlc_MediaPlayerStopped? libvlc_Stopped : libvlc_Error;
+		break;
+	}
+	c->events++;
+	PerlVLC_clock_write_end(c);
+}
+
+/* Start listening to the player's events, after seeding the clock from the getters */
+void PerlVLC_clock_attach(PerlVLC_player_t *player) {
+	PerlVLC_clock_t *c= &player->clock;
+	libvlc_event_manager_t *em;
+	unsigned long events;
+	int64_t time_ms, length_ms;
+	double position, rate;
+	int i, state;
+	if (player->clock_attached) return;
+	em= libvlc_media_player_event_manager(player->player);
+	for (i= 0; i < PERLVLC_CLOCK_EVENT_COUNT; i++) {
+		if (libvlc_event_attach(em, PerlVLC_clock_events[i], PerlVLC_clock_event_cb, player) != 0) {
+			while (--i >= 0)
+				libvlc_event_detach(em, PerlVLC_clock_events[i], PerlVLC_clock_event_cb, player);
+			croak("libvlc_event_attach failed");
+		}
+	}
+	player->clock_attached= true;
+	/* Attach first so no event is missed, but then an event may arrive while reading the
+	 * getters.  In that case the event is newer, so keep it.
+	 */
+	events= __atomic_load_n(&c->events, __ATOMIC_ACQUIRE);
+	state= libvlc_media_player_get_state(player->player);
+	time_ms= libvlc_media_player_get_time(player->player);
+	length_ms= libvlc_media_player_get_length(player->player);
+	position= libvlc_media_player_get_position(player->player);
+	rate= libvlc_media_player_get_rate(player->player);
+	PerlVLC_clock_write_begin(c);
+	if (c->events == events) {
+		c->state= state;
+		c->time_ms= time_ms;
+		c->position= position;
+		c->base_us= PerlVLC_monotonic_us();
+	}
+	if (c->length_ms <= 0) c->length_ms= length_ms > 0? length_ms : 0;
+	c->rate= rate > 0? rate : 1;
+	PerlVLC_clock_write_end(c);
+}
+
+/* libvlc holds the event manager's lock while calling back, so once this returns the
+ * callback is no longer running.
+ */
+void PerlVLC_clock_detach(PerlVLC_player_t *player) {
+	libvlc_event_manager_t *em;
+	int i;
+	if (!player->clock_attached) return;
+	em= libvlc_media_player_event_manager(player->player);
+	for (i= 0; i < PERLVLC_CLOCK_EVENT_COUNT; i++)
+		libvlc_event_detach(em, PerlVLC_clock_events[i], PerlVLC_clock_event_cb, player);
+	player->clock_attached= false;
+}
+
+/* Copy the clock as of now.  Position is derived from the time whenever the length is known. */
+void PerlVLC_clock_read(PerlVLC_player_t *player, PerlVLC_clock_t *out) {
+	PerlVLC_clock_t *c= &player->clock;
+	uint32_t seq;
+	uint64_t now;
+	do {
+		while ((seq= __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE)) & 1)
+			sched_yield();
+		memcpy(out, c, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq);
+	now= PerlVLC_monotonic_us();
+	out->time_ms= PerlVLC_clock_time_at(out, now);
+	if (out->time_ms >= 0 && out->length_ms > 0)
+		out->position= (double) out->time_ms / out->length_ms;
+	out->base_us= now;
+}
+
+/* libvlc seeks asynchronously, and won't report the new time until the input gets there.
+ * Jump the clock now, so readers don't see the old time in the meantime.  Pass -1 for
+ * whichever of time_ms or position is not given.
+ */
+void PerlVLC_clock_seek(PerlVLC_player_t *player, int64_t time_ms, double position) {
+	PerlVLC_clock_t *c= &player->clock;
+	PerlVLC_clock_write_begin(c);
+	if (time_ms < 0 && position >= 0 && c->length_ms > 0)
+		time_ms= (int64_t) (position * c->length_ms);
+	if (time_ms >= 0) {
+		c->time_ms= time_ms;
+		c->base_us= PerlVLC_monotonic_us();
+	}
+	if (position >= 0)
+		c->position= position;
+	PerlVLC_clock_write_end(c);
+}
+
+/* There is no event for rate changes, so the player calls this after setting the rate */
+void PerlVLC_clock_set_rate(PerlVLC_player_t *player, double rate) {
+	PerlVLC_clock_t *c= &player->clock;
+	uint64_t now= PerlVLC_monotonic_us();
+	PerlVLC_clock_write_begin(c);
+	c->time_ms= PerlVLC_clock_time_at(c, now);
+	c->base_us= now;
+	c->rate= rate;
+	PerlVLC_clock_write_end(c);
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Statistics sampler
+ *
+ * libvlc_media_get_stats only returns running totals, so watching a player's health means
+ * polling it and diffing.  One thread does that for every registered player, and posts the
+ * totals with the change and rate over each interval, so perl only has to dispatch a message.
+ */
+
+const char *PerlVLC_stats_names[PERLVLC_STATS_COUNTERS]= {
+	"read_bytes", "demux_read_bytes", "demux_corrupted", "demux_discontinuity",
+	"decoded_video", "decoded_audio", "displayed_pictures", "lost_pictures",
+	"played_abuffers", "lost_abuffers"
+};
+
+/* Read the totals (only) of the media's input.  Returns false if it has none. */
+bool PerlVLC_stats_read(libvlc_media_t *media, PerlVLC_stats_sample_t *out) {
+	libvlc_media_stats_t st;
+	memset(out, 0, sizeof(*out));
+	if (!libvlc_media_get_stats(media, &st))
+		return false;
+	out->input_bitrate= st.f_input_bitrate;
+	out->demux_bitrate= st.f_demux_bitrate;
+	out->total[0]= st.i_read_bytes;
+	out->total[1]= st.i_demux_read_bytes;
+	out->total[2]= st.i_demux_corrupted;
+	out->total[3]= st.i_demux_discontinuity;
+	out->total[4]= st.i_decoded_video;
+	out->total[5]= st.i_decoded_audio;
+	out->total[6]= st.i_displayed_pictures;
+	out->total[7]= st.i_lost_pictures;
+	out->total[8]= st.i_played_abuffers;
+	out->total[9]= st.i_lost_abuffers;
+	return true;
+}
+
+/* Totals are keys of 'hv'.  A sample from the sampler also gets 'elapsed', and hashes of the
+ * same keys for 'delta' and 'rate' if there was a previous sample to compare to.
+ */
+void PerlVLC_stats_sample_to_hv(const PerlVLC_stats_sample_t *sample, HV *hv) {
+	HV *delta, *rate;
+	int i;
+	hv_stores(hv, "input_bitrate", newSVnv(sample->input_bitrate));
+	hv_stores(hv, "demux_bitrate", newSVnv(sample->demux_bitrate));
+	for (i= 0; i < PERLVLC_STATS_COUNTERS; i++)
+		hv_store(hv, PerlVLC_stats_names[i], strlen(PerlVLC_stats_names[i]), newSViv(sample->total[i]), 0);
+	if (sample->elapsed_ms) {
+		hv_stores(hv, "elapsed", newSVnv(sample->elapsed_ms * .001));
+		hv_stores(hv, "delta", newRV_noinc((SV*) (delta= newHV())));
+		hv_stores(hv, "rate", newRV_noinc((SV*) (rate= newHV())));
+		for (i= 0; i < PERLVLC_STATS_COUNTERS; i++) {
+			hv_store(delta, PerlVLC_stats_names[i], strlen(PerlVLC_stats_names[i]), newSViv(sample->delta[i]), 0);
+			hv_store(rate, PerlVLC_stats_names[i], strlen(PerlVLC_stats_names[i]), newSVnv(sample->rate[i]), 0);
+		}
+	}
+}
+
+typedef struct PerlVLC_stats_entry {
+	struct PerlVLC_stats_entry *next;
+	libvlc_media_player_t *mp;  // retained
+	libvlc_media_t *media;      // media of the previous sample (retained), or NULL
+	unsigned interval_ms;
+	uint64_t due_us, prev_us;
+	int32_t prev[PERLVLC_STATS_COUNTERS];
+	int event_pipe;
+	uint32_t callback_id;
+} PerlVLC_stats_entry_t;
+
+static pthread_mutex_t PerlVLC_stats_mutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PerlVLC_stats_cond;  // monotonic clock; initialized with the thread
+static PerlVLC_stats_entry_t *PerlVLC_stats_entries= NULL, *PerlVLC_stats_running= NULL;
+static bool PerlVLC_stats_started= false;
+static pthread_once_t PerlVLC_stats_once= PTHREAD_ONCE_INIT;
+
+/* As with the encoder, the child of a fork starts over without the parent's players */
+static void PerlVLC_stats_atfork_prepare(void) { pthread_mutex_lock(&PerlVLC_stats_mutex); }
+static void PerlVLC_stats_atfork_parent(void) { pthread_mutex_unlock(&PerlVLC_stats_mutex); }
+static void PerlVLC_stats_atfork_child(void) {
+	PerlVLC_stats_entries= PerlVLC_stats_running= NULL;
+	PerlVLC_stats_started= false;
+	pthread_mutex_init(&PerlVLC_stats_mutex, NULL);
+}
+static void PerlVLC_stats_atfork_init(void) {
+	pthread_atfork(PerlVLC_stats_atfork_prepare, PerlVLC_stats_atfork_parent, PerlVLC_stats_atfork_child);
+}
+
+static void PerlVLC_stats_entry_free(PerlVLC_stats_entry_t *e) {
+	if (e->media) libvlc_media_release(e->media);
+	libvlc_media_player_release(e->mp);
+	free(e);
+}
+
+/* Take one sample of the entry and post it.  Runs without the mutex, while the entry is
+ * PerlVLC_stats_running, which keeps it from being freed.
+ */
+static void PerlVLC_stats_take(PerlVLC_stats_entry_t *e, uint64_t now) {
+	PerlVLC_Message_Stats_t msg;
+	libvlc_media_t *media= NULL;
+	bool ok, first;
+	int i;
+	ok= libvlc_media_player_is_playing(e->mp)
+		&& (media= libvlc_media_player_get_media(e->mp))
+		&& PerlVLC_stats_read(media, &msg.sample);
+	/* A new media, or a paused or stopped player, starts over without a previous sample */
+	first= !ok || media != e->media;
+	if (e->media) libvlc_media_release(e->media);
+	e->media= ok? media : NULL;
+	if (!ok) {
+		if (media) libvlc_media_release(media);
+		return;
+	}
+	/* Totals go back to 0 when the input restarts, such as playing the same media again */
+	for (i= 0; i < PERLVLC_STATS_COUNTERS && !first; i++)
+		if (msg.sample.total[i] < e->prev[i])
+			first= true;
+	if (!first && now > e->prev_us) {
+		msg.sample.elapsed_ms= (now - e->prev_us + 500) / 1000;
+		if (!msg.sample.elapsed_ms) msg.sample.elapsed_ms= 1;
+		for (i= 0; i < PERLVLC_STATS_COUNTERS; i++) {
+			msg.sample.delta[i]= msg.sample.total[i] - e->prev[i];
+			msg.sample.rate[i]= msg.sample.delta[i] * 1000000.0 / (now - e->prev_us);
+		}
+	}
+	memcpy(e->prev, msg.sample.total, sizeof(e->prev));
+	e->prev_us= now;
+	msg.event_id= PERLVLC_MSG_MEDIA_STATS;
+	msg.callback_id= e->callback_id;
+	if (send(e->event_pipe, &msg, sizeof(msg), MSG_DONTWAIT) != sizeof(msg) && errno != EAGAIN)
+		PerlVLC_cb_log_error("stats sampler: can't post sample: %s", strerror(errno));
+}
+
+static void* PerlVLC_stats_thread(void *arg) {
+	PerlVLC_stats_entry_t *e, *next;
+	struct timespec ts;
+	uint64_t now;
+	pthread_mutex_lock(&PerlVLC_stats_mutex);
+	while (1) {
+		now= PerlVLC_monotonic_us();
+		for (next= NULL, e= PerlVLC_stats_entries; e; e= e->next)
+			if (!next || e->due_us < next->due_us)
+				next= e;
+		if (!next) {
+			pthread_cond_wait(&PerlVLC_stats_cond, &PerlVLC_stats_mutex);
+			continue;
+		}
+		if (next->due_us > now) {
+			ts.tv_sec= next->due_us / 1000000;
+			ts.tv_nsec= (next->due_us % 1000000) * 1000;
+			pthread_cond_timedwait(&PerlVLC_stats_cond, &PerlVLC_stats_mutex, &ts);
+			continue;
+		}
+		/* Stay on the schedule, unless it fell behind by a whole interval */
+		next->due_us += next->interval_ms * 1000;
+		if (next->due_us <= now) next->due_us= now + next->interval_ms * 1000;
+		PerlVLC_stats_running= next;
+		pthread_mutex_unlock(&PerlVLC_stats_mutex);
+		PerlVLC_stats_take(next, now);
+		pthread_mutex_lock(&PerlVLC_stats_mutex);
+		PerlVLC_stats_running= NULL;
+		pthread_cond_broadcast(&PerlVLC_stats_cond);
+	}
+	return NULL;
+}
+
+/* Unlink the entries matching 'mp' (or if NULL, 'event_pipe') and wait for any of them that
+ * is being sampled.  Caller holds the mutex, and frees the returned list without it.
+ */
+static PerlVLC_stats_entry_t* PerlVLC_stats_unlink(libvlc_media_player_t *mp, int event_pipe) {
+	PerlVLC_stats_entry_t *e, **prev, *dropped= NULL;
+	for (prev= &PerlVLC_stats_entries; (e= *prev); ) {
+		if (mp? e->mp == mp : e->event_pipe == event_pipe) {
+			*prev= e->next;
+			e->next= dropped;
+			dropped= e;
+			while (PerlVLC_stats_running == e)
+				pthread_cond_wait(&PerlVLC_stats_cond, &PerlVLC_stats_mutex);
+		}
+		else prev= &e->next;
+	}
+	return dropped;
+}
+
+/* Start sampling the player, or change its interval */
+void PerlVLC_stats_add(libvlc_media_player_t *mp, unsigned interval_ms, int event_pipe, uint32_t callback_id) {
+	PerlVLC_stats_entry_t *e, *dropped;
+	pthread_condattr_t attr;
+	pthread_t thread;
+	if (event_pipe < 0)
+		croak("Event pipe is not initialized");
+	if (!interval_ms)
+		croak("Interval must be at least 1ms");
+	if (!(e= (PerlVLC_stats_entry_t*) calloc(1, sizeof(*e))))
+		croak("Out of memory");
+	libvlc_media_player_retain(mp);
+	e->mp= mp;
+	e->interval_ms= interval_ms;
+	e->due_us= PerlVLC_monotonic_us() + interval_ms * 1000;
+	e->event_pipe= event_pipe;
+	e->callback_id= callback_id;
+	pthread_once(&PerlVLC_stats_once, PerlVLC_stats_atfork_init);
+	pthread_mutex_lock(&PerlVLC_stats_mutex);
+	if (!PerlVLC_stats_started) {
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&PerlVLC_stats_cond, &attr);
+		pthread_condattr_destroy(&attr);
+		if (pthread_create(&thread, NULL, PerlVLC_stats_thread, NULL) != 0) {
+			pthread_cond_destroy(&PerlVLC_stats_cond);
+			pthread_mutex_unlock(&PerlVLC_stats_mutex);
+			PerlVLC_stats_entry_free(e);
+			croak("Can't start stats sampler thread: %s", strerror(errno));
+		}
+		pthread_detach(thread);
+		PerlVLC_stats_started= true;
+	}
+	dropped= PerlVLC_stats_unlink(mp, -1);
+	e->next= PerlVLC_stats_entries;
+	PerlVLC_stats_entries= e;
+	pthread_cond_broadcast(&PerlVLC_stats_cond);
+	pthread_mutex_unlock(&PerlVLC_stats_mutex);
+	while ((e= dropped)) {
+		dropped= e->next;
+		PerlVLC_stats_entry_free(e);
+	}
+}
+
+/* Stop sampling the player.  Once this returns, no more samples of it will be posted. */
+void PerlVLC_stats_remove(libvlc_media_player_t *mp) {
+	PerlVLC_stats_entry_t *e, *dropped;
+	pthread_mutex_lock(&PerlVLC_stats_mutex);
+	dropped= PerlVLC_stats_unlink(mp, -1);
+	pthread_mutex_unlock(&PerlVLC_stats_mutex);
+	while ((e= dropped)) {
+		dropped= e->next;
+		PerlVLC_stats_entry_free(e);
+	}
+}
+
+/* Stop sampling every player that posts to the instance's event pipe */
+void PerlVLC_stats_cancel(PerlVLC_vlc_t *vlc) {
+	PerlVLC_stats_entry_t *e, *dropped;
+	pthread_mutex_lock(&PerlVLC_stats_mutex);
+	dropped= PerlVLC_stats_unlink(NULL, vlc->event_pipe[1]);
+	pthread_mutex_unlock(&PerlVLC_stats_mutex);
+	while ((e= dropped)) {
+		dropped= e->next;
+		PerlVLC_stats_entry_free(e);
+	}
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Picture stream writer
+ */
+
+/* YUV4MPEG2 colorspace of each chroma that has one, and the order its planes are written in */
+static const struct PerlVLC_y4m_chroma {
+	char chroma[4];
+	const char *tag;
+	unsigned char order[PERLVLC_PICTURE_PLANES];
+} PerlVLC_y4m_chromas[]= {
+	{ "I420", "420jpeg", { 0, 1, 2 } },
+	{ "IYUV", "420jpeg", { 0, 1, 2 } },
+	{ "J420", "420jpeg", { 0, 1, 2 } },
+	{ "YV12", "420jpeg", { 0, 2, 1 } },
+	{ "I422", "422",     { 0, 1, 2 } },
+	{ "J422", "422",     { 0, 1, 2 } },
+	{ "YV16", "422",     { 0, 2, 1 } },
+	{ "I444", "444",     { 0, 1, 2 } },
+	{ "J444", "444",     { 0, 1, 2 } },
+	{ "YV24", "444",     { 0, 2, 1 } },
+	{ "I0AL", "420p10",  { 0, 1, 2 } },
+	{ "I2AL", "422p10",  { 0, 1, 2 } },
+	{ "I4AL", "444p10",  { 0, 1, 2 } },
+	{ "GREY", "mono",    { 0, 1, 2 } },
+	{ "Y800", "mono",    { 0, 1, 2 } },
+};
+
+static const struct PerlVLC_y4m_chroma * PerlVLC_y4m_chroma_find(const char *chroma) {
+	int i;
+	for (i= 0; i < sizeof(PerlVLC_y4m_chromas)/sizeof(*PerlVLC_y4m_chromas); i++)
+		if (memcmp(PerlVLC_y4m_chromas[i].chroma, chroma, 4) == 0)
+			return &PerlVLC_y4m_chromas[i];
+	return NULL;
+}
+
+static void* PerlVLC_writer_thread(void *arg);
+
+PerlVLC_writer_t * PerlVLC_writer_new(int fd, int format, const char *y4m_params,
+	unsigned queue_size, int event_pipe, int callback_id
+) {
+	PerlVLC_writer_t *w;
+	int err;
+	if (format != PERLVLC_WRITER_RAW && format != PERLVLC_WRITER_Y4M)
+		croak("Unknown writer format %d", format);
+	if (strlen(y4m_params) >= sizeof(w->y4m_params))
+		croak("YUV4MPEG2 header parameters too long");
+	if (queue_size && event_pipe < 0)
+		croak("A writer thread needs the event pipe");
+	Newxz(w, 1, PerlVLC_writer_t);
+	w->fd= fd;
+	w->format= format;
+	strcpy(w->y4m_params, y4m_params);
+	w->event_pipe= event_pipe;
+	w->callback_id= callback_id;
+	if (queue_size) {
+		Newxz(w->queue, queue_size, PerlVLC_picture_t*);
+		w->queue_size= queue_size;
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if ((err= pthread_create(&w->thread, NULL, PerlVLC_writer_thread, w))) {
+			pthread_cond_destroy(&w->cond);
+			pthread_mutex_destroy(&w->mutex);
+			Safefree(w->queue);
+			Safefree(w);
+			croak("pthread_create: %s", strerror(err));
+		}
+		w->threaded= true;
+	}
+	return w;
+}
+
+/* writev all of iov[0..n), continuing after partial writes.  Returns 0 or an errno. */
+static int PerlVLC_writev_all(int fd, struct iovec *iov, int n, uint64_t *bytes) {
+	ssize_t got;
+	while (n > 0) {
+		if ((got= writev(fd, iov, n)) < 0) {
+			if (errno == EINTR) continue;
+			return errno;
+		}
+		*bytes += got;
+		while (n > 0 && (size_t) got >= iov->iov_len) {
+			got -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base= (char*) iov->iov_base + got;
+			iov->iov_len -= got;
+		}
+	}
+	return 0;
+}
+
+#define PERLVLC_WRITER_IOV 64
+
+/* Write one picture, skipping it if the stream already failed or has another format.
+ * Runs on the writer thread if there is one, so must not touch perl.
+ */
+static void PerlVLC_writer_frame(PerlVLC_writer_t *w, PerlVLC_picture_t *pic) {
+	const PerlVLC_chroma_layout_t *layout= PerlVLC_chroma_layout_find(pic->format.chroma);
+	const struct PerlVLC_y4m_chroma *y4m= NULL;
+	static const unsigned char in_order[PERLVLC_PICTURE_PLANES]= { 0, 1, 2 };
+	const unsigned char *order= in_order;
+	struct iovec iov[PERLVLC_WRITER_IOV];
+	char header[sizeof(w->y4m_params) + 64];
+	size_t row_bytes;
+	unsigned rows, r;
+	int n= 0, i, p, planes, err= 0;
+	char *row;
+
+	if (w->error) {
+		w->skipped++;
+		return;
+	}
+	if (w->format == PERLVLC_WRITER_Y4M) {
+		if (!(y4m= PerlVLC_y4m_chroma_find(pic->format.chroma))) {
+			w->skipped++;
+			return;
+		}
+		order= y4m->order;
+	}
+	if (!w->started) {
+		w->stream_format= pic->format;
+		w->started= true;
+		if (y4m) {
+			iov[n].iov_base= header;
+			iov[n++].iov_len= snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u %s C%s\n",
+				pic->format.width, pic->format.height, w->y4m_params, y4m->tag);
+		}
+	}
+	else if (memcmp(pic->format.chroma, w->stream_format.chroma, 4)
+		|| pic->format.width != w->stream_format.width
+		|| pic->format.height != w->stream_format.height
+	) {
+		w->skipped++;
+		return;
+	}
+	if (y4m) {
+		iov[n].iov_base= (void*) "FRAME\n";
+		iov[n++].iov_len= 6;
+	}
+	planes= layout? layout->planes : PERLVLC_PICTURE_PLANES;
+	for (i= 0; i < planes && !err; i++) {
+		p= order[i];
+		if (!pic->plane_ptr[p]) continue;
+		/* Only the visible part of each row, unless the layout is unknown */
+		if (layout) {
+			row_bytes= (size_t)((pic->format.width + layout->plane[p].w_div - 1) / layout->plane[p].w_div) * layout->plane[p].bytes;
+			rows= (pic->format.height + layout->plane[p].h_div - 1) / layout->plane[p].h_div;
+			if (row_bytes > pic->format.pitch[p]) row_bytes= pic->format.pitch[p];
+			if (rows > pic->format.lines[p]) rows= pic->format.lines[p];
+		} else {
+			row_bytes= pic->format.pitch[p];
+			rows= pic->format.lines[p];
+		}
+		for (r= 0, row= (char*) pic->plane_ptr[p]; r < rows; r++, row += pic->format.pitch[p]) {
+			/* rows without padding make one contiguous iovec */
+			if (n && (char*) iov[n-1].iov_base + iov[n-1].iov_len == row) {
+				iov[n-1].iov_len += row_bytes;
+				continue;
+			}
+			if (n == PERLVLC_WRITER_IOV) {
+				if ((err= PerlVLC_writev_all(w->fd, iov, n, &w->bytes)))
+					break;
+				n= 0;
+			}
+			iov[n].iov_base= row;
+			iov[n++].iov_len= row_bytes;
+		}
+	}
+	if (!err)
+		err= PerlVLC_writev_all(w->fd, iov, n, &w->bytes);
+	if (err) {
+		w->error= err;
+		w->skipped++;
+	}
+	else
+		w->frames++;
+}
+
+static void* PerlVLC_writer_thread(void *arg) {
+	PerlVLC_writer_t *w= (PerlVLC_writer_t*) arg;
+	PerlVLC_Message_TradePicture_t msg;
+	PerlVLC_picture_t *pic, **grown;
+	bool posted;
+	msg.event_id= PERLVLC_MSG_VIDEO_WRITTEN;
+	msg.callback_id= w->callback_id;
+	pthread_mutex_lock(&w->mutex);
+	while (1) {
+		while (!w->queue_count && !w->stopping)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		/* When stopping, the queue is still written, so that every picture gets its message */
+		if (!w->queue_count)
+			break;
+		pic= w->queue[w->queue_head];
+		posted= !w->unposted_count;
+		pthread_mutex_unlock(&w->mutex);
+		PerlVLC_writer_frame(w, pic);
+		/* Perl might be waiting in PerlVLC_writer_write for room in the queue, and not reading
+		 * the event pipe, so a full pipe must not block this thread.  Once a picture misses
+		 * the pipe, later ones follow it to the unposted list, to stay in order. */
+		msg.picture= pic;
+		if (posted && send(w->event_pipe, &msg, sizeof(msg), MSG_DONTWAIT) != sizeof(msg)) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				PerlVLC_cb_log_error("writer: can't post picture %d: %s", pic->id, strerror(errno));
+			posted= false;
+		}
+		pthread_mutex_lock(&w->mutex);
+		if (!posted) {
+			if (w->unposted_count == w->unposted_size) {
+				grown= (PerlVLC_picture_t**) realloc(w->unposted,
+					(w->unposted_size? w->unposted_size * 2 : w->queue_size) * sizeof(*grown));
+				if (grown) {
+					w->unposted= grown;
+					w->unposted_size= w->unposted_size? w->unposted_size * 2 : w->queue_size;
+				}
+			}
+			if (w->unposted_count < w->unposted_size)
+				w->unposted[w->unposted_count++]= pic;
+			else
+				PerlVLC_cb_log_error("writer: can't return picture %d: out of memory", pic->id);
+		}
+		w->queue_head= (w->queue_head + 1) % w->queue_size;
+		w->queue_count--;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+/* Write the picture now, or queue it for the writer thread, waiting for room if the queue is
+ * full.  Returns false if an earlier write failed, in which case the picture isn't taken.
+ */
+bool PerlVLC_writer_write(PerlVLC_writer_t *w, PerlVLC_picture_t *pic) {
+	if (w->format == PERLVLC_WRITER_Y4M && !PerlVLC_y4m_chroma_find(pic->format.chroma))
+		croak("No YUV4MPEG2 colorspace for chroma %.4s", pic->format.chroma);
+	if (pic->held_by_vlc)
+		croak("Can't write picture %d while it is held by the decoder", pic->id);
+	if (w->error)
+		return false;
+	if (!w->threaded) {
+		PerlVLC_writer_frame(w, pic);
+		return !w->error;
+	}
+	pthread_mutex_lock(&w->mutex);
+	if (w->stopping) {
+		pthread_mutex_unlock(&w->mutex);
+		croak("Writer is closed");
+	}
+	while (w->queue_count == w->queue_size)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	w->queue[(w->queue_head + w->queue_count) % w->queue_size]= pic;
+	w->queue_count++;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	return true;
+}
+
+/* Wait until the writer thread has finished with every queued picture */
+void PerlVLC_writer_wait(PerlVLC_writer_t *w) {
+	if (!w->threaded) return;
+	pthread_mutex_lock(&w->mutex);
+	while (w->queue_count)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/* Take the pictures that were written while the event pipe was full.  The caller frees the
+ * array in *out with free().
+ */
+unsigned PerlVLC_writer_take_unposted(PerlVLC_writer_t *w, PerlVLC_picture_t ***out) {
+	unsigned n;
+	*out= NULL;
+	if (!w->threaded && !w->unposted_count) return 0;
+	if (w->threaded) pthread_mutex_lock(&w->mutex);
+	n= w->unposted_count;
+	if (n) {
+		*out= w->unposted;
+		w->unposted= NULL;
+		w->unposted_count= w->unposted_size= 0;
+	}
+	if (w->threaded) pthread_mutex_unlock(&w->mutex);
+	return n;
+}
+
+/* Write what is queued, then end the writer thread.  The writer is synchronous after this. */
+void PerlVLC_writer_stop(PerlVLC_writer_t *w) {
+	if (!w->threaded) return;
+	pthread_mutex_lock(&w->mutex);
+	w->stopping= true;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	w->threaded= false;
+}
+
+SV * PerlVLC_wrap_writer(PerlVLC_writer_t *w) {
+	SV *self;
+	if (!w) return &PL_sv_undef;
+	self= newRV_noinc((SV*) newHV());
+	sv_bless(self, gv_stashpv("VideoLAN::LibVLC::VideoWriter", GV_ADD));
+	PerlVLC_set_writer_mg(self, w);
+	return self;
+}
+
+int PerlVLC_writer_mg_free(pTHX_ SV *writer_sv, MAGIC *mg) {
+	PerlVLC_writer_t *w= (PerlVLC_writer_t*) mg->mg_ptr;
+	if (!w) return 0;
+	PerlVLC_writer_stop(w);
+	if (w->queue) Safefree(w->queue);
+	free(w->unposted);
+	Safefree(w);
+	return 0;
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Snapshot encoder
+ *
+ * One worker thread, started by the first job, encodes pictures for every instance of the
+ * process, in the order they were submitted.  The perl thread never reads the pixels.
+ */
+
+#define PERLVLC_ENCODE_GREY   0
+#define PERLVLC_ENCODE_RGB    1
+#define PERLVLC_ENCODE_PLANAR 2
+#define PERLVLC_ENCODE_PACKED 3
+
+/* How to get RGB (or grey) out of each chroma the encoder understands.  The meaning of p[]
+ * depends on the kind:
+ *   RGB:    bytes per pixel, offset of R, G, and B
+ *   PLANAR: plane of U, plane of V, bytes per chroma sample, offset of U and V in the sample
+ *   PACKED: offset of Y0, U, Y1, and V in each 4 bytes
+ */
+static const struct PerlVLC_encode_chroma {
+	char chroma[4];
+	unsigned char kind, full_range;
+	unsigned char p[5];
+} PerlVLC_encode_chromas[]= {
+	{ "GREY", PERLVLC_ENCODE_GREY,   1, { 0 } },
+	{ "Y800", PERLVLC_ENCODE_GREY,   1, { 0 } },
+	{ "RV24", PERLVLC_ENCODE_RGB,    1, { 3, 2, 1, 0 } },
+	{ "RV32", PERLVLC_ENCODE_RGB,    1, { 4, 2, 1, 0 } },
+	{ "RGBA", PERLVLC_ENCODE_RGB,    1, { 4, 0, 1, 2 } },
+	{ "RGBX", PERLVLC_ENCODE_RGB,    1, { 4, 0, 1, 2 } },
+	{ "BGRA", PERLVLC_ENCODE_RGB,    1, { 4, 2, 1, 0 } },
+	{ "BGRX", PERLVLC_ENCODE_RGB,    1, { 4, 2, 1, 0 } },
+	{ "ARGB", PERLVLC_ENCODE_RGB,    1, { 4, 1, 2, 3 } },
+	{ "I420", PERLVLC_ENCODE_PLANAR, 0, { 1, 2, 1, 0, 0 } },
+	{ "IYUV", PERLVLC_ENCODE_PLANAR, 0, { 1, 2, 1, 0, 0 } },
+	{ "J420", PERLVLC_ENCODE_PLANAR, 1, { 1, 2, 1, 0, 0 } },
+	{ "YV12", PERLVLC_ENCODE_PLANAR, 0, { 2, 1, 1, 0, 0 } },
+	{ "I422", PERLVLC_ENCODE_PLANAR, 0, { 1, 2, 1, 0, 0 } },
+	{ "J422", PERLVLC_ENCODE_PLANAR, 1, { 1, 2, 1, 0, 0 } },
+	{ "YV16", PERLVLC_ENCODE_PLANAR, 0, { 2, 1, 1, 0, 0 } },
+	{ "I444", PERLVLC_ENCODE_PLANAR, 0, { 1, 2, 1, 0, 0 } },
+	{ "J444", PERLVLC_ENCODE_PLANAR, 1, { 1, 2, 1, 0, 0 } },
+	{ "YV24", PERLVLC_ENCODE_PLANAR, 0, { 2, 1, 1, 0, 0 } },
+	{ "I411", PERLVLC_ENCODE_PLANAR, 0, { 1, 2, 1, 0, 0 } },
+	{ "I410", PERLVLC_ENCODE_PLANAR, 0, { 1, 2, 1, 0, 0 } },
+	{ "YVU9", PERLVLC_ENCODE_PLANAR, 0, { 2, 1, 1, 0, 0 } },
+	{ "NV12", PERLVLC_ENCODE_PLANAR, 0, { 1, 1, 2, 0, 1 } },
+	{ "NV21", PERLVLC_ENCODE_PLANAR, 0, { 1, 1, 2, 1, 0 } },
+	{ "NV16", PERLVLC_ENCODE_PLANAR, 0, { 1, 1, 2, 0, 1 } },
+	{ "NV61", PERLVLC_ENCODE_PLANAR, 0, { 1, 1, 2, 1, 0 } },
+	{ "NV24", PERLVLC_ENCODE_PLANAR, 0, { 1, 1, 2, 0, 1 } },
+	{ "YUY2", PERLVLC_ENCODE_PACKED, 0, { 0, 1, 2, 3 } },
+	{ "YUYV", PERLVLC_ENCODE_PACKED, 0, { 0, 1, 2, 3 } },
+	{ "YVYU", PERLVLC_ENCODE_PACKED, 0, { 0, 3, 2, 1 } },
+	{ "UYVY", PERLVLC_ENCODE_PACKED, 0, { 1, 0, 3, 2 } },
+	{ "VYUY", PERLVLC_ENCODE_PACKED, 0, { 1, 2, 3, 0 } },
+};
+
+static const struct PerlVLC_encode_chroma * PerlVLC_encode_chroma_find(const char *chroma) {
+	int i;
+	for (i= 0; i < sizeof(PerlVLC_encode_chromas)/sizeof(*PerlVLC_encode_chromas); i++)
+		if (memcmp(PerlVLC_encode_chromas[i].chroma, chroma, 4) == 0)
+			return &PerlVLC_encode_chromas[i];
+	return NULL;
+}
+
+bool PerlVLC_encode_chroma_supported(const char *chroma) {
+	return PerlVLC_encode_chroma_find(chroma) != NULL;
+}
+
+static inline unsigned char PerlVLC_clamp_u8(int x) {
+	return x < 0? 0 : x > 255? 255 : x;
+}
+
+/* BT.601, in 8.8 fixed point */
+static inline void PerlVLC_yuv_to_rgb(int y, int u, int v, bool full_range, unsigned char *out) {
+	int c, d= u - 128, e= v - 128;
+	if (full_range) {
+		c= y * 256;
+		out[0]= PerlVLC_clamp_u8((c + 359 * e + 128) >> 8);
+		out[1]= PerlVLC_clamp_u8((c - 88 * d - 183 * e + 128) >> 8);
+		out[2]= PerlVLC_clamp_u8((c + 454 * d + 128) >> 8);
+	} else {
+		c= (y - 16) * 298;
+		out[0]= PerlVLC_clamp_u8((c + 409 * e + 128) >> 8);
+		out[1]= PerlVLC_clamp_u8((c - 100 * d - 208 * e + 128) >> 8);
+		out[2]= PerlVLC_clamp_u8((c + 516 * d + 128) >> 8);
+	}
+}
+
+/* Convert row 'y' of the job's picture to 8-bit grey or RGB in 'out' */
+static void PerlVLC_encode_row(PerlVLC_encode_job_t *job, const struct PerlVLC_encode_chroma *ec,
+	const PerlVLC_chroma_layout_t *layout, unsigned y, unsigned char *out
+) {
+	const PerlVLC_picture_format_t *fmt= &job->pic_format;
+	const unsigned char *row= (const unsigned char*) job->plane_ptr[0] + (size_t) y * fmt->pitch[0];
+	const unsigned char *u_row, *v_row;
+	unsigned x, w= fmt->width, step, w_div;
+	switch (ec->kind) {
+	case PERLVLC_ENCODE_GREY:
+		memcpy(out, row, w);
+		break;
+	case PERLVLC_ENCODE_RGB:
+		step= ec->p[0];
+		for (x= 0; x < w; x++, row += step, out += 3) {
+			out[0]= row[ec->p[1]];
+			out[1]= row[ec->p[2]];
+			out[2]= row[ec->p[3]];
+		}
+		break;
+	case PERLVLC_ENCODE_PLANAR:
+		w_div= layout->plane[1].w_div;
+		step= ec->p[2];
+		u_row= (const unsigned char*) job->plane_ptr[ec->p[0]] + (size_t)(y / layout->plane[1].h_div) * fmt->pitch[ec->p[0]] + ec->p[3];
+		v_row= (const unsigned char*) job->plane_ptr[ec->p[1]] + (size_t)(y / layout->plane[1].h_div) * fmt->pitch[ec->p[1]] + ec->p[4];
+		for (x= 0; x < w; x++, out += 3)
+			PerlVLC_yuv_to_rgb(row[x], u_row[x / w_div * step], v_row[x / w_div * step], ec->full_range, out);
+		break;
+	case PERLVLC_ENCODE_PACKED:
+		for (x= 0; x < w; x++, out += 3)
+			PerlVLC_yuv_to_rgb(row[(x >> 1) * 4 + ((x & 1)? ec->p[2] : ec->p[0])],
+				row[(x >> 1) * 4 + ec->p[1]], row[(x >> 1) * 4 + ec->p[3]], ec->full_range, out);
+		break;
+	}
+}
+
+static void PerlVLC_put_be32(unsigned char *p, uint32_t v) {
+	p[0]= v >> 24; p[1]= v >> 16; p[2]= v >> 8; p[3]= v;
+}
+
+#ifdef PERLVLC_HAVE_ZLIB
+static void PerlVLC_png_chunk(FILE *f, const char *type, const unsigned char *data, size_t len) {
+	unsigned char hdr[8], crc_buf[4];
+	uLong crc;
+	PerlVLC_put_be32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	crc= crc32(0, hdr + 4, 4);
+	if (len) crc= crc32(crc, data, len); /* a NULL buffer would reset it */
+	PerlVLC_put_be32(crc_buf, crc);
+	fwrite(hdr, 1, 8, f);
+	if (len) fwrite(data, 1, len, f);
+	fwrite(crc_buf, 1, 4, f);
+}
+
+#define PERLVLC_PNG_IDAT_SIZE 65536
+
+/* PNG with the "Sub" filter on every row, which is cheap and does well on video frames.
+ * Returns 0 or an errno.
+ */
+static int PerlVLC_encode_png(PerlVLC_encode_job_t *job, const struct PerlVLC_encode_chroma *ec,
+	const PerlVLC_chroma_layout_t *layout, FILE *f
+) {
+	static const unsigned char signature[8]= { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	unsigned char ihdr[13], *raw, *filtered, *idat;
+	unsigned channels= ec->kind == PERLVLC_ENCODE_GREY? 1 : 3;
+	size_t row_bytes= (size_t) job->pic_format.width * channels, i;
+	unsigned y;
+	z_stream zs;
+	int ret= 0, zret;
+	raw= (unsigned char*) malloc(row_bytes);
+	filtered= (unsigned char*) malloc(row_bytes + 1);
+	idat= (unsigned char*) malloc(PERLVLC_PNG_IDAT_SIZE);
+	memset(&zs, 0, sizeof(zs));
+	if (!raw || !filtered || !idat || deflateInit(&zs, job->level) != Z_OK) {
+		free(raw); free(filtered); free(idat);
+		return ENOMEM;
+	}
+	fwrite(signature, 1, 8, f);
+	PerlVLC_put_be32(ihdr, job->pic_format.width);
+	PerlVLC_put_be32(ihdr + 4, job->pic_format.height);
+	ihdr[8]= 8;                      /* bit depth */
+	ihdr[9]= channels == 1? 0 : 2;   /* grey or RGB */
+	ihdr[10]= ihdr[11]= ihdr[12]= 0; /* deflate, adaptive filtering, not interlaced */
+	PerlVLC_png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+	zs.next_out= idat;
+	zs.avail_out= PERLVLC_PNG_IDAT_SIZE;
+	for (y= 0; y <= job->pic_format.height; y++) {
+		if (y < job->pic_format.height) {
+			PerlVLC_encode_row(job, ec, layout, y, raw);
+			filtered[0]= 1;
+			for (i= 0; i < channels; i++)
+				filtered[i+1]= raw[i];
+			for (; i < row_bytes; i++)
+				filtered[i+1]= raw[i] - raw[i - channels];
+			zs.next_in= filtered;
+			zs.avail_in= row_bytes + 1;
+		}
+		do {
+			zret= deflate(&zs, y < job->pic_format.height? Z_NO_FLUSH : Z_FINISH);
+			if (zret == Z_STREAM_ERROR) {
+				ret= EINVAL;
+				goto done;
+			}
+			if (!zs.avail_out || zret == Z_STREAM_END) {
+				PerlVLC_png_chunk(f, "IDAT", idat, PERLVLC_PNG_IDAT_SIZE - zs.avail_out);
+				zs.next_out= idat;
+				zs.avail_out= PERLVLC_PNG_IDAT_SIZE;
+			}
+		} while (zs.avail_in || (y == job->pic_format.height && zret != Z_STREAM_END));
+	}
+	PerlVLC_png_chunk(f, "IEND", NULL, 0);
+done:
+	deflateEnd(&zs);
+	free(raw); free(filtered); free(idat);
+	return ret;
+}
+#endif
+
+/* Binary PPM (P6), or PGM (P5) for grey chromas */
+static int PerlVLC_encode_ppm(PerlVLC_encode_job_t *job, const struct PerlVLC_encode_chroma *ec,
+	const PerlVLC_chroma_layout_t *layout, FILE *f
+) {
+	unsigned channels= ec->kind == PERLVLC_ENCODE_GREY? 1 : 3, y;
+	size_t row_bytes= (size_t) job->pic_format.width * channels;
+	unsigned char *row= (unsigned char*) malloc(row_bytes);
+	if (!row)
+		return ENOMEM;
+	fprintf(f, "P%c\n%u %u\n255\n", channels == 1? '5' : '6', job->pic_format.width, job->pic_format.height);
+	for (y= 0; y < job->pic_format.height; y++) {
+		PerlVLC_encode_row(job, ec, layout, y, row);
+		fwrite(row, 1, row_bytes, f);
+	}
+	free(row);
+	return 0;
+}
+
+/* Encode to "path.tmp" and rename it into place, so nobody sees a partial file.
+ * Returns 0 or an errno, and the size of the file in *bytes.
+ */
+static int PerlVLC_encode_file(PerlVLC_encode_job_t *job, uint64_t *bytes) {
+	const struct PerlVLC_encode_chroma *ec= PerlVLC_encode_chroma_find(job->pic_format.chroma);
+	const PerlVLC_chroma_layout_t *layout= PerlVLC_chroma_layout_find(job->pic_format.chroma);
+	size_t len= strlen(job->path);
+	char *tmp;
+	FILE *f;
+	int err;
+	*bytes= 0;
+	if (!ec || !layout)
+		return EINVAL;
+	if (!(tmp= (char*) malloc(len + 5)))
+		return ENOMEM;
+	memcpy(tmp, job->path, len);
+	memcpy(tmp + len, ".tmp", 5);
+	if (!(f= fopen(tmp, "wb"))) {
+		err= errno;
+		free(tmp);
+		return err;
+	}
+#ifdef PERLVLC_HAVE_ZLIB
+	err= job->format == PERLVLC_ENCODE_PNG? PerlVLC_encode_png(job, ec, layout, f)
+		: PerlVLC_encode_ppm(job, ec, layout, f);
+#else
+	err= job->format == PERLVLC_ENCODE_PNG? ENOTSUP : PerlVLC_encode_ppm(job, ec, layout, f);
+#endif
+	if (!err && fflush(f) != 0) err= errno;
+	if (!err && ferror(f)) err= EIO;
+	if (!err) *bytes= ftell(f);
+	if (fclose(f) != 0 && !err) err= errno;
+	if (!err && rename(tmp, job->path) != 0) err= errno;
+	if (err) unlink(tmp);
+	free(tmp);
+	return err;
+}
+
+static pthread_mutex_t PerlVLC_encoder_mutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PerlVLC_encoder_cond= PTHREAD_COND_INITIALIZER;
+static PerlVLC_encode_job_t *PerlVLC_encoder_head= NULL, *PerlVLC_encoder_tail= NULL,
+	*PerlVLC_encoder_running= NULL;
+static bool PerlVLC_encoder_started= false;
+static pthread_once_t PerlVLC_encoder_once= PTHREAD_ONCE_INIT;
+
+/* The encoder thread doesn't survive fork.  Hold the lock across it so the queue is in a
+ * known state, and let the child start over with its own thread.  Jobs of the parent are
+ * forgotten in the child, since their pictures and event pipes belong to the parent.
+ */
+static void PerlVLC_encoder_atfork_prepare(void) { pthread_mutex_lock(&PerlVLC_encoder_mutex); }
+static void PerlVLC_encoder_atfork_parent(void) { pthread_mutex_unlock(&PerlVLC_encoder_mutex); }
+static void PerlVLC_encoder_atfork_child(void) {
+	PerlVLC_encoder_head= PerlVLC_encoder_tail= PerlVLC_encoder_running= NULL;
+	PerlVLC_encoder_started= false;
+	pthread_mutex_init(&PerlVLC_encoder_mutex, NULL);
+	pthread_cond_init(&PerlVLC_encoder_cond, NULL);
+}
+static void PerlVLC_encoder_atfork_init(void) {
+	pthread_atfork(PerlVLC_encoder_atfork_prepare, PerlVLC_encoder_atfork_parent, PerlVLC_encoder_atfork_child);
+}
+
+static void PerlVLC_encode_job_free(PerlVLC_encode_job_t *job) {
+	if (job->copy) free(job->copy);
+	free(job);
+}
+
+/* A cancelled job (event_pipe < 0) belongs to PerlVLC_encode_cancel once it stops running */
+static void* PerlVLC_encoder_thread(void *arg) {
+	PerlVLC_encode_job_t *job;
+	PerlVLC_Message_Encoded_t msg;
+	struct timespec retry;
+	uint64_t bytes;
+	ssize_t sent;
+	int err, fd;
+	pthread_mutex_lock(&PerlVLC_encoder_mutex);
+	while (1) {
+		while (!PerlVLC_encoder_head)
+			pthread_cond_wait(&PerlVLC_encoder_cond, &PerlVLC_encoder_mutex);
+		job= PerlVLC_encoder_head;
+		if (!(PerlVLC_encoder_head= job->next))
+			PerlVLC_encoder_tail= NULL;
+		PerlVLC_encoder_running= job;
+		pthread_mutex_unlock(&PerlVLC_encoder_mutex);
+		err= PerlVLC_encode_file(job, &bytes);
+		msg.event_id= PERLVLC_MSG_PICTURE_ENCODED;
+		msg.callback_id= job->callback_id;
+		msg.picture= job->pic;
+		msg.job_id= job->job_id;
+		msg.error= err;
+		msg.bytes= bytes;
+		pthread_mutex_lock(&PerlVLC_encoder_mutex);
+		/* Perl is the only reader of the pipe, and might be in PerlVLC_encode_submit or
+		 * PerlVLC_encode_cancel waiting for this mutex, so don't send while holding it, and
+		 * don't block on a full pipe: retry until it has room or the job is cancelled. */
+		while ((fd= job->event_pipe) >= 0) {
+			pthread_mutex_unlock(&PerlVLC_encoder_mutex);
+			sent= send(fd, &msg, sizeof(msg), MSG_DONTWAIT);
+			err= errno;
+			pthread_mutex_lock(&PerlVLC_encoder_mutex);
+			if (sent == sizeof(msg)) {
+				/* the message carries the picture reference, if any */
+				job->pic= NULL;
+				break;
+			}
+			if (err != EAGAIN && err != EWOULDBLOCK) {
+				PerlVLC_cb_log_error("encoder: can't post job %u: %s", job->job_id, strerror(err));
+				break;
+			}
+			clock_gettime(CLOCK_REALTIME, &retry);
+			if ((retry.tv_nsec += 2000000) >= 1000000000) { retry.tv_sec++; retry.tv_nsec -= 1000000000; }
+			pthread_cond_timedwait(&PerlVLC_encoder_cond, &PerlVLC_encoder_mutex, &retry);
+		}
+		PerlVLC_encoder_running= NULL;
+		if (job->event_pipe >= 0) {
+			/* not posted; the picture goes home another way */
+			if (job->pic) PerlVLC_picture_release(job->pic);
+			PerlVLC_encode_job_free(job);
+		}
+		pthread_cond_broadcast(&PerlVLC_encoder_cond);
+	}
+	return NULL;
+}
+
+/* Queue a job for the encoder thread.  Without 'copy', the job holds a reference to the
+ * picture, and it must not be given to the decoder until the message brings it back.
+ */
+void PerlVLC_encode_submit(PerlVLC_picture_t *pic, int format, int level, const char *path,
+	bool copy, int event_pipe, uint32_t callback_id, uint32_t job_id
+) {
+	PerlVLC_encode_job_t *job;
+	size_t len, total= 0, ofs;
+	pthread_t thread;
+	int i;
+	if (!PerlVLC_encode_chroma_supported(pic->format.chroma))
+		croak("Can't encode chroma %.4s", pic->format.chroma);
+#ifndef PERLVLC_HAVE_ZLIB
+	if (format == PERLVLC_ENCODE_PNG)
+		croak("PNG encoding needs zlib, which was not found when this module was built");
+#endif
+	if (pic->held_by_vlc)
+		croak("Can't encode picture %d while it is held by the decoder", pic->id);
+	if (event_pipe < 0)
+		croak("Event pipe is not initialized");
+	len= strlen(path);
+	if (!(job= (PerlVLC_encode_job_t*) calloc(1, sizeof(PerlVLC_encode_job_t) + len + 1)))
+		croak("Out of memory");
+	memcpy(job->path, path, len + 1);
+	job->format= format;
+	job->level= level;
+	job->pic_format= pic->format;
+	job->event_pipe= event_pipe;
+	job->callback_id= callback_id;
+	job->job_id= job_id;
+	if (copy) {
+		for (i= 0; i < PERLVLC_PICTURE_PLANES; i++)
+			if (pic->plane_ptr[i])
+				total += (size_t) pic->format.pitch[i] * pic->format.lines[i];
+		if (!(job->copy= malloc(total ? total : 1))) {
+			free(job);
+			croak("Out of memory");
+		}
+		for (i= 0, ofs= 0; i < PERLVLC_PICTURE_PLANES; i++) {
+			if (!pic->plane_ptr[i]) continue;
+			job->plane_ptr[i]= (char*) job->copy + ofs;
+			memcpy(job->plane_ptr[i], pic->plane_ptr[i], (size_t) pic->format.pitch[i] * pic->format.lines[i]);
+			ofs += (size_t) pic->format.pitch[i] * pic->format.lines[i];
+		}
+	} else {
+		/* perl could move or free those buffers while the encoder reads them */
+		if (pic->owner || pic->plane_buffer_sv[0] || pic->plane_buffer_sv[1] || pic->plane_buffer_sv[2]) {
+			free(job);
+			croak("Can't encode picture %d without 'copy'; its planes belong to perl scalars", pic->id);
+		}
+		for (i= 0; i < PERLVLC_PICTURE_PLANES; i++)
+			job->plane_ptr[i]= pic->plane_ptr[i];
+		job->pic= pic;
+		__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
+	}
+	pthread_once(&PerlVLC_encoder_once, PerlVLC_encoder_atfork_init);
+	pthread_mutex_lock(&PerlVLC_encoder_mutex);
+	if (!PerlVLC_encoder_started) {
+		if (pthread_create(&thread, NULL, PerlVLC_encoder_thread, NULL) != 0) {
+			pthread_mutex_unlock(&PerlVLC_encoder_mutex);
+			if (job->pic) PerlVLC_picture_release(job->pic);
+			PerlVLC_encode_job_free(job);
+			croak("Can't start encoder thread: %s", strerror(errno));
+		}
+		pthread_detach(thread);
+		PerlVLC_encoder_started= true;
+	}
+	if (PerlVLC_encoder_tail) PerlVLC_encoder_tail->next= job;
+	else PerlVLC_encoder_head= job;
+	PerlVLC_encoder_tail= job;
+	pthread_cond_broadcast(&PerlVLC_encoder_cond);
+	pthread_mutex_unlock(&PerlVLC_encoder_mutex);
+}
+
+/* Release the picture reference carried by a message that will never be dispatched */
+static void PerlVLC_message_drop_picture(const char *buf, ssize_t len) {
+	const PerlVLC_Message_t *msg= (const PerlVLC_Message_t*) buf;
+	PerlVLC_picture_t *pic;
+	if (len < sizeof(PerlVLC_Message_t))
+		return;
+	if (msg->event_id == PERLVLC_MSG_PICTURE_ENCODED && len >= sizeof(PerlVLC_Message_Encoded_t)) {
+		if ((pic= ((const PerlVLC_Message_Encoded_t*) buf)->picture))
+			PerlVLC_picture_release(pic);
+	}
+	/* A returned picture has no references left.  Take one, to drop it like any other,
+	 * without sending it back to this pipe. */
+	else if (msg->event_id == PERLVLC_MSG_PICTURE_RELEASED && len >= sizeof(PerlVLC_Message_TradePicture_t)) {
+		pic= ((const PerlVLC_Message_TradePicture_t*) buf)->picture;
+		pic->return_fd= -1;
+		__atomic_add_fetch(&pic->refs, 1, __ATOMIC_RELAXED);
+		PerlVLC_picture_release(pic);
+	}
+}
+
+/* Drop every job that would report to the instance's event pipe, waiting for the one in
+ * progress, if any.  Called before the pipe closes.  Held pictures are released, including
+ * those of messages that were posted but not dispatched, whether still in the pipe or
+ * already read into the instance's _event_queue (this is their home thread).
+ */
+void PerlVLC_encode_cancel(PerlVLC_vlc_t *vlc, HV *self) {
+	PerlVLC_encode_job_t *job, **prev, *dropped= NULL, *running= NULL;
+	char buf[PERLVLC_MSG_BUFFER_SIZE];
+	const char *queued;
+	SV **item, *msg_sv;
+	AV *queues, *q;
+	STRLEN len;
+	ssize_t got;
+	int i;
+	pthread_mutex_lock(&PerlVLC_encoder_mutex);
+	for (prev= &PerlVLC_encoder_head; (job= *prev); ) {
+		if (job->event_pipe == vlc->event_pipe[1]) {
+			*prev= job->next;
+			job->next= dropped;
+			dropped= job;
+		}
+		else prev= &job->next;
+	}
+	for (PerlVLC_encoder_tail= PerlVLC_encoder_head; PerlVLC_encoder_tail && PerlVLC_encoder_tail->next; )
+		PerlVLC_encoder_tail= PerlVLC_encoder_tail->next;
+	if (PerlVLC_encoder_running && PerlVLC_encoder_running->event_pipe == vlc->event_pipe[1]) {
+		running= PerlVLC_encoder_running;
+		running->event_pipe= -1;
+		pthread_cond_broadcast(&PerlVLC_encoder_cond);
+		while (PerlVLC_encoder_running == running)
+			pthread_cond_wait(&PerlVLC_encoder_cond, &PerlVLC_encoder_mutex);
+		running->next= dropped;
+		dropped= running;
+	}
+	pthread_mutex_unlock(&PerlVLC_encoder_mutex);
+	while ((job= dropped)) {
+		dropped= job->next;
+		if (job->pic) PerlVLC_picture_release(job->pic);
+		PerlVLC_encode_job_free(job);
+	}
+	while ((got= recv(vlc->event_pipe[0], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+		PerlVLC_message_drop_picture(buf, got);
+	if (self && (item= hv_fetchs(self, "_event_queue", 0)) && SvROK(*item) && SvTYPE(SvRV(*item)) == SVt_PVAV) {
+		queues= (AV*) SvRV(*item);
+		for (i= 0; i <= av_len(queues); i++) {
+			if (!(item= av_fetch(queues, i, 0)) || !SvROK(*item) || SvTYPE(SvRV(*item)) != SVt_PVAV)
+				continue;
+			q= (AV*) SvRV(*item);
+			while ((msg_sv= av_shift(q)) != &PL_sv_undef) {
+				queued= SvPV(msg_sv, len);
+				PerlVLC_message_drop_picture(queued, len);
+				SvREFCNT_dec(msg_sv);
+			}
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------------------------
+ * Set up the vtable structs for applying magic
+ */
+
+/* VLC objects other than pictures stay with the thread that made them.  Croaking here would
+ * make every threads->create die while an instance exists, so a clone in a new iThread is
+ * left empty and marked, and PerlVLC_get_mg croaks when it is used.  Destroying it does
+ * nothing.
+ */
+static int PerlVLC_mg_nodup(pTHX_ MAGIC *mg, CLONE_PARAMS *param) {
+	mg->mg_ptr= NULL;
+	mg->mg_private= PERLVLC_MG_CLONED;
+	return 0;
+}
+#ifdef MGf_LOCAL
+static int PerlVLC_mg_nolocal(pTHX_ SV *var, MAGIC* mg) {
+	croak("Can't share VLC objects across perl iThreads");
+	return 0;
+}
+#endif
+
+MGVTBL PerlVLC_instance_mg_vtbl= {
+	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
+	PerlVLC_instance_mg_free,
+	0, PerlVLC_mg_nodup
+#ifdef MGf_LOCAL
+	, PerlVLC_mg_nolocal
+#endif
+};
+MGVTBL PerlVLC_media_mg_vtbl= {
+	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
+	PerlVLC_media_mg_free,
+	0, PerlVLC_mg_nodup
+#ifdef MGf_LOCAL
 	, PerlVLC_mg_nolocal
 #endif
 };
@@ -961,6 +4626,30 @@ MGVTBL PerlVLC_media_player_mg_vtbl= {
 MGVTBL PerlVLC_picture_mg_vtbl= {
 	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
 	PerlVLC_picture_mg_free,
+	0, PerlVLC_picture_mg_dup
+#ifdef MGf_LOCAL
+	, PerlVLC_mg_nolocal
+#endif
+};
+MGVTBL PerlVLC_track_list_mg_vtbl= {
+	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
+	PerlVLC_track_list_mg_free,
+	0, PerlVLC_mg_nodup
+#ifdef MGf_LOCAL
+	, PerlVLC_mg_nolocal
+#endif
+};
+MGVTBL PerlVLC_slab_mg_vtbl= {
+	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
+	PerlVLC_slab_mg_free,
+	0, PerlVLC_mg_nodup
+#ifdef MGf_LOCAL
+	, PerlVLC_mg_nolocal
+#endif
+};
+MGVTBL PerlVLC_writer_mg_vtbl= {
+	0, /* get */ 0, /* write */ 0, /* length */ 0, /* clear */
+	PerlVLC_writer_mg_free,
 	0, PerlVLC_mg_nodup
 #ifdef MGf_LOCAL
 	, PerlVLC_mg_nolocal
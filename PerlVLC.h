@@ -1,4 +1,8 @@
 #include <vlc/vlc.h>
+#include <pthread.h>
+#ifdef PERLVLC_FAKE_LIBVLC
+#include "FakeVLC.h"
+#endif
 
 /* Wrapper around VLC instance.  It also holds the event pipe handles, and details about
  * logging and anything else of instance-wide nature.
@@ -7,6 +11,9 @@ typedef struct PerlVLC_vlc {
 	libvlc_instance_t *instance;
 	int event_pipe[2];
 	int log_level, log_callback_id;
+	unsigned long log_dropped;    // log messages discarded because the backlog was full
+	int record_fd;                // if >= 0, messages read from the event pipe are copied here
+	uint64_t record_last_us;      // time the previous message was recorded
 	int log_module:1, log_file:1, log_line:1, log_name:1, log_header:1, log_objid:1;
 } PerlVLC_vlc_t;
 
@@ -29,9 +36,41 @@ typedef struct PerlVLC_Message PerlVLC_Message_t;
 #define PERLVLC_MSG_VIDEO_DISPLAY_EVENT 5
 #define PERLVLC_MSG_VIDEO_FORMAT_EVENT  6
 #define PERLVLC_MSG_VIDEO_CLEANUP_EVENT 7
-#define PERLVLC_MSG_EVENT_MAX           7
+#define PERLVLC_MSG_MEDIA_STREAM_LOW    8
+#define PERLVLC_MSG_AUDIO_LOUDNESS_EVENT 9
+#define PERLVLC_MSG_PICTURE_RELEASED    10
+#define PERLVLC_MSG_VIDEO_WRITTEN       11
+#define PERLVLC_MSG_PICTURE_ENCODED     12
+#define PERLVLC_MSG_MEDIA_STATS         13
+#define PERLVLC_MSG_VIDEO_FORMAT_ANSWERED 14
+#define PERLVLC_MSG_EVENT_MAX           14
 SV* PerlVLC_inflate_message(void *buffer, int msglen);
 
+/* Messages are dispatched in order of these classes, so that a decoder thread blocked on a
+ * reply never waits behind a burst of log messages.
+ */
+#define PERLVLC_PRIORITY_DECODER 0 // format, cleanup, lock: a decoder thread is waiting on perl
+#define PERLVLC_PRIORITY_PICTURE 1 // display, unlock, returned pictures
+#define PERLVLC_PRIORITY_EVENT   2 // everything else
+#define PERLVLC_PRIORITY_LOG     3
+#define PERLVLC_PRIORITY_CLASSES 4
+extern int PerlVLC_message_priority(const void *buffer, int msglen);
+extern int PerlVLC_recv_prioritized(PerlVLC_vlc_t *vlc, AV *queues, int max, int log_limit);
+
+/* A recording of the event pipe is a header of the magic string, sizeof(void*) and
+ * PERLVLC_MSG_BUFFER_SIZE (as uint32), then each message as read, prefixed by this struct.
+ * Everything is in native byte order; it is meant to be replayed on the same machine.
+ */
+#define PERLVLC_RECORD_MAGIC "PVLCMSG1"
+#define PERLVLC_RECORD_HEADER_SIZE 16
+typedef struct PerlVLC_record_header {
+	uint32_t delta_us;  // microseconds since the previous message
+	uint32_t len;
+} PerlVLC_record_header_t;
+extern bool PerlVLC_record_start(PerlVLC_vlc_t *vlc, int fd);
+extern void PerlVLC_record_message(PerlVLC_vlc_t *vlc, const void *buffer, int msglen);
+extern void PerlVLC_message_rewrite(void *buffer, int msglen, int callback_id, void *picture);
+
 /* These are exposed so that PerlVLC_get_mg and PerlVLC_set_mg can be generic and not need
  * a pair of functions for each type of object.
  */
@@ -39,7 +78,11 @@ extern MGVTBL PerlVLC_instance_mg_vtbl;
 extern MGVTBL PerlVLC_media_mg_vtbl;
 extern MGVTBL PerlVLC_media_player_mg_vtbl;
 extern MGVTBL PerlVLC_picture_mg_vtbl;
+extern MGVTBL PerlVLC_track_list_mg_vtbl;
+extern MGVTBL PerlVLC_slab_mg_vtbl;
+extern MGVTBL PerlVLC_writer_mg_vtbl;
 extern void* PerlVLC_get_mg(SV *obj, MGVTBL *mg_vtbl);
+extern bool PerlVLC_is_clone(SV *obj, MGVTBL *mg_vtbl);
 
 #define PERLVLC_PICTURE_PLANES 3
 typedef struct PerlVLC_picture_format {
@@ -51,6 +94,19 @@ typedef struct PerlVLC_picture_format {
 
 extern void PerlVLC_picture_format_init_from_hv(PerlVLC_picture_format_t *format, HV *hv);
 
+/* Table entry describing the planes of a chroma */
+typedef struct PerlVLC_chroma_layout {
+	char chroma[4];
+	int planes;
+	struct {
+		unsigned char bytes;        // bytes per sample
+		unsigned char w_div, h_div; // pixels per sample horizontally and vertically
+	} plane[PERLVLC_PICTURE_PLANES];
+} PerlVLC_chroma_layout_t;
+
+extern const PerlVLC_chroma_layout_t* PerlVLC_chroma_layout_find(const char *chroma);
+extern int PerlVLC_picture_format_fill_layout(PerlVLC_picture_format_t *format);
+
 typedef struct PerlVLC_picture {
 	int id;                 // user-supplied ID to help track picture
 	HV *self_hv;            // Picture objects are paired with an HV
@@ -58,13 +114,38 @@ typedef struct PerlVLC_picture {
 	int trace_destruction;  // whether to log the destruction of this object
 	PerlVLC_picture_format_t format; // to identify layout of picture
 	
-	// Plane data is either a scalar-ref, or a directly allocated buffer.  The scalar-refs are
-	// hopefully aligned, but we don't adjust the pointers.  The plane[] pointers are direct
-	// result of allocation, and we *do* align those before giving to VLC.
-	// Either plane[i] OR plane_buffer_sv[i] should be set, and not all planes need to be set.
-	// likewise, pitch and lines for unused planes can be 0.
+	// Plane data is either a scalar-ref, a directly allocated buffer, or a foreign address.
+	// The scalar-refs are hopefully aligned, but we don't adjust the pointers.  The plane[]
+	// pointers are direct result of allocation, and we *do* align those before giving to VLC.
+	// At most one of plane[i] or plane_buffer_sv[i] is set; neither is set for foreign memory.
+	// Not all planes need to be set, and pitch and lines for unused planes can be 0.
 	void *plane[PERLVLC_PICTURE_PLANES];
 	SV *plane_buffer_sv[PERLVLC_PICTURE_PLANES];
+	// The address VLC decodes into, fixed when the picture is created so that the video
+	// thread never has to look at a perl scalar.
+	void *plane_ptr[PERLVLC_PICTURE_PLANES];
+	SV *owner;              // keeps foreign plane memory alive, if given
+	int alloc;              // PERLVLC_ALLOC_* used for plane[]
+	bool native;            // allocated by the video thread with calloc, for a format policy
+	// Each perl object for this picture, in any iThread, holds one of 'refs', as does each
+	// unclaimed handle from PerlVLC_picture_share.  Only 'home' (the interpreter that created
+	// the picture) may touch self_hv or the perl scalars above.
+	int refs, handles;
+	void *home;
+	// Event pipe and callback of the player the picture was last queued to.  If the last
+	// reference is dropped in another thread, the picture is sent back there.  A picture
+	// never queued waits on a list of orphans for 'home' to free it.
+	int return_fd, return_callback_id;
+	struct PerlVLC_picture *next_orphan;
+	// Bytes of all planes, and of the planes allocated here, as counted in PerlVLC_budget
+	size_t bytes, alloc_bytes;
+	int priority;           // negative priorities can't use the reserve of the budget
+	// Stamped by the video thread each time VLC takes the picture: the player's count of
+	// locks (so a gap means frames went to the scratch buffer or were dropped), the
+	// monotonic time of lock, unlock, and display (0 until reached), and the cached clock's
+	// media time at display (-1 if unknown).
+	uint64_t sequence, lock_us, unlock_us, display_us;
+	int64_t media_time_ms;
 } PerlVLC_picture_t;
 
 /* Picture planes are most efficient when aligned.  VLC docs recommend 32 bytes,
@@ -82,16 +163,102 @@ typedef struct PerlVLC_picture {
 #define PerlVLC_set_picture_mg(obj, ptr)     PerlVLC_set_mg(obj, &PerlVLC_picture_mg_vtbl, (void*) ptr)
 #define PerlVLC_get_picture_mg(obj)          ((PerlVLC_picture_t*) PerlVLC_get_mg(obj, &PerlVLC_picture_mg_vtbl))
 extern PerlVLC_picture_t* PerlVLC_picture_new_from_hash(SV *args);
+
+/* Backends for the planes that pictures allocate themselves.  The low bits pick the
+ * backend and the high bits are modifiers that apply to any of them.
+ */
+#define PERLVLC_ALLOC_NEWX         0    // Newx with slack for alignment
+#define PERLVLC_ALLOC_MEMALIGN     1    // posix_memalign to PERLVLC_PLANE_PITCH_MUL
+#define PERLVLC_ALLOC_MMAP         2    // anonymous mmap
+#define PERLVLC_ALLOC_HUGEPAGE     3    // anonymous mmap aligned to 2MB, with MADV_HUGEPAGE
+#define PERLVLC_ALLOC_BACKENDS     4
+#define PERLVLC_ALLOC_BACKEND_MASK 0x0F
+#define PERLVLC_ALLOC_PREFAULT     0x10 // touch every page while allocating
+#define PERLVLC_ALLOC_MLOCK        0x20 // lock the pages into RAM
+#define PERLVLC_HUGEPAGE_SIZE      (2*1024*1024)
+
+typedef struct PerlVLC_alloc_stats {
+	unsigned long allocs, frees;
+	unsigned long failures;        // mlock or madvise refused; the allocation still succeeded
+	unsigned long faults;          // page faults taken inside the allocator (i.e. prefaulting)
+	size_t bytes_live, bytes_peak;
+} PerlVLC_alloc_stats_t;
+
+extern PerlVLC_alloc_stats_t PerlVLC_alloc_stats[PERLVLC_ALLOC_BACKENDS];
+extern const char *PerlVLC_alloc_names[PERLVLC_ALLOC_BACKENDS];
+extern int PerlVLC_plane_alloc_default; // process-wide, shared by all iThreads; access atomically
+extern int PerlVLC_plane_alloc_from_hv(HV *hv, int alloc);
+extern void* PerlVLC_plane_alloc(int alloc, size_t len, void **base);
+extern void PerlVLC_plane_free(int alloc, void *base, size_t len);
 extern SV* PerlVLC_wrap_picture(PerlVLC_picture_t *pic);
 extern void PerlVLC_picture_destroy(PerlVLC_picture_t *pic);
+extern void PerlVLC_picture_reap_orphans();
+extern SV * PerlVLC_picture_plane_scalar(PerlVLC_picture_t *pic, int idx);
+
+/* Process-wide accounting of picture planes.  Only planes allocated by pictures count against
+ * the limit; pictures on supplied memory are counted but never refused.
+ */
+typedef struct PerlVLC_budget {
+	size_t limit;                // 0 for no limit
+	size_t reserve;              // part of the limit that pictures of negative priority can't use
+	unsigned wait_ms;            // how long creating a picture may wait for room
+	size_t bytes, bytes_peak;    // planes of every picture
+	size_t alloc_bytes;          // planes allocated by pictures
+	size_t vlc_bytes;            // planes of pictures held by the video thread
+	unsigned long pictures, refused, waits;
+} PerlVLC_budget_t;
+
+extern PerlVLC_budget_t PerlVLC_budget;
+extern void PerlVLC_budget_set(size_t limit, size_t reserve, unsigned wait_ms);
+extern int PerlVLC_budget_fit(size_t bytes, int priority, int want);
+extern void PerlVLC_budget_reset_stats();
+extern void PerlVLC_picture_set_held(PerlVLC_picture_t *pic, int held);
+extern UV PerlVLC_picture_share(PerlVLC_picture_t *pic);
+extern SV* PerlVLC_picture_from_handle(UV handle);
+
+/* Snapshot of the playback clock, kept up to date from the player's events so that reading
+ * it never takes libvlc's locks.  Writers (the libvlc event thread, and perl after a seek)
+ * hold 'seq' odd while they change the rest, and readers retry if it was odd or changed.
+ */
+typedef struct PerlVLC_clock {
+	uint32_t seq;
+	int state;            // libvlc_state_t
+	int64_t time_ms;      // as of base_us, or -1 if unknown
+	int64_t length_ms;    // 0 if unknown
+	double position;      // as of base_us, or -1 if unknown
+	double rate;
+	uint64_t base_us;     // monotonic time when time_ms was last set
+	unsigned long events; // number of events applied
+} PerlVLC_clock_t;
+
+/* A format policy lets the video thread answer the format callback itself, allocating the
+ * pictures, instead of waiting for perl.  Perl adopts the pictures afterward.
+ */
+#define PERLVLC_POLICY_CHROMAS  8
+#define PERLVLC_POLICY_PICTURES 32
+typedef struct PerlVLC_format_policy {
+	bool enabled;
+	int chroma_count;
+	char chroma[PERLVLC_POLICY_CHROMAS][4]; // in order of preference; the native one wins if listed
+	unsigned max_width, max_height;         // 0 for no limit
+	unsigned align;                         // pitch multiple, 0 for PERLVLC_PLANE_PITCH_MUL
+	unsigned alloc_count;
+	int alloc, priority;                    // plane allocator and budget priority of the pictures
+} PerlVLC_format_policy_t;
+
+extern void PerlVLC_format_to_hv(HV *ret, const PerlVLC_picture_format_t *format);
+extern void PerlVLC_format_policy_from_hv(PerlVLC_format_policy_t *policy, HV *hv);
+extern bool PerlVLC_format_policy_apply(const PerlVLC_format_policy_t *policy, PerlVLC_picture_format_t *format);
 
 /* The player struct holds a reference to a vlc mediaplayer object,
  * and tracks the state of things the perl library is doing to it.
  */
+#define PERLVLC_SCRATCH_SLOTS 8
 typedef struct PerlVLC_player {
 	libvlc_media_player_t *player;
 	bool video_cb_installed;
 	bool video_format_cb_installed;
+	bool unlock_events;  // whether the unlock callback sends events to perl
 	bool trace_pictures; // enables logging of movement of pictures
 	int event_pipe;      // write handle of event pipe to VLC instance
 	int callback_id;     // id marking this object's events among others on the event_pipe
@@ -101,8 +268,45 @@ typedef struct PerlVLC_player {
 	// array that keeps track of which pictures have been sent to VLC.
 	PerlVLC_picture_t **pictures;
 	int picture_alloc, picture_count;
+	struct PerlVLC_loudness *loudness; // audio sink that meters loudness, if installed
+	// Bounded wait in the lock callback.  If no picture arrives from perl within
+	// lock_timeout_ms (-1 = forever) the lock_policy decides what the decoder gets.
+	int lock_timeout_ms, lock_policy;
+	// Private buffers for PERLVLC_LOCK_SCRATCH, malloc'd by the video thread.  Each is busy
+	// from lock to unlock, since the decoder may keep several as reference frames.
+	struct PerlVLC_scratch {
+		void *buf;
+		size_t len;
+		int busy;
+	} scratch[PERLVLC_SCRATCH_SLOTS];
+	struct PerlVLC_lock_stats {
+		unsigned long locks;          // pictures requested by the decoder
+		unsigned long timeouts;       // waits that reached lock_timeout_ms
+		unsigned long scratch;        // frames decoded into the scratch buffer and discarded
+		unsigned long null;           // frames refused by returning NULL planes
+		unsigned long wait_max_us;    // longest wait for a picture
+		uint64_t wait_total_us;
+		unsigned long seeks, keyframe_seeks; // seeks requested through perl, and how many used the index
+		unsigned long seeks_done;     // seeks followed by a displayed frame
+		unsigned long seek_last_us, seek_max_us; // time from the seek to that frame
+		uint64_t seek_total_us;
+	} lock_stats;
+	uint64_t seek_start_us; // monotonic time of a seek still waiting for a frame, or 0
+	bool clock_attached;    // whether 'clock' is listening to the player's events
+	bool stats_sampled;     // whether the stats sampler has this player
+	PerlVLC_clock_t clock;
+	PerlVLC_format_policy_t format_policy;
+	// Pictures allocated by the video thread for the format policy, until perl adopts them
+	PerlVLC_picture_t *native_pictures[PERLVLC_POLICY_PICTURES];
+	// Monotonic time of the last play, until the first frame; and how long after it the
+	// format callback and the first display happened (0 if not yet)
+	uint64_t play_start_us, format_after_us, first_frame_after_us;
+	uint64_t lock_sequence; // count of lock callbacks, for Picture->sequence
 } PerlVLC_player_t;
 
+#define PERLVLC_LOCK_SCRATCH 1 // decode into a private buffer and drop the frame
+#define PERLVLC_LOCK_NULL    2 // return NULL planes, as the error path does
+
 /* Constructor/destructor of player.  The player struct is magically attached to a blessed
  * hashref, and each is reachable form the other.
  */
@@ -110,6 +314,19 @@ typedef struct PerlVLC_player {
 #define PerlVLC_get_media_player_mg(obj)      ((PerlVLC_player_t*) PerlVLC_get_mg(obj, &PerlVLC_media_player_mg_vtbl))
 extern SV * PerlVLC_wrap_media_player(libvlc_media_player_t *player);
 
+extern void PerlVLC_seek_start(PerlVLC_player_t *mpinfo, bool keyframe);
+extern void PerlVLC_play_start(PerlVLC_player_t *mpinfo);
+extern bool PerlVLC_player_adopt_picture(PerlVLC_player_t *player, PerlVLC_picture_t *pic);
+extern bool PerlVLC_mp4_keyframes(const char *path, AV *out);
+
+/* Cached playback clock.  PerlVLC_clock_read interpolates the time to 'now' while playing. */
+extern void PerlVLC_clock_attach(PerlVLC_player_t *player);
+extern void PerlVLC_clock_detach(PerlVLC_player_t *player);
+extern void PerlVLC_clock_event_cb(const libvlc_event_t *event, void *opaque);
+extern void PerlVLC_clock_read(PerlVLC_player_t *player, PerlVLC_clock_t *out);
+extern void PerlVLC_clock_seek(PerlVLC_player_t *player, int64_t time_ms, double position);
+extern void PerlVLC_clock_set_rate(PerlVLC_player_t *player, double rate);
+
 /* Video capturing callback API
  * VLC provides an API where callbacks can receive the video frames.  These callbacks can't be
  * handed directly to perl because they run from secondary threads, so need to pass all
@@ -126,12 +343,239 @@ extern int  PerlVLC_player_remove_picture(PerlVLC_player_t *player, PerlVLC_pict
 extern void PerlVLC_video_reply_format(PerlVLC_player_t *player, PerlVLC_picture_format_t *format, int alloc_count);
 extern void PerlVLC_player_send_picture(PerlVLC_player_t *player, PerlVLC_picture_t *pic);
 
-/* VLC media objects aremagically attached directly to blessed hashrefs.
- * I didn't have enough reason to give them a wrapper struct, yet.
+/* EBU R128 loudness meter, installed as the player's audio output with
+ * libvlc_audio_set_callbacks.  All the measurement runs on the audio thread, and only
+ * periodic summaries are posted through the event pipe.  'rate' is the sample rate the
+ * filters are designed for; the audio output runs at rate*speed so that playing faster than
+ * real time (without time-stretch) still delivers the content at 'rate'.
+ */
+#define PERLVLC_LOUDNESS_MAX_CHANNELS 8
+#define PERLVLC_LOUDNESS_HIST_BINS 1000  // 0.1 LU bins from -70 to +30 LUFS
+#define PERLVLC_LOUDNESS_SHORT_TERM 30   // number of 100ms sub-blocks in 3s
+#define PERLVLC_TRUE_PEAK_TAPS 12        // FIR taps per oversampling phase
+
+typedef struct PerlVLC_loudness_summary {
+	double momentary, short_term, integrated; // LUFS, or -INFINITY if not yet measured
+	double range;                             // LU
+	double true_peak, sample_peak;            // linear, 1.0 = full scale
+	uint64_t samples;                         // sample frames metered so far
+	uint32_t final;                           // set after the audio output drained
+} PerlVLC_loudness_summary_t;
+
+typedef struct PerlVLC_loudness {
+	pthread_mutex_t mutex;   // held by the audio thread while metering a buffer
+	int event_pipe, callback_id;
+	unsigned rate, channels, speed;
+	unsigned interval;       // post a summary every N sub-blocks, or 0 for never
+	double weight[PERLVLC_LOUDNESS_MAX_CHANNELS];
+	// K-weighting is a high shelf followed by a high pass, each a biquad
+	double shelf_b[3], shelf_a[3], hp_b[3], hp_a[3];
+	double shelf_z[PERLVLC_LOUDNESS_MAX_CHANNELS][2], hp_z[PERLVLC_LOUDNESS_MAX_CHANNELS][2];
+	// Gating blocks are 400ms with 75% overlap, so are built from 100ms sub-blocks
+	unsigned sub_len, sub_pos;
+	double sub_sum;
+	double sub_energy[PERLVLC_LOUDNESS_SHORT_TERM];
+	uint64_t sub_count;
+	double momentary, short_term; // mean-square energy of the latest windows
+	uint32_t block_hist[PERLVLC_LOUDNESS_HIST_BINS], short_hist[PERLVLC_LOUDNESS_HIST_BINS];
+	double block_energy[PERLVLC_LOUDNESS_HIST_BINS]; // exact sums, so only the gate is quantized
+	// True peak uses a polyphase interpolator over the recent input
+	unsigned tp_factor, tp_pos;
+	double tp_coef[4 * PERLVLC_TRUE_PEAK_TAPS];
+	float tp_hist[PERLVLC_LOUDNESS_MAX_CHANNELS][PERLVLC_TRUE_PEAK_TAPS];
+	double true_peak, sample_peak;
+	uint64_t samples;
+} PerlVLC_loudness_t;
+
+extern void PerlVLC_enable_loudness_meter(PerlVLC_player_t *mpinfo, unsigned rate, unsigned channels,
+	const double *weights, unsigned speed, unsigned interval);
+extern void PerlVLC_loudness_get_summary(PerlVLC_loudness_t *meter, PerlVLC_loudness_summary_t *out);
+extern void PerlVLC_loudness_measure(unsigned rate, unsigned channels, const float *samples, unsigned frames,
+	PerlVLC_loudness_summary_t *out);
+extern void PerlVLC_loudness_summary_to_hv(PerlVLC_loudness_summary_t *summary, HV *hv);
+
+/* A ring buffer that perl feeds with chunks of media, and that the VLC input thread reads
+ * from.  The capacity is the high-water mark; when the buffered amount drops to low_water
+ * the reader posts an event so perl can top it up ahead of demand.
+ * The perl media object holds one reference and each VLC open/close pair holds another,
+ * since the input thread can outlive the perl object.
  */
+typedef struct PerlVLC_media_stream {
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;    // signalled when data is fed, or at eof/close
+	char     *ring;
+	size_t    size;          // capacity of ring
+	size_t    head;          // read position
+	size_t    fill;          // number of bytes buffered
+	size_t    low_water;
+	uint64_t  total_fed, total_read;
+	bool      eof;           // perl has no more data; reader returns 0 once drained
+	bool      closed;        // reader should return immediately, such as when stopping
+	bool      low_water_sent;
+	int       event_pipe;    // write handle of event pipe to VLC instance
+	int       callback_id;   // id marking this object's events among others on the event_pipe
+	int       refcount;      // protected by mutex
+} PerlVLC_media_stream_t;
+
+/* The media struct wraps a VLC media object, and holds on to anything that VLC reads from
+ * for the lifetime of the media, such as an in-memory buffer.  Like the others, it is
+ * magically attached to a blessed hashref.
+ */
+typedef struct PerlVLC_media {
+	libvlc_media_t *media;
+	// For media read from memory (a pinned perl scalar or a mmap'd file) this is the
+	// address and length that the open/read/seek callbacks serve from.
+	const char *buffer;
+	size_t buffer_len;
+	SV *buffer_sv;             // scalar holding the buffer, if any.  Made read-only while held.
+	bool buffer_sv_was_readonly;
+	void *mmap_addr;           // address to munmap on destruction, if any
+	PerlVLC_media_stream_t *stream; // for media fed incrementally from perl
+} PerlVLC_media_t;
+
 #define PerlVLC_set_media_mg(obj, ptr)        PerlVLC_set_mg(obj, &PerlVLC_media_mg_vtbl, (void*) ptr)
-#define PerlVLC_get_media_mg(obj)             ((libvlc_media_t*) PerlVLC_get_mg(obj, &PerlVLC_media_mg_vtbl))
-extern SV * PerlVLC_wrap_media(libvlc_media_t *player);
+#define PerlVLC_get_media_mg(obj)             ((PerlVLC_media_t*) PerlVLC_get_mg(obj, &PerlVLC_media_mg_vtbl))
+extern SV * PerlVLC_wrap_media(libvlc_media_t *media);
+extern SV * PerlVLC_media_new_buffer(PerlVLC_vlc_t *vlc, SV *buffer);
+extern SV * PerlVLC_media_new_mmap(PerlVLC_vlc_t *vlc, const char *path);
+extern SV * PerlVLC_media_new_stream(PerlVLC_vlc_t *vlc, size_t size, size_t low_water);
+extern size_t PerlVLC_media_stream_feed(PerlVLC_media_stream_t *st, const char *data, size_t len);
+extern void PerlVLC_media_stream_finish(PerlVLC_media_stream_t *st, bool close);
+extern SV * PerlVLC_mmap_file_scalar(const char *path);
+
+/* Linux scheduler affinity for VLC's internal threads, by kernel thread id */
+extern bool PerlVLC_thread_get_affinity(int tid, AV *out);
+extern bool PerlVLC_thread_set_affinity(int tid, AV *cpus);
+
+/* Track info is copied out of libvlc's per-track allocations into one flat block, so that
+ * a list of tracks is a single allocation attached to a single perl object, and fields are
+ * only turned into perl scalars when an accessor asks for them.
+ */
+typedef struct PerlVLC_track {
+	uint32_t codec, original_fourcc;
+	int id, type, profile, level;
+	unsigned bitrate;
+	unsigned channels, rate;                  // audio tracks
+	unsigned width, height, sar_num, sar_den; // video tracks
+	unsigned frame_rate_num, frame_rate_den;  // video tracks
+	const char *language, *description, *encoding; // point into the string area, or NULL
+} PerlVLC_track_t;
+
+typedef struct PerlVLC_track_list {
+	unsigned count;
+	PerlVLC_track_t track[]; // followed by the strings
+} PerlVLC_track_list_t;
+
+#define PerlVLC_set_track_list_mg(obj, ptr)   PerlVLC_set_mg(obj, &PerlVLC_track_list_mg_vtbl, (void*) ptr)
+#define PerlVLC_get_track_list_mg(obj)        ((PerlVLC_track_list_t*) PerlVLC_get_mg(obj, &PerlVLC_track_list_mg_vtbl))
+extern SV * PerlVLC_wrap_track_list(PerlVLC_track_list_t *tl);
+extern PerlVLC_track_list_t * PerlVLC_track_list_from_media(libvlc_media_t *media);
+extern PerlVLC_track_list_t * PerlVLC_track_list_from_av(AV *tracks);
+
+/* A slab is an anonymous shared memory map divided into equal-size slots.  It is created
+ * before forking, so parent and child see the same pages, and a child can decode pictures
+ * directly into memory that the parent reads.  Which process may touch a slot is decided
+ * by whoever hands out the slot numbers; the slab itself does no locking.  Perl scalars
+ * aliasing a slot each hold a reference, so the map outlives the object if needed.
+ */
+typedef struct PerlVLC_slab {
+	char *base;
+	size_t map_len;
+	size_t slot_size;    // multiple of PERLVLC_PLANE_PITCH_MUL, so slots stay aligned
+	unsigned slot_count;
+	int refcnt;          // the perl object, plus each live scalar aliasing a slot
+} PerlVLC_slab_t;
+
+#define PerlVLC_set_slab_mg(obj, ptr)         PerlVLC_set_mg(obj, &PerlVLC_slab_mg_vtbl, (void*) ptr)
+#define PerlVLC_get_slab_mg(obj)              ((PerlVLC_slab_t*) PerlVLC_get_mg(obj, &PerlVLC_slab_mg_vtbl))
+extern PerlVLC_slab_t * PerlVLC_slab_new(size_t slot_size, unsigned slot_count);
+extern SV * PerlVLC_wrap_slab(PerlVLC_slab_t *slab);
+extern SV * PerlVLC_slab_slot_scalar(PerlVLC_slab_t *slab, unsigned slot, size_t offset, size_t len, bool readonly);
+
+/* Writes pictures to a file descriptor as a YUV4MPEG2 stream or bare planes, with writev
+ * straight from the plane memory: one iovec per row, or per plane when the rows have no
+ * padding.  With a queue, a private thread does the writing and posts
+ * PERLVLC_MSG_VIDEO_WRITTEN when it is done with each picture; perl keeps the picture alive
+ * until then.  The stream is fixed to the chroma and size of the first picture written.
+ */
+#define PERLVLC_WRITER_RAW 0
+#define PERLVLC_WRITER_Y4M 1
+typedef struct PerlVLC_writer {
+	int fd, format;
+	char y4m_params[64];      // header fields between the size and colorspace, like "F25:1 Ip"
+	bool started;             // first picture written, and stream_format is set
+	PerlVLC_picture_format_t stream_format;
+	int error;                // errno of the first failed write; nothing is written after it
+	// The writer thread updates these without a lock, like the player's lock_stats
+	uint64_t frames, bytes;
+	unsigned long skipped;    // pictures not written because of an error or another format
+	// Only used with a queue
+	bool threaded, stopping;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;      // signalled when the queue gains or loses a picture, or on stop
+	PerlVLC_picture_t **queue;
+	unsigned queue_size, queue_head, queue_count;
+	int event_pipe, callback_id;
+	// Pictures written while the event pipe was full, in order, for perl to collect instead.
+	// Allocated with malloc by the writer thread.
+	PerlVLC_picture_t **unposted;
+	unsigned unposted_count, unposted_size;
+} PerlVLC_writer_t;
+
+#define PerlVLC_set_writer_mg(obj, ptr)       PerlVLC_set_mg(obj, &PerlVLC_writer_mg_vtbl, (void*) ptr)
+#define PerlVLC_get_writer_mg(obj)            ((PerlVLC_writer_t*) PerlVLC_get_mg(obj, &PerlVLC_writer_mg_vtbl))
+extern PerlVLC_writer_t * PerlVLC_writer_new(int fd, int format, const char *y4m_params,
+	unsigned queue_size, int event_pipe, int callback_id);
+extern SV * PerlVLC_wrap_writer(PerlVLC_writer_t *w);
+extern bool PerlVLC_writer_write(PerlVLC_writer_t *w, PerlVLC_picture_t *pic);
+extern void PerlVLC_writer_wait(PerlVLC_writer_t *w);
+extern unsigned PerlVLC_writer_take_unposted(PerlVLC_writer_t *w, PerlVLC_picture_t ***out);
+extern void PerlVLC_writer_stop(PerlVLC_writer_t *w);
+
+/* Encodes a picture to a PNG or PPM file on a worker thread shared by the whole process, and
+ * posts PERLVLC_MSG_PICTURE_ENCODED when done.  A job either holds a reference to the picture
+ * (which the message carries back to perl) or a private copy of its planes.
+ */
+#define PERLVLC_ENCODE_PNG 0
+#define PERLVLC_ENCODE_PPM 1
+typedef struct PerlVLC_encode_job {
+	struct PerlVLC_encode_job *next;
+	int format, level;        // PERLVLC_ENCODE_*, and zlib level for PNG
+	PerlVLC_picture_format_t pic_format;
+	void *plane_ptr[PERLVLC_PICTURE_PLANES];
+	PerlVLC_picture_t *pic;   // the picture, or NULL if plane_ptr point into 'copy'
+	void *copy;
+	int event_pipe;           // -1 once cancelled
+	uint32_t callback_id, job_id;
+	char path[];
+} PerlVLC_encode_job_t;
+
+extern bool PerlVLC_encode_chroma_supported(const char *chroma);
+extern void PerlVLC_encode_submit(PerlVLC_picture_t *pic, int format, int level, const char *path,
+	bool copy, int event_pipe, uint32_t callback_id, uint32_t job_id);
+extern void PerlVLC_encode_cancel(PerlVLC_vlc_t *vlc, HV *self);
+
+/* Samples libvlc_media_get_stats of each registered player on a thread shared by the whole
+ * process, each at its own interval, and posts PERLVLC_MSG_MEDIA_STATS with the totals and
+ * their change and rate since the previous sample.  Only playing players are sampled.  The
+ * sampler holds a reference to each libvlc player until it is removed.
+ */
+#define PERLVLC_STATS_COUNTERS 10
+extern const char *PerlVLC_stats_names[PERLVLC_STATS_COUNTERS];
+typedef struct PerlVLC_stats_sample {
+	uint32_t elapsed_ms;      // since the previous sample, or 0 if there was none for this input
+	float input_bitrate, demux_bitrate;       // as reported by libvlc
+	int32_t total[PERLVLC_STATS_COUNTERS];    // in the order of PerlVLC_stats_names
+	int32_t delta[PERLVLC_STATS_COUNTERS];    // change since the previous sample
+	float rate[PERLVLC_STATS_COUNTERS];       // delta per second
+} PerlVLC_stats_sample_t;
+
+extern bool PerlVLC_stats_read(libvlc_media_t *media, PerlVLC_stats_sample_t *out);
+extern void PerlVLC_stats_sample_to_hv(const PerlVLC_stats_sample_t *sample, HV *hv);
+extern void PerlVLC_stats_add(libvlc_media_player_t *mp, unsigned interval_ms, int event_pipe, uint32_t callback_id);
+extern void PerlVLC_stats_remove(libvlc_media_player_t *mp);
+extern void PerlVLC_stats_cancel(PerlVLC_vlc_t *vlc);
 
 /* Include the API for exposing C buffers as perl scalars. */
 #include "buffer_scalar.c"
@@ -7,6 +7,7 @@
 #define BUFFER_SCALAR_UTF8 2
 typedef intptr_t buffer_scalar_callback_data_t[8];
 typedef void (*buffer_scalar_free_fn)(SV *var, void *address, size_t length, buffer_scalar_callback_data_t callback_data);
+typedef bool (*buffer_scalar_dup_fn)(void *address, size_t length, buffer_scalar_callback_data_t callback_data);
 
 #ifndef SvPV_free
 #	define SvPV_free(arg) sv_setpvn_mg(arg, NULL, 0);
@@ -22,6 +23,7 @@ struct buffer_scalar_info {
 	int flags;
 	buffer_scalar_callback_data_t callback_data;
 	buffer_scalar_free_fn destructor;
+	buffer_scalar_dup_fn dup;
 };
 
 static int buffer_scalar_mg_write(pTHX_ SV *sv, MAGIC* mg);
@@ -35,8 +37,17 @@ static int buffer_scalar_mg_local(pTHX_ SV* var, MAGIC* mg) {
 }
 #endif
 #ifdef USE_ITHREADS
+/* Without a destructor the buffer belongs to someone else anyway, so a clone can alias it
+ * just the same.  A destructor means this scalar owns the buffer, which can't be shared
+ * unless the dup callback takes another claim on it for the clone.
+ */
 static int buffer_scalar_mg_dup(pTHX_ MAGIC* magic, CLONE_PARAMS* param) {
-	croak("Can't share foreign buffer between iThreads");
+	struct buffer_scalar_info *info= (struct buffer_scalar_info*) magic->mg_ptr, *copy;
+	if (info->dup? !info->dup(info->address, info->length, info->callback_data) : info->destructor != NULL)
+		croak("Can't share foreign buffer between iThreads");
+	copy= PerlMemShared_malloc(sizeof *copy);
+	memcpy(copy, info, sizeof *copy);
+	magic->mg_ptr= (char*) copy;
 	return 0;
 }
 #else
@@ -182,10 +193,19 @@ static SV* buffer_scalar_wrap(
 	if (cbdata)
 		memcpy(info->callback_data, cbdata, sizeof(buffer_scalar_callback_data_t));
 	info->destructor= destructor;
+	info->dup= NULL;
 	reset_var(target, info);
 	return target;
 }
 
+/* Let a scalar with a destructor be cloned into a new iThread, if 'dup' agrees */
+static void buffer_scalar_set_dup(pTHX_ SV *target, buffer_scalar_dup_fn dup) {
+	struct buffer_scalar_info *info= get_sv_magic(aTHX_ target);
+	if (!info)
+		croak("Scalar is not bound to a buffer");
+	info->dup= dup;
+}
+
 static SV* buffer_scalar_unwrap(pTHX_ SV *target) {
 	if (!get_sv_magic(aTHX_ target))
 		croak("Scalar is not bound to a buffer");
@@ -6,6 +6,7 @@ use Carp;
 use Scalar::Util 'weaken';
 use Socket qw( AF_UNIX SOCK_DGRAM );
 use IO::Handle;
+use Time::HiRes ();
 
 # ABSTRACT: Wrapper for libvlc.so
 # VERSION
@@ -109,7 +110,13 @@ sub exporter_autoload_symbol {
 }
 
 require XSLoader;
-XSLoader::load('VideoLAN::LibVLC', $VideoLAN::LibVLC::VERSION);
+# Loading the XS module is when libvlc.so and libvlccore.so get linked, which is part
+# of startup cost worth reporting.
+our $XS_LOAD_TIME= do {
+	my $t0= Time::HiRes::time();
+	XSLoader::load('VideoLAN::LibVLC', $VideoLAN::LibVLC::VERSION);
+	Time::HiRes::time() - $t0;
+};
 
 =head1 CONSTANTS
 
@@ -157,6 +164,24 @@ not supported by your version of libvlc will throw an exception.
 (I figured it would be better to allow the exceptions at runtime than for
  programs to break at compile time due to the host's version of libvlc.)
 
+=head2 PERLVLC_FAKE_LIBVLC
+
+True if the module was built with C<PERLVLC_FAKE_LIBVLC=1 perl Makefile.PL>.  That build adds
+a stand-in video output for load testing: a media location beginning with C<fake://> plays
+synthetic frames from a thread of its own, through the same video callbacks as real media,
+with the resolutions, chromas, frame rate, and mid-stream format changes given in the
+location:
+
+  $player->media('fake://?format=I420:3840x2160&format=RV32:320x240&change_every=50&fps=0');
+
+See F<FakeVLC.c> for all the parameters, and F<util/stress-callbacks.pl>.  Other media still
+play through libvlc.
+
+=head2 PERLVLC_HAVE_ZLIB
+
+True if zlib was found when the module was built, which
+L<encode_async|VideoLAN::LibVLC::Picture/encode_async> needs to write PNG.
+
 =head1 ATTRIBUTES
 
 =head2 libvlc_version
@@ -182,6 +207,11 @@ sub libvlc_compiler  { libvlc_get_compiler() }
 
 A copy of the argv that you passed to the constructor.  Read-only.
 
+Most of the time spent in C<libvlc_new> goes to loading the plugin cache.  If that cache
+is stale (such as after installing plugins without running C<vlc-cache-gen>) libvlc
+rescans every plugin directory on each startup; passing C<--no-plugins-scan> makes it
+use the cache as-is, and L</startup_report> shows whether that helped.
+
 =head2 app_id
 
 A java-style name identifying the application.  Defaults to an empty string if you set app_version
@@ -231,7 +261,9 @@ sub user_agent_http { my $self= shift; if (@_) { $self->{user_agent_http}= shift
 
 =head2 audio_filters
 
-An arrayref of all audio filter modules built into LibVLC.
+An arrayref of all audio filter modules built into LibVLC.  The module list is the same
+for every instance created with the same L</argv>, so it is only fetched from libvlc once
+per process for each distinct argv.
 
 =head2 audio_filter_list
 
@@ -247,8 +279,19 @@ List accessor for video_filters.
 
 =cut
 
-sub audio_filters { my $self= shift; $self->{audio_filters} ||= [ $self->libvlc_audio_filter_list_get ] }
-sub video_filters { my $self= shift; $self->{video_filters} ||= [ $self->libvlc_video_filter_list_get ] }
+our %_filter_cache;
+sub _argv_key { join "\0", map { defined $_? $_ : '' } @{ $_[0] || [] } }
+
+sub audio_filters { $_[0]{audio_filters} ||= $_[0]->_cached_filters('audio', \&libvlc_audio_filter_list_get) }
+sub video_filters { $_[0]{video_filters} ||= $_[0]->_cached_filters('video', \&libvlc_video_filter_list_get) }
+
+sub _cached_filters {
+	my ($self, $type, $list_get)= @_;
+	my $t0= Time::HiRes::time();
+	my $list= $_filter_cache{_argv_key($self->{argv})}{$type} ||= [ $self->$list_get ];
+	push @{ $self->{startup_profile} }, [ "${type}_filters", Time::HiRes::time() - $t0 ];
+	return $list;
+}
 
 sub audio_filter_list { @{ shift->audio_filters } }
 sub video_filter_list { @{ shift->video_filters } }
@@ -295,6 +338,18 @@ you call L</callback_dispatch>.
 
 =cut
 
+=head2 startup_profile
+
+An arrayref of C<< [ $phase, $seconds ] >> recording where the time went while setting up
+this instance: C<xs_load> (linking libvlc when this module was loaded, shared by all
+instances), C<libvlc_new> (plugin cache load and core init), C<configure> (app id, user
+agent, logging), and C<audio_filters>/C<video_filters> the first time each is requested.
+See also L</startup_report>.
+
+=cut
+
+sub startup_profile { $_[0]{startup_profile} }
+
 sub log { my $self= shift; $self->_set_logger(@_) if @_; $self->{log} }
 sub can_redirect_log { !!$_[0]->can('libvlc_log_unset') }
 
@@ -339,7 +394,7 @@ sub _set_logger {
 		$lev= LOG_LEVEL_NOTICE() unless defined $lev;
 		# Install callback
 		weaken($self);
-		my $cb_id= $self->_register_callback(sub { $self->log->($_[0]) } );
+		my $cb_id= $self->{_log_callback_id}= $self->_register_callback(sub { $self->log->($_[0]) } );
 		$self->_libvlc_log_set($cb_id, $lev, $options->{fields} || []);
 	}
 }
@@ -370,7 +425,9 @@ sub new {
 		: ((@_&1) == 0)? @_
 		: croak "Expected hashref, even-length list, or arrayref";
 	$args{argv} ||= [];
+	my $t0= Time::HiRes::time();
 	my $self= VideoLAN::LibVLC::libvlc_new($args{argv});
+	my $t1= Time::HiRes::time();
 	%$self= %args;
 	$self->_update_app_id
 		if defined $self->{app_id} or defined $self->{app_version} or defined $self->{app_icon};
@@ -378,21 +435,129 @@ sub new {
 		if defined $self->{user_agent_name} or defined $self->{user_agent_http};
 	$self->_set_logger($self->log)
 		if defined $self->{log};
+	$self->{startup_profile}= [
+		[ xs_load    => $XS_LOAD_TIME ],
+		[ libvlc_new => $t1 - $t0 ],
+		[ configure  => Time::HiRes::time() - $t1 ],
+	];
 	return $self;
 }
 
+=head2 shared
+
+  my $vlc= VideoLAN::LibVLC->shared;
+  my $vlc= VideoLAN::LibVLC->shared( \@argv );
+  my $vlc= VideoLAN::LibVLC->shared( argv => \@argv, %attributes );
+
+Return a process-wide instance for this argv, creating it on first use.  C<libvlc_new>
+loads the plugin cache and initializes every core module, which costs hundreds of
+milliseconds, so code that needs "a libvlc" for a short job should use this instead of
+L</new>.  The pool holds a reference to each instance until L</release_shared>; any other
+attributes are only applied when the instance is first created.
+
+Since the instance is shared, callers should treat its own attributes (L</log>,
+L</app_id>, etc.) as belonging to whoever configured the pool.  Players and media
+created from it are independent of each other.
+
+An instance created before C<fork> is not reused in the child (libvlc's threads don't
+survive a fork) and the child gets a new one.  To pay the startup cost eagerly, such as
+before accepting jobs, list the argvs to create when loading the module:
+
+  use VideoLAN::LibVLC::Warm [], [ '--no-video' ];
+
+or call L</warm_shared>.
+
+=head2 warm_shared
+
+  VideoLAN::LibVLC->warm_shared( \@argv1, \@argv2, ... );
+
+Create shared instances (with no arguments, the default instance) and also fetch their
+filter lists, so later calls are cheap.
+
+=head2 release_shared
+
+  VideoLAN::LibVLC->release_shared( \@argv );  # one
+  VideoLAN::LibVLC->release_shared;           # all
+
+Remove instances from the pool.  They are freed once nothing else refers to them.
+
+=head2 startup_report
+
+  print VideoLAN::LibVLC->startup_report;
+  print $vlc->startup_report;
+
+Return a text table of L</startup_profile> for this instance, or for every shared
+instance when called as a class method.
+
+=cut
+
+our %_shared;
+
+sub shared {
+	my $class= shift;
+	my %args= (@_ == 1 && ref($_[0]) eq 'HASH')? %{ $_[0] }
+		: (@_ == 1 && ref($_[0]) eq 'ARRAY')? ( argv => $_[0] )
+		: ((@_&1) == 0)? @_
+		: croak "Expected hashref, even-length list, or arrayref";
+	my $key= _argv_key($args{argv});
+	my $ent= $_shared{$key};
+	if ($ent && $ent->{pid} != $$) {
+		# Don't let the child free the parent's instance, because libvlc_release would
+		# try to stop threads that don't exist in this process.  Perl frees every object at
+		# global destruction, so detach the object from the instance instead of holding it.
+		$ent->{vlc}->_forget;
+		$ent= undef;
+	}
+	$ent ||= ($_shared{$key}= { vlc => $class->new(%args), pid => $$ });
+	return $ent->{vlc};
+}
+
+sub warm_shared {
+	my $class= shift;
+	for my $argv (@_? @_ : ([])) {
+		my $vlc= $class->shared($argv);
+		$vlc->audio_filters;
+		$vlc->video_filters;
+	}
+	1;
+}
+
+sub release_shared {
+	my $class= shift;
+	if (@_) { delete $_shared{_argv_key($_)} for @_ }
+	else { %_shared= () }
+	1;
+}
+
+sub startup_report {
+	my $self= shift;
+	my @vlc= ref $self? ($self) : map $_->{vlc}, grep $_->{pid} == $$, @_shared{sort keys %_shared};
+	my $report= '';
+	for my $vlc (@vlc) {
+		my $total= 0;
+		$report .= sprintf "libvlc instance argv=[%s]\n", join ' ', @{ $vlc->argv };
+		for (@{ $vlc->startup_profile || [] }) {
+			$report .= sprintf "  %-14s %9.3f ms\n", $_->[0], $_->[1] * 1000;
+			$total += $_->[1];
+		}
+		$report .= sprintf "  %-14s %9.3f ms\n", 'total', $total * 1000;
+	}
+	return $report;
+}
+
 =head2 new_media
 
   my $media= $vlc->new_media( $path );
   my $media= $vlc->new_media( $uri );
   my $media= $vlc->new_media( $file_handle );
+  my $media= $vlc->new_media( \$bytes );
   my $media= $vlc->new_media( %attributes );
   my $media= $vlc->new_media( \%attributes );
 
 This nice heavily-overloaded method helps you quickly open new media
-streams.  VLC can open paths, URIs, or file handles, and if you only
-pass one argument to this method it attempts to decide which of those
-three you intended.
+streams.  VLC can open paths, URIs, file handles, or in-memory buffers,
+and if you only pass one argument to this method it attempts to decide
+which of those you intended.
 
 You can instead pass a hash or hashref, and then it just passes them
 along to the Media constructor.
@@ -404,11 +569,12 @@ sub new_media {
 	my @attrs= (@_ & 1) == 0? @_
 		: (@_ == 1 && !ref($_[0]))? ( ($_[0] =~ m,://,? 'location' : 'path') => $_[0] )
 		: (@_ == 1 && ref($_[0]) eq 'HASH')?        %{ $_[0] }
-		: (@_ == 1 && ref($_[0]) eq 'GLOB')?        ( fh => $_[0] )
+		: (@_ == 1 && ref($_[0]) eq 'GLOB')?        ( fd => $_[0] )
+		: (@_ == 1 && ref($_[0]) eq 'SCALAR')?      ( buffer => $_[0] )
 		: (@_ == 1 && ref($_[0])->can('scheme'))?   ( location => $_[0] )
 		: (@_ == 1 && ref($_[0])->can('absolute'))? ( path => $_[0] )
-		: (@_ == 1 && ref($_[0])->can('read'))?     ( fh => $_[0] )
-		: croak "Expected hashref, even-length list, file handle, string, Path::Class, or URI";
+		: (@_ == 1 && ref($_[0])->can('read'))?     ( fd => $_[0] )
+		: croak "Expected hashref, even-length list, file handle, scalar-ref, string, Path::Class, or URI";
 	require VideoLAN::LibVLC::Media;
 	VideoLAN::LibVLC::Media->new(libvlc => $self, @attrs);
 }
@@ -438,9 +604,58 @@ IT FOR ANY REASON, lest ye incur the Wrath of the Segfault.
 
 =head2 callback_dispatch
 
+  my $n= $vlc->callback_dispatch;
+  my $n= $vlc->callback_dispatch($time_budget);
+
 Read any pending callback messages from the pipe(s), and execute the callback.
 This method does not block (unless your callback does).  You can wait for the
 file handle L</callback_fh> to become readable to know when to call this method.
+Returns the number of callbacks executed.
+
+Messages are not run in the order they arrived.  Everything waiting on the pipe is
+read first, and then they run by priority class:
+
+=over
+
+=item 1. C<format> and C<lock>, because a decoder thread is blocked until perl replies
+
+=item 2. C<display>, C<unlock>, and pictures returned by the decoder or the snapshot encoder
+
+=item 3. other events, such as stream low-water or loudness summaries
+
+=item 4. log messages
+
+=back
+
+and the pipe is checked again after each callback, so a C<lock> request arriving during
+a burst of debug logging jumps ahead of the logs.  Order is preserved within a class.
+
+If C<$time_budget> (seconds) is given, this stops once that much time has passed, after
+at least one callback, which keeps an event loop responsive during a flood of messages.
+Anything left over stays queued inside this object, where L</callback_fh> can't signal
+it, so check L</callback_pending> and call again soon (from an idle or zero-length timer
+watcher, for example).
+
+At most L</log_backlog> log messages are held in the queue; beyond that they are
+discarded and counted in L</log_dropped>.
+
+=head2 callback_pending
+
+Number of messages read from the pipe but not yet dispatched.
+
+=head2 encode_pending
+
+Number of L<encode_async|VideoLAN::LibVLC::Picture/encode_async> jobs of this instance that
+have not been reported by L</callback_dispatch> yet.
+
+=head2 log_backlog
+
+Maximum number of log messages held for dispatch.  Default 10000.  Set to C<-1> for no
+limit.
+
+=head2 log_dropped
+
+Number of log messages discarded because of L</log_backlog>.
 
 =over
 
@@ -471,18 +686,90 @@ file handle L</callback_fh> to become readable to know when to call this method.
 The "wire format" used to stream the callbacks is deliberately hidden within
 this module.  It does not contain any user-servicable parts.
 
+=head2 record_messages
+
+  $vlc->record_messages("session.pvlcmsg");
+  ...
+  $vlc->record_messages(undef);  # stop
+
+Copy every message that L</callback_dispatch> reads from the callback pipe into a file, with
+the time between them.  Play it back later with L<VideoLAN::LibVLC::Replay> to measure the
+perl side of dispatch without any decoding.  The file is in native byte order and holds raw
+pointers, so it is only meaningful on the same machine and build.
+
 =cut
 
 sub callback_fh { shift->_event_pipe->[0] }
 
+sub record_messages {
+	my ($self, $path)= @_;
+	$self->_record_messages(-1);
+	close delete $self->{_record_fh} if $self->{_record_fh};
+	if (defined $path) {
+		open my $fh, '>:raw', $path or croak "open($path): $!";
+		$self->_record_messages(fileno $fh) or croak "write($path): $!";
+		$self->{_record_fh}= $fh;
+	}
+	1;
+}
+
+sub encode_pending { scalar keys %{ $_[0]{_encode_jobs} || {} } }
+
+# Submit a job to the snapshot encoder.  Its completion comes back to this instance as a
+# PERLVLC_MSG_PICTURE_ENCODED message, matched to the job by id.
+sub _encode_async {
+	my ($self, $pic, $format, $opts)= @_;
+	$self->_event_pipe;
+	$self->{_encode_callback_id} //= do {
+		weaken(my $vlc= $self);
+		$self->_register_callback(sub { $vlc && $vlc->_dispatch_encoded(@_) });
+	};
+	my $id= $self->{_encode_next_id}= (($self->{_encode_next_id} || 0) + 1) & 0xFFFFFFFF;
+	$self->_encode_picture($pic, $format, $opts->{level} // 6, $opts->{path}, $opts->{copy}? 1 : 0,
+		$self->{_encode_callback_id}, $id);
+	my $job= $self->{_encode_jobs}{$id}= { path => $opts->{path}, on_done => $opts->{on_done}, player => $opts->{player} };
+	weaken($job->{player}) if $job->{player};
+	$id;
+}
+
+sub _dispatch_encoded {
+	my ($self, $event)= @_;
+	my $job= delete $self->{_encode_jobs}{$event->{job}} or return;
+	$event->{path}= $job->{path};
+	if ($job->{on_done}) { $job->{on_done}->($event) }
+	elsif ($job->{player} && $event->{picture}) { $job->{player}->_recycle_picture($event->{picture}) }
+}
+
+sub log_backlog { my $self= shift; $self->{log_backlog}= shift if @_; $self->{log_backlog} // 10000 }
+
+sub _event_queue { $_[0]{_event_queue} ||= [ map [], 1 .. PERLVLC_PRIORITY_CLASSES() ] }
+
+sub callback_pending {
+	my $n= 0;
+	$n += @$_ for @{ $_[0]->_event_queue };
+	$n;
+}
+
 sub callback_dispatch {
-	my ($self)= @_;
-	# unsolved bug - I used perl recv() and it blocks.  If I use C recv() it works....
-	my $event= $self->_recv_event()
-		or return 0;
-	my $cb= $self->{_callback}{$event->{callback_id}};
-	$cb->($event) if $cb;
-	return 1;
+	my ($self, $budget)= @_;
+	my $queue= $self->_event_queue;
+	my $deadline= defined $budget? Time::HiRes::time() + $budget : undef;
+	my $log_backlog= $self->log_backlog;
+	my ($n, $buf)= (0);
+	$self->_event_pipe;
+	while (1) {
+		# unsolved bug - I used perl recv() and it blocks.  If I use C recv() it works....
+		$self->_recv_prioritized($queue, 256, $log_backlog);
+		undef $buf;
+		for (@$queue) { last if defined($buf= shift @$_) }
+		last unless defined $buf;
+		my $event= $self->_inflate_message($buf);
+		my $cb= $self->{_callback}{$event->{callback_id}};
+		$cb->($event) if $cb;
+		++$n;
+		last if defined $deadline && Time::HiRes::time() >= $deadline;
+	}
+	return $n;
 }
 
 sub _event_pipe {
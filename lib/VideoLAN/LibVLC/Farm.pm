@@ -0,0 +1,570 @@
+package VideoLAN::LibVLC::Farm;
+use strict;
+use warnings;
+use Carp;
+use Scalar::Util qw( weaken );
+use Socket qw( AF_UNIX SOCK_DGRAM SOCK_SEQPACKET );
+use IO::Handle;
+use IO::Select;
+use POSIX ();
+use Time::HiRes ();
+use VideoLAN::LibVLC;
+
+# ABSTRACT: Decode media in worker processes, returning frames through shared memory
+# VERSION
+
+=head1 SYNOPSIS
+
+  my $farm= VideoLAN::LibVLC::Farm->new(
+    workers    => 4,
+    slot_size  => 1920*1088*4,
+    argv       => [ '--no-audio' ],
+    on_frame   => sub {
+      my ($farm, $frame)= @_;
+      analyze( ${ $frame->plane(0) }, $frame->width, $frame->height, $frame->pitch(0) );
+      $frame->release;  # hand the memory back to the worker's decoder
+    },
+    on_job_end => sub {
+      my ($farm, $job_id, $status)= @_;
+      ...
+    },
+  );
+  $farm->submit(path => $_, chroma => 'RV32', width => 640, height => 360) for @files;
+
+  # One file handle for the event loop, regardless of the number of workers
+  AE::io $farm->fh, 0, sub { $farm->dispatch };
+
+=head1 DESCRIPTION
+
+A single perl interpreter can only service so many decoders, and VLC objects can't be
+shared with other perl threads.  This module forks a number of worker processes, each with
+its own libvlc instance, and hands each one a job (a media and a video format) at a time.
+
+Workers decode directly into a L<shared memory slab|VideoLAN::LibVLC::SharedSlab> created
+before forking, so a frame reaching the parent costs one small datagram on L</fh> rather
+than a copy of the picture.  Each worker owns a fixed set of slots in the slab.  When a
+frame is displayed, its slot belongs to the parent until the L<Frame|/FRAMES> is released,
+and then the worker queues it to the decoder again.  If the parent holds on to all of a
+worker's slots, that worker's decoder simply waits, so the number of slots per worker also
+bounds how far ahead of the parent the workers can get.
+
+Create the farm early, before the parent has started any libvlc threads, so that the
+workers are forked from a clean process.
+
+=head1 ATTRIBUTES
+
+=head2 workers
+
+Number of worker processes.  Default 2.
+
+=head2 slots_per_worker
+
+Number of picture buffers each worker has.  Default 6.
+
+=head2 slot_size
+
+Bytes in each slot, which must fit every plane of the largest frame you will decode.
+Default is enough for 1920x1088 at 32 bits per pixel.  A job whose frames don't fit ends
+with an error status.
+
+=head2 argv
+
+Arguments for each worker's libvlc instance.
+
+=head2 job_timeout
+
+Seconds a worker waits for a job to begin playing before giving up.  Default 30.
+
+=head2 on_frame
+
+  on_frame => sub { my ($farm, $frame)= @_; ... }
+
+Called from L</dispatch> for each decoded frame.  See L</FRAMES>.  If not set, frames are
+released immediately.
+
+=head2 on_job_end
+
+  on_job_end => sub { my ($farm, $job_id, $status)= @_; ... }
+
+Called from L</dispatch> when a job finishes.  C<$status> is C<'ended'>, C<'cancelled'>,
+or C<'error: ...'>.
+
+=head2 fh
+
+The read end of the socket all workers post to.  Call L</dispatch> when it is readable.
+
+=head2 slab
+
+The L<VideoLAN::LibVLC::SharedSlab> holding the frames.
+
+=cut
+
+sub workers          { $_[0]{workers} }
+sub slots_per_worker { $_[0]{slots_per_worker} }
+sub slot_size        { $_[0]{slot_size} }
+sub argv             { $_[0]{argv} }
+sub job_timeout      { $_[0]{job_timeout} }
+sub on_frame         { $_[0]{on_frame} }
+sub on_job_end       { $_[0]{on_job_end} }
+sub fh               { $_[0]{_event_r} }
+sub slab             { $_[0]{slab} }
+
+# Worker -> parent datagrams on the shared event socket:
+#   F: frame    worker, job, slot, seq, time_ms+1, chroma, width, height, pitch[3], lines[3]
+#   E: job end  worker, job, status
+# Parent -> worker packets on each worker's command socket:
+#   J: job      job, key/value pairs
+#   R: release  slot
+#   C: cancel   job
+#   Q: quit
+use constant {
+	FRAME_PACK => 'a1 w w w w w a4 w w w3 w3',
+	END_PACK   => 'a1 w w a*',
+	JOB_PACK   => 'a1 w (w/a*)*',
+};
+our @JOB_KEYS= qw( path location chroma width height pitch lines );
+
+=head1 METHODS
+
+=head2 new
+
+  my $farm= VideoLAN::LibVLC::Farm->new( %attributes );
+
+Create the shared memory and fork the workers.
+
+=cut
+
+sub new {
+	my $class= shift;
+	my %args= (@_ == 1 && ref($_[0]) eq 'HASH')? %{ $_[0] }
+		: (@_ & 1) == 0? @_
+		: croak "Expected hashref or even length list";
+	my $self= bless {
+		workers          => 2,
+		slots_per_worker => 6,
+		slot_size        => 1920*1088*4,
+		argv             => [],
+		job_timeout      => 30,
+		%args,
+		_pid             => $$,
+		_tid             => _tid(),
+		_next_job_id     => 1,
+		_queue           => [],
+		_jobs            => {},
+		_worker          => [],
+	}, $class;
+	$self->{workers} > 0 && $self->{slots_per_worker} > 0
+		or croak "workers and slots_per_worker must be positive";
+	$self->{slab}= VideoLAN::LibVLC::SharedSlab->new($self->{slot_size},
+		$self->{workers} * $self->{slots_per_worker});
+	socketpair(my $r, my $w, AF_UNIX, SOCK_DGRAM, 0)
+		or croak "socketpair: $!";
+	$r->blocking(0);
+	@{$self}{qw( _event_r _event_w )}= ($r, $w);
+	$self->_spawn($_) for 0 .. $self->{workers} - 1;
+	return $self;
+}
+
+# Perl threads each get a clone of the farm, but only the creator's copy owns the workers
+sub _tid { $INC{'threads.pm'}? threads->tid : 0 }
+
+sub DESTROY {
+	my $self= shift;
+	$self->shutdown if $self->{_pid} == $$ && $self->{_tid} == _tid();
+}
+
+=head2 submit
+
+  my $job_id= $farm->submit( path => $file, %format );
+  my $job_id= $farm->submit( location => $uri, %format );
+  my $job_id= $farm->submit( $path_or_uri );
+
+Queue a media to be decoded by the next idle worker.  The format options C<chroma>,
+C<width>, C<height>, C<pitch>, and C<lines> have the same meaning as in
+L<VideoLAN::LibVLC::MediaPlayer/set_video_format>, and any that are omitted come from the
+media's native format.  Returns a job id, which is passed to L</on_job_end> and available
+from each L<Frame|/FRAMES>.
+
+=head2 cancel
+
+  $farm->cancel($job_id);
+
+Stop a job.  If it was still queued, it is dropped without calling L</on_job_end>.
+Frames of the job that arrive after this are released without being delivered.
+
+=head2 pending_jobs
+
+Number of jobs waiting for a worker.
+
+=head2 active_jobs
+
+Number of jobs being decoded.
+
+=head2 frames_held
+
+Number of frames delivered to the parent that have not been released.
+
+=cut
+
+sub submit {
+	my $self= shift;
+	my %job= (@_ == 1 && ref($_[0]) eq 'HASH')? %{ $_[0] }
+		: (@_ == 1)? ( ($_[0] =~ m,://,? 'location' : 'path') => $_[0] )
+		: (@_ & 1) == 0? @_
+		: croak "Expected hashref, even length list, or path";
+	defined $job{path} || defined $job{location}
+		or croak "Job requires 'path' or 'location'";
+	my $id= $self->{_next_job_id}++;
+	push @{ $self->{_queue} }, [ $id, \%job ];
+	$self->_assign;
+	return $id;
+}
+
+sub cancel {
+	my ($self, $id)= @_;
+	my $n= @{ $self->{_queue} };
+	@{ $self->{_queue} }= grep $_->[0] != $id, @{ $self->{_queue} };
+	return 1 if @{ $self->{_queue} } < $n;
+	my $w= $self->{_jobs}{$id} or return 0;
+	$w->{cancelled}{$id}= 1;
+	send($w->{cmd}, pack('a1 w', 'C', $id), 0);
+	return 1;
+}
+
+sub pending_jobs { scalar @{ $_[0]{_queue} } }
+sub active_jobs  { scalar keys %{ $_[0]{_jobs} } }
+sub frames_held  { my $n= 0; $n += keys %{ $_->{held} } for @{ $_[0]{_worker} }; $n }
+
+=head2 dispatch
+
+Process every message waiting on L</fh>, calling L</on_frame> and L</on_job_end>, and
+hand queued jobs to any workers that became idle.  Also notices workers that died, ending
+their job with an error and starting a replacement.  Returns the number of messages
+processed.
+
+=head2 shutdown
+
+Tell the workers to exit, and wait for them.  This happens automatically when the object
+is destroyed.  Frames still held remain readable.
+
+=cut
+
+sub dispatch {
+	my $self= shift;
+	my $n= 0;
+	while (defined sysread($self->{_event_r}, my $buf, 1024)) {
+		++$n;
+		my $type= substr($buf, 0, 1);
+		if ($type eq 'F') {
+			$self->_dispatch_frame(unpack FRAME_PACK, $buf);
+		}
+		elsif ($type eq 'E') {
+			my (undef, $widx, $id, $status)= unpack END_PACK, $buf;
+			$self->_job_ended($widx, $id, $status);
+		}
+		else {
+			warn "Unknown farm message type '$type'";
+		}
+	}
+	$self->_reap;
+	$self->_assign;
+	return $n;
+}
+
+sub shutdown {
+	my $self= shift;
+	my @workers= grep defined, @{ $self->{_worker} };
+	for (@workers) {
+		send($_->{cmd}, 'Q', 0);
+		close $_->{cmd};
+	}
+	waitpid($_->{pid}, 0) for @workers;
+	@{ $self->{_worker} }= ();
+	1;
+}
+
+sub _spawn {
+	my ($self, $idx)= @_;
+	socketpair(my $cmd_r, my $cmd_w, AF_UNIX, SOCK_SEQPACKET, 0)
+		or croak "socketpair: $!";
+	my $held= $self->{_worker}[$idx]? $self->{_worker}[$idx]{held} : {};
+	my $pid= fork;
+	defined $pid or croak "fork: $!";
+	if (!$pid) {
+		close $cmd_w;
+		close $self->{_event_r};
+		close $_->{cmd} for grep defined, @{ $self->{_worker} };
+		my $ok= eval { $self->_worker_main($idx, $cmd_r, $held); 1 };
+		warn "farm worker $idx: $@" unless $ok;
+		# Skip destructors; everything inherited belongs to the parent
+		POSIX::_exit($ok? 0 : 1);
+	}
+	close $cmd_r;
+	$self->{_worker}[$idx]= { idx => $idx, pid => $pid, cmd => $cmd_w, job => undef, held => $held };
+}
+
+sub _assign {
+	my $self= shift;
+	for my $w (grep defined && !defined $_->{job}, @{ $self->{_worker} }) {
+		my $next= shift @{ $self->{_queue} } or last;
+		my ($id, $job)= @$next;
+		my @kv= map {
+			my $v= $job->{$_};
+			defined $v? ( $_ => ref $v eq 'ARRAY'? join(',', @$v) : "$v" ) : ()
+		} @JOB_KEYS;
+		send($w->{cmd}, pack(JOB_PACK, 'J', $id, @kv), 0)
+			or croak "send job to worker $w->{idx}: $!";
+		$w->{job}= $id;
+		$self->{_jobs}{$id}= $w;
+	}
+}
+
+sub _reap {
+	my $self= shift;
+	for my $w (grep defined, @{ $self->{_worker} }) {
+		next unless waitpid($w->{pid}, POSIX::WNOHANG()) == $w->{pid};
+		my $status= $?;
+		close $w->{cmd};
+		$self->_job_ended($w->{idx}, $w->{job}, "error: worker exited with status $status")
+			if defined $w->{job};
+		# The replacement inherits the list of slots the parent still holds
+		$self->_spawn($w->{idx});
+	}
+}
+
+sub _job_ended {
+	my ($self, $widx, $id, $status)= @_;
+	my $w= delete $self->{_jobs}{$id} or return;
+	$w->{job}= undef if defined $w->{job} && $w->{job} == $id;
+	$status= 'cancelled' if delete $w->{cancelled}{$id};
+	$self->{on_job_end}->($self, $id, $status) if $self->{on_job_end};
+}
+
+sub _dispatch_frame {
+	my ($self, undef, $widx, $id, $slot, $seq, $time, $chroma, $width, $height, @pl)= @_;
+	my $w= $self->{_worker}[$widx] or return;
+	$w->{held}{$slot}= 1;
+	my $frame= bless {
+		farm => $self, slab => $self->{slab}, worker => $widx, job => $id, slot => $slot,
+		seq => $seq, time => $time? ($time - 1) * .001 : undef,
+		chroma => $chroma, width => $width, height => $height,
+		pitch => [ @pl[0..2] ], lines => [ @pl[3..5] ],
+	}, 'VideoLAN::LibVLC::Farm::Frame';
+	weaken($frame->{farm});
+	if ($self->{_jobs}{$id} && !$w->{cancelled}{$id} && $self->{on_frame}) {
+		$self->{on_frame}->($self, $frame);
+	}
+	# else frame goes out of scope and releases itself
+}
+
+sub _release {
+	my ($self, $frame)= @_;
+	my $w= $self->{_worker}[$frame->{worker}] or return;
+	delete $w->{held}{$frame->{slot}} or return;
+	send($w->{cmd}, pack('a1 w', 'R', $frame->{slot}), 0);
+}
+
+# Byte offset and length of each plane within a slot, with planes aligned like VLC wants.
+# Returns the total size followed by [offset, length] for each plane.
+sub _plane_layout {
+	my ($pitch, $lines)= @_;
+	my ($ofs, @layout)= (0);
+	for my $i (0 .. 2) {
+		last unless $pitch->[$i] && $lines->[$i];
+		my $len= $pitch->[$i] * $lines->[$i];
+		push @layout, [ $ofs, $len ];
+		$ofs += ($len + VideoLAN::LibVLC::PERLVLC_PLANE_PITCH_MASK())
+			& ~VideoLAN::LibVLC::PERLVLC_PLANE_PITCH_MASK();
+	}
+	return ($ofs, @layout);
+}
+
+sub _three { my $v= shift; my @v= ref $v? @$v : defined $v? ($v) : (); [ map $_ || 0, @v[0..2] ] }
+
+# The worker runs one job at a time, reading commands and libvlc callbacks from one
+# select loop.
+sub _worker_main {
+	my ($self, $idx, $cmd, $held)= @_;
+	require VideoLAN::LibVLC::MediaPlayer;
+	my $spw= $self->{slots_per_worker};
+	my @my_slots= $idx * $spw .. ($idx+1) * $spw - 1;
+	my %held= %$held;  # slots the parent has and will release
+	my $slab= $self->{slab};
+	my $event_w= $self->{_event_w};
+	my $vlc= VideoLAN::LibVLC->new(argv => $self->{argv});
+	my $sel= IO::Select->new($cmd, $vlc->callback_fh);
+	my ($job, $player, $layout, $seq, $started, $deadline, $end_status);
+
+	my $slot_picture= sub {
+		my $slot= shift;
+		my ($fmt, @planes)= @$layout;
+		VideoLAN::LibVLC::Picture->new({ %$fmt, id => $slot,
+			plane => [ map $slab->slot($slot, @$_), @planes ] });
+	};
+	my %callbacks= (
+		format => sub {
+			my ($p, $event)= @_;
+			my %fmt= %$event;
+			if (grep defined $job->{$_}, qw( chroma width height )) {
+				# Native pitch and lines don't apply to a different format
+				delete @fmt{qw( pitch lines )};
+				defined $job->{$_} and $fmt{$_}= $job->{$_}
+					for qw( chroma width height pitch lines );
+			}
+			$fmt{$_}= [ split /,/, $fmt{$_} ] for grep defined $fmt{$_} && !ref $fmt{$_}, qw( pitch lines );
+			my @free= grep !$held{$_}, @my_slots;
+			$p->set_video_format(%fmt, alloc_count => scalar(@free) || 1);
+			my $f= $p->video_format;
+			my %norm= (%$f, pitch => _three($f->{pitch}), lines => _three($f->{lines}));
+			my ($size, @planes)= _plane_layout($norm{pitch}, $norm{lines});
+			if ($size > $slab->slot_size) {
+				$end_status= "error: frame needs $size bytes but slot_size is ".$slab->slot_size;
+				return;
+			}
+			$layout= [ \%norm, @planes ];
+			$p->queue_picture($slot_picture->($_)) for @free;
+		},
+		display => sub {
+			my ($p, $event)= @_;
+			my $pic= $event->{picture} or return;
+			my $f= $layout->[0];
+			$held{$pic->id}= 1;
+			send($event_w, pack(FRAME_PACK, 'F', $idx, $job->{id}, $pic->id, ++$seq,
+				VideoLAN::LibVLC::libvlc_media_player_get_time($p) + 1,
+				$f->{chroma}, $f->{width}, $f->{height}, @{ $f->{pitch} }, @{ $f->{lines} }), 0);
+		},
+	);
+
+	while (1) {
+		for my $fh ($sel->can_read(0.1)) {
+			if ($fh == $cmd) {
+				my $got= sysread($cmd, my $buf, 65536);
+				return unless $got; # parent went away
+				my $type= substr($buf, 0, 1);
+				if ($type eq 'Q') {
+					return;
+				}
+				elsif ($type eq 'R') {
+					my (undef, $slot)= unpack 'a1 w', $buf;
+					delete $held{$slot};
+					$player->queue_picture($slot_picture->($slot))
+						if $player && $layout;
+				}
+				elsif ($type eq 'C') {
+					my (undef, $id)= unpack 'a1 w', $buf;
+					$end_status //= 'cancelled' if $job && $job->{id} == $id;
+				}
+				elsif ($type eq 'J') {
+					my (undef, $id, %kv)= unpack JOB_PACK, $buf;
+					$job= { %kv, id => $id };
+					($seq, $started, $layout, $end_status)= (0, 0, undef, undef);
+					$deadline= Time::HiRes::time() + $self->{job_timeout};
+					eval {
+						$player= $vlc->new_media_player(media => $vlc->new_media(
+							defined $kv{location}? (location => $kv{location}) : (path => $kv{path})));
+						$player->set_video_callbacks(%callbacks);
+						$player->play or die "play failed\n";
+						1;
+					} or do {
+						($end_status= "error: $@") =~ s/\s+\z//;
+					};
+				}
+			}
+			else {
+				1 while $vlc->callback_dispatch;
+			}
+		}
+		next unless $job;
+		if (!defined $end_status) {
+			if ($player->is_playing) { $started= 1 }
+			elsif ($started) { $end_status= 'ended' }
+			elsif (Time::HiRes::time() > $deadline) { $end_status= 'error: timeout waiting for playback' }
+		}
+		if (defined $end_status) {
+			# Releasing the player shuts down its picture pipe first, so this can't block
+			# on a decoder waiting for a slot the parent holds.
+			undef $player;
+			send($event_w, pack(END_PACK, 'E', $idx, $job->{id}, $end_status), 0);
+			($job, $layout)= ();
+		}
+	}
+}
+
+package VideoLAN::LibVLC::Farm::Frame;
+
+=head1 FRAMES
+
+Each frame passed to L</on_frame> is a C<VideoLAN::LibVLC::Farm::Frame> with the
+following methods.  The frame's slot belongs to the parent until L</release> is called
+or the frame object is destroyed, and then the worker will decode into it again.
+
+=head2 job
+
+The job id from L</submit>.
+
+=head2 worker
+
+Index of the worker that decoded it.
+
+=head2 seq
+
+Sequence number of the frame within the job, starting from 1.
+
+=head2 time
+
+Playback time of the frame in seconds, or undef if unknown.
+
+=head2 chroma
+
+=head2 width
+
+=head2 height
+
+=head2 pitch
+
+=head2 lines
+
+  my $pitch= $frame->pitch($plane);
+
+The layout of the picture, as in L<VideoLAN::LibVLC::Picture>.
+
+=head2 plane
+
+  my $scalar_ref= $frame->plane($plane);
+
+A read-only scalar aliasing the plane in shared memory.  Don't keep it after releasing the
+frame, because its contents will be overwritten by the next frame decoded into the slot.
+
+=head2 release
+
+Return the slot to the worker.
+
+=cut
+
+sub job    { $_[0]{job} }
+sub worker { $_[0]{worker} }
+sub seq    { $_[0]{seq} }
+sub time   { $_[0]{time} }
+sub chroma { $_[0]{chroma} }
+sub width  { $_[0]{width} }
+sub height { $_[0]{height} }
+sub pitch  { $_[0]{pitch}[$_[1] || 0] }
+sub lines  { $_[0]{lines}[$_[1] || 0] }
+
+sub plane {
+	my ($self, $i)= @_;
+	Carp::croak("Frame was already released") if $self->{released};
+	my (undef, @planes)= VideoLAN::LibVLC::Farm::_plane_layout($self->{pitch}, $self->{lines});
+	my $p= $planes[$i || 0] or return undef;
+	return $self->{slab}->slot($self->{slot}, @$p, 1);
+}
+
+sub release {
+	my $self= shift;
+	return if $self->{released}++;
+	$self->{farm}->_release($self) if $self->{farm};
+}
+
+sub DESTROY { $_[0]->release }
+
+1;
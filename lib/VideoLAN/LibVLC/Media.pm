@@ -1,7 +1,9 @@
 package VideoLAN::LibVLC::Media;
 use strict;
 use warnings;
-use VideoLAN::LibVLC;
+use VideoLAN::LibVLC qw( PERLVLC_MSG_MEDIA_STREAM_LOW );
+use VideoLAN::LibVLC::TrackList;
+use Scalar::Util 'weaken';
 use Carp;
 
 # ABSTRACT: Playable media stream
@@ -10,7 +12,9 @@ use Carp;
 =head1 DESCRIPTION
 
 This object wraps C<libvlc_media_t>, which is an open stream of playable media.
-It can be created from a file descriptor, path, or URL (L</location>).
+It can be created from a file descriptor, path, URL (L</location>), in-memory
+L</buffer>, memory-mapped file (L</mmap>), or a L</stream> that you feed
+incrementally.
 Specify one of those options to the constructor, and also a library instance
 in the L</libvlc> attribute.
 
@@ -33,11 +37,56 @@ One of 3 possible constructor parameters.
 File descriptor of media file.  Must be a "real" file handle with a defined
 C<fileno>.
 
+=head2 buffer
+
+A scalar-ref holding the entire media file in memory.  VLC reads directly from
+the scalar's buffer (no copy, and no perl code on the read path), so the scalar
+is made read-only for as long as this Media object exists.  Requires libvlc 3.0.
+
+=head2 mmap
+
+File name of media, to be memory-mapped and read directly from the mapping
+instead of going through VLC's file access module.  Requires libvlc 3.0.
+
+=head2 stream
+
+  stream => {
+    buffer_size  => $bytes,  # capacity of ring buffer, default 4MiB
+    low_water    => $bytes,  # default 1/4 of buffer_size
+    on_low_water => sub { my ($media, $event)= @_; $media->feed(...) },
+  }
+
+Create a media source whose bytes are pushed in from perl with L</feed>, for
+data generated on the fly.  VLC's input thread reads from a native ring buffer
+without any perl calls; when the amount buffered drops to C<low_water> it posts
+an event through L<VideoLAN::LibVLC/callback_dispatch> which calls
+C<on_low_water> so that you can refill it ahead of demand.  The C<$event>
+contains C<buffered> (bytes remaining) and C<total_read>.  The callback is
+called at most once per drop below the mark.  Call L</feed_eof> when there is no
+more data.
+
+The stream is not seekable, and it can only be consumed once, so don't
+L</parse> it before playback.  Requires libvlc 3.0.
+
 =cut
 
 sub path { shift->{path} }
 sub location { shift->{location} }
 sub fd { shift->{fd} }
+sub buffer { shift->{buffer} }
+sub mmap { shift->{mmap} }
+sub stream { shift->{stream} }
+
+=head2 probe_cache
+
+An optional L<VideoLAN::LibVLC::ProbeCache>.  For a media opened by L</path>
+or L</mmap>, L</parse>, L</metadata>, and L</duration> are answered from the
+cache when it holds a fresh entry for the file, and the results of a real
+parse are stored back into it.
+
+=cut
+
+sub probe_cache { shift->{probe_cache} }
 
 =head2 metadata
 
@@ -77,7 +126,102 @@ possible list is:
 
 =cut
 
-sub metadata { $_[0]{metadata} ||= $_[0]->_build_metadata }
+sub metadata {
+	$_[0]{metadata} ||= do {
+		my $probe= $_[0]->_cached_probe;
+		$probe? { %{ $probe->{metadata} } } : $_[0]->_build_metadata
+	};
+}
+
+=head2 duration
+
+Length of the media in seconds (fractional), or undef if not known.  Like
+L</metadata>, this usually isn't known until after L</parse>.
+
+=cut
+
+sub duration {
+	my $probe= $_[0]->_cached_probe;
+	my $ms= $probe? $probe->{duration} : VideoLAN::LibVLC::libvlc_media_get_duration($_[0]);
+	return $ms >= 0? $ms * .001 : undef;
+}
+
+=head2 tracks
+
+A L<VideoLAN::LibVLC::TrackList> describing the codec, resolution, frame rate,
+bitrate, etc. of each elementary stream.  The list is empty until after L</parse>.
+Requires libvlc 2.1.
+
+=cut
+
+sub tracks {
+	my $self= shift;
+	return $self->{tracks} if $self->{tracks};
+	my $probe= $self->_cached_probe;
+	my $tracks= $probe? VideoLAN::LibVLC::TrackList->new($probe->{tracks})
+		: (VideoLAN::LibVLC::TrackList::_from_media($self))[0];
+	# Don't hold onto an empty list from before the media was parsed
+	$self->{tracks}= $tracks if $probe || $tracks->count;
+	return $tracks;
+}
+
+=head2 options
+
+Arrayref of the options added to this media with L</add_option> (or the C<options> and
+C<profile> constructor parameters), in order.
+
+=head2 profile
+
+Name of the L</PROFILES> entry applied to this media, if any.
+
+=cut
+
+sub options { $_[0]{options} ||= [] }
+sub profile { $_[0]{profile} }
+
+=head1 PROFILES
+
+A profile is a named list of media options that tunes the decoder for a kind of workload.
+Apply one with the C<profile> constructor parameter, L</apply_profile>, or
+L<VideoLAN::LibVLC::MediaPlayer/profile>.  They are stored in
+C<%VideoLAN::LibVLC::Media::PROFILES>, and you can add your own.
+
+=over
+
+=item analysis
+
+Decode video as fast as possible for inspecting frames: no audio or subtitle decoding, no
+H.264/HEVC loop filter (slightly lower quality, much less CPU), speed tricks allowed, one
+decoder thread per core, and frames may be dropped if the decoder falls behind.
+
+=item thumbnail
+
+Only decode key frames, without audio or subtitles.  Combine with a seek to grab a frame
+cheaply; the picture comes from the key frame at or before the seek point.
+
+=item low-latency
+
+Minimal input caching and single-threaded decoding (frame threading adds a frame of delay
+per thread), for live sources where latency matters more than throughput.
+
+=back
+
+=cut
+
+our %PROFILES= (
+	analysis => [qw(
+		:no-audio :no-spu :no-sub-autodetect-file
+		:avcodec-fast :avcodec-skiploopfilter=4 :avcodec-threads=0 :avcodec-hurry-up
+	)],
+	thumbnail => [qw(
+		:no-audio :no-spu :no-sub-autodetect-file
+		:avcodec-skip-frame=3 :avcodec-skiploopfilter=4 :avcodec-threads=0
+	)],
+	'low-latency' => [qw(
+		:file-caching=0 :network-caching=50 :live-caching=0 :clock-jitter=0
+		:avcodec-threads=1 :avcodec-hurry-up :no-sub-autodetect-file
+	)],
+);
 
 =head1 METHODS
 
@@ -86,8 +230,14 @@ sub metadata { $_[0]{metadata} ||= $_[0]->_build_metadata }
   my $media= VideoLAN::LibVLC::Media->new(
     libvlc => $vlc,
     location => $url,      # 
-    path     => $filename, # specify only one
-    fd       => $handle,   # 
+    path     => $filename, # 
+    fd       => $handle,   # specify only one
+    buffer   => \$bytes,   # 
+    mmap     => $filename, # 
+    stream   => \%opts,    # 
+    probe_cache => $cache, # optional
+    options  => \@opts,    # optional, see add_option
+    profile  => $name,     # optional, see PROFILES
   );
 
 =cut
@@ -98,23 +248,223 @@ sub new {
 		: (@_ & 1) == 0? @_
 		: croak "Expected hashref or even length list";
 	defined $args{libvlc} or croak "Missing required attribute 'libvlc'";
-	1 == (defined $args{path}? 1 : 0) + (defined $args{location}? 1 : 0) + (defined $args{fd}? 1 : 0)
-		or croak "You must supply exactly one of 'path','location','args'";
+	1 == grep defined $args{$_}, qw( path location fd buffer mmap stream )
+		or croak "You must supply exactly one of 'path','location','fd','buffer','mmap','stream'";
 	my $self= defined $args{fd}? VideoLAN::LibVLC::libvlc_media_new_fd($args{libvlc}, fileno($args{fd}))
 		: defined $args{path}? VideoLAN::LibVLC::libvlc_media_new_path($args{libvlc}, "$args{path}")
+		: defined $args{buffer}? VideoLAN::LibVLC::_media_new_buffer($args{libvlc}, $args{buffer})
+		: defined $args{mmap}? VideoLAN::LibVLC::_media_new_mmap($args{libvlc}, "$args{mmap}")
+		: defined $args{stream}? do {
+			my $size= $args{stream}{buffer_size} || 4*1024*1024;
+			VideoLAN::LibVLC::_media_new_stream($args{libvlc}, $size, $args{stream}{low_water} // int($size/4));
+		}
 		: VideoLAN::LibVLC::libvlc_media_new_location($args{libvlc}, "$args{location}");
+	my ($options, $profile)= delete @args{qw( options profile )};
 	%$self= %args;
+	$self->_init_stream_callback if defined $args{stream};
+	$self->apply_profile($profile) if defined $profile;
+	$self->add_option(@$options) if $options;
 	return $self;
 }
 
+sub _init_stream_callback {
+	my $self= shift;
+	my $event_wr= $self->{libvlc}->_event_pipe->[1];
+	weaken($self);
+	my $cb_id= $self->{_callback_id}= $self->{libvlc}->_register_callback(sub {
+		$self && $self->_dispatch_stream_event(@_);
+	});
+	$self->_set_stream_callback(fileno($event_wr), $cb_id);
+}
+
+sub _dispatch_stream_event {
+	my ($self, $event)= @_;
+	if ($event->{event_id} == PERLVLC_MSG_MEDIA_STREAM_LOW) {
+		my $cb= $self->{stream}{on_low_water};
+		$cb->($self, $event) if $cb;
+	}
+	else {
+		warn "Unknown event ".$event->{event_id};
+	}
+}
+
+sub DESTROY {
+	my $self= shift;
+	$self->{libvlc}->_unregister_callback($self->{_callback_id})
+		if $self->{libvlc} && $self->{_callback_id};
+}
+
 =head2 parse
 
-Parse the media stream
+Parse the media stream.  If L</probe_cache> has a fresh entry for this file,
+this returns immediately without involving libvlc.
 
 =cut
 
 sub parse {
-	VideoLAN::LibVLC::libvlc_media_parse(shift);
+	my $self= shift;
+	return if $self->_cached_probe;
+	VideoLAN::LibVLC::libvlc_media_parse($self);
+	my $file= $self->_probe_file;
+	$self->{probe_cache}->store($file, $self->_probe)
+		if $self->{probe_cache} && defined $file;
 }
 
+sub _probe_file { defined $_[0]{path}? $_[0]{path} : $_[0]{mmap} }
+
+# Return the probe cache entry for this media's file, if any and still fresh
+sub _cached_probe {
+	my $self= shift;
+	return $self->{_probe} if $self->{_probe};
+	my $cache= $self->{probe_cache} or return undef;
+	my $file= $self->_probe_file;
+	return undef unless defined $file;
+	$self->{_probe}= $cache->lookup($file);
+}
+
+# Collect everything the probe cache records about a parsed media
+sub _probe {
+	my $self= shift;
+	return {
+		duration => VideoLAN::LibVLC::libvlc_media_get_duration($self),
+		metadata => $self->_build_metadata,
+		tracks   => [ $self->tracks->to_list ],
+	};
+}
+
+=head2 build_seek_index
+
+  my $count= $media->build_seek_index;
+
+Read the time of every keyframe of the first video track, for
+L<seek|VideoLAN::LibVLC::MediaPlayer/seek> in C<keyframe> mode.  libvlc doesn't expose
+keyframes, so they are read from the sample table of the file, which only MP4 and MOV files
+(not fragmented) have.  Returns the number of keyframes, or undef if the media is not such a
+file.  Dies if the file can't be read.
+
+With a L</probe_cache>, the index is stored in the entry for the file (parsing the media first
+if the entry isn't fresh), and answered from there the next time.
+
+=head2 keyframes
+
+Arrayref of the keyframe times (seconds) from L</build_seek_index> or the L</probe_cache>, or
+undef if not known.
+
+=cut
+
+sub build_seek_index {
+	my $self= shift;
+	my $kf= $self->_keyframes_ms;
+	return scalar @$kf if $kf;
+	my $file= $self->_probe_file;
+	return undef unless defined $file;
+	$kf= VideoLAN::LibVLC::_mp4_keyframes($file) or return undef;
+	$self->{_keyframes_ms}= $kf;
+	if (my $cache= $self->{probe_cache}) {
+		$self->parse;
+		my $entry= $cache->lookup($file);
+		$cache->store($file, { %$entry, keyframes => $kf }) if $entry;
+		delete $self->{_probe};
+	}
+	scalar @$kf;
+}
+
+sub keyframes {
+	my $kf= $_[0]->_keyframes_ms or return undef;
+	[ map $_ * .001, @$kf ];
+}
+
+sub _keyframes_ms {
+	my $self= shift;
+	return $self->{_keyframes_ms} if $self->{_keyframes_ms};
+	my $probe= $self->_cached_probe;
+	$probe? $probe->{keyframes} : undef;
+}
+
+=head2 add_option
+
+  $media->add_option(':no-audio', ':avcodec-threads=4', ...);
+
+Add options (the same as VLC command line options, with C<:> in place of C<-->) that apply
+only to this media.  They take effect the next time the media is played, and can't be
+removed.  Returns the media, for chaining.
+
+=head2 apply_profile
+
+  $media->apply_profile('analysis');
+
+Add the options of one of the L</PROFILES>.  Dies if the name is unknown.
+
+=cut
+
+sub add_option {
+	my $self= shift;
+	for (@_) {
+		VideoLAN::LibVLC::libvlc_media_add_option($self, "$_");
+		push @{ $self->options }, "$_";
+	}
+	$self;
+}
+
+sub apply_profile {
+	my ($self, $name)= @_;
+	my $options= $PROFILES{$name}
+		or croak "Unknown media profile '$name' (have: ".join(', ', sort keys %PROFILES).")";
+	$self->add_option(@$options);
+	$self->{profile}= $name;
+	$self;
+}
+
+=head2 tracks_batch
+
+  my @track_lists= VideoLAN::LibVLC::Media->tracks_batch(@media);
+
+Return L</tracks> for each of a list of media, fetching all the ones that aren't
+already known in a single XS call.
+
+=cut
+
+sub tracks_batch {
+	my $class= shift;
+	my @need= grep !$_->{tracks} && !$_->_cached_probe, @_;
+	my %fetched;
+	@fetched{@need}= VideoLAN::LibVLC::TrackList::_from_media(@need);
+	$_->{tracks}= $fetched{$_} for grep $fetched{$_}->count, @need;
+	return map $fetched{$_} || $_->tracks, @_;
+}
+
+=head2 feed
+
+  my $accepted= $media->feed($bytes);
+
+Append bytes to a L</stream>.  Returns the number of bytes accepted, which is
+less than C<length $bytes> if the ring buffer is full; hold on to the rest and
+feed it on the next C<on_low_water> event.  This never blocks.
+
+=head2 feed_eof
+
+Signal that no more data will be fed to a L</stream>.  VLC sees end-of-file
+once it has read what remains in the buffer.
+
+=head2 stream_buffered
+
+Number of bytes currently buffered in a L</stream>.
+
+=head2 stream_space
+
+Number of bytes that L</feed> would currently accept.
+
+=head2 stats
+
+  my $stats= $media->stats;
+
+Returns the decoder statistics of the media's input (C<libvlc_media_get_stats>) as a hashref
+of C<read_bytes>, C<input_bitrate>, C<demux_read_bytes>, C<demux_bitrate>, C<demux_corrupted>,
+C<demux_discontinuity>, C<decoded_video>, C<decoded_audio>, C<displayed_pictures>,
+C<lost_pictures>, C<played_abuffers> and C<lost_abuffers>, or undef if the media has not been
+played.  The counters are totals since playback started.  To monitor players, see
+L<sample_stats|VideoLAN::LibVLC::MediaPlayer/sample_stats>, which doesn't need polling.
+
+=cut
+
 1;
@@ -8,10 +8,19 @@ use VideoLAN::LibVLC qw(
  PERLVLC_MSG_VIDEO_FORMAT_EVENT
  PERLVLC_MSG_VIDEO_CLEANUP_EVENT
  PERLVLC_MSG_VIDEO_TRADE_PICTURE
+ PERLVLC_MSG_AUDIO_LOUDNESS_EVENT
+ PERLVLC_MSG_PICTURE_RELEASED
+ PERLVLC_MSG_MEDIA_STATS
+ PERLVLC_MSG_VIDEO_FORMAT_ANSWERED
+ PERLVLC_LOCK_SCRATCH
+ PERLVLC_LOCK_NULL
  PERLVLC_PLANE_PITCH_MASK );
+use VideoLAN::LibVLC::Media ();
+use VideoLAN::LibVLC::Picture ();
 use Socket qw( AF_UNIX SOCK_DGRAM );
 use Scalar::Util 'weaken';
 use IO::Handle;
+use Time::HiRes ();
 use Carp;
 
 # ABSTRACT: Media Player
@@ -40,7 +49,8 @@ The L<VideoLAN::LibVLC::Media> object being played
 
 =head2 is_playing
 
-Boolean, whether playback is active
+Boolean, whether playback is active.  With L</cached_clock>, this is true from the "Playing"
+event until the player pauses, stops, or reaches the end.
 
 =head2 will_play
 
@@ -60,7 +70,6 @@ sub libvlc { shift->{libvlc} }
 
 sub media { my $self= shift; $self->set_media(@_) if @_; $self->{media} }
 
-*is_playing=  *VideoLAN::LibVLC::libvlc_media_player_is_playing;
 *will_play=   *VideoLAN::LibVLC::libvlc_media_player_will_play;
 *is_seekable= *VideoLAN::LibVLC::libvlc_media_player_is_seekable;
 *can_pause=   *VideoLAN::LibVLC::libvlc_media_player_can_pause;
@@ -73,7 +82,7 @@ Writing this attribute calls L</set_rate>.
 
 =head2 length
 
-The length in seconds of the media
+The length in seconds of the media, or 0 if not known.
 
 =head2 title_count
 
@@ -98,7 +107,7 @@ Setting this attribute changes the chapter.
 
 =cut
 
-sub length { &VideoLAN::LibVLC::libvlc_media_player_get_length * .001; }
+sub length { &_get_length * .001; }
 
 sub title_count {
 	my $n= &VideoLAN::LibVLC::libvlc_media_player_title_count;
@@ -131,16 +140,128 @@ The position within the media file, measured as a fraction of media length. (0..
 Undef until playback begins.
 Setting this attribute performs a seek.
 
+=head2 cached_clock
+
+  $player->cached_clock(1);
+
+Each read of L</time>, L</position>, L</length>, or L</is_playing> normally asks libvlc, which
+locks the player and its input thread.  When this attribute is true, the player instead
+listens to libvlc's "TimeChanged", "PositionChanged", "LengthChanged" and state events, and
+these accessors read a copy kept up to date by them, without any lock.  libvlc reports the
+time only a few times per second, so while playing, the time is advanced by the elapsed
+(monotonic) time multiplied by the L</rate>.  A seek or L</set_rate> through this object
+updates the copy right away.
+
+Before libvlc 2.2 there is no "LengthChanged" event, and the length is only read when the
+clock is enabled.
+
+=head2 clock
+
+  my $clock= $player->clock;
+  # { state => STATE_PLAYING, playing => 1, time => 12.34, position => .2057,
+  #   length => 60, rate => 1, events => 57 }
+
+A consistent snapshot of the L</cached_clock>, or undef if it isn't enabled.  C<state> is one
+of the C<:state_t> constants of L<VideoLAN::LibVLC>, C<time> and C<position> are undef when
+not known, and C<events> counts the libvlc events received so far.
+
 =cut
 
 sub time {
-	@_ > 1? VideoLAN::LibVLC::libvlc_media_player_set_time($_[0], int($_[1] * 1000))
-	: do { my $x= &VideoLAN::LibVLC::libvlc_media_player_get_time; $x >= 0? $x * .001 : undef; };
+	return do { my $x= &_get_time; $x >= 0? $x * .001 : undef; } unless @_ > 1;
+	$_[0]->seek($_[1]);
 }
 
 sub position {
-	@_ > 1? &VideoLAN::LibVLC::libvlc_media_player_set_position
-	: do { my $x= &VideoLAN::LibVLC::libvlc_media_player_get_position; $x >= 0? $x : undef; };
+	return do { my $x= &_get_position; $x >= 0? $x : undef; } unless @_ > 1;
+	$_[0]->_seek_start(0);
+	&VideoLAN::LibVLC::libvlc_media_player_set_position;
+	$_[0]->_clock_seek(-1, $_[1]);
+}
+
+sub cached_clock {
+	my $self= shift;
+	$self->_clock_attach($_[0]? 1 : 0) if @_;
+	$self->_clock_attached;
+}
+
+=head2 audio_track
+
+=head2 video_track
+
+=head2 spu
+
+The ID of the active audio, video, or subtitle track, or -1 if that kind of output is
+disabled.  Setting this attribute selects a track by ID (see L</audio_tracks>) or disables
+the output with -1.  Tracks only exist once playback has started, so to avoid decoding audio
+or subtitles at all, use a media L<profile|/profile> instead.
+
+=head2 audio_track_count
+
+=head2 video_track_count
+
+=head2 spu_count
+
+Number of tracks of each kind, including the "disable" pseudo-track, or -1 if there is no
+active input.
+
+=head2 profile
+
+The name of a L<media profile|VideoLAN::LibVLC::Media/PROFILES> to apply to every media given
+to this player.  Media that already have a profile are left alone.  Setting it does not
+affect the media that is already loaded, since options only take effect when playback
+starts; call L</set_media> again for that.
+
+=head2 decoder_threads
+
+If set, the number of threads the video decoder may use, added to each media given to this
+player as C<:avcodec-threads=N> (after the L</profile>, so it wins).  Like the profile, it
+takes effect when a media is loaded.  L<VideoLAN::LibVLC::Scheduler> sets this to share the
+CPUs between many players.
+
+=cut
+
+sub _track_attr {
+	my ($get, $set)= @_;
+	sub {
+		@_ > 1? ($set->(@_) == 0 or croak "Can't select track $_[1]")
+		: $get->(@_)
+	}
+}
+*audio_track= _track_attr(\&VideoLAN::LibVLC::libvlc_audio_get_track, \&VideoLAN::LibVLC::libvlc_audio_set_track);
+*video_track= _track_attr(\&VideoLAN::LibVLC::libvlc_video_get_track, \&VideoLAN::LibVLC::libvlc_video_set_track);
+*spu=         _track_attr(\&VideoLAN::LibVLC::libvlc_video_get_spu,   \&VideoLAN::LibVLC::libvlc_video_set_spu);
+*audio_track_count= *VideoLAN::LibVLC::libvlc_audio_get_track_count;
+*video_track_count= *VideoLAN::LibVLC::libvlc_video_get_track_count;
+*spu_count=         *VideoLAN::LibVLC::libvlc_video_get_spu_count;
+
+sub profile {
+	my $self= shift;
+	if (@_) {
+		my $name= shift;
+		!defined $name or $VideoLAN::LibVLC::Media::PROFILES{$name}
+			or croak "Unknown media profile '$name'";
+		$self->{profile}= $name;
+	}
+	$self->{profile};
+}
+
+sub decoder_threads {
+	my $self= shift;
+	$self->{decoder_threads}= shift if @_;
+	$self->{decoder_threads};
+}
+
+sub _prepare_media {
+	my ($self, $media)= @_;
+	$media->apply_profile($self->{profile})
+		if defined $self->{profile} && !defined $media->profile;
+	return unless $self->{decoder_threads};
+	# Media can be set again (such as by the Scheduler), so only add the option if it
+	# isn't already in effect.  VLC uses the last of repeated options.
+	my $opt= ':avcodec-threads='.$self->{decoder_threads};
+	my ($cur)= grep /^:avcodec-threads=/, reverse @{ $media->options };
+	$media->add_option($opt) unless defined $cur && $cur eq $opt;
 }
 
 =head1 METHODS
@@ -148,7 +269,10 @@ sub position {
 =head2 new
 
   my $player= VideoLAN::LibVLC::MediaPlayer->new(
-    libvlc => $vlc,
+    libvlc  => $vlc,
+    media   => $media,     # optional
+    profile => 'analysis', # optional
+    decoder_threads => 4,  # optional
   );
 
 =cut
@@ -159,14 +283,25 @@ sub new {
 		: (@_ & 1) == 0? @_
 		: croak "Expected hashref or even length list";
 	defined $args{libvlc} or croak "Missing required attribute 'libvlc'";
-	my $self= !defined $args{media}? VideoLAN::LibVLC::libvlc_media_player_new($args{libvlc})
-		: VideoLAN::LibVLC::libvlc_media_player_new_from_media($args{libvlc}->new_media($args{media}));
+	!defined $args{profile} or $VideoLAN::LibVLC::Media::PROFILES{$args{profile}}
+		or croak "Unknown media profile '$args{profile}'";
+	my $media= !defined $args{media}? undef
+		: ref($args{media}) && ref($args{media})->isa('VideoLAN::LibVLC::Media')? $args{media}
+		: $args{libvlc}->new_media($args{media});
+	_prepare_media(\%args, $media) if $media;
+	my $self= !defined $media? VideoLAN::LibVLC::libvlc_media_player_new($args{libvlc})
+		: VideoLAN::LibVLC::libvlc_media_player_new_from_media($media);
 	%$self= %args;
+	$self->{media}= $media if defined $media;
 	return $self;
 }
 
 sub DESTROY {
 	my $self= shift;
+	# A stream source could have the input thread waiting for data, which would block
+	# the player from being released.  (Not from a clone in another iThread, though.)
+	$self->{media}->_stream_close
+		if $self->{media} && $self->{media}->stream && !$self->{media}->_is_clone;
 	$self->{libvlc}->_unregister_callback($self->{_callback_id})
 		if $self->{libvlc} && $self->{_callback_id};
 }
@@ -179,13 +314,22 @@ L<VideoLAN::LibVLC/new_media>.
 
 This can also be called by setting the L</media> attribute.
 
+The player holds a reference to the Media object for as long as it is the
+active source, since media read from a L<buffer|VideoLAN::LibVLC::Media/buffer>
+must outlive the decoder's use of it.
+
+If the player has a L</profile>, it is applied to the media unless the media
+already has one, followed by L</decoder_threads>.
+
 =cut
 
 sub set_media {
 	my ($self, $media)= @_;
 	$media= $self->libvlc->new_media($media)
 		unless ref($media) && ref($media)->isa('VideoLAN::LibVLC::Media');
+	$self->_prepare_media($media);
 	VideoLAN::LibVLC::libvlc_media_player_set_media($self, $media);
+	$self->{media}= $media;
 }
 
 =head2 play
@@ -198,16 +342,69 @@ Requires libvlc 1.1.1
 
 =head2 stop
 
+If the media is a L<stream|VideoLAN::LibVLC::Media/stream>, stopping also
+ends the stream, since the input thread might be waiting on it for more data.
+
 =head2 set_rate
 
 =cut
 
-sub play { VideoLAN::LibVLC::libvlc_media_player_play(shift) == 0 }
+sub play {
+	my $self= shift;
+	$self->_play_start;
+	VideoLAN::LibVLC::libvlc_media_player_play($self) == 0;
+}
 *pause = *VideoLAN::LibVLC::libvlc_media_player_pause;
-*stop  = *VideoLAN::LibVLC::libvlc_media_player_stop;
+sub stop {
+	my $self= shift;
+	$self->{media}->_stream_close if $self->{media} && $self->{media}->stream;
+	VideoLAN::LibVLC::libvlc_media_player_stop($self);
+}
 *set_pause = *VideoLAN::LibVLC::libvlc_media_player_set_pause
 	if defined *VideoLAN::LibVLC::libvlc_media_player_set_pause;
-*set_rate  = *VideoLAN::LibVLC::libvlc_media_player_set_rate;
+sub set_rate {
+	my $ret= &VideoLAN::LibVLC::libvlc_media_player_set_rate;
+	$_[0]->_clock_set_rate($_[1]) if $ret == 0;
+	$ret;
+}
+
+=head2 seek
+
+  $player->seek($seconds);
+  my $landed= $player->seek($seconds, mode => 'keyframe');
+
+Seek to a time.  In the default C<accurate> mode, this is the same as setting L</time>: the
+decoder starts from the keyframe before the target and decodes up to it, which for codecs
+with long GOPs can take a good part of a second.  In C<keyframe> mode, the target moves back
+to the keyframe at or before it, so that the first frame decoded is the one displayed.  This
+uses the L<seek index|VideoLAN::LibVLC::Media/build_seek_index> of the media, and is an
+accurate seek if the media has none.
+
+Returns the time sought, in seconds.  The time until the next frame is displayed is measured
+in L</lock_stats>.
+
+=cut
+
+sub seek {
+	my ($self, $seconds, %opts)= @_;
+	my $mode= $opts{mode} // 'accurate';
+	$mode eq 'accurate' || $mode eq 'keyframe' or croak "Unknown seek mode '$mode'";
+	my $ms= int($seconds * 1000);
+	my $kf= $mode eq 'keyframe' && $self->{media}? $self->{media}->_keyframes_ms : undef;
+	if ($kf && @$kf) {
+		# last keyframe at or before the target, or the first one
+		my ($lo, $hi)= (0, $#$kf);
+		while ($lo < $hi) {
+			my $mid= ($lo + $hi + 1) >> 1;
+			if ($kf->[$mid] <= $ms) { $lo= $mid } else { $hi= $mid - 1 }
+		}
+		$ms= $kf->[$lo];
+	}
+	$self->_seek_start($kf && @$kf? 1 : 0);
+	VideoLAN::LibVLC::libvlc_media_player_set_time($self, $ms);
+	$self->_clock_seek($ms, -1);
+	$ms * .001;
+}
 
 =head2 set_video_title_display
 
@@ -328,9 +525,10 @@ playback begins.
 Once you know the format, you can create picture buffers for VLC to render into.
 These are instances of L<VideoLAN::LibVLC::Picture>.  If you only specify the dimensions of
 the picture buffer, it will allocate memory internally.  You may also provide the memory of
-the planes as scalar-refs, but this is likely to crash your program if you're not careful,
-and should only be done if you have special requirements like rendering into a memory-map
-(such as created by L<File::Map> or L<OpenGL::Sandbox::Buffer>).
+the planes as scalar-refs, or as raw addresses with an owner object, but this is likely to
+crash your program if you're not careful, and should only be done if you have special
+requirements like rendering into a memory-map (such as created by L<File::Map> or
+L<OpenGL::Sandbox::Buffer>).
 
 After creating a picture buffer, pass it to L<queue_picture>.  This gives the internal VLC
 thread access to them.
@@ -439,6 +637,18 @@ few of of the Picture objects.
 This is called for any picture which the decoder wasn't able to use, either due being the wrong
 format, or at the end of playback of there were extra pictures queued.
 
+=item released
+
+  released => sub {
+    my ($player, $event)= @_;
+    ... # $event->{picture} is back from another thread
+  }
+
+This is called when the last reference to a picture that was
+L<shared with other threads|VideoLAN::LibVLC::Picture/THREADS> is dropped by one of them,
+after this player's thread had already dropped its own.  Without this callback, the picture is
+queued to the decoder again if it still matches L</video_format>, and freed otherwise.
+
 =item opaque
 
   opaque => $my_object
@@ -462,7 +672,7 @@ sub set_video_callbacks {
 	# Can't specify 'cleanup' without 'format'
 	!$opts{cleanup} || ($opts{format} || $cur->{format})
 		or croak "Can't specify 'cleanup' without 'format'";
-	for (qw( lock unlock display cleanup format discard )) {
+	for (qw( lock unlock display cleanup format discard released )) {
 		my $name= $_;
 		if (exists $opts{$_}) {
 			$cur->{$_}= $opts{$_};
@@ -479,8 +689,10 @@ sub set_video_callbacks {
 		$self && $self->_dispatch_callback(@_);
 	});
 	
-	# Now register the callbacks in the XS code
-	$self->_enable_video_callbacks(fileno($event_wr), $cb_id, ['lock', keys %$cur]);
+	# Now register the callbacks in the XS code.  A format policy needs the format callback.
+	my @enable= ('lock', grep $_ ne 'released', keys %$cur);
+	push @enable, 'format' if $self->{_format_policy} && !$cur->{format};
+	$self->_enable_video_callbacks(fileno($event_wr), $cb_id, \@enable);
 	1;
 }
 
@@ -495,6 +707,12 @@ sub set_video_callbacks {
     alloc_count => $n        # number of concurrent buffers you plan to provide
   );
 
+Any C<pitch> or C<lines> you leave out are computed from the chroma's plane layout (see
+L<VideoLAN::LibVLC::Picture/plane_layout>), so for planar formats like C<I420> or C<NV12> you
+only need the chroma and dimensions.  Replying to the C<format> callback with the native chroma
+this way avoids a conversion inside VLC.  The complete C<pitch> and C<lines> arrays are then
+available in L</video_format>.
+
 If this is called without registering a C<format> callback, it will call
 C<libvlc_video_set_format> which forces VLC to rescale the pictures to your desired format.
 If called after registering a C<format> callback, it will send this as a reply to the video
@@ -502,6 +720,8 @@ thread, with mostly the same effect (but after you've had the opportunity to see
 native format is).
 
 See L<VideoLAN::LibVLC::Picture> for discussion of the parameters other than C<alloc_count>.
+The L<plane allocator|VideoLAN::LibVLC::Picture/alloc> options C<alloc>, C<prefault>, and
+C<mlock> may also be given here, and are used by L</new_picture>.
 C<alloc_count> is the number of pictures you plan to make available to the decoder at one time,
 and might be used by the decoder to decide whether to allocate its own temporary buffers if
 it can't get enough supplied by the application.
@@ -521,8 +741,12 @@ sub set_video_format {
 		for qw( chroma width height );
 	!$self->{video_format}
 		or croak "Video format already set";
-	(ref $opts->{pitch}? $opts->{pitch}[0] : $opts->{pitch}) ||= ( ($opts->{width} * 4 + PERLVLC_PLANE_PITCH_MASK) & ~PERLVLC_PLANE_PITCH_MASK );
-	(ref $opts->{lines}? $opts->{lines}[0] : $opts->{lines}) ||= $opts->{height};
+	# Unset pitch and lines are filled in from the chroma's plane layout, but if the chroma
+	# is unknown assume 4 bytes per pixel.
+	if (!VideoLAN::LibVLC::Picture->plane_layout(@{$opts}{qw( chroma width height )})) {
+		(ref $opts->{pitch}? $opts->{pitch}[0] : $opts->{pitch}) ||= ( ($opts->{width} * 4 + PERLVLC_PLANE_PITCH_MASK) & ~PERLVLC_PLANE_PITCH_MASK );
+		(ref $opts->{lines}? $opts->{lines}[0] : $opts->{lines}) ||= $opts->{height};
+	}
 	if ($self->_video_callbacks->{format}) {
 		croak "Player is not ready for format information until after callback"
 			unless $self->_need_format_response;
@@ -530,9 +754,66 @@ sub set_video_format {
 	}
 	$self->_set_video_format($opts);
 	$self->{video_format}{$_}= $opts->{$_} for qw( chroma width height pitch lines alloc_count );
+	# plane allocator options for new_picture
+	defined $opts->{$_} and $self->{video_format}{$_}= $opts->{$_} for qw( alloc prefault mlock );
 	1;
 }
 
+=head2 set_video_format_policy
+
+  $p->set_video_format_policy(
+    chroma      => [ 'I420', 'RGBA' ], # keep the native chroma if listed, else the first
+    max_width   => 1280,               # scale down to fit, keeping the aspect
+    max_height  => 720,
+    align       => 64,                 # pitch alignment in bytes, default PERLVLC_PLANE_PITCH_MUL
+    alloc_count => 8,                  # pictures to allocate, default 8, at most 32
+  );
+
+Decide the video format ahead of time, so the video thread can answer VLC's format callback
+without waiting for perl.  Normally the decoder stops at the format callback until the main
+thread gets around to dispatching it, replying with L</set_video_format>, and queueing
+pictures; with a policy, the video thread picks the chroma and size, allocates the pictures
+itself, and decoding continues right away.  The player then adopts the pictures on the next
+L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch>, after which L</video_format> holds
+the result, and the pictures come back through the C<display> callback as usual.
+
+If the chosen chroma has no known plane layout (see
+L<VideoLAN::LibVLC::Picture/plane_layout>), or the
+L<memory budget|VideoLAN::LibVLC::Picture/memory_budget> has no room for even one picture,
+the format event goes to perl as before, and the C<format> callback (or the default reply)
+handles it.  The plane allocator options C<alloc>, C<prefault>, and C<mlock> apply to the
+pictures of the policy, and they get the L</picture_priority> of the player.
+
+Call with no arguments to remove the policy.  This can't be changed during playback.
+
+=head2 time_to_format
+
+=head2 time_to_first_frame
+
+  $p->play;
+  ...
+  printf "first frame after %.3fs\n", $p->time_to_first_frame;
+
+Seconds from the last call to L</play> until VLC asked for the video format, and until the
+first picture was displayed, or undef if that hasn't happened yet.
+
+=cut
+
+sub set_video_format_policy {
+	my $self= shift;
+	my $opts= @_ == 1? $_[0] : { @_ };
+	!$self->is_playing or croak "Can't change the format policy during playback";
+	if (%$opts) {
+		$self->_set_format_policy({ priority => $self->picture_priority, %$opts });
+		$self->{_format_policy}= { %$opts };
+	} else {
+		$self->_set_format_policy(undef);
+		delete $self->{_format_policy};
+	}
+	# register the format callback, or not
+	$self->set_video_callbacks($self->_video_callbacks);
+}
+
 my %event_id_to_name= (
 	PERLVLC_MSG_VIDEO_LOCK_EVENT   , 'lock',
 	PERLVLC_MSG_VIDEO_UNLOCK_EVENT , 'unlock',
@@ -540,13 +821,19 @@ my %event_id_to_name= (
 	PERLVLC_MSG_VIDEO_FORMAT_EVENT , 'format',
 	PERLVLC_MSG_VIDEO_CLEANUP_EVENT, 'cleanup',
 	PERLVLC_MSG_VIDEO_TRADE_PICTURE, 'discard',
+	PERLVLC_MSG_AUDIO_LOUDNESS_EVENT, 'loudness',
+	PERLVLC_MSG_PICTURE_RELEASED   , 'released',
+	PERLVLC_MSG_MEDIA_STATS        , 'stats',
+	PERLVLC_MSG_VIDEO_FORMAT_ANSWERED, 'format_answered',
 );
 
 sub _dispatch_callback {
 	my ($self, $event)= @_;
-	my $opaque= $self->_video_callbacks->{opaque} || $self;
 	if (my $cbname= $event_id_to_name{$event->{event_id}}) {
-		$self->can('_dispatch_cb_'.$cbname)->($self, $event, $self->_video_callbacks->{$cbname}, $opaque);
+		my $cbs= $cbname eq 'loudness'? $self->_audio_callbacks
+			: $cbname eq 'stats'? ($self->{_stats_callbacks} || {})
+			: $self->_video_callbacks;
+		$self->can('_dispatch_cb_'.$cbname)->($self, $event, $cbs->{$cbname}, $cbs->{opaque} || $self);
 	}
 	else {
 		warn "Unknown event ".$event->{event_id};
@@ -562,12 +849,25 @@ sub _dispatch_cb_format {
 	if ($cb) { $cb->($opaque, $event) }
 	# If user didn't register a callback, reply to the message saying format is OK.
 	else {
-		$event->{alloc_count}= 8;
+		# Take 8, or as many as the picture memory budget has room for.  With no room at all,
+		# alloc_count 0 tells the video thread the format failed.
+		my $bytes= 0;
+		$bytes += $event->{pitch}[$_] * $event->{lines}[$_] for 0..2;
+		$event->{alloc_count}= VideoLAN::LibVLC::Picture->_budget_fit($bytes, $self->picture_priority, 8);
 		$self->set_video_format($event);
-		$self->queue_new_picture(id => $_) for 1..8;
+		$self->queue_new_picture(id => $_) for 1..$event->{alloc_count};
 	}
 }
 
+# The video thread answered the format from the format policy, and allocated the pictures
+sub _dispatch_cb_format_answered {
+	my ($self, $event)= @_;
+	$self->_adopt_pictures(delete $event->{pictures});
+	$self->{video_format}= { map +($_ => $event->{$_}), qw( chroma width height pitch lines alloc_count ) };
+	my $policy= $self->{_format_policy};
+	defined $policy->{$_} and $self->{video_format}{$_}= $policy->{$_} for qw( alloc prefault mlock );
+}
+
 sub _dispatch_cb_lock {
 	my ($self, $event, $cb, $opaque)= @_;
 	$cb->($opaque, $event) if $cb;
@@ -586,6 +886,7 @@ sub _dispatch_cb_display {
 	my ($self, $event, $cb, $opaque)= @_;
 	# 'display' callback needs to detach the picture object from the player
 	$event->{picture}= $self->_dequeue_picture($event->{picture});
+	$self->_snapshot($event->{picture}, $opaque) if $self->{_snapshot} && $event->{picture};
 	$cb->($opaque, $event) if $cb;
 }
 
@@ -594,9 +895,25 @@ sub _dispatch_cb_cleanup {
 	$cb->($opaque, $event) if $cb;
 }
 
+sub _dispatch_cb_released {
+	my ($self, $event, $cb, $opaque)= @_;
+	return $cb->($opaque, $event) if $cb;
+	$self->_recycle_picture($event->{picture});
+}
+
+# Queue a picture to the decoder again if it still fits, else let it be freed
+sub _recycle_picture {
+	my ($self, $pic)= @_;
+	my $fmt= $self->{video_format};
+	$self->queue_picture($pic)
+		if $fmt && !$self->_need_format_response && $fmt->{chroma} eq $pic->chroma
+			&& $fmt->{width} == $pic->width && $fmt->{height} == $pic->height
+			&& $fmt->{pitch}[0] == $pic->pitch(0);
+}
+
 sub _dispatch_cb_discard {
 	my ($self, $event, $cb, $opaque)= @_;
-	$event->{picture}= $self->dequeue_picture(undef, $event->{picture});
+	$event->{picture}= $self->_dequeue_picture($event->{picture});
 	$cb->($opaque, $event) if $cb;
 }
 
@@ -620,6 +937,18 @@ had to the picture and let the Player hold onto it until time for a C<display> e
 
 A shorthand combination of the above methods.
 
+=head2 picture_priority
+
+  $player->picture_priority(-1);
+
+The L<priority|VideoLAN::LibVLC::Picture/priority> given to pictures from L</new_picture>,
+default 0.  When you register callbacks without a C<format> callback, the player accepts the
+native format and queues 8 pictures, or as many as the
+L<memory_budget|VideoLAN::LibVLC::Picture/memory_budget> has room for at this priority.  If
+there is no room for even one, the format is refused, and VLC plays without video.  Give
+players that can fall behind a negative priority, so they get fewer buffers when memory runs
+short.
+
 =head2 queued_picture_count
 
 Number of pictures which have been given to the decoder thread and have not yet come back for
@@ -632,26 +961,357 @@ logged on file descriptor 2 (stderr).  Note that due to the multi-threaded natur
 decoder, this won't be synchronized with changes to STDERR by perl, and could result in
 garbled messages in some cases.  This is only intended for debugging use.
 
+=head2 set_lock_timeout
+
+  $player->set_lock_timeout($seconds, $policy);
+
+By default, the decoder thread waits indefinitely for you to L</queue_picture>, which means
+a slow perl event loop stalls playback.  This sets an upper limit on that wait, after which the
+C<$policy> decides what happens to the frame:
+
+=over
+
+=item C<'scratch'> (default)
+
+Decode into a private buffer owned by the player, and discard the frame.  No C<unlock> or
+C<display> event is delivered for it.  Each such frame gets its own buffer for as long as the
+decoder holds it, so the decoder's reference frames stay intact.  The player has 8 of these
+buffers; if the decoder holds all of them, the frame falls back to C<'null'>.
+
+=item C<'null'>
+
+Hand the decoder NULL planes, the same as when the picture pipe fails.  LibVLC treats this
+as a lost frame, which for some codecs causes artifacts until the next keyframe.
+
+=back
+
+Pass C<undef> (or a negative number) as C<$seconds> to wait forever again.  A picture that
+you queue after the timeout is not lost; it is used for the next frame.  The timeout has
+millisecond resolution.
+
+=head2 lock_timeout
+
+The current timeout in seconds, or undef if the decoder waits forever.
+
+=head2 lock_stats
+
+  my $stats= $player->lock_stats;
+  my $stats= $player->lock_stats(1); # and reset the counters
+
+Returns a hashref of counters from the decoder thread:
+
+=over
+
+=item locks
+
+Number of pictures the decoder asked for.
+
+=item timeouts
+
+Number of those that hit the L</set_lock_timeout> limit.
+
+=item scratch
+
+Number of frames decoded into the scratch buffer and dropped.
+
+=item null
+
+Number of frames refused with NULL planes.
+
+=item wait_max, wait_total
+
+Longest, and total, seconds the decoder spent waiting for a picture.  Waits for pictures that
+were already queued are not measured, and don't count.
+
+=item seeks, keyframe_seeks
+
+Number of seeks through L</seek>, L</time> or L</position>, and how many of those moved to a
+keyframe of the seek index.
+
+=item seeks_done, seek_latency_last, seek_latency_max, seek_latency_total
+
+Number of those seeks that were followed by a displayed frame, and the last, longest, and
+total seconds from the seek to that frame.  A seek made before the frame of the previous one
+replaces it.  This is only measured with L</set_video_callbacks>.
+
+=back
+
 =cut
 
+my %lock_policy= ( scratch => PERLVLC_LOCK_SCRATCH, null => PERLVLC_LOCK_NULL );
+sub set_lock_timeout {
+	my ($self, $seconds, $policy)= @_;
+	my $policy_id= $lock_policy{$policy // 'scratch'}
+		// croak "Unknown lock policy '$policy'";
+	$self->_set_lock_policy(defined $seconds && $seconds >= 0? int($seconds * 1000 + .5) : -1, $policy_id);
+	$self;
+}
+
+sub lock_timeout {
+	my $ms= shift->lock_timeout_ms;
+	$ms < 0? undef : $ms * .001;
+}
+
 sub new_picture {
 	my $self= shift;
 	my $fmt= $self->{video_format}
 		or croak "Video format is not yet known/set";
-	$fmt= { %$fmt, @_ == 1? %{$_[0]} : @_ }
-		if @_;
+	$fmt= { %$fmt, priority => $self->picture_priority, @_ == 1? %{$_[0]} : @_ };
 	VideoLAN::LibVLC::Picture->new($fmt);
 }
 
+sub picture_priority {
+	my $self= shift;
+	$self->{picture_priority}= shift if @_;
+	$self->{picture_priority} // 0;
+}
+
 sub queue_new_picture {
 	my $self= shift;
 	$self->queue_picture($self->new_picture(@_));
 }
 
-=head1 AUDIO CALLBACK API (TODO)
+=head2 snapshot_every
+
+  $player->snapshot_every(10, path => 'thumbs/%05d.png');
+  $player->snapshot_every(10,
+    path    => sub { my ($player, $n)= @_; ... return $path },
+    on_done => sub { my ($player, $event)= @_; warn $event->{error} if $event->{error} },
+  );
+  $player->snapshot_every(0); # stop
+
+Write a displayed picture to an image file every C<$seconds> of playback (by L</time>, or
+by the wall clock while the player doesn't report a time), starting with the next one.  The
+encoding happens in the background with L<encode_async|VideoLAN::LibVLC::Picture/encode_async>
+from a copy of the planes, so the picture still goes on to your C<display> callback as usual.
+
+C<path> is a C<sprintf> pattern given the number of the snapshot (counting from 0), or a
+coderef called with the player (or C<opaque>) and that number, returning the path.  C<format>
+and C<level> are passed on to C<encode_async>.  C<on_done> receives the player (or C<opaque>)
+and the event.  Pictures of a chroma that L<can't be encoded|VideoLAN::LibVLC::Picture/can_encode>
+are skipped.
 
-I have not implemented this yet.  Patches welcome.
+This needs C<display> events, so if you haven't set a C<display> callback, one is set which
+gives each picture back to the decoder.  Like L</set_video_callbacks>, that can't be done
+during playback.
 
 =cut
 
+sub snapshot_every {
+	my ($self, $seconds, %opts)= @_;
+	if (!$seconds) {
+		delete $self->{_snapshot};
+		return 1;
+	}
+	defined $opts{path} or croak "snapshot_every requires 'path'";
+	unless ($self->_video_callbacks->{display}) {
+		weaken(my $player= $self);
+		$self->set_video_callbacks(%{ $self->_video_callbacks },
+			display => sub { $player && $player->_recycle_picture($_[1]{picture}) });
+	}
+	$self->{_snapshot}= { %opts, every => $seconds, count => 0 };
+	1;
+}
+
+sub _snapshot {
+	my ($self, $pic, $opaque)= @_;
+	my $s= $self->{_snapshot};
+	my $t= $self->time;
+	my $clock= defined $t && $t > 0? 'media' : 'wall';
+	$t= Time::HiRes::time() if $clock eq 'wall';
+	# a change of clock or a seek backward starts over
+	return if $clock eq ($s->{clock} // '') && $t >= $s->{last} && $t < $s->{last} + $s->{every};
+	return unless $pic->can_encode;
+	@{$s}{qw( clock last )}= ($clock, $t);
+	my $n= $s->{count}++;
+	my $on_done= $s->{on_done};
+	$pic->encode_async(
+		libvlc => $self->{libvlc},
+		path   => ref $s->{path} eq 'CODE'? $s->{path}->($opaque, $n) : sprintf($s->{path}, $n),
+		format => $s->{format},
+		level  => $s->{level},
+		copy   => 1,
+		$on_done? ( on_done => sub { $on_done->($opaque, @_) } ) : (),
+	);
+}
+
+=head1 AUDIO CALLBACK API
+
+Passing decoded audio to perl is not implemented yet, but the player can use a native audio
+sink that measures loudness.
+
+=head2 enable_loudness_meter
+
+  $player->enable_loudness_meter(
+    rate     => 48000,     # sample rate to measure at
+    channels => 2,         # VLC up/down-mixes to this many channels
+    channel_weights => [ 1, 1 ],  # per channel, default 1.0 each
+    interval => 1,         # seconds of audio between summary events, 0 to disable
+    speed    => 1,         # integer multiple of real-time, see below
+    loudness => sub { my ($player, $summary)= @_; ... },
+  );
+  $player->play;
+  ...
+  my $summary= $player->loudness;
+
+Replace the audio output of this player with an EBU R128 (ITU-R BS.1770-4) loudness meter.
+VLC converts the audio to floating point samples at C<rate> with C<channels> channels, and all
+the filtering, gating and true-peak interpolation run on VLC's audio thread.  Perl only sees a
+summary every C<interval> seconds of audio, delivered to the C<loudness> callback by
+L<VideoLAN::LibVLC/callback_dispatch>, and a final summary (with C<final> set) when the audio
+drains at the end of the media.  Summary events are dropped rather than stalling the audio
+thread if you fall behind dispatching them; L</loudness> always returns the current values.
+
+The summary is a hashref of:
+
+=over
+
+=item momentary
+
+Loudness of the latest 400ms, in LUFS.
+
+=item short_term
+
+Loudness of the latest 3s, in LUFS.
+
+=item integrated
+
+Gated loudness of everything measured so far, in LUFS.
+
+=item range
+
+Loudness range (EBU Tech 3342), in LU.
+
+=item true_peak
+
+Maximum of the signal reconstructed with 4x oversampling (2x at 96KHz), in dBTP.
+
+=item sample_peak
+
+Maximum absolute sample value, in dBFS.
+
+=item samples
+
+Number of sample frames measured.
+
+=item final
+
+True if this is the summary sent when the audio output drained.
+
+=back
+
+Loudness values are undef until enough audio has been measured.  The C<channel_weights>
+depend on the channel order VLC produces for C<channels>; for 5.1 pass 1.41 for the surround
+channels and 0 for LFE.
+
+C<speed> measures faster than real time by playing at C<speed> times normal rate with the
+audio output running at C<< rate * speed >>, so that the content still reaches the meter at
+C<rate>.  This only measures correctly if VLC resamples rather than time-stretches, so create
+the library instance with C<--no-audio-time-stretch>.
+
+This must be called while the player is stopped.  Calling it again replaces the meter and
+its measurements.  Requires libvlc 2.0.
+
+=head2 loudness
+
+Return the current summary of the loudness meter (as described above) or undef if the
+meter is not enabled.
+
+=cut
+
+sub _audio_callbacks { $_[0]{_audio_callbacks} //= {} }
+
+sub enable_loudness_meter {
+	my $self= shift;
+	my %opts= @_ == 1? %{ $_[0] } : @_;
+	$self->{libvlc} or croak "Can't set up callbacks without reference to VLC instance";
+	!$self->is_playing or croak "Can't change audio output during playback";
+	my $rate= $opts{rate} || 48000;
+	my $channels= $opts{channels} || 2;
+	my $speed= $opts{speed} || 1;
+	$speed == int($speed) or croak "speed must be an integer";
+	$self->_audio_callbacks->{loudness}= $opts{loudness};
+	$self->_audio_callbacks->{opaque}= $opts{opaque};
+
+	my $event_wr= $self->{libvlc}->_event_pipe->[1];
+	weaken($self);
+	my $cb_id= $self->{_callback_id} //= $self->{libvlc}->_register_callback(sub {
+		$self && $self->_dispatch_callback(@_);
+	});
+	$self->_enable_loudness_meter(fileno($event_wr), $cb_id, $rate, $channels,
+		$opts{channel_weights} || [], $speed, int(($opts{interval} // 1) * 10 + .5));
+	$self->set_rate($speed) if $speed != 1;
+	1;
+}
+
+sub _dispatch_cb_loudness {
+	my ($self, $event, $cb, $opaque)= @_;
+	$cb->($opaque, $event) if $cb;
+}
+
+=head2 sample_stats
+
+  $player->sample_stats(1, sub { my ($player, $stats)= @_; ... });
+  $player->sample_stats(0); # stop
+
+Sample the decoder statistics of the player's media (see L<VideoLAN::LibVLC::Media/stats>)
+every C<$seconds> while it plays.  The sampling happens on a native thread shared by all
+players, which posts each sample through the event pipe, so the callback runs from
+L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch> and no perl code polls.  Each sample
+has the totals, plus (except for the first sample of a playback, or after a pause):
+
+=over
+
+=item elapsed
+
+Seconds since the previous sample.
+
+=item delta
+
+Hashref of the change of each counter since the previous sample.
+
+=item rate
+
+Hashref of the change of each counter per second, such as C<< $stats->{rate}{lost_pictures} >>
+or C<< $stats->{rate}{read_bytes} >>.
+
+=back
+
+The callback is optional; the latest sample is also kept in L</last_stats>.  Samples are
+dropped rather than blocking the sampler if the event pipe is full.  Calling this again
+changes the interval and callback.
+
+=head2 last_stats
+
+The latest sample delivered by L</sample_stats>, or undef.
+
+=cut
+
+sub sample_stats {
+	my ($self, $seconds, $cb)= @_;
+	my $ms= $seconds && $seconds > 0? int($seconds * 1000 + .5) || 1 : 0;
+	if (!$ms) {
+		$self->_sample_stats(0, -1, 0);
+		delete $self->{_stats_callbacks};
+		return 1;
+	}
+	$self->{libvlc} or croak "Can't set up callbacks without reference to VLC instance";
+	$self->{_stats_callbacks}= { stats => $cb };
+	my $event_wr= $self->{libvlc}->_event_pipe->[1];
+	weaken(my $weak= $self);
+	my $cb_id= $self->{_callback_id} //= $self->{libvlc}->_register_callback(sub {
+		$weak && $weak->_dispatch_callback(@_);
+	});
+	$self->_sample_stats($ms, fileno($event_wr), $cb_id);
+	1;
+}
+
+sub last_stats { $_[0]{last_stats} }
+
+sub _dispatch_cb_stats {
+	my ($self, $event, $cb, $opaque)= @_;
+	$self->{last_stats}= $event;
+	$cb->($opaque, $event) if $cb;
+}
+
 1;
@@ -0,0 +1,400 @@
+package VideoLAN::LibVLC::Picture;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+use Carp;
+
+# ABSTRACT: A buffer for the VLC decoder to render one video frame into
+# VERSION
+
+=head1 SYNOPSIS
+
+  # Let the picture allocate its own planes
+  my $pic= VideoLAN::LibVLC::Picture->new({
+    chroma => 'RGBA', width => 640, height => 480, pitch => 640*4, lines => 480
+  });
+
+  # Decode straight into memory owned by another library, such as a mapped
+  # OpenGL pixel buffer.  $addr is the integer address from that library.
+  my $pic= VideoLAN::LibVLC::Picture->new({
+    chroma => 'RGBA', width => 640, height => 480, pitch => 640*4, lines => 480,
+    address => $addr, length => 640*480*4, owner => $buffer_object,
+  });
+
+=head1 DESCRIPTION
+
+A picture is a set of up to three planes of pixel data in a particular format.  You give
+pictures to the decoder with L<VideoLAN::LibVLC::MediaPlayer/queue_picture> and get them back
+in the C<display> callback.  See L<VideoLAN::LibVLC::MediaPlayer/VIDEO CALLBACK API> for the
+whole exchange.
+
+The address of each plane is decided when the picture is created, and the decoder thread only
+ever uses that address.  This matters if you supply the planes yourself.
+
+=head1 METHODS
+
+=head2 new
+
+  my $pic= VideoLAN::LibVLC::Picture->new(\%args);
+
+=over
+
+=item chroma, width, height
+
+The format, which must match the format of the player when the picture is queued.
+
+=item pitch, lines
+
+Bytes per row, and rows, of each plane.  Either a number for plane 0, or an arrayref of one
+number per plane.  Any that you leave out are filled in from L</plane_layout>.  If the chroma
+isn't in that table and you don't supply the buffers, plane 0 defaults to the width (rounded
+up to C<PERLVLC_PLANE_PITCH_MUL>) and height.
+
+=item plane
+
+A scalar-ref, or arrayref of scalar-refs, whose string buffers are used as the planes.  Each
+must already hold at least C<< pitch * lines >> bytes.  The scalars must not be resized or
+reassigned while the picture exists; L<queue_picture|VideoLAN::LibVLC::MediaPlayer/queue_picture>
+dies if one of them has moved.  Mapped scalars (like L<File::Map> or
+L<VideoLAN::LibVLC::SharedSlab> slots) are the safe way to do this.
+
+=item address
+
+The memory address of plane 0, or an arrayref of one address per plane.  This is memory that
+you got from some other library, such as a mapped OpenGL pixel buffer or DMA buffer, and lets
+VLC decode into it with no copy.  Every plane with a non-zero C<< pitch * lines >> needs an
+address.
+
+=item length
+
+The usable bytes at each C<address>, checked against C<< pitch * lines >>.  Optional, but a
+good idea.
+
+=item owner
+
+Any value (usually the object that owns the memory) which will be held until the picture is
+destroyed.  Note that the picture being destroyed is I<after> the decoder is done with it, so
+as long as the owner doesn't unmap the memory on its own, this keeps the address valid.
+
+=item alloc, prefault, mlock
+
+How to allocate the planes, when you don't supply them.  C<alloc> is one of:
+
+=over
+
+=item C<newx>
+
+Perl's allocator, with some slack so the plane can be aligned.  This is the default.
+
+=item C<memalign>
+
+C<posix_memalign> to exactly C<PERLVLC_PLANE_PITCH_MUL>, with no slack.
+
+=item C<mmap>
+
+An anonymous memory map per plane.  Freeing a picture returns the memory to the OS
+immediately rather than to the heap.
+
+=item C<hugepage>
+
+An anonymous map aligned to 2MB with C<MADV_HUGEPAGE>, so a 4K frame takes a handful of TLB
+entries instead of thousands.  This depends on transparent huge pages being enabled in the
+kernel; if C<madvise> is refused it counts as a failure in L</alloc_stats> and you just get
+normal pages.
+
+=back
+
+C<prefault> touches every page of the new planes, so the page faults happen now instead of
+during the first decode into the picture.  C<mlock> locks the planes into RAM; this is often
+limited by C<RLIMIT_MEMLOCK>, and a refusal counts as a failure but is otherwise ignored.
+These override the L</default_alloc> for one picture.
+
+=item id
+
+An arbitrary integer, useful with L<VideoLAN::LibVLC::MediaPlayer/trace_pictures>.
+
+=item priority
+
+An integer, default 0.  Pictures with a negative priority can't use the C<reserve> of the
+L</memory_budget>.
+
+=back
+
+=head2 id
+
+=head2 chroma
+
+=head2 width
+
+=head2 height
+
+=head2 pitch
+
+  my $pitch= $pic->pitch($plane);
+
+=head2 lines
+
+  my $lines= $pic->lines($plane);
+
+=head2 plane
+
+  my $scalar_ref= $pic->plane($plane);
+
+Returns a scalar-ref to the data of a plane.  For allocated or foreign planes, the scalar
+aliases the memory directly.  Dies if the picture is currently held by the decoder.
+
+=head2 address
+
+  my $addr= $pic->address($plane);
+
+The address that the decoder writes the plane to, or 0 if the plane is unused.
+
+=head2 owner
+
+The C<owner> passed to the constructor.
+
+=head2 held_by_vlc
+
+True between L<queue_picture|VideoLAN::LibVLC::MediaPlayer/queue_picture> and the picture
+coming back in the C<display> callback.
+
+=head2 alloc
+
+The name of the allocator used for the planes of this picture.
+
+=head2 priority
+
+The C<priority> given to L</new>.
+
+=head2 sequence
+
+=head2 lock_time
+
+=head2 unlock_time
+
+=head2 display_time
+
+=head2 media_time
+
+  my $late= $pic->display_time - $pic->unlock_time;
+  warn "dropped ".($pic->sequence - $prev - 1)." frames" if $pic->sequence > $prev + 1;
+
+Stamps written by the video thread the last time VLC used this picture, so the C<display>
+callback can pace output and detect drops without asking for the time after the fact.
+
+C<sequence> is the player's count of lock callbacks when VLC took the picture; every lock
+takes a number, so a gap between displayed pictures means frames were decoded into the
+scratch buffer or never displayed.  C<lock_time>, C<unlock_time>, and C<display_time> are
+seconds on the monotonic clock (the same as
+C<< Time::HiRes::clock_gettime(CLOCK_MONOTONIC) >>) when VLC took the picture, finished
+decoding into it, and asked to display it.  C<media_time> is the playback time in seconds
+at display, read from the L<cached clock|VideoLAN::LibVLC::MediaPlayer/cached_clock>, so it
+is only known when that is enabled.  Each is undef if it hasn't happened yet.
+
+=head2 share_handle
+
+  my $handle= $pic->share_handle;
+
+Returns an integer that another thread can turn into its own object for this picture with
+L</from_handle>, for passing through L<Thread::Queue> or anything else that only carries plain
+scalars.  The handle holds a reference until it is claimed, so every handle must be claimed
+exactly once or the picture leaks.  See L</THREADS>.
+
+=head2 shared_refs
+
+The number of Picture objects for this picture in all threads, plus unclaimed handles.
+
+=head2 encode_async
+
+  $pic->encode_async(
+    path    => "thumb.png",   # required
+    format  => 'png',         # or 'ppm'; default from the extension of path
+    libvlc  => $vlc,          # required unless 'player' is given
+    on_done => sub { my $event= shift; ... },
+  );
+
+Write the picture to an image file on a background thread, without the perl thread ever
+reading the pixels.  C<png> is compressed with zlib at C<level> (0-9, default 6); C<ppm> is a
+binary PPM, or PGM for C<GREY> and C<Y800>.  PNG is only available if zlib was found when the
+module was built (see L<PERLVLC_HAVE_ZLIB|VideoLAN::LibVLC/PERLVLC_HAVE_ZLIB>).  The file is
+written under a temporary name and renamed into place when complete.  See L</can_encode> for
+the chromas that can be encoded.
+
+The job holds the picture until it is done, so don't queue it to the decoder until then.
+Completion is reported on a later L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch> of
+the instance, to C<on_done> with a hashref of C<picture>, C<path>, C<bytes> (the size of the
+file), and C<error> (undef, or the reason the file could not be written).  Without C<on_done>,
+the picture is given back to C<player> if one was given (queued to the decoder again if it
+still fits the video format), or else just dropped.
+
+With C<< copy => 1 >>, the planes are copied (in C) and the picture is free again as soon as
+this returns, at the cost of one copy of the picture.  The event has no C<picture> then.
+
+Returns an id for the job, which is also in the event as C<job>.
+
+=head1 CLASS METHODS
+
+=head2 can_encode
+
+  VideoLAN::LibVLC::Picture->can_encode($chroma);
+  $pic->can_encode;
+
+Whether L</encode_async> can convert the chroma: C<GREY>, C<Y800>, the 8-bit RGB formats
+C<RV24>, C<RV32>, C<RGBA>, C<RGBX>, C<BGRA>, C<BGRX>, and C<ARGB>, and the 8-bit YUV formats
+(planar, semi-planar, and packed 4:2:2) listed in L</plane_layout>.  YUV is converted with the
+BT.601 matrix, full-range for the C<J> chromas.
+
+=head2 from_handle
+
+  my $pic= VideoLAN::LibVLC::Picture->from_handle($handle);
+
+Claim a handle from L</share_handle>, returning an object in the current thread that refers to
+the same planes.  Dies if the handle was already claimed.
+
+=head2 plane_layout
+
+  my $layout= VideoLAN::LibVLC::Picture->plane_layout($chroma, $width, $height);
+  # { pitch => [ $p0, $p1, ... ], lines => [ $l0, $l1, ... ] }
+
+Returns the default pitch and lines of each plane of a chroma, or undef if the chroma isn't
+known.  Pitches are rounded up to C<PERLVLC_PLANE_PITCH_MUL> and subsampled planes round up,
+so odd dimensions are still fully covered.  Known chromas are the 8-bit planar YUV formats
+(C<I420>, C<IYUV>, C<J420>, C<YV12>, C<I422>, C<J422>, C<YV16>, C<I444>, C<J444>, C<YV24>,
+C<I411>, C<I410>, C<YVU9>), 16-bit planar YUV (C<I0AL>, C<I0AB>, C<I2AL>, C<I4AL>),
+semi-planar (C<NV12>, C<NV21>, C<NV16>, C<NV61>, C<NV24>, C<P010>, C<P016>), packed 4:2:2
+(C<YUY2>, C<YUYV>, C<YVYU>, C<UYVY>, C<VYUY>), and C<GREY>, C<Y800>, C<GR16>, C<RV15>,
+C<RV16>, C<RV24>, C<RV32>, C<RGBA>, C<BGRA>, C<ARGB>, C<RGBX>, C<BGRX>.
+
+=head2 default_alloc
+
+  VideoLAN::LibVLC::Picture->default_alloc({ alloc => 'hugepage', prefault => 1 });
+  my $cur= VideoLAN::LibVLC::Picture->default_alloc;
+
+Change the allocator options used by pictures that don't specify them, and return the current
+settings as a hashref of C<alloc>, C<prefault>, and C<mlock>.  Keys you don't give are left
+unchanged.
+
+=head2 alloc_stats
+
+  my $stats= VideoLAN::LibVLC::Picture->alloc_stats;
+  my $stats= VideoLAN::LibVLC::Picture->alloc_stats(1); # and reset
+
+Returns a hashref keyed by allocator name, each a hashref of:
+
+=over
+
+=item allocs, frees
+
+Planes allocated and freed.
+
+=item faults
+
+Page faults taken while allocating, which is mostly the cost of C<prefault> and C<mlock>.
+Compare with the process-wide count from L<BSD::Resource> or C<getrusage> to see how many the
+decoder takes instead.
+
+=item failures
+
+Number of times C<madvise> or C<mlock> was refused.
+
+=item bytes_live, bytes_peak
+
+Bytes in planes that currently exist, and the most that ever existed at once.  Resetting
+sets C<bytes_peak> to C<bytes_live>.
+
+=back
+
+See F<util/bench-plane-alloc.pl> in the distribution for a comparison of the allocators.
+
+=head2 memory_budget
+
+  VideoLAN::LibVLC::Picture->memory_budget({ limit => 2 * 1024**3, reserve => 512 * 1024**2, wait => 1 });
+  my $cur= VideoLAN::LibVLC::Picture->memory_budget;
+
+Cap the bytes of planes that pictures allocate for themselves, across every player and thread
+of the process, and return the current settings as a hashref of C<limit> (bytes, 0 for no
+limit, the default), C<reserve>, and C<wait>.  Keys you don't give are left unchanged.
+
+Creating a picture that would take the allocated total over the C<limit> waits up to C<wait>
+seconds (default 0) for other threads to free pictures, then dies.  Pictures with a negative
+L</priority> are held to C<< limit - reserve >>, so that when memory runs short they stop
+getting buffers first.  Pictures on memory you supply (C<plane> or C<address>) are counted in
+L</memory_stats> but never refused.  Lowering the limit doesn't free anything.
+
+=head2 memory_stats
+
+  my $stats= VideoLAN::LibVLC::Picture->memory_stats;
+  my $stats= VideoLAN::LibVLC::Picture->memory_stats(1); # and reset
+
+Returns a hashref describing every picture of the process:
+
+=over
+
+=item pictures
+
+Number of pictures that exist.
+
+=item bytes, bytes_peak
+
+Bytes in their planes, and the most at any one time.  Resetting sets C<bytes_peak> to C<bytes>.
+
+=item bytes_alloc
+
+The part of C<bytes> that the pictures allocated, which is what the L</memory_budget> limits.
+
+=item bytes_vlc, bytes_perl
+
+The part of C<bytes> in pictures L</held_by_vlc>, and the rest.
+
+=item refused, waits
+
+Number of pictures refused by the budget, and the number that had to wait for room.
+
+=back
+
+=head1 THREADS
+
+A picture can be used from several perl iThreads at once, without copying the planes.  Either
+let a new thread inherit the object when it is created, or send a L</share_handle> to a running
+one.  All the objects refer to the same C picture, which is freed when the last of them goes
+away.
+
+  my $q= Thread::Queue->new;
+  my @workers= map threads->create(sub {
+    while (defined(my $h= $q->dequeue)) {
+      my $pic= VideoLAN::LibVLC::Picture->from_handle($h);
+      analyze(${ $pic->plane(0) });
+    } # picture released here
+  }), 1..4;
+  $player->set_video_callbacks(display => sub { $q->enqueue($_[1]{picture}->share_handle) });
+
+If the thread that created the picture has dropped its own objects first, the last release in
+a worker sends the picture back to the player it was last queued to, which handles it on the
+next L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch> with the C<released> callback (by
+default, queueing it to the decoder again).  The player's L<VideoLAN::LibVLC> instance must
+outlive the other threads' objects for this to work.
+
+A picture can't be queued to the decoder while another thread still has it.  Pictures whose
+planes are perl scalars, or that have an L</owner>, belong to one thread; they can't be shared,
+and the object in a new thread is empty.  The same goes for all the other objects of this
+distribution, which stay with the thread that created them.
+
+=cut
+
+my %encode_formats= (
+	png => VideoLAN::LibVLC::PERLVLC_ENCODE_PNG(),
+	ppm => VideoLAN::LibVLC::PERLVLC_ENCODE_PPM(),
+	pgm => VideoLAN::LibVLC::PERLVLC_ENCODE_PPM(),
+);
+
+sub encode_async {
+	my ($self, %opts)= @_;
+	defined $opts{path} or croak "encode_async requires 'path'";
+	my $vlc= $opts{libvlc} || ($opts{player} && $opts{player}->libvlc)
+		or croak "encode_async requires 'libvlc' or 'player'";
+	my $format= lc($opts{format} // ($opts{path} =~ /\.(\w+)$/? $1 : 'png'));
+	defined $encode_formats{$format} or croak "Unknown image format '$format'";
+	$vlc->_encode_async($self, $encode_formats{$format}, \%opts);
+}
+
+1;
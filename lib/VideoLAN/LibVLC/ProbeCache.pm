@@ -0,0 +1,329 @@
+package VideoLAN::LibVLC::ProbeCache;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+use Digest::MD5 'md5';
+use File::Spec;
+use Carp;
+
+# ABSTRACT: Persistent on-disk cache of media probe results
+# VERSION
+
+=head1 SYNOPSIS
+
+  my $cache= VideoLAN::LibVLC::ProbeCache->new(file => "$ENV{HOME}/.cache/vlc-probe");
+
+  # probe anything that is new or has changed since last time
+  $cache->warm($vlc, @library_paths);
+  $cache->save;
+
+  # answered from the cache without libvlc opening the file
+  my $media= $vlc->new_media(path => $library_paths[0], probe_cache => $cache);
+  $media->parse;
+  say $media->metadata->{Title}, " ", $media->duration;
+
+=head1 DESCRIPTION
+
+Parsing a media file with libvlc opens and demuxes it, which adds up to hours
+for a large library even when almost nothing changed.  This cache remembers the
+result of a probe (duration, metadata, and anything else stored in the entry)
+keyed by absolute path, file size, and modification time, and
+L<VideoLAN::LibVLC::Media> consults it in L<parse|VideoLAN::LibVLC::Media/parse>,
+L<metadata|VideoLAN::LibVLC::Media/metadata>, and
+L<duration|VideoLAN::LibVLC::Media/duration> when given a C<probe_cache>.
+
+The file is a sorted index of fixed-size entries followed by the packed records,
+and is memory-mapped read-only, so opening a cache of any size costs nothing and
+a lookup only unpacks the one record it finds.  New entries are held in memory
+until L</save> rewrites the file (atomically, via rename).
+
+=head1 ATTRIBUTES
+
+=head2 file
+
+Path of the cache file.  It does not need to exist yet.
+
+=cut
+
+sub file { shift->{file} }
+
+# File layout, all little-endian:
+#   header:  "PVLCPC01", uint32 entry_count, uint32 reserved
+#   index:   entry_count * { char[8] md5_prefix(path), uint64 size, int64 mtime, uint32 offset, uint32 length }
+#            sorted by md5_prefix
+#   records: { w/a* path, w duration_ms+1, w/a* metadata, w/a* tracks, [w/a* keyframes] }
+#            keyframes are the differences between successive keyframe times (ms) as w*,
+#            and are absent from records without a seek index
+use constant {
+	MAGIC        => 'PVLCPC01',
+	HEADER_SIZE  => 16,
+	INDEX_SIZE   => 32,
+	INDEX_PACK   => 'a8 Q< q< V V',
+};
+
+=head1 METHODS
+
+=head2 new
+
+  my $cache= VideoLAN::LibVLC::ProbeCache->new(file => $path);
+
+=cut
+
+sub new {
+	my $class= shift;
+	my %args= (@_ == 1 && ref($_[0]) eq 'HASH')? %{ $_[0] }
+		: (@_ & 1) == 0? @_
+		: croak "Expected hashref or even length list";
+	defined $args{file} or croak "Missing required attribute 'file'";
+	bless { %args, _pending => {} }, $class;
+}
+
+# Lazily map the cache file.  Returns a scalar-ref, or undef if there is no file yet.
+sub _map {
+	my $self= shift;
+	return $self->{_map} if exists $self->{_map};
+	my $map= -s $self->{file}? VideoLAN::LibVLC::_mmap_file($self->{file}) : undef;
+	if ($map) {
+		substr($$map, 0, 8) eq MAGIC && length($$map) >= HEADER_SIZE
+			or croak "$self->{file} is not a probe cache file";
+		my $count= unpack('V', substr($$map, 8, 4));
+		length($$map) >= HEADER_SIZE + $count * INDEX_SIZE
+			or croak "$self->{file} is truncated";
+	}
+	$self->{_map}= $map;
+}
+
+sub _count {
+	my $map= $_[0]->_map or return 0;
+	unpack('V', substr($$map, 8, 4));
+}
+
+sub _index_entry {
+	my ($self, $i)= @_;
+	unpack(INDEX_PACK, substr(${ $self->{_map} }, HEADER_SIZE + $i * INDEX_SIZE, INDEX_SIZE));
+}
+
+sub _decode_record {
+	my ($self, $size, $mtime, $ofs, $len)= @_;
+	my ($path, $dur, $meta, $tracks, $rest)= unpack('w/a* w w/a* w/a* a*', substr(${ $self->{_map} }, $ofs, $len));
+	my $keyframes;
+	if (length $rest) {
+		my $t= 0;
+		$keyframes= [ map $t += $_, unpack('w*', unpack('w/a*', $rest)) ];
+	}
+	return {
+		path     => $path,
+		size     => $size,
+		mtime    => $mtime,
+		duration => $dur - 1,
+		metadata => { unpack('(w/a*)*', $meta) },
+		tracks   => [ map +{ unpack('(w/a*)*', $_) }, unpack('(w/a*)*', $tracks) ],
+		($keyframes? ( keyframes => $keyframes ) : ()),
+	};
+}
+
+sub _encode_record {
+	my ($entry)= @_;
+	my @meta= %{ $entry->{metadata} || {} };
+	my @tracks= map { my @t= %$_; _bytes(@t); pack('(w/a*)*', @t) } @{ $entry->{tracks} || [] };
+	_bytes(@meta);
+	my $rec= pack('w/a* w w/a* w/a*', $entry->{path}, ($entry->{duration} // -1) + 1,
+		pack('(w/a*)*', @meta), pack('(w/a*)*', @tracks));
+	if (my $kf= $entry->{keyframes}) {
+		my $prev= 0;
+		$rec .= pack('w/a*', pack('w*', map { my $d= $_ - $prev; $prev= $_; $d } @$kf));
+	}
+	$rec;
+}
+
+# Binary search the mapped index for a path.  Returns the decoded entry or undef.
+sub _find_mapped {
+	my ($self, $path)= @_;
+	my $map= $self->_map or return undef;
+	my $key= substr(md5($path), 0, 8);
+	my ($lo, $hi)= (0, $self->_count);
+	while ($lo < $hi) {
+		my $mid= ($lo + $hi) >> 1;
+		if (substr($$map, HEADER_SIZE + $mid * INDEX_SIZE, 8) lt $key) { $lo= $mid + 1 }
+		else { $hi= $mid }
+	}
+	# There could be more than one path with the same key prefix
+	for (my $i= $lo; $i < $self->_count; $i++) {
+		my ($k, @loc)= $self->_index_entry($i);
+		last if $k ne $key;
+		my $entry= $self->_decode_record(@loc);
+		return $entry if $entry->{path} eq $path;
+	}
+	return undef;
+}
+
+# Records hold bytes; encode anything that arrived as perl unicode strings
+sub _bytes {
+	utf8::is_utf8($_) && utf8::encode($_) for @_;
+}
+
+sub _abs_path {
+	my $path= File::Spec->rel2abs("$_[0]");
+	_bytes($path);
+	$path;
+}
+
+=head2 get
+
+  my $entry= $cache->get($path);
+
+Return the cached entry for a path, whether or not it is still fresh.
+An entry is a hashref of C<path>, C<size>, C<mtime>, C<duration> (milliseconds,
+or -1 if unknown), C<metadata> (hashref), and C<tracks> (arrayref of hashrefs as
+returned by L<VideoLAN::LibVLC::TrackList/to_list>).  Entries for files with a
+L<seek index|VideoLAN::LibVLC::Media/build_seek_index> also have C<keyframes>, an
+arrayref of keyframe times in milliseconds.
+
+=head2 lookup
+
+  my $entry= $cache->lookup($path);
+
+Like L</get>, but returns undef unless the file's current size and mtime match
+the entry.
+
+=cut
+
+sub get {
+	my ($self, $path)= @_;
+	$path= _abs_path($path);
+	return $self->{_pending}{$path} if exists $self->{_pending}{$path};
+	return $self->_find_mapped($path);
+}
+
+sub lookup {
+	my ($self, $path)= @_;
+	my ($size, $mtime)= (stat $path)[7,9];
+	defined $size or return undef;
+	my $entry= $self->get($path) or return undef;
+	return ($entry->{size} == $size && $entry->{mtime} == $mtime)? $entry : undef;
+}
+
+=head2 store
+
+  $cache->store($path, { duration => $ms, metadata => \%meta, tracks => \@tracks });
+
+Record a probe result for a path, stamped with the file's current size and mtime.
+The entry is held in memory until L</save>.
+
+=head2 remove
+
+  $cache->remove(@paths);
+
+Forget the entries for these paths.
+
+=cut
+
+sub store {
+	my ($self, $path, $info)= @_;
+	my ($size, $mtime)= (stat $path)[7,9];
+	defined $size or croak "stat($path): $!";
+	my $abs= _abs_path($path);
+	$self->{_pending}{$abs}= { %$info, path => $abs, size => $size, mtime => $mtime };
+}
+
+sub remove {
+	my $self= shift;
+	$self->{_pending}{_abs_path($_)}= undef for @_;
+}
+
+=head2 paths
+
+Return a list of every path in the cache.
+
+=cut
+
+sub paths {
+	my $self= shift;
+	my %seen;
+	for my $i (0 .. $self->_count - 1) {
+		my (undef, @loc)= $self->_index_entry($i);
+		my ($path)= unpack('w/a*', substr(${ $self->{_map} }, $loc[2], $loc[3]));
+		$seen{$path}= 1;
+	}
+	$seen{$_}= defined $self->{_pending}{$_} for keys %{ $self->{_pending} };
+	grep $seen{$_}, sort keys %seen;
+}
+
+=head2 validate
+
+  my @stale= $cache->validate;          # check every entry
+  my @stale= $cache->validate(@paths);  # check only these
+
+Return the paths whose entries are missing, or whose file has changed size or
+mtime, or no longer exists.  Pass the result to L</remove> to prune the cache, or
+to L</warm> to re-probe.
+
+=head2 warm
+
+  my $probed= $cache->warm($vlc, @paths);
+
+Probe every path that doesn't have a fresh entry, and store the results.
+Returns the number of files that needed probing.
+
+=cut
+
+sub validate {
+	my $self= shift;
+	grep !$self->lookup($_), (@_? @_ : $self->paths);
+}
+
+sub warm {
+	my ($self, $vlc, @paths)= @_;
+	my $n= 0;
+	for my $path ($self->validate(@paths)) {
+		next unless -f $path;
+		require VideoLAN::LibVLC::Media;
+		my $media= VideoLAN::LibVLC::Media->new(libvlc => $vlc, path => $path);
+		$media->parse;
+		$self->store($path, $media->_probe);
+		++$n;
+	}
+	return $n;
+}
+
+=head2 save
+
+Write the cache file, merging the in-memory entries with those already on disk.
+
+=cut
+
+sub save {
+	my $self= shift;
+	my $pending= $self->{_pending};
+	my @records;
+	# Carry over entries from the existing file that weren't replaced
+	for my $i (0 .. $self->_count - 1) {
+		my ($key, $size, $mtime, $ofs, $len)= $self->_index_entry($i);
+		my $rec= substr(${ $self->{_map} }, $ofs, $len);
+		my ($path)= unpack('w/a*', $rec);
+		push @records, [ $key, $size, $mtime, $rec ]
+			unless exists $pending->{$path};
+	}
+	for (grep defined, values %$pending) {
+		push @records, [ substr(md5($_->{path}), 0, 8), $_->{size}, $_->{mtime}, _encode_record($_) ];
+	}
+	@records= sort { $a->[0] cmp $b->[0] } @records;
+	my $ofs= HEADER_SIZE + INDEX_SIZE * @records;
+	my $tmp= "$self->{file}.tmp$$";
+	open my $fh, '>:raw', $tmp or croak "open($tmp): $!";
+	print $fh pack('a8 V V', MAGIC, scalar @records, 0);
+	for (@records) {
+		print $fh pack(INDEX_PACK, @{$_}[0..2], $ofs, length $_->[3]);
+		$ofs += length $_->[3];
+	}
+	print $fh $_->[3] for @records;
+	close $fh or croak "close($tmp): $!";
+	rename $tmp, $self->{file} or croak "rename($tmp, $self->{file}): $!";
+	# The old mapping stays valid until released, so this is safe even with other
+	# processes reading the file.
+	delete $self->{_map};
+	$self->{_pending}= {};
+	1;
+}
+
+1;
@@ -0,0 +1,257 @@
+package VideoLAN::LibVLC::Replay;
+use strict;
+use warnings;
+use VideoLAN::LibVLC qw(
+ PERLVLC_MSG_LOG
+ PERLVLC_MSG_VIDEO_TRADE_PICTURE
+ PERLVLC_MSG_VIDEO_UNLOCK_EVENT
+ PERLVLC_MSG_VIDEO_DISPLAY_EVENT
+ PERLVLC_MSG_PICTURE_RELEASED
+ PERLVLC_MSG_VIDEO_WRITTEN
+ PERLVLC_MSG_PICTURE_ENCODED );
+use Config;
+use Time::HiRes ();
+use Carp;
+
+# ABSTRACT: Play back a recording of the callback messages, without decoding
+# VERSION
+
+=head1 SYNOPSIS
+
+  # Record a real session
+  $vlc->record_messages('session.pvlcmsg');
+  ... play some media, calling $vlc->callback_dispatch ...
+  $vlc->record_messages(undef);
+
+  # Later, feed the same messages to the same kind of callbacks
+  my $vlc= VideoLAN::LibVLC->new;
+  my $player= $vlc->new_media_player;
+  $player->set_video_callbacks(display => sub { ... }, format => sub { ... });
+  my $replay= VideoLAN::LibVLC::Replay->new(
+    libvlc  => $vlc,
+    file    => 'session.pvlcmsg',
+    players => [ $player ],
+  );
+  my $stats= $replay->run;
+  printf "%d callbacks in %.3fs\n", $stats->{dispatched}, $stats->{dispatch_time};
+
+=head1 DESCRIPTION
+
+Timing the perl side of L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch> against real
+playback mostly measures the decoder.  A recording made by
+L<VideoLAN::LibVLC/record_messages> holds every message VLC sent, and this object sends them
+through the callback pipe again, one at a time, calling C<callback_dispatch> after each.  The
+whole path (pipe, priority queues, C<_inflate_message>, the player's dispatch and your
+callbacks) runs exactly as it did, with no libvlc decoding anything.
+
+This object also stands in for the video thread.  When a recorded C<unlock>, C<display>, or
+C<discard> names a picture, it is replaced with one of the pictures that your callbacks
+actually queued to the player (for example, from the default format handler or your
+C<format> callback), so those pictures are synthetic but really allocated and traded.  If
+none is queued the message is skipped and counted as C<starved>, as the real decoder would
+have had to wait.
+
+The players should not be playing, and are left holding any pictures still "in the decoder"
+at the end, so use fresh ones for each replay.
+
+=head1 ATTRIBUTES
+
+=head2 libvlc
+
+The instance whose L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch> is exercised.
+
+=head2 file
+
+The recording.  It is read completely by the constructor, so file reads don't count in the
+timing.
+
+=head2 players
+
+Arrayref of players to receive the recorded player messages.  The recording refers to players
+by callback ID; each new ID found in the file is given the next player of this list.
+
+=head2 callback_map
+
+Hashref of recorded callback ID to a player or a callback ID of L</libvlc>, to assign targets
+explicitly.  Log messages always go to the current log callback of L</libvlc>.  Messages
+with no target are skipped, as are pictures returned from other threads or from a
+L<VideoLAN::LibVLC::VideoWriter>.
+
+=head2 speed
+
+0 (the default) sends each message as soon as the previous one is dispatched.  Otherwise the
+recorded gaps between messages are reproduced, divided by this number.
+
+=cut
+
+sub libvlc       { $_[0]{libvlc} }
+sub file         { $_[0]{file} }
+sub players      { $_[0]{players} }
+sub callback_map { $_[0]{callback_map} }
+sub speed        { $_[0]{speed} }
+
+=head1 METHODS
+
+=head2 new
+
+  my $replay= VideoLAN::LibVLC::Replay->new(%attributes);
+
+=cut
+
+sub new {
+	my $class= shift;
+	my %args= @_ == 1? %{ $_[0] } : @_;
+	defined $args{$_} or croak "Missing required attribute '$_'" for qw( libvlc file );
+	$args{players} ||= [];
+	$args{callback_map} ||= {};
+	$args{speed} ||= 0;
+	my $self= bless \%args, $class;
+	$self->{messages}= $self->_load($args{file});
+	$self;
+}
+
+sub _load {
+	my ($self, $file)= @_;
+	open my $fh, '<:raw', $file or croak "open($file): $!";
+	local $/;
+	my $data= <$fh>;
+	my ($magic, $ptr_size, $buffer_size)= unpack 'a8 L L', $data;
+	$magic eq 'PVLCMSG1' or croak "$file is not a message recording";
+	$ptr_size == $Config{ptrsize} or croak "$file was recorded with $ptr_size-byte pointers";
+	my ($pos, @messages)= (16);
+	while ($pos + 8 <= length $data) {
+		my ($delta, $len)= unpack "x$pos L L", $data;
+		$len <= $buffer_size && $pos + 8 + $len <= length $data
+			or croak "$file is truncated or corrupt at offset $pos";
+		push @messages, [ $delta, substr($data, $pos+8, $len) ];
+		$pos += 8 + $len;
+	}
+	\@messages;
+}
+
+=head2 message_count
+
+Number of messages in the recording.
+
+=cut
+
+sub message_count { scalar @{ $_[0]{messages} } }
+
+=head2 run
+
+  my $stats= $replay->run;
+
+Send every message and return a hashref of:
+
+=over
+
+=item messages
+
+Messages in the recording.
+
+=item dispatched
+
+Callbacks run by C<callback_dispatch>.
+
+=item skipped, starved
+
+Messages not sent because they had no target, or named a picture when none was queued.
+
+=item elapsed, dispatch_time
+
+Seconds for the whole replay, and the part of it spent inside C<callback_dispatch>.
+
+=back
+
+=cut
+
+sub run {
+	my $self= shift;
+	my $vlc= $self->{libvlc};
+	my $pipe= $vlc->_event_pipe->[1];
+	my $stats= { messages => scalar @{ $self->{messages} }, dispatched => 0, skipped => 0,
+		starved => 0, dispatch_time => 0 };
+	$self->{_targets}= {};
+	my $t0= Time::HiRes::time;
+	my $t= 0;
+	for (@{ $self->{messages} }) {
+		my ($delta, $buf)= ($_->[0], "$_->[1]");
+		if ($self->{speed}) {
+			$t += $delta / 1e6 / $self->{speed};
+			my $wait= $t0 + $t - Time::HiRes::time;
+			Time::HiRes::sleep($wait) if $wait > 0;
+		}
+		$self->_rewrite($buf, $stats) or next;
+		send($pipe, $buf, 0) == length $buf or croak "send: $!";
+		my $t1= Time::HiRes::time;
+		$stats->{dispatched} += $vlc->callback_dispatch;
+		$stats->{dispatch_time} += Time::HiRes::time - $t1;
+		$self->_collect_pictures;
+	}
+	$stats->{elapsed}= Time::HiRes::time - $t0;
+	$stats;
+}
+
+# Point a recorded message at a live callback and picture.  Returns false to skip it.
+sub _rewrite {
+	my ($self, $buf, $stats)= @_;
+	my $vlc= $self->{libvlc};
+	# pictures returned from other threads were held by nobody; the address means nothing now
+	my $ev_id= unpack('L', $buf);
+	if ($ev_id == PERLVLC_MSG_PICTURE_RELEASED || $ev_id == PERLVLC_MSG_VIDEO_WRITTEN
+		|| $ev_id == PERLVLC_MSG_PICTURE_ENCODED
+	) {
+		++$stats->{skipped};
+		return;
+	}
+	my $event= $vlc->_inflate_message($buf);
+	my $rec_id= $event->{callback_id};
+	my $target= $event->{event_id} == PERLVLC_MSG_LOG? { id => $vlc->{_log_callback_id} }
+		: $self->_target($rec_id);
+	unless (defined $target->{id}) {
+		++$stats->{skipped};
+		return;
+	}
+	my $picture= 0;
+	my $ev= $event->{event_id};
+	if ($ev == PERLVLC_MSG_VIDEO_UNLOCK_EVENT || $ev == PERLVLC_MSG_VIDEO_DISPLAY_EVENT || $ev == PERLVLC_MSG_VIDEO_TRADE_PICTURE) {
+		my $map= $target->{pictures} ||= {};
+		$picture= $map->{$event->{picture}} //= shift @{ $target->{free} || [] };
+		unless ($picture) {
+			delete $map->{$event->{picture}};
+			++$stats->{starved};
+			return;
+		}
+		# display and discard return the picture to perl, and VLC may reuse the address
+		delete $map->{$event->{picture}} unless $ev == PERLVLC_MSG_VIDEO_UNLOCK_EVENT;
+	}
+	$vlc->_rewrite_message($_[1], $target->{id}, $picture);
+	1;
+}
+
+sub _target {
+	my ($self, $rec_id)= @_;
+	$self->{_targets}{$rec_id} //= do {
+		my $t= $self->{callback_map}{$rec_id};
+		$t //= $self->{players}[ $self->{_next_player}++ ]
+			unless exists $self->{callback_map}{$rec_id};
+		!ref $t? { id => $t }
+			: { id => $t->{_callback_id}, player => $t, free => [] };
+	};
+}
+
+# Act as the video thread: take the pictures perl queued to each player
+sub _collect_pictures {
+	my $self= shift;
+	my $vlc= $self->{libvlc};
+	for my $t (values %{ $self->{_targets} }) {
+		next unless $t->{player} && $t->{player}{_vbuf_pipe};
+		for ($t->{player}->_vbuf_drain) {
+			my $msg= $vlc->_inflate_message($_);
+			push @{ $t->{free} }, $msg->{picture}
+				if $msg->{event_id} == PERLVLC_MSG_VIDEO_TRADE_PICTURE;
+		}
+	}
+}
+
+1;
@@ -0,0 +1,343 @@
+package VideoLAN::LibVLC::Scheduler;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+use Scalar::Util qw( refaddr weaken );
+use Time::HiRes ();
+use POSIX ();
+use Carp;
+
+# ABSTRACT: Share a CPU budget among many MediaPlayers
+# VERSION
+
+=head1 SYNOPSIS
+
+  my $sched= VideoLAN::LibVLC::Scheduler->new(pin => 1);
+  for my $file (@files) {
+    my $p= $vlc->new_media_player(media => $file);
+    $p->set_video_callbacks(...);
+    $sched->start($p);
+  }
+  while (...) {
+    1 while $vlc->callback_dispatch;
+    $sched->update;   # a few times per second
+  }
+  printf "%s: %d threads, %.0f%% cpu, %.1f fps\n", $_->media->path,
+    @{ $sched->player_stats($_) }{qw( threads cpu_pct fps )}
+    for $sched->players;
+
+=head1 DESCRIPTION
+
+Each libvlc decoder picks its own number of threads, usually one per core, so twenty players
+on a 32-core host run hundreds of threads that fight over the caches.  This object owns a
+budget of CPUs and splits it between the players you L</start> through it:
+
+=over
+
+=item *
+
+Each player gets C<< cpus / players >> decoder threads (within L</min_threads> and
+L</max_threads>), through L<VideoLAN::LibVLC::MediaPlayer/decoder_threads>, which adds
+C<:avcodec-threads=N> to its media.  A decoder's thread count is fixed once it opens, so a
+rebalance affects the next media each player loads.
+
+=item *
+
+The threads VLC creates for a player are discovered by comparing C</proc/self/task> before
+it starts and after its first frame.  Players are therefore started one at a time; the next
+one waits in L</update> until the previous has produced a frame or L</start_timeout> passes.
+
+=item *
+
+With L</pin>, each player's threads are restricted to their own slice of the CPUs, and the
+slices are reassigned (live) whenever players start or stop.
+
+=item *
+
+L</update> samples the CPU time of each player's threads and the rate of decoded frames, for
+L</player_stats>.
+
+=back
+
+Thread discovery, CPU time, and pinning rely on Linux C</proc> and C<sched_setaffinity>.
+Elsewhere only the thread budget applies.
+
+=head1 ATTRIBUTES
+
+=head2 cpus
+
+Arrayref of CPU numbers in the budget.  Defaults to the CPUs this process may run on.
+
+=head2 min_threads
+
+Fewest decoder threads for one player, default 1.
+
+=head2 max_threads
+
+Most decoder threads for one player, default 16; beyond that avcodec gains little.
+
+=head2 pin
+
+Whether to pin each player's threads to its slice of L</cpus>.
+
+=head2 start_timeout
+
+Seconds to wait for a player's first frame before starting the next one anyway.  Default 5.
+
+=cut
+
+sub cpus          { $_[0]{cpus} }
+sub min_threads   { $_[0]{min_threads} }
+sub max_threads   { $_[0]{max_threads} }
+sub pin           { $_[0]{pin} }
+sub start_timeout { $_[0]{start_timeout} }
+
+=head1 METHODS
+
+=head2 new
+
+  my $sched= VideoLAN::LibVLC::Scheduler->new(%attributes);
+
+=cut
+
+sub new {
+	my $class= shift;
+	my %args= @_ == 1? %{ $_[0] } : @_;
+	$args{cpus} ||= [ VideoLAN::LibVLC::_thread_get_affinity(0) ];
+	$args{cpus}= [ 0 .. (POSIX::sysconf(POSIX::_SC_NPROCESSORS_ONLN()) || 1) - 1 ]
+		unless @{ $args{cpus} };
+	$args{min_threads} ||= 1;
+	$args{max_threads} ||= 16;
+	$args{start_timeout} //= 5;
+	$args{_entries}= [];
+	bless \%args, $class;
+}
+
+=head2 start
+
+  $sched->start($player);
+
+Take charge of a player and play it, once no other player is starting.  The player should
+already have its media and callbacks set.  Returns the scheduler.
+
+=head2 stop
+
+  $sched->stop($player);
+
+Stop the player, and give its share of the budget to the others.
+
+=head2 remove
+
+Like L</stop>, but leave the player running; it just stops being counted.
+
+=cut
+
+sub start {
+	my ($self, $player)= @_;
+	!$self->_entry($player) or croak "Player is already scheduled";
+	my $e= { player => $player, state => 'pending', tids => {}, cpus => [], cpu => 0 };
+	weaken($e->{player});
+	push @{ $self->{_entries} }, $e;
+	$self->_rebalance;
+	$self->update;
+	$self;
+}
+
+sub stop {
+	my ($self, $player)= @_;
+	$self->remove($player);
+	$player->stop;
+}
+
+sub remove {
+	my ($self, $player)= @_;
+	my $n= @{ $self->{_entries} };
+	@{ $self->{_entries} }= grep !($_->{player} && refaddr($_->{player}) == refaddr($player)), @{ $self->{_entries} };
+	$self->_rebalance if $n != @{ $self->{_entries} };
+	$self;
+}
+
+=head2 players
+
+The players currently scheduled, in the order they were started.
+
+=cut
+
+sub players { map $_->{player}, grep $_->{player}, @{ $_[0]{_entries} } }
+
+sub _entry {
+	my ($self, $player)= @_;
+	for (@{ $self->{_entries} }) {
+		return $_ if $_->{player} && refaddr($_->{player}) == refaddr($player);
+	}
+	undef;
+}
+
+=head2 update
+
+Call this periodically (a few times per second is plenty).  It finishes starting the current
+player, starts the next pending one, forgets players that were garbage collected, and samples
+CPU time and frame rate.
+
+=cut
+
+sub update {
+	my $self= shift;
+	my $now= Time::HiRes::time;
+	my $entries= $self->{_entries};
+	if (my @gone= grep !$_->{player}, @$entries) {
+		@$entries= grep $_->{player}, @$entries;
+		$self->_rebalance;
+	}
+	my ($starting)= grep $_->{state} eq 'starting', @$entries;
+	if ($starting) {
+		my $frames= $starting->{player}->lock_stats->{locks};
+		if ($frames || $now - $starting->{started} >= $self->{start_timeout}) {
+			# Every new thread since the snapshot belongs to this player
+			my %owned= map %{ $_->{tids} }, @$entries;
+			$starting->{tids}{$_}= 1 for grep !$starting->{_snapshot}{$_} && !$owned{$_}, _tasks();
+			delete $starting->{_snapshot};
+			$starting->{state}= 'running';
+			$self->_pin($starting);
+			undef $starting;
+		}
+	}
+	if (!$starting and my ($next)= grep $_->{state} eq 'pending', @$entries) {
+		$self->_launch($next, $now);
+	}
+	$self->_sample($_, $now) for grep $_->{state} eq 'running', @$entries;
+	$self;
+}
+
+sub _launch {
+	my ($self, $e, $now)= @_;
+	my $player= $e->{player};
+	$e->{_snapshot}= { map +($_ => 1), _tasks() };
+	# re-applies the thread count to the current media, before it opens its decoder
+	$player->media($player->media) if $player->media;
+	$e->{state}= 'starting';
+	$e->{started}= $now;
+	$player->play or carp "Player failed to start";
+}
+
+# Split the CPUs: each player gets a thread budget, and with 'pin' a contiguous slice of
+# that many CPUs (wrapping around when min_threads oversubscribes).
+sub _rebalance {
+	my $self= shift;
+	my @cpus= @{ $self->{cpus} };
+	my @entries= @{ $self->{_entries} } or return;
+	my $share= int(@cpus / @entries);
+	$share= $self->{min_threads} if $share < $self->{min_threads};
+	$share= $self->{max_threads} if $share > $self->{max_threads};
+	my $ofs= 0;
+	for my $e (@entries) {
+		$e->{threads}= $share;
+		$e->{player}->decoder_threads($share) if $e->{player};
+		$e->{cpus}= [ map $cpus[($ofs + $_) % @cpus], 0 .. $share-1 ];
+		$ofs += $share;
+		$self->_pin($e) if $e->{state} eq 'running';
+	}
+}
+
+sub _pin {
+	my ($self, $e)= @_;
+	return unless $self->{pin};
+	for my $tid (keys %{ $e->{tids} }) {
+		VideoLAN::LibVLC::_thread_set_affinity($tid, $e->{cpus})
+			or delete $e->{tids}{$tid}; # thread exited
+	}
+}
+
+my $clk_tck;
+sub _sample {
+	my ($self, $e, $now)= @_;
+	$clk_tck ||= POSIX::sysconf(POSIX::_SC_CLK_TCK()) || 100;
+	my $ticks= 0;
+	for my $tid (keys %{ $e->{tids} }) {
+		my $t= _task_ticks($tid);
+		defined $t? ($ticks += $t) : delete $e->{tids}{$tid};
+	}
+	my $frames= $e->{player}->lock_stats->{locks};
+	if (my $dt= defined $e->{_t}? $now - $e->{_t} : 0) {
+		# threads that exit take their CPU time with them; don't let that go negative
+		my $dticks= $ticks - $e->{_ticks};
+		$e->{cpu} += $dticks / $clk_tck if $dticks > 0;
+		$e->{cpu_pct}= $dticks > 0? 100 * $dticks / $clk_tck / $dt : 0;
+		$e->{fps}= ($frames - $e->{_frames}) / $dt;
+	}
+	@{$e}{qw( _t _ticks _frames frames )}= ($now, $ticks, $frames, $frames);
+}
+
+# Thread IDs of this process
+sub _tasks {
+	opendir(my $dh, '/proc/self/task') or return;
+	grep /^\d+$/, readdir $dh;
+}
+
+# utime + stime of one thread, in clock ticks
+sub _task_ticks {
+	open my $fh, '<', "/proc/self/task/$_[0]/stat" or return undef;
+	my @f= split / /, (scalar(<$fh>) // '') =~ s/^.*\) //r;
+	return $f[11] + $f[12];
+}
+
+=head2 player_stats
+
+  my $stats= $sched->player_stats($player);
+
+Returns a hashref of:
+
+=over
+
+=item state
+
+C<pending>, C<starting>, or C<running>.
+
+=item threads
+
+Decoder thread budget.
+
+=item cpus
+
+Arrayref of the CPUs the player is (or would be) pinned to.
+
+=item tids
+
+Number of threads attributed to the player.
+
+=item cpu
+
+Seconds of CPU time used by those threads since they were discovered.
+
+=item cpu_pct
+
+CPU use over the last L</update> interval, where 100 is one core.
+
+=item fps, frames
+
+Decoded frames per second over the last interval, and the total.  These count pictures
+requested through the L<video callbacks|VideoLAN::LibVLC::MediaPlayer/VIDEO CALLBACK API>,
+so they are zero for players rendering through VLC's own video output.
+
+=back
+
+Returns undef if the player isn't scheduled.
+
+=cut
+
+sub player_stats {
+	my ($self, $player)= @_;
+	my $e= $self->_entry($player) or return undef;
+	return {
+		state   => $e->{state},
+		threads => $e->{threads},
+		cpus    => [ @{ $e->{cpus} } ],
+		tids    => scalar keys %{ $e->{tids} },
+		cpu     => $e->{cpu},
+		cpu_pct => $e->{cpu_pct} // 0,
+		fps     => $e->{fps} // 0,
+		frames  => $e->{frames} // 0,
+	};
+}
+
+1;
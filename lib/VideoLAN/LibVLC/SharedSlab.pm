@@ -0,0 +1,49 @@
+package VideoLAN::LibVLC::SharedSlab;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+
+# ABSTRACT: Anonymous shared memory divided into equal slots
+# VERSION
+
+=head1 SYNOPSIS
+
+  my $slab= VideoLAN::LibVLC::SharedSlab->new($slot_size, $slot_count);
+  my $buf= $slab->slot(3);              # scalar-ref aliasing all of slot 3
+  if (!fork) { substr($$buf, 0, 5)= 'hello'; exit }
+  wait;
+  print ${ $slab->slot(3, 0, 5, 1) };   # "hello", read-only
+
+=head1 DESCRIPTION
+
+This is a C<MAP_SHARED|MAP_ANONYMOUS> memory map, so processes forked after it was created
+all see the same pages.  L<VideoLAN::LibVLC::Farm> uses it to let worker processes decode
+pictures into memory the parent can read without copying.  The scalars returned by L</slot>
+can be given as C<plane> buffers to L<VideoLAN::LibVLC::Picture>.
+
+There is no locking; deciding which process may write a slot is up to the caller.
+
+=head1 METHODS
+
+=head2 new
+
+  my $slab= VideoLAN::LibVLC::SharedSlab->new($slot_size, $slot_count);
+
+C<$slot_size> is rounded up to a multiple of C<PERLVLC_PLANE_PITCH_MUL> so that every slot
+is aligned the way VLC prefers.
+
+=head2 slot_size
+
+=head2 slot_count
+
+=head2 slot
+
+  my $scalar_ref= $slab->slot($slot, $offset= 0, $length= slot_size - $offset, $readonly= 0);
+
+Return a reference to a scalar whose string buffer is the given range of a slot.  The
+scalar can't change length.  Each one keeps the memory mapped for as long as it exists,
+even after the slab object is gone.
+
+=cut
+
+1;
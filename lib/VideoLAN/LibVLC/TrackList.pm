@@ -0,0 +1,138 @@
+package VideoLAN::LibVLC::TrackList;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+
+# ABSTRACT: Compact list of the elementary streams in a Media
+# VERSION
+
+=head1 SYNOPSIS
+
+  $media->parse;
+  my $tracks= $media->tracks;
+  for my $i ($tracks->find(VideoLAN::LibVLC::TRACK_VIDEO)) {
+    printf "%s %dx%d @ %.2ffps %dbps\n", $tracks->codec($i),
+      $tracks->width($i), $tracks->height($i), $tracks->frame_rate($i), $tracks->bitrate($i);
+  }
+
+  # Inspect many media at once
+  my @lists= VideoLAN::LibVLC::Media->tracks_batch(@media);
+
+=head1 DESCRIPTION
+
+This object holds a copy of C<libvlc_media_tracks_get> for one media, in a single
+C allocation.  Nothing is converted to perl values until you call an accessor, so
+inspecting the video resolution of thousands of files doesn't build thousands of
+hashes.  Every accessor takes the index of a track, from 0 to C<< count-1 >>, and
+returns undef for an index out of range or for a field that doesn't apply to that
+type of track.
+
+The list is only populated after the media has been parsed.  Get one from
+L<VideoLAN::LibVLC::Media/tracks>.
+
+=head1 METHODS
+
+=head2 new
+
+  my $tracks= VideoLAN::LibVLC::TrackList->new(\@hashrefs);
+
+Build a track list from hashrefs of the same fields as the accessors, such as
+those returned by L</to_list>.
+
+=head2 count
+
+Number of tracks.
+
+=head2 find
+
+  my @indices= $tracks->find(TRACK_VIDEO);
+
+Return the indices of all tracks of a type (see C<:track_type_t> in
+L<VideoLAN::LibVLC/CONSTANTS>).
+
+=head2 Accessors for all tracks
+
+=over
+
+=item id
+
+=item type
+
+One of the C<TRACK_*> constants.
+
+=item codec
+
+=item original_fourcc
+
+Four-character code, like C<h264> or C<mp4a>.
+
+=item profile
+
+=item level
+
+=item bitrate
+
+=item language
+
+=item description
+
+=back
+
+=head2 Accessors for audio tracks
+
+=over
+
+=item channels
+
+=item rate
+
+=back
+
+=head2 Accessors for video tracks
+
+=over
+
+=item width
+
+=item height
+
+=item sar_num
+
+=item sar_den
+
+=item frame_rate_num
+
+=item frame_rate_den
+
+=item frame_rate
+
+Frames per second, as a floating point number.
+
+=back
+
+=head2 Accessors for text tracks
+
+=over
+
+=item encoding
+
+=back
+
+=head2 to_list
+
+Return a list of hashrefs, one per track, containing the defined fields.
+
+=cut
+
+our @FIELDS= qw( id type codec original_fourcc profile level bitrate language description
+	channels rate width height sar_num sar_den frame_rate_num frame_rate_den encoding );
+
+sub to_list {
+	my $self= shift;
+	map {
+		my $i= $_;
+		+{ map { my $v= $self->$_($i); defined $v? ($_ => $v) : () } @FIELDS }
+	} 0 .. $self->count - 1;
+}
+
+1;
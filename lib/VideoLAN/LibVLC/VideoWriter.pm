@@ -0,0 +1,273 @@
+package VideoLAN::LibVLC::VideoWriter;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+use Scalar::Util qw( weaken looks_like_number );
+use Time::HiRes ();
+use Carp;
+
+# ABSTRACT: Write pictures to a file handle as YUV4MPEG2 or raw planes, without copying
+# VERSION
+
+=head1 SYNOPSIS
+
+  # Feed an encoder on a pipe, from its own thread, recycling pictures to the player
+  open my $enc, '|-', 'ffmpeg -f yuv4mpegpipe -i - out.mkv' or die;
+  my $writer= VideoLAN::LibVLC::VideoWriter->new(
+    fh => $enc, format => 'y4m', fps => '30000:1001', queue => 8, libvlc => $vlc,
+  );
+  $writer->attach($player);   # every displayed picture is written
+  $player->play;
+  ...
+  $writer->close;
+
+  # Or write pictures directly, from any code that has them
+  my $writer= VideoLAN::LibVLC::VideoWriter->new(fh => \*STDOUT, format => 'raw');
+  $writer->write($picture);
+
+=head1 DESCRIPTION
+
+Building a frame stream in perl from L<plane|VideoLAN::LibVLC::Picture/plane> means at least
+one copy of every frame.  This object hands the plane memory to C<writev> instead, with one
+entry per row (only the visible bytes, leaving out the padding of the pitch) or one per plane
+when the rows have no padding.
+
+The stream is fixed to the chroma and size of the first picture written.  Pictures of any
+other chroma or size are skipped and counted in L</stats>.  For a player whose format may
+change, create a new writer from the C<format> callback.
+
+With a L</queue>, a private thread does the writing, and the picture is returned (to the
+L</on_written> callback, or to the attached player) on a later
+L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch> once the thread is done with it.
+Until then the writer holds the picture, and you must not queue it to the decoder.  Without a
+queue, L</write> returns after the write and the picture is returned right away.
+
+If the file handle is a pipe, set C<$SIG{PIPE}> to C<'IGNORE'>, or the process will be killed
+when the reader goes away instead of getting an error.
+
+=head1 ATTRIBUTES
+
+=head2 fh
+
+The file handle (or file descriptor number) to write to.  Perl's buffer for it is bypassed,
+so don't print to it yourself.  The writer keeps a reference to it.
+
+=head2 format
+
+C<'y4m'> (the default) for a YUV4MPEG2 stream, or C<'raw'> for only the planes of each
+picture, back to back.  YUV4MPEG2 needs one of the chromas C<I420>, C<IYUV>, C<J420>, C<YV12>,
+C<I422>, C<J422>, C<YV16>, C<I444>, C<J444>, C<YV24>, C<I0AL>, C<I2AL>, C<I4AL>, C<GREY> or
+C<Y800>, and planes of C<YV> chromas are swapped into YUV order.  Raw works with any chroma in
+L<VideoLAN::LibVLC::Picture/plane_layout>, and writes all of C<< pitch * lines >> of each
+plane for others.
+
+=head2 fps, interlace, aspect
+
+The frame rate (a number, or C<"num:den">, default 25), interlacing (C<p>, C<t>, C<b>, or
+C<m>, default C<p>), and pixel aspect ratio (C<"num:den">, omitted by default) for the
+YUV4MPEG2 header.
+
+=head2 queue
+
+Number of pictures that can wait for the writer thread.  0 (the default) means no thread.
+When the queue is full, L</write> waits for room.
+
+=head2 libvlc
+
+The instance whose event pipe brings pictures back from the writer thread.  Required with a
+L</queue>, unless a L</player> is given.
+
+=head2 player
+
+Where written pictures go: they are queued to it again if they still match its
+L<video_format|VideoLAN::LibVLC::MediaPlayer/video_format>.  Set by L</attach>.  Held weakly.
+
+=head2 on_written
+
+  on_written => sub { my ($writer, $picture)= @_; ... }
+
+Called with each picture when the writer is done with it, instead of giving it to the
+L</player>.
+
+=cut
+
+sub fh         { $_[0]{fh} }
+sub format     { $_[0]{format} }
+sub fps        { $_[0]{fps} }
+sub interlace  { $_[0]{interlace} }
+sub aspect     { $_[0]{aspect} }
+sub queue      { $_[0]{queue} }
+sub libvlc     { $_[0]{libvlc} }
+sub player     { $_[0]{player} }
+sub on_written { my $self= shift; $self->{on_written}= shift if @_; $self->{on_written} }
+
+my %formats= ( raw => 0, y4m => 1 );
+
+=head1 METHODS
+
+=head2 new
+
+  my $writer= VideoLAN::LibVLC::VideoWriter->new(%attributes);
+
+=cut
+
+sub new {
+	my $class= shift;
+	my %args= @_ == 1? %{ $_[0] } : @_;
+	defined $args{fh} or croak "Missing required attribute 'fh'";
+	my $fd= looks_like_number($args{fh}) && !ref $args{fh}? $args{fh} : fileno($args{fh});
+	defined $fd && $fd >= 0 or croak "fh is not an open file handle";
+	$args{format} //= 'y4m';
+	defined $formats{$args{format}} or croak "Unknown format '$args{format}'";
+	$args{fps} //= 25;
+	$args{interlace} //= 'p';
+	$args{interlace} =~ /^[ptbm]$/ or croak "interlace must be one of p, t, b, m";
+	my $y4m= join ' ', 'F'._ratio($args{fps}, 'fps'), 'I'.$args{interlace},
+		defined $args{aspect}? ('A'._ratio($args{aspect}, 'aspect')) : ();
+	$args{queue} ||= 0;
+	$args{libvlc} //= $args{player}{libvlc} if $args{player};
+	my ($self, $event_fd, $cb_id)= (undef, -1, 0);
+	if ($args{queue}) {
+		$args{libvlc} or croak "A writer with a queue requires 'libvlc'";
+		$event_fd= fileno $args{libvlc}->_event_pipe->[1];
+		$cb_id= $args{libvlc}->_register_callback(sub { $self && $self->_dispatch_written(@_) });
+	}
+	$self= $class->_new($fd, $formats{$args{format}}, $y4m, $args{queue}, $event_fd, $cb_id);
+	%$self= ( %args, _callback_id => $cb_id, _pending => {} );
+	weaken($self->{player}) if $self->{player};
+	my $ret= $self;
+	weaken($self);
+	$ret;
+}
+
+sub _ratio {
+	my ($v, $name)= @_;
+	return $v if $v =~ /^\d+:\d+$/;
+	looks_like_number($v) && $v > 0 or croak "Invalid $name '$v'";
+	return int($v).':1' if $v == int $v;
+	sprintf('%d:%d', int($v * 1000 + .5), 1000);
+}
+
+sub DESTROY {
+	my $self= shift;
+	# A clone in another iThread has no writer of its own to stop
+	$self->_stop unless $self->_is_clone;
+	$self->{libvlc}->_unregister_callback($self->{_callback_id})
+		if $self->{libvlc} && $self->{_callback_id};
+}
+
+=head2 write
+
+  $writer->write($picture);
+
+Write the picture, or queue it for the writer thread.  Dies if an earlier write failed (see
+L</error>), in which case the picture is not taken.
+
+=cut
+
+sub write {
+	my ($self, $pic)= @_;
+	my $key= $self->_write($pic)
+		or croak "Write failed: ".$self->error;
+	if ($self->{queue}) { push @{ $self->{_pending}{$key} }, $pic }
+	else { $self->_written($pic) }
+	$self->_collect_unposted;
+	1;
+}
+
+# Pictures the writer thread finished while the event pipe was full
+sub _collect_unposted {
+	my $self= shift;
+	$self->_dispatch_written({ picture => $_ }) for $self->_unposted;
+}
+
+sub _dispatch_written {
+	my ($self, $event)= @_;
+	my $list= $self->{_pending}{$event->{picture}} or return;
+	my $pic= shift @$list;
+	delete $self->{_pending}{$event->{picture}} unless @$list;
+	$self->_written($pic);
+}
+
+sub _written {
+	my ($self, $pic)= @_;
+	if ($self->{on_written}) { $self->{on_written}->($self, $pic) }
+	elsif ($self->{player}) { $self->{player}->_recycle_picture($pic) }
+}
+
+=head2 attach
+
+  $writer->attach($player);
+
+Set the C<display> callback of the player to write each picture, and make the player the
+destination of written pictures.  The player's other video callbacks are kept.
+
+=cut
+
+sub attach {
+	my ($self, $player)= @_;
+	weaken($self->{player}= $player);
+	weaken(my $writer= $self);
+	$player->set_video_callbacks(%{ $player->_video_callbacks },
+		display => sub { $writer && $writer->write($_[1]{picture}) });
+	1;
+}
+
+=head2 pending
+
+Number of pictures held by the writer: queued, being written, or written but not yet
+returned by L<callback_dispatch|VideoLAN::LibVLC/callback_dispatch>.
+
+=cut
+
+sub pending {
+	my $n= 0;
+	$n += @$_ for values %{ $_[0]{_pending} };
+	$n;
+}
+
+=head2 flush
+
+  $writer->flush;
+
+Wait for the writer thread to finish the queue, then dispatch callbacks of L</libvlc> until
+every picture has been returned.
+
+=head2 close
+
+Flush, then end the writer thread.  Writes after this happen synchronously.
+
+=cut
+
+sub flush {
+	my $self= shift;
+	return 1 unless $self->{queue};
+	$self->_wait;
+	my $timeout= Time::HiRes::time() + 5;
+	while ($self->pending && Time::HiRes::time() < $timeout) {
+		$self->{libvlc}->callback_dispatch or Time::HiRes::sleep(.001);
+		$self->_collect_unposted;
+	}
+	1;
+}
+
+sub close {
+	my $self= shift;
+	$self->flush;
+	$self->_stop unless $self->_is_clone;
+	$self->{queue}= 0;
+	1;
+}
+
+=head2 error
+
+The message of the first failed write, or undef.  Nothing more is written after a failure.
+
+=head2 stats
+
+Returns a hashref of C<frames> and C<bytes> written, C<skipped> pictures (after an error, or
+of a different chroma or size), and C<queued> for the writer thread.
+
+=cut
+
+1;
@@ -0,0 +1,31 @@
+package VideoLAN::LibVLC::Warm;
+use strict;
+use warnings;
+use VideoLAN::LibVLC;
+
+# ABSTRACT: Create shared libvlc instances at compile time
+# VERSION
+
+=head1 SYNOPSIS
+
+  use VideoLAN::LibVLC::Warm;                       # default instance
+  use VideoLAN::LibVLC::Warm [], [ '--no-video' ];  # one per argv
+
+  ...
+  my $vlc= VideoLAN::LibVLC->shared([ '--no-video' ]);  # already initialized
+
+=head1 DESCRIPTION
+
+Loading this module calls L<VideoLAN::LibVLC/warm_shared> with each argv arrayref
+given to C<use>, so the cost of C<libvlc_new> and the filter-list queries is paid
+while the program is compiling (or, in a pre-forking server, before it forks,
+though children still create their own instance on first use).
+
+=cut
+
+sub import {
+	my $class= shift;
+	VideoLAN::LibVLC->warm_shared(@_);
+}
+
+1;
@@ -38,4 +38,19 @@ is( $vlc->app_icon, '',  'default icon' );
 is( $vlc->user_agent_name, 'Test2', 'ua name' );
 is( $vlc->user_agent_http, 'Test/2.1', 'ua http' );
 
+# A lone file handle is passed to Media as 'fd'
+
+subtest new_media_handle => sub {
+	require VideoLAN::LibVLC::Media;
+	no warnings qw( redefine once );
+	local *VideoLAN::LibVLC::Media::new= sub { shift; return { @_ } };
+	open my $fh, '<', $0 or die "open($0): $!";
+	my $args= $vlc->new_media($fh);
+	is( $args->{fd}, $fh, 'GLOB handle' );
+	ok( !exists $args->{fh}, 'no fh key' );
+	my $io= bless {}, 'Local::Reader';
+	{ no strict 'refs'; *{'Local::Reader::read'}= sub {}; }
+	is( $vlc->new_media($io)->{fd}, $io, 'object with ->read' );
+};
+
 done_testing;
@@ -0,0 +1,56 @@
+use strict;
+use warnings;
+use Test::More;
+
+use_ok('VideoLAN::LibVLC') || BAIL_OUT;
+
+my $vlc= VideoLAN::LibVLC->shared;
+isa_ok( $vlc, 'VideoLAN::LibVLC', 'shared default instance' );
+is( VideoLAN::LibVLC->shared, $vlc, 'same instance on second call' );
+is( VideoLAN::LibVLC->shared([]), $vlc, 'empty argv is the default' );
+
+my $quiet= VideoLAN::LibVLC->shared([ '--no-video' ]);
+isnt( $quiet, $vlc, 'different argv, different instance' );
+is( VideoLAN::LibVLC->shared( argv => [ '--no-video' ] ), $quiet, 'same instance via argv attribute' );
+
+my @phases= map $_->[0], @{ $vlc->startup_profile };
+is_deeply( \@phases, [qw( xs_load libvlc_new configure )], 'startup profile phases' )
+	or diag explain $vlc->startup_profile;
+
+ok( VideoLAN::LibVLC->warm_shared([ '--no-video' ]), 'warm_shared' );
+is( $quiet->startup_profile->[-1][0], 'video_filters', 'filter lists recorded in profile' );
+is( VideoLAN::LibVLC->new(argv => [ '--no-video' ])->audio_filters, $quiet->audio_filters,
+	'filter list shared between instances with same argv' );
+
+my $report= VideoLAN::LibVLC->startup_report;
+like( $report, qr/argv=\[--no-video\]/, 'report lists shared instances' );
+like( $report, qr/libvlc_new\s+[\d.]+ ms/, 'report has libvlc_new timing' );
+note $report;
+
+SKIP: {
+	skip "no fork on $^O", 1 if $^O eq 'MSWin32';
+	pipe(my $r, my $w) or die "pipe: $!";
+	my $pid= fork;
+	defined $pid or skip "fork: $!", 3;
+	if (!$pid) {
+		close $r;
+		print $w (VideoLAN::LibVLC->shared == $vlc? "same" : "new");
+		# the parent's instance is detached, and global destruction must not release it
+		print $w (eval { $vlc->audio_filters; 1 }? " usable" : " detached");
+		close $w;
+		exit 0;
+	}
+	close $w;
+	my $answer= <$r>;
+	waitpid $pid, 0;
+	is( $answer, 'new detached', 'child process gets its own instance' );
+	is( $?, 0, 'child exited cleanly' );
+	ok( $vlc->audio_filters, 'parent instance still usable' );
+}
+
+VideoLAN::LibVLC->release_shared([ '--no-video' ]);
+isnt( VideoLAN::LibVLC->shared([ '--no-video' ]), $quiet, 'released instance is replaced' );
+VideoLAN::LibVLC->release_shared;
+isnt( VideoLAN::LibVLC->shared, $vlc, 'release all' );
+
+done_testing;
@@ -0,0 +1,72 @@
+use strict;
+use warnings;
+use Test::More;
+use IO::Select;
+
+use_ok('VideoLAN::LibVLC') || BAIL_OUT;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'new instance' );
+my $wr= $vlc->_event_pipe->[1];
+
+# Forge messages the way the C side writes them: uint32 event_id, uint32 callback_id, payload
+my @got;
+my $cb_id= $vlc->_register_callback(sub { push @got, $_[0] });
+sub post { send($wr, pack('L L', @_[0,1]).($_[2] // ''), 0) or die "send: $!" }
+sub post_log {
+	my ($cb, $text)= @_;
+	post(VideoLAN::LibVLC::PERLVLC_MSG_LOG(), $cb, pack('L L L C C C C', 0, 0, 0, 0, 0, 0, 0)."$text\0");
+}
+sub post_lock { post(VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_LOCK_EVENT(), $_[0]) }
+sub post_low { post(VideoLAN::LibVLC::PERLVLC_MSG_MEDIA_STREAM_LOW(), $_[0], pack('Q Q', 5, 10)) }
+
+post_log($cb_id, "log $_") for 1..3;
+post_low($cb_id);
+post_lock($cb_id);
+is( $vlc->callback_dispatch, 5, 'dispatched everything' );
+is_deeply( [ map $_->{event_id}, @got ], [
+	VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_LOCK_EVENT(),
+	VideoLAN::LibVLC::PERLVLC_MSG_MEDIA_STREAM_LOW(),
+	(VideoLAN::LibVLC::PERLVLC_MSG_LOG()) x 3,
+], 'lock, then events, then logs' );
+is_deeply( [ map $_->{message}, @got[2..4] ], [ 'log 1', 'log 2', 'log 3' ], 'logs in order' );
+is( $vlc->callback_dispatch, 0, 'nothing left' );
+
+# The cleanup of one format is dispatched before the next format that arrived with it
+@got= ();
+post(VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_CLEANUP_EVENT(), $cb_id);
+post(VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_FORMAT_EVENT(), $cb_id, pack('a4 L L L3 L3 L', 'RGBA', 16, 16, 64, 0, 0, 16, 0, 0, 0));
+$vlc->callback_dispatch;
+is_deeply( [ map $_->{event_id}, @got ], [
+	VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_CLEANUP_EVENT(),
+	VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_FORMAT_EVENT(),
+], 'cleanup, then the next format' );
+
+# A lock that arrives while logs are being dispatched jumps ahead of the remaining logs
+@got= ();
+my $log_cb= $vlc->_register_callback(sub { push @got, $_[0]; post_lock($cb_id) if @got == 1 });
+post_log($log_cb, "log $_") for 1..3;
+$vlc->callback_dispatch;
+is_deeply( [ map $_->{event_id}, @got[0,1] ],
+	[ VideoLAN::LibVLC::PERLVLC_MSG_LOG(), VideoLAN::LibVLC::PERLVLC_MSG_VIDEO_LOCK_EVENT() ],
+	'lock dispatched right after the log during which it arrived' );
+
+# Time budget stops early, and leaves the rest queued
+@got= ();
+my $slow_cb= $vlc->_register_callback(sub { push @got, $_[0]; select(undef, undef, undef, .02) });
+post_log($slow_cb, "slow $_") for 1..10;
+my $n= $vlc->callback_dispatch(.05);
+ok( $n >= 1 && $n < 10, "budget limited dispatch to $n" );
+is( $vlc->callback_pending, 10 - $n, 'remainder is pending' );
+ok( !IO::Select->new($vlc->callback_fh)->can_read(0), 'pipe was drained' );
+1 while $vlc->callback_dispatch;
+is( scalar @got, 10, 'all dispatched eventually' );
+
+# Log backlog limit
+@got= ();
+$vlc->log_backlog(2);
+post_log($cb_id, "x$_") for 1..5;
+$vlc->callback_dispatch;
+is( scalar @got, 2, 'only log_backlog logs kept' );
+is( $vlc->log_dropped, 3, 'dropped logs counted' );
+
+done_testing;
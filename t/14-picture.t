@@ -28,4 +28,68 @@ weaken($picture);
 is( $picture, undef, 'got cleaned up' )
 	or Devel::Peek::Dump($picture);
 
+subtest foreign_address => sub {
+	my $buf= "\0" x 1024;
+	my $addr= unpack('J', pack('p', $buf));
+	my $owner= [ \$buf ];
+	my $pic= new_ok( 'VideoLAN::LibVLC::Picture', [{ %info, address => $addr, length => 1024, owner => $owner }], 'picture on foreign memory' );
+	is( $pic->address(0), $addr, 'address is pinned' );
+	is( $pic->owner, $owner, 'owner' );
+	${ $pic->plane(0) } =~ tr/\0/x/;
+	is( substr($buf, 0, 640), 'x' x 640, 'plane aliases foreign memory' );
+	weaken($owner);
+	ok( $owner, 'owner held by picture' );
+	undef $pic;
+	is( $owner, undef, 'owner released with picture' );
+
+	ok( !eval { VideoLAN::LibVLC::Picture->new({ %info, address => $addr, length => 100 }) }, 'length too short' );
+	like( $@, qr/pitch\*lines/, 'error message' );
+	ok( !eval { VideoLAN::LibVLC::Picture->new({ %info, plane => \"short" }) }, 'plane scalar too short' );
+	like( $@, qr/pitch\*lines/, 'error message' );
+};
+
+subtest plane_allocators => sub {
+	my %big= ( chroma => 'RGBA', width => 1024, height => 600, pitch => 4096, lines => 600 );
+	VideoLAN::LibVLC::Picture->alloc_stats(1);
+	for my $alloc (qw( newx memalign mmap hugepage )) {
+		my $pic= new_ok( 'VideoLAN::LibVLC::Picture', [{ %big, alloc => $alloc, prefault => 1 }], $alloc );
+		is( $pic->alloc, $alloc, 'alloc' );
+		is( $pic->address(0) % 64, 0, 'aligned' );
+		is( length ${ $pic->plane(0) }, 4096*600, 'plane length' );
+		${ $pic->plane(0) } =~ tr/\0/x/;
+		my $stats= VideoLAN::LibVLC::Picture->alloc_stats->{$alloc};
+		is( $stats->{allocs}, 1, 'counted alloc' );
+		is( $stats->{bytes_live}, 4096*600, 'bytes_live' );
+		undef $pic;
+		$stats= VideoLAN::LibVLC::Picture->alloc_stats->{$alloc};
+		is( $stats->{frees}, 1, 'counted free' );
+		is( $stats->{bytes_live}, 0, 'bytes_live back to 0' );
+		is( $stats->{bytes_peak}, 4096*600, 'bytes_peak' );
+	}
+	ok( !eval { VideoLAN::LibVLC::Picture->new({ %big, alloc => 'bogus' }) }, 'unknown allocator' );
+	my $cur= VideoLAN::LibVLC::Picture->default_alloc({ alloc => 'mmap', mlock => 1 });
+	is_deeply( $cur, { alloc => 'mmap', prefault => 0, mlock => 1 }, 'default_alloc' );
+	is( VideoLAN::LibVLC::Picture->new(\%big)->alloc, 'mmap', 'default applied' );
+	VideoLAN::LibVLC::Picture->default_alloc({ alloc => 'newx', mlock => 0 });
+};
+
+subtest plane_layout => sub {
+	is_deeply( VideoLAN::LibVLC::Picture->plane_layout('I420', 641, 481),
+		{ pitch => [ 704, 384, 384 ], lines => [ 481, 241, 241 ] }, 'I420 odd size' );
+	is_deeply( VideoLAN::LibVLC::Picture->plane_layout('NV12', 1920, 1080),
+		{ pitch => [ 1920, 1920 ], lines => [ 1080, 540 ] }, 'NV12' );
+	is_deeply( VideoLAN::LibVLC::Picture->plane_layout('YUY2', 100, 10),
+		{ pitch => [ 256 ], lines => [ 10 ] }, 'YUY2' );
+	is_deeply( VideoLAN::LibVLC::Picture->plane_layout('RV24', 100, 10),
+		{ pitch => [ 320 ], lines => [ 10 ] }, 'RV24' );
+	is( VideoLAN::LibVLC::Picture->plane_layout('XXXX', 100, 10), undef, 'unknown chroma' );
+
+	my $pic= new_ok( 'VideoLAN::LibVLC::Picture', [{ chroma => 'I420', width => 640, height => 480 }], 'I420 picture' );
+	is_deeply( [ map $pic->pitch($_), 0..2 ], [ 640, 320, 320 ], 'pitch of every plane' );
+	is_deeply( [ map $pic->lines($_), 0..2 ], [ 480, 240, 240 ], 'lines of every plane' );
+	is( length ${ $pic->plane(2) }, 320*240, 'plane 2 allocated' );
+	$pic= new_ok( 'VideoLAN::LibVLC::Picture', [{ chroma => 'RGBA', width => 100, height => 10 }], 'RGBA picture' );
+	is( $pic->pitch(0), 448, 'RGBA pitch is 4 bytes per pixel' );
+};
+
 done_testing;
@@ -12,4 +12,82 @@ $flare->parse;
 isa_ok( $flare->metadata, 'HASH', 'metadata' );
 note explain $flare->metadata;
 
+my $tracks= $flare->tracks;
+isa_ok( $tracks, 'VideoLAN::LibVLC::TrackList', 'tracks' );
+my ($video)= $tracks->find(VideoLAN::LibVLC::TRACK_VIDEO());
+ok( defined $video, 'has video track' );
+ok( $tracks->width($video) > 0 && $tracks->height($video) > 0, 'video resolution' );
+is( length $tracks->codec($video), 4, 'codec is fourcc' );
+is( $tracks->channels($video), undef, 'audio field undef on video track' );
+is( $tracks->width($tracks->count), undef, 'index out of range' );
+note explain [ $tracks->to_list ];
+is_deeply( [ VideoLAN::LibVLC::TrackList->new([ $tracks->to_list ])->to_list ], [ $tracks->to_list ], 'round trip through to_list' );
+my @batch= VideoLAN::LibVLC::Media->tracks_batch($flare, VideoLAN::LibVLC::Media->new(libvlc => $vlc, path => $flare->path));
+is( scalar @batch, 2, 'tracks_batch' );
+is( $batch[1]->count, 0, 'unparsed media has no tracks' );
+
+SKIP: {
+	skip "Media from memory requires libvlc 3.0", 6
+		unless ($vlc->libvlc_version =~ /^(\d+)/)[0] >= 3;
+	my $bytes= do { open my $fh, '<:raw', "$datadir/NASA-solar-flares-2017-04-02.mp4" or die "$!"; local $/; <$fh> };
+	my $media= new_ok( 'VideoLAN::LibVLC::Media', [ libvlc => $vlc, buffer => \$bytes ], 'media from buffer' );
+	ok( Internals::SvREADONLY($bytes), 'buffer is pinned read-only' );
+	$media->parse;
+	isa_ok( $media->metadata, 'HASH', 'metadata from buffer' );
+	undef $media;
+	ok( !Internals::SvREADONLY($bytes), 'buffer released' );
+
+	$media= new_ok( 'VideoLAN::LibVLC::Media', [ libvlc => $vlc, mmap => "$datadir/NASA-solar-flares-2017-04-02.mp4" ], 'media from mmap' );
+	$media->parse;
+	isa_ok( $media->metadata, 'HASH', 'metadata from mmap' );
+}
+
+SKIP: {
+	skip "Media from stream requires libvlc 3.0", 7
+		unless ($vlc->libvlc_version =~ /^(\d+)/)[0] >= 3;
+	my $media= new_ok( 'VideoLAN::LibVLC::Media', [ libvlc => $vlc, stream => { buffer_size => 1000 } ], 'media from stream' );
+	is( $media->stream_space, 1000, 'stream_space' );
+	is( $media->feed('x' x 600), 600, 'feed 600 bytes' );
+	is( $media->feed('x' x 600), 400, 'feed stops at buffer_size' );
+	is( $media->stream_buffered, 1000, 'stream_buffered' );
+	$media->feed_eof;
+	ok( !eval { $media->feed('x'); 1 }, 'feed after eof dies' );
+	undef $media;
+	ok( 1, 'stream freed' );
+}
+
+SKIP: {
+	require Config;
+	skip "Media from stream requires libvlc 3.0", 1
+		unless ($vlc->libvlc_version =~ /^(\d+)/)[0] >= 3;
+	skip "Perl lacks iThreads", 1
+		unless $Config::Config{useithreads} && eval { require threads; 1 };
+	require VideoLAN::LibVLC::MediaPlayer;
+	my $player= $vlc->new_media_player;
+	$player->media(VideoLAN::LibVLC::Media->new(libvlc => $vlc, stream => { buffer_size => 1000 }));
+	is( threads->create(sub {
+		my @warnings;
+		local $SIG{__WARN__}= sub { push @warnings, @_ };
+		undef $player;
+		join '', @warnings;
+	})->join, '', 'clone of a streaming player is destroyed quietly' );
+}
+
+subtest profiles => sub {
+	my $media= new_ok( 'VideoLAN::LibVLC::Media', [ libvlc => $vlc, path => $flare->path,
+		profile => 'analysis', options => [ ':avcodec-threads=2' ] ], 'media with profile' );
+	is( $media->profile, 'analysis', 'profile' );
+	ok( (grep $_ eq ':no-audio', @{ $media->options }), 'profile options added' );
+	is( $media->options->[-1], ':avcodec-threads=2', 'explicit options added after profile' );
+	ok( !eval { $media->apply_profile('bogus'); 1 }, 'unknown profile' );
+	like( $@, qr/Unknown media profile/, 'error message' );
+
+	require VideoLAN::LibVLC::MediaPlayer;
+	my $player= new_ok( 'VideoLAN::LibVLC::MediaPlayer', [ libvlc => $vlc, profile => 'thumbnail' ], 'player with profile' );
+	$player->media($flare->path);
+	is( $player->media->profile, 'thumbnail', 'player applied profile to media' );
+	$player->media($media);
+	is( $player->media->profile, 'analysis', 'media profile not overridden' );
+};
+
 done_testing;
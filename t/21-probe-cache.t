@@ -0,0 +1,54 @@
+use strict;
+use warnings;
+use Test::More;
+use File::Temp;
+use FindBin;
+my $datadir= "$FindBin::Bin/data";
+my $flare_path= "$datadir/NASA-solar-flares-2017-04-02.mp4";
+
+use_ok('VideoLAN::LibVLC::ProbeCache') || BAIL_OUT;
+use VideoLAN::LibVLC::Media;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'new instance, no args' );
+my $tmp= File::Temp->newdir;
+my $cache= new_ok( 'VideoLAN::LibVLC::ProbeCache', [ file => "$tmp/probe" ], 'new cache' );
+is( $cache->lookup($flare_path), undef, 'empty cache' );
+is_deeply( [ $cache->validate($flare_path) ], [ $flare_path ], 'uncached file is stale' );
+
+my $flare= VideoLAN::LibVLC::Media->new(libvlc => $vlc, path => $flare_path, probe_cache => $cache);
+$flare->parse;
+my $entry= $cache->lookup($flare_path);
+ok( $entry, 'parse stored entry' );
+is_deeply( $entry->{metadata}, $flare->metadata, 'entry metadata' );
+$cache->save;
+ok( -s "$tmp/probe", 'saved' );
+
+# A fresh cache reads it back from the file
+$cache= VideoLAN::LibVLC::ProbeCache->new(file => "$tmp/probe");
+$entry= $cache->lookup($flare_path);
+ok( $entry, 'entry from file' );
+is_deeply( $entry->{metadata}, $flare->metadata, 'metadata from file' );
+is( $entry->{duration}, VideoLAN::LibVLC::libvlc_media_get_duration($flare), 'duration from file' );
+is( $cache->warm($vlc, $flare_path), 0, 'warm skips fresh entries' );
+
+my $cached= VideoLAN::LibVLC::Media->new(libvlc => $vlc, path => $flare_path, probe_cache => $cache);
+$cached->parse;
+is_deeply( $cached->metadata, $flare->metadata, 'media answered from cache' );
+is( $cached->duration, $flare->duration, 'duration answered from cache' );
+is_deeply( [ $cached->tracks->to_list ], [ $flare->tracks->to_list ], 'tracks answered from cache' );
+
+# Changing the file invalidates the entry
+my $copy= "$tmp/copy.mp4";
+{
+	open my $in, '<:raw', $flare_path or die "$!";
+	open my $out, '>:raw', $copy or die "$!";
+	local $/; print {$out} <$in>;
+}
+is( $cache->warm($vlc, $copy), 1, 'warm probes new file' );
+utime 1, 1, $copy;
+is_deeply( [ $cache->validate ], [ $copy ], 'validate finds changed file' );
+$cache->remove($copy);
+$cache->save;
+is_deeply( [ $cache->paths ], [ $flare_path ], 'removed entry' );
+
+done_testing;
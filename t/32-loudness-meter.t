@@ -0,0 +1,59 @@
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use Time::HiRes 'sleep';
+use File::Spec::Functions 'catdir';
+my $datadir= catdir($FindBin::Bin, 'data');
+
+use_ok('VideoLAN::LibVLC::MediaPlayer') || BAIL_OUT;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [ argv => [ '--no-audio-time-stretch' ] ], 'init libvlc' );
+$vlc->log(sub { note $_[0]->{message}; }, { level => 1 });
+
+# EBU Tech 3341 case 1 is a stereo 1kHz sine at -23 dBFS, which reads -23 LUFS; the same
+# at -20 dBFS reads -20 LUFS.  Its 48KHz samples fall on the peaks, so those are -20 dBFS too.
+# Start it at a zero crossing, as a step at the start would really overshoot.
+subtest reference_sine => sub {
+	my $amp= 10 ** (-20 / 20);
+	my $samples= pack 'f<*', map { (sin(2 * 3.14159265358979 * 1000 * $_ / 48000) * $amp) x 2 } 0 .. 48000*10-1;
+	my $m= VideoLAN::LibVLC::_loudness_measure(48000, 2, $samples);
+	ok( abs($m->{integrated} + 20) < .1, 'integrated' ) or diag "integrated $m->{integrated}";
+	ok( abs($m->{short_term} + 20) < .1, 'short term' ) or diag "short_term $m->{short_term}";
+	ok( abs($m->{momentary} + 20) < .1, 'momentary' ) or diag "momentary $m->{momentary}";
+	ok( $m->{range} < .5, 'no range' ) or diag "range $m->{range}";
+	ok( abs($m->{sample_peak} + 20) < .01, 'sample peak' ) or diag "sample_peak $m->{sample_peak}";
+	ok( abs($m->{true_peak} + 20) < .1, 'true peak' ) or diag "true_peak $m->{true_peak}";
+	is( $m->{samples}, 480000, 'samples' );
+	$m= VideoLAN::LibVLC::_loudness_measure(48000, 2, pack 'f<*', (0) x 96000);
+	is( $m->{integrated}, undef, 'silence is below the gate' );
+};
+
+my $player= new_ok( 'VideoLAN::LibVLC::MediaPlayer', [ libvlc => $vlc ], 'player instance' );
+is( $player->loudness, undef, 'no meter yet' );
+
+my @summaries;
+ok( $player->enable_loudness_meter(interval => .5, loudness => sub { push @summaries, $_[1] }), 'enable_loudness_meter' );
+my $initial= $player->loudness;
+is( $initial->{samples}, 0, 'no samples metered' );
+is( $initial->{integrated}, undef, 'integrated unknown' );
+
+my $media= $vlc->new_media(catdir($datadir, 'NASA-solar-flares-2017-04-02.mp4'));
+$media->parse;
+SKIP: {
+	skip "test media has no audio track", 2
+		unless $media->tracks->find(VideoLAN::LibVLC::TRACK_AUDIO());
+	$player->media($media);
+	$player->play;
+	my $timeout= time + 15;
+	while (time < $timeout && !@summaries) {
+		1 while $vlc->callback_dispatch;
+		sleep .1;
+	}
+	ok( scalar @summaries, 'received summary events' );
+	ok( $player->loudness->{samples} > 0, 'samples metered' );
+	$player->stop;
+	1 while $vlc->callback_dispatch;
+}
+
+done_testing;
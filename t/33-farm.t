@@ -0,0 +1,85 @@
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use Time::HiRes 'sleep';
+use File::Spec::Functions 'catdir';
+my $datadir= catdir($FindBin::Bin, 'data');
+
+use_ok('VideoLAN::LibVLC::Farm') || BAIL_OUT;
+
+subtest shared_slab => sub {
+	my $slab= new_ok( 'VideoLAN::LibVLC::SharedSlab', [ 100, 4 ], 'slab' );
+	is( $slab->slot_size, 128, 'slot size rounded up to alignment' );
+	is( $slab->slot_count, 4, 'slot count' );
+	my $rw= $slab->slot(2);
+	is( length $$rw, 128, 'slot scalar covers slot' );
+	SKIP: {
+		skip "no fork on $^O", 1 if $^O eq 'MSWin32';
+		my $pid= fork;
+		if (!$pid) { substr($$rw, 0, 5)= 'child'; require POSIX; POSIX::_exit(0) }
+		waitpid $pid, 0;
+		is( substr($$rw, 0, 5), 'child', 'child write visible to parent' );
+	}
+	my $ro= $slab->slot(2, 0, 5, 1);
+	undef $slab;
+	is( $$ro, 'child', 'read-only alias survives slab object' );
+	ok( !eval { $$ro= 'x'; 1 }, 'read-only alias rejects writes' );
+	ok( !eval { VideoLAN::LibVLC::SharedSlab->new(64, 1)->slot(1); 1 }, 'slot out of range' );
+	done_testing;
+};
+
+subtest ithread_clone => sub {
+	plan skip_all => "no fork on $^O" if $^O eq 'MSWin32';
+	require Config;
+	plan skip_all => 'Perl lacks iThreads'
+		unless $Config::Config{useithreads} && eval { require threads; 1 };
+	my $farm= new_ok( 'VideoLAN::LibVLC::Farm', [ workers => 1, slots_per_worker => 1, slot_size => 64 ] );
+	my $pid= $farm->{_worker}[0]{pid};
+	threads->create(sub { 1 })->join;
+	ok( $farm->{_worker}[0] && kill(0, $pid), "thread exit didn't shut down the farm" );
+	$farm->shutdown;
+	ok( !kill(0, $pid), 'shutdown from the creating thread' );
+};
+
+SKIP: {
+	skip "no fork on $^O", 1 if $^O eq 'MSWin32';
+	my (@frames, %ended, $bad);
+	my $farm= new_ok( 'VideoLAN::LibVLC::Farm', [
+		workers          => 2,
+		slots_per_worker => 4,
+		slot_size        => 64*64*4,
+		argv             => [ '--no-audio' ],
+		on_frame         => sub {
+			my ($farm, $frame)= @_;
+			my $plane= $frame->plane(0);
+			++$bad unless length $$plane == $frame->pitch(0) * $frame->lines(0);
+			push @frames, $frame->job if $$plane =~ /[^\0]/;
+			$frame->release;
+		},
+		on_job_end       => sub { $ended{$_[1]}= $_[2] },
+	], 'farm' );
+	my @jobs= map $farm->submit(
+		path => catdir($datadir, 'NASA-solar-flares-2017-04-02.mp4'),
+		chroma => 'RV32', width => 64, height => 64,
+	), 1..3;
+	is( $farm->pending_jobs, 1, 'third job waits for a worker' );
+	my $huge= $farm->submit(
+		path => catdir($datadir, 'NASA-solar-flares-2017-04-02.mp4'),
+		chroma => 'RV32', width => 640, height => 640,
+	);
+	my $timeout= time + 60;
+	while (time < $timeout && keys %ended < 4) {
+		sleep .02;
+		$farm->dispatch;
+	}
+	is( $ended{$_}, 'ended', "job $_ ended" ) for @jobs;
+	like( $ended{$huge}, qr/^error: frame needs/, 'frame larger than slot is an error' );
+	is( $bad, undef, 'plane lengths match layout' );
+	my %seen= map +($_ => 1), @frames;
+	is_deeply( [ sort keys %seen ], [ sort @jobs ], 'received non-blank frames from every job' );
+	is( $farm->frames_held, 0, 'all frames released' );
+	ok( $farm->shutdown, 'shutdown' );
+}
+
+done_testing;
@@ -0,0 +1,49 @@
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use Time::HiRes 'sleep';
+use File::Spec::Functions 'catdir';
+my $datadir= catdir($FindBin::Bin, 'data');
+
+use_ok('VideoLAN::LibVLC::MediaPlayer') || BAIL_OUT;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+$vlc->log(sub { note $_[0]->{message}; }, { level => 1 });
+
+my $player= new_ok( 'VideoLAN::LibVLC::MediaPlayer', [ libvlc => $vlc ], 'player instance' );
+is( $player->lock_timeout, undef, 'waits forever by default' );
+is_deeply( $player->lock_stats, { locks => 0, timeouts => 0, scratch => 0, null => 0, wait_max => 0, wait_total => 0,
+	seeks => 0, keyframe_seeks => 0, seeks_done => 0, seek_latency_last => 0, seek_latency_max => 0, seek_latency_total => 0 },
+	'counters start at zero' );
+$player->set_lock_timeout(.02);
+is( $player->lock_timeout, .02, 'lock_timeout' );
+ok( !eval { $player->set_lock_timeout(1, 'oldest'); 1 }, 'unknown policy' );
+like( $@, qr/policy/, 'error message' );
+$player->set_lock_timeout(undef);
+is( $player->lock_timeout, undef, 'wait forever again' );
+
+# Give the decoder only two pictures and never return them.  Every later frame must
+# time out into the scratch buffer instead of stalling the video thread.
+$player->set_video_callbacks(display => sub {});
+$player->set_video_format(chroma => 'RGBA', width => 64, height => 64, pitch => 64*4);
+$player->set_lock_timeout(.01, 'scratch');
+$player->queue_new_picture(id => $_) for 0..1;
+$player->media(catdir($datadir, 'NASA-solar-flares-2017-04-02.mp4'));
+ok( $player->play, 'play' );
+my $timeout= time + 10;
+while (time < $timeout && $player->lock_stats->{scratch} < 5) {
+	1 while $vlc->callback_dispatch;
+	sleep .05;
+}
+my $stats= $player->lock_stats(1);
+ok( $stats->{scratch} >= 5, 'frames decoded into scratch buffer' )
+	or diag explain $stats;
+is( $stats->{null}, 0, 'no NULL frames' );
+is( $stats->{timeouts}, $stats->{scratch}, 'every timeout used scratch' );
+ok( $stats->{wait_max} < 1, 'waits were bounded' );
+ok( $player->lock_stats->{scratch} <= 1, 'counters reset' );
+$player->stop;
+1 while $vlc->callback_dispatch;
+
+done_testing;
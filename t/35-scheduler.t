@@ -0,0 +1,76 @@
+use strict;
+use warnings;
+use Test::More;
+
+use_ok('VideoLAN::LibVLC::Scheduler') || BAIL_OUT;
+
+my @affinity= VideoLAN::LibVLC::_thread_get_affinity(0);
+SKIP: {
+	skip 'no thread affinity on this platform', 2 unless @affinity;
+	ok( VideoLAN::LibVLC::_thread_set_affinity(0, \@affinity), 'set affinity to the same CPUs' );
+	is_deeply( [ VideoLAN::LibVLC::_thread_get_affinity(0) ], \@affinity, 'affinity unchanged' );
+}
+
+# The scheduler only needs a few methods of the player, so exercise the budget
+# and the start sequence with stand-ins that "decode" when told to.
+{
+	package FakePlayer;
+	sub new { bless { frames => 0, playing => 0 }, shift }
+	sub play { $_[0]{playing}= 1 }
+	sub stop { $_[0]{playing}= 0 }
+	sub media { undef }
+	sub lock_stats { { locks => $_[0]{frames} } }
+	sub decoder_threads { $_[0]{threads}= $_[1] if @_ > 1; $_[0]{threads} }
+}
+
+my $sched= new_ok( 'VideoLAN::LibVLC::Scheduler', [ cpus => [0..7], start_timeout => 60 ] );
+my @p= map FakePlayer->new, 1..3;
+$sched->start($_) for @p;
+is_deeply( [ map $_->{threads}, @p ], [2,2,2], 'budget split three ways' );
+is_deeply( [ map $sched->player_stats($_)->{state}, @p ], [qw( starting pending pending )], 'one player starts at a time' );
+ok( $p[0]{playing} && !$p[1]{playing}, 'only first is playing' );
+is_deeply( $sched->player_stats($p[2])->{cpus}, [4,5], 'CPU slice' );
+
+$p[0]{frames}= 1;
+$sched->update;
+is( $sched->player_stats($p[0])->{state}, 'running', 'first frame finishes start' );
+ok( $p[1]{playing}, 'second player started' );
+$sched->update;
+ok( !$p[2]{playing}, 'third waits for the second' );
+$p[1]{frames}= 1;
+$sched->update;
+ok( $p[2]{playing}, 'third started' );
+
+$p[0]{frames}= 11;
+$sched->update;
+my $st= $sched->player_stats($p[0]);
+ok( $st->{fps} > 0, 'fps measured' ) or diag explain $st;
+is( $st->{frames}, 11, 'frame count' );
+
+$sched->stop($p[1]);
+ok( !$p[1]{playing}, 'stopped' );
+is_deeply( [ map $_->{threads}, @p[0,2] ], [4,4], 'budget rebalanced' );
+is_deeply( [ map $sched->player_stats($_)->{cpus}, @p[0,2] ], [[0..3],[4..7]], 'CPU slices rebalanced' );
+is( $sched->player_stats($p[1]), undef, 'stopped player not scheduled' );
+undef $p[2];
+$sched->update;
+is_deeply( [ $sched->players ], [ $p[0] ], 'freed player forgotten' );
+is( $p[0]{threads}, 8, 'whole budget' );
+
+my $small= VideoLAN::LibVLC::Scheduler->new(cpus => [0,1], max_threads => 1);
+my @q= map FakePlayer->new, 1..3;
+$small->start($_) for @q;
+is_deeply( [ map @{ $small->player_stats($_)->{cpus} }, @q ], [0,1,0], 'slices wrap when oversubscribed' );
+
+subtest media_set_again => sub {
+	my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+	my $p= $vlc->new_media_player(decoder_threads => 2);
+	my $media= $vlc->new_media('fake://frames=1');
+	$p->media($media) for 1..3; # as Scheduler->_launch does
+	is_deeply( [ grep /avcodec-threads/, @{ $media->options } ], [ ':avcodec-threads=2' ], 'option added once' );
+	$p->decoder_threads(4);
+	$p->media($media);
+	is( (grep /avcodec-threads/, @{ $media->options })[-1], ':avcodec-threads=4', 'new count added' );
+};
+
+done_testing;
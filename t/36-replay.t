@@ -0,0 +1,56 @@
+use strict;
+use warnings;
+use Test::More;
+use File::Temp;
+use VideoLAN::LibVLC qw( PERLVLC_MSG_VIDEO_FORMAT_EVENT PERLVLC_MSG_VIDEO_DISPLAY_EVENT PERLVLC_MSG_VIDEO_TRADE_PICTURE );
+
+use_ok('VideoLAN::LibVLC::Replay') || BAIL_OUT;
+use_ok('VideoLAN::LibVLC::MediaPlayer') || BAIL_OUT;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+my $tmp= File::Temp->new;
+my @shown;
+my %callbacks= (display => sub { push @shown, $_[1]{picture} });
+
+# Play the part of the video thread by writing the messages it would send, so that
+# a session can be recorded without decoding anything.
+my $player= $vlc->new_media_player;
+$player->set_video_callbacks(%callbacks);
+my $event_wr= $vlc->_event_pipe->[1];
+$vlc->record_messages("$tmp");
+send($event_wr, pack('L L a4 L L L3 L3 L', PERLVLC_MSG_VIDEO_FORMAT_EVENT, $player->{_callback_id},
+	'RGBA', 16, 16, 16, 0, 0, 64, 0, 0, 0), 0);
+is( $vlc->callback_dispatch, 1, 'format event dispatched' );
+my @pics= map $_->{picture}, grep $_->{event_id} == PERLVLC_MSG_VIDEO_TRADE_PICTURE,
+	map $vlc->_inflate_message($_), $player->_vbuf_drain;
+is( scalar @pics, 8, 'default format handler queued 8 pictures' );
+send($event_wr, pack('L L J', PERLVLC_MSG_VIDEO_DISPLAY_EVENT, $player->{_callback_id}, $_), 0)
+	for @pics[0,1,2];
+is( $vlc->callback_dispatch, 3, 'display events dispatched' );
+$vlc->record_messages(undef);
+is( scalar @shown, 3, 'pictures displayed' );
+is( -s "$tmp", 16 + (8+48) + 3*(8+16), 'recording size' );
+
+# Replay into a fresh player, which gets its own pictures
+@shown= ();
+my $player2= $vlc->new_media_player;
+$player2->set_video_callbacks(%callbacks);
+my $replay= new_ok( 'VideoLAN::LibVLC::Replay', [ libvlc => $vlc, file => "$tmp", players => [ $player2 ] ] );
+is( $replay->message_count, 4, 'message_count' );
+my $stats= $replay->run;
+is_deeply( [ @{$stats}{qw( messages dispatched skipped starved )} ], [ 4, 4, 0, 0 ], 'stats' )
+	or diag explain $stats;
+is( scalar @shown, 3, 'pictures displayed' );
+is( scalar(grep $_->isa('VideoLAN::LibVLC::Picture'), @shown), 3, 'as Picture objects' );
+is( $player2->queued_picture_count, 5, 'player2 still has the rest' );
+ok( $stats->{dispatch_time} <= $stats->{elapsed}, 'dispatch_time' );
+
+# No player to receive them
+$stats= VideoLAN::LibVLC::Replay->new(libvlc => $vlc, file => "$tmp")->run;
+is( $stats->{skipped}, 4, 'messages without a target are skipped' );
+
+open my $fh, '>', "$tmp" or die; print $fh "junk" x 10; close $fh;
+ok( !eval { VideoLAN::LibVLC::Replay->new(libvlc => $vlc, file => "$tmp"); 1 }, 'not a recording' );
+like( $@, qr/not a message recording/, 'error message' );
+
+done_testing;
@@ -0,0 +1,100 @@
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC qw( PERLVLC_FAKE_LIBVLC );
+
+plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to test the stand-in video output'
+	unless PERLVLC_FAKE_LIBVLC;
+
+use_ok('VideoLAN::LibVLC::MediaPlayer') || BAIL_OUT;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+my @log;
+$vlc->log(sub { push @log, $_[0] }, { level => 0, fields => [ 'module' ] });
+
+sub run_until_stopped {
+	my $player= shift;
+	my $timeout= time + 10;
+	while (time < $timeout && $player->is_playing) {
+		1 while $vlc->callback_dispatch;
+		sleep .005;
+	}
+	1 while $vlc->callback_dispatch;
+}
+
+subtest format_changes => sub {
+	my $p= $vlc->new_media_player;
+	my (@formats, @frames, $cleanups);
+	$p->set_video_callbacks(
+		format => sub {
+			my ($p, $event)= @_;
+			push @formats, "$event->{chroma}:$event->{width}x$event->{height}";
+			$p->set_video_format({ %$event, alloc_count => 4 });
+			$p->queue_new_picture(id => $_) for 1..4;
+		},
+		display => sub {
+			my ($p, $event)= @_;
+			my $pic= $event->{picture};
+			push @frames, ord ${ $pic->plane(0) };
+			# pictures of the previous format can still be arriving after a format change
+			my $fmt= $p->video_format;
+			$p->queue_picture($pic) if $fmt->{chroma} eq $pic->chroma && $fmt->{width} == $pic->width;
+		},
+		cleanup => sub { ++$cleanups },
+	);
+	$p->media('fake://?format=RV32:64x32&format=I420:128x72&change_every=10&frames=30&fps=0');
+	ok( $p->play, 'play' );
+	run_until_stopped($p);
+	ok( !$p->is_playing, 'end of stream' );
+	is_deeply( \@formats, [ 'RV32:64x32', 'I420:128x72', 'RV32:64x32' ], 'format changes' );
+	is_deeply( \@frames, [ 0..29 ], 'every frame displayed, in order' );
+	is( $cleanups, 3, 'cleanup after each format' );
+	ok( (grep $_->{message} =~ /ended after 30 frames/ && $_->{module} eq 'fake', @log), 'log messages' );
+};
+
+subtest rate_and_stop => sub {
+	my $p= $vlc->new_media_player;
+	my $frames= 0;
+	$p->set_video_callbacks(display => sub { ++$frames; $_[0]->queue_picture($_[1]{picture}) });
+	$p->set_video_format(chroma => 'RGBA', width => 32, height => 16);
+	$p->queue_new_picture(id => $_) for 1..4;
+	# with no end, stopping must not hang on a decoder waiting for a picture
+	$p->set_lock_timeout(.05);
+	$p->media('fake://fps=200,frames=0');
+	my $t0= time;
+	ok( $p->play, 'play' );
+	while (time - $t0 < .5) {
+		1 while $vlc->callback_dispatch;
+		sleep .005;
+	}
+	$p->stop;
+	1 while $vlc->callback_dispatch;
+	ok( !$p->is_playing, 'stopped' );
+	ok( $frames > 40 && $frames < 150, 'about 200 fps' ) or diag "$frames frames in .5s";
+};
+
+subtest held_scratch => sub {
+	my $p= $vlc->new_media_player;
+	my $frames= 0;
+	$p->set_video_callbacks(display => sub { ++$frames });
+	$p->set_video_format(chroma => 'RGBA', width => 32, height => 16);
+	# no pictures queued, so every frame times out into scratch while 3 earlier ones are held
+	$p->set_lock_timeout(.005, 'scratch');
+	$p->media('fake://fps=0,frames=20,hold=3');
+	ok( $p->play, 'play' );
+	run_until_stopped($p);
+	my $stats= $p->lock_stats;
+	is( $stats->{scratch}, 20, 'every frame decoded into scratch' ) or diag explain $stats;
+	is( $frames, 0, 'none displayed to perl' );
+	is( $p->media->stats->{lost_pictures}, 0, 'no frame decoded over a held frame' );
+};
+
+subtest bad_mrl => sub {
+	my $p= $vlc->new_media_player;
+	$p->set_video_callbacks(display => sub {});
+	$p->media('fake://bogus=1');
+	ok( !$p->play, 'unknown parameter fails to play' );
+};
+
+done_testing;
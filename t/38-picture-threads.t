@@ -0,0 +1,127 @@
+use strict;
+use warnings;
+use Config;
+use Test::More;
+BEGIN {
+	plan skip_all => 'Perl is not built with iThreads'
+		unless $Config{useithreads} && eval { require threads; require Thread::Queue; 1 };
+}
+use VideoLAN::LibVLC qw( PERLVLC_MSG_VIDEO_FORMAT_EVENT PERLVLC_MSG_VIDEO_DISPLAY_EVENT PERLVLC_MSG_VIDEO_TRADE_PICTURE );
+use VideoLAN::LibVLC::MediaPlayer;
+
+my %info= ( chroma => 'RGBA', width => 16, height => 10, pitch => 64, lines => 10 );
+
+subtest inherited => sub {
+	my $pic= new_ok( 'VideoLAN::LibVLC::Picture', [\%info] );
+	${ $pic->plane(0) } =~ tr/\0-\xFF/a/;
+	my $thr= threads->create(sub {
+		my $ret= [ $pic->shared_refs, substr(${ $pic->plane(0) }, 0, 4) ];
+		${ $pic->plane(0) } =~ tr/a/b/;
+		$ret;
+	});
+	my $ret= $thr->join;
+	is( $ret->[0], 2, 'clone is a second reference' );
+	is( $ret->[1], 'aaaa', 'clone sees the same planes' );
+	is( substr(${ $pic->plane(0) }, 0, 4), 'bbbb', 'and writes to them' );
+	is( $pic->shared_refs, 1, 'reference released when thread ended' );
+};
+
+subtest plane_alias => sub {
+	my $pic= new_ok( 'VideoLAN::LibVLC::Picture', [\%info] );
+	my $plane= $pic->plane(0);
+	is( $pic->shared_refs, 2, 'plane scalar holds a reference' );
+	$$plane =~ tr/\0-\xFF/c/;
+	my $q= Thread::Queue->new;
+	my $thr= threads->create(sub {
+		undef $pic;
+		$q->dequeue; # wait until main thread has let go
+		substr($$plane, 0, 4);
+	});
+	undef $pic;
+	undef $plane;
+	$q->enqueue(1);
+	is( $thr->join, 'cccc', 'cloned plane scalar kept the picture' );
+	my $before= VideoLAN::LibVLC::Picture->memory_stats->{pictures};
+	VideoLAN::LibVLC::Picture->new(\%info);
+	is( VideoLAN::LibVLC::Picture->memory_stats->{pictures}, $before-1, 'freed in this thread' );
+};
+
+subtest handles => sub {
+	my $pic= new_ok( 'VideoLAN::LibVLC::Picture', [{ %info, id => 7 }] );
+	my $q= Thread::Queue->new;
+	my $thr= threads->create(sub {
+		my $p= VideoLAN::LibVLC::Picture->from_handle($q->dequeue);
+		[ $p->id, length ${ $p->plane(0) }, $p->address(0) ];
+	});
+	is( $pic->shared_refs, 2, 'worker has a clone' );
+	my $h= $pic->share_handle;
+	is( $pic->shared_refs, 3, 'handle holds a reference' );
+	$q->enqueue($h);
+	is_deeply( $thr->join, [ 7, 640, $pic->address(0) ], 'same picture in worker' );
+	is( $pic->shared_refs, 1, 'released by worker' );
+	ok( !eval { VideoLAN::LibVLC::Picture->from_handle($h) }, 'handle can only be claimed once' );
+	like( $@, qr/already claimed/, 'error message' );
+
+	# claimed in the same thread, it is the same object
+	my $h2= $pic->share_handle;
+	is( VideoLAN::LibVLC::Picture->from_handle($h2), $pic, 'same object in home thread' );
+	is( $pic->shared_refs, 1, 'refs' );
+
+	my $buf= "\0" x 640;
+	my $scalar_pic= VideoLAN::LibVLC::Picture->new({ %info, plane => \$buf });
+	ok( !eval { $scalar_pic->share_handle }, "can't share perl scalar planes" );
+	like( $@, qr/belong to perl scalars/, 'error message' );
+	is( threads->create(sub { eval { $scalar_pic->id; 1 }? 'usable' : 'empty' })->join, 'empty', 'clone is empty' );
+};
+
+subtest return_to_player => sub {
+	my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+	like( threads->create(sub { eval { $vlc->callback_dispatch; 1 }? '' : $@ })->join,
+		qr/Can't share VLC objects/, "clone of the instance can't be used" );
+	my (@shown, @released);
+	my $player= $vlc->new_media_player;
+	$player->set_video_callbacks(
+		display  => sub { push @shown, $_[1]{picture} },
+		released => sub { push @released, $_[1]{picture} },
+	);
+	# Play the part of the video thread, as in t/36-replay.t
+	my $event_wr= $vlc->_event_pipe->[1];
+	send($event_wr, pack('L L a4 L L L3 L3 L', PERLVLC_MSG_VIDEO_FORMAT_EVENT, $player->{_callback_id},
+		'RGBA', 16, 10, 16, 0, 0, 64, 0, 0, 0), 0);
+	$vlc->callback_dispatch;
+	my @pics= map $_->{picture}, grep $_->{event_id} == PERLVLC_MSG_VIDEO_TRADE_PICTURE,
+		map $vlc->_inflate_message($_), $player->_vbuf_drain;
+	send($event_wr, pack('L L J', PERLVLC_MSG_VIDEO_DISPLAY_EVENT, $player->{_callback_id}, $pics[0]), 0);
+	$vlc->callback_dispatch;
+	is( scalar @shown, 1, 'picture displayed' );
+
+	my $q= Thread::Queue->new;
+	my $thr= threads->create(sub {
+		my $p= VideoLAN::LibVLC::Picture->from_handle($q->dequeue);
+		$q->dequeue; # wait until main thread has let go
+		1;
+	});
+	$q->enqueue($shown[0]->share_handle);
+	my $addr= $shown[0]->address(0);
+	ok( !eval { $player->queue_picture($shown[0]) }, "can't queue while another thread has it" );
+	like( $@, qr/another thread/, 'error message' );
+	@shown= ();
+	$q->enqueue(1);
+	$thr->join;
+	my $n= 0;
+	for (1..100) { last if $n= $vlc->callback_dispatch; select(undef, undef, undef, .01) }
+	is( $n, 1, 'released event' );
+	is( scalar @released, 1, 'released callback' );
+	is( $released[0]->address(0), $addr, 'same picture' );
+	is( $released[0]->shared_refs, 1, 'owned by this thread again' );
+
+	# by default, it goes back to the decoder
+	$player->set_video_callbacks(display => sub {});
+	my $count= $player->queued_picture_count;
+	$q->enqueue(pop(@released)->share_handle);
+	threads->create(sub { VideoLAN::LibVLC::Picture->from_handle($q->dequeue); 1 })->join;
+	for (1..100) { last if $vlc->callback_dispatch; select(undef, undef, undef, .01) }
+	is( $player->queued_picture_count, $count+1, 'queued again' );
+};
+
+done_testing;
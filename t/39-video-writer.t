@@ -0,0 +1,151 @@
+use strict;
+use warnings;
+use Test::More;
+use File::Temp;
+use Config;
+use Socket qw( MSG_DONTWAIT );
+use VideoLAN::LibVLC qw( PERLVLC_MSG_VIDEO_FORMAT_EVENT PERLVLC_MSG_VIDEO_DISPLAY_EVENT PERLVLC_MSG_VIDEO_TRADE_PICTURE
+	PERLVLC_MSG_VIDEO_WRITTEN );
+use VideoLAN::LibVLC::MediaPlayer;
+
+use_ok('VideoLAN::LibVLC::VideoWriter') || BAIL_OUT;
+
+sub slurp { open my $fh, '<:raw', $_[0] or die; local $/; scalar <$fh> }
+
+# Plane 0 is filled with 'Y', 1 with 'U', 2 with 'V', including the padding of each row
+sub new_pic {
+	my ($chroma, $w, $h)= @_;
+	my $pic= VideoLAN::LibVLC::Picture->new({ chroma => $chroma, width => $w, height => $h });
+	for (0..2) {
+		my $plane= $pic->plane($_) or next;
+		my $c= substr('YUV', $_, 1);
+		eval "\$\$plane =~ tr/\\0-\\xFF/$c/"; die $@ if $@;
+	}
+	$pic;
+}
+
+subtest y4m => sub {
+	my $tmp= File::Temp->new;
+	my $w= new_ok( 'VideoLAN::LibVLC::VideoWriter', [ fh => $tmp, fps => 29.97 ] );
+	my $pic= new_pic('I420', 8, 6);
+	ok( $pic->pitch(0) > 8, 'rows are padded' );
+	ok( $w->write($pic), 'write' );
+	ok( $w->write($pic), 'write again' );
+	ok( $w->write(new_pic('I420', 16, 6)), 'different size' );
+	ok( $w->write(new_pic('YV12', 8, 6)), 'different chroma' );
+	is_deeply( $w->stats, { frames => 2, bytes => 40 + 2*(6+72), skipped => 2, queued => 0 }, 'stats' );
+	my $frame= "FRAME\n" . ('Y' x 48) . ('U' x 12) . ('V' x 12);
+	is( slurp("$tmp"), "YUV4MPEG2 W8 H6 F29970:1000 Ip C420jpeg\n$frame$frame", 'stream' );
+
+	# YV12 has V in plane 1, which is filled with 'U' here
+	my $tmp2= File::Temp->new;
+	VideoLAN::LibVLC::VideoWriter->new(fh => $tmp2, aspect => '1:1')->write(new_pic('YV12', 8, 6));
+	is( slurp("$tmp2"), "YUV4MPEG2 W8 H6 F25:1 Ip A1:1 C420jpeg\nFRAME\n" . ('Y' x 48) . ('V' x 12) . ('U' x 12),
+		'YV12 written in YUV order' );
+	ok( !eval { $w->write(new_pic('RGBA', 8, 6)) }, 'no colorspace for RGBA' );
+	like( $@, qr/YUV4MPEG2/, 'error message' );
+};
+
+subtest raw => sub {
+	my $tmp= File::Temp->new;
+	my $w= new_ok( 'VideoLAN::LibVLC::VideoWriter', [ fh => $tmp, format => 'raw' ] );
+	$w->write(new_pic('NV12', 5, 3));
+	$w->write(new_pic('RGBA', 5, 3));
+	# NV12 chroma rows are 3 samples of 2 bytes, for 2 rows
+	is( slurp("$tmp"), ('Y' x 15) . ('U' x 12), 'visible bytes only' );
+	is( $w->stats->{skipped}, 1, 'format is fixed by the first picture' );
+};
+
+subtest threaded => sub {
+	my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+	my $tmp= File::Temp->new;
+	my @written;
+	my $w= new_ok( 'VideoLAN::LibVLC::VideoWriter', [ fh => $tmp, format => 'raw', queue => 2,
+		libvlc => $vlc, on_written => sub { push @written, $_[1] } ] );
+	my @pics= map new_pic('GREY', 4, 2), 1..5;
+	$w->write($_) for @pics;
+	ok( $w->pending > 0, 'writer holds pictures' );
+	$w->flush;
+	is( $w->pending, 0, 'flushed' );
+	is( scalar @written, 5, 'every picture returned' );
+	is( $written[$_], $pics[$_], "picture $_ in order" ) for 0..4;
+	is( slurp("$tmp"), 'Y' x 40, 'contents' );
+	$w->close;
+	ok( $w->write(new_pic('GREY', 4, 2)), 'synchronous after close' );
+	is( scalar @written, 6, 'returned right away' );
+	undef $w;
+	ok( 1, 'destroyed' );
+
+	# With the event pipe full, the writer thread must not block perl waiting for room
+	my $ev_wr= $vlc->_event_pipe->[1];
+	my $filler= pack('L L J', PERLVLC_MSG_VIDEO_WRITTEN, 0, 0);
+	my $filled= 0;
+	++$filled while send($ev_wr, $filler, MSG_DONTWAIT);
+	ok( $filled, "event pipe full after $filled messages" );
+	$tmp= File::Temp->new;
+	@written= ();
+	$w= VideoLAN::LibVLC::VideoWriter->new(fh => $tmp, format => 'raw', queue => 2,
+		libvlc => $vlc, on_written => sub { push @written, $_[1] });
+	@pics= map new_pic('GREY', 4, 2), 1..5;
+	local $SIG{ALRM}= sub { die "timeout\n" };
+	alarm 10;
+	ok( eval { $w->write($_) for @pics; $w->flush; 1 }, 'writes finish' ) or diag $@;
+	alarm 0;
+	is( scalar @written, 5, 'every picture returned' );
+	is( $written[$_], $pics[$_], "picture $_ in order" ) for 0..4;
+	undef $w;
+
+	pipe(my $r, my $wr) or die;
+	close $r;
+	local $SIG{PIPE}= 'IGNORE';
+	$w= VideoLAN::LibVLC::VideoWriter->new(fh => $wr, format => 'raw', queue => 2, libvlc => $vlc);
+	$w->write(new_pic('GREY', 4, 2));
+	$w->flush;
+	like( $w->error, qr/pipe/i, 'error from the writer thread' );
+	ok( !eval { $w->write(new_pic('GREY', 4, 2)) }, 'later writes die' );
+	like( $@, qr/Write failed/, 'error message' );
+};
+
+subtest attach => sub {
+	my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+	my $player= $vlc->new_media_player;
+	my $tmp= File::Temp->new;
+	my $w= VideoLAN::LibVLC::VideoWriter->new(fh => $tmp, format => 'raw', queue => 4, libvlc => $vlc);
+	$w->attach($player);
+	# Play the part of the video thread, as in t/36-replay.t
+	my $event_wr= $vlc->_event_pipe->[1];
+	send($event_wr, pack('L L a4 L L L3 L3 L', PERLVLC_MSG_VIDEO_FORMAT_EVENT, $player->{_callback_id},
+		'GREY', 64, 2, 2, 0, 0, 64, 0, 0, 0), 0);
+	$vlc->callback_dispatch;
+	my @pics= map $_->{picture}, grep $_->{event_id} == PERLVLC_MSG_VIDEO_TRADE_PICTURE,
+		map $vlc->_inflate_message($_), $player->_vbuf_drain;
+	send($event_wr, pack('L L J', PERLVLC_MSG_VIDEO_DISPLAY_EVENT, $player->{_callback_id}, $_), 0)
+		for @pics[0..2];
+	$vlc->callback_dispatch;
+	# the writer thread may already have returned some of them during that dispatch
+	is( $player->queued_picture_count + $w->pending, 8, 'displayed pictures went to the writer' );
+	$w->flush;
+	is( -s "$tmp", 3*128, 'written' );
+	is( $player->queued_picture_count, 8, 'and queued to the player again' );
+};
+
+subtest ithread_clone => sub {
+	plan skip_all => 'Perl lacks iThreads'
+		unless $Config{useithreads} && eval { require threads; 1 };
+	my $vlc= VideoLAN::LibVLC->new;
+	my $tmp= File::Temp->new;
+	my $w= VideoLAN::LibVLC::VideoWriter->new(fh => $tmp, format => 'raw', queue => 2, libvlc => $vlc);
+	my $warnings= threads->create(sub {
+		my @warnings;
+		local $SIG{__WARN__}= sub { push @warnings, @_ };
+		undef $w;
+		join '', @warnings;
+	})->join;
+	is( $warnings, '', 'no warning when the clone is destroyed' );
+	$w->write(new_pic('GREY', 4, 2));
+	$w->flush;
+	# (the clone of File::Temp has already removed the file, so count what was written)
+	is_deeply( [ @{ $w->stats }{qw( frames bytes )} ], [ 1, 8 ], 'writer still works in the parent' );
+};
+
+done_testing;
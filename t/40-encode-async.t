@@ -0,0 +1,218 @@
+use strict;
+use warnings;
+use Test::More;
+use File::Temp;
+use POSIX ();
+use Compress::Zlib ();
+use Socket qw( MSG_DONTWAIT );
+use VideoLAN::LibVLC qw( PERLVLC_MSG_VIDEO_FORMAT_EVENT PERLVLC_MSG_VIDEO_DISPLAY_EVENT PERLVLC_MSG_VIDEO_TRADE_PICTURE
+	PERLVLC_MSG_VIDEO_WRITTEN PERLVLC_HAVE_ZLIB );
+use VideoLAN::LibVLC::MediaPlayer;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+my $dir= File::Temp->newdir;
+
+sub slurp { open my $fh, '<:raw', $_[0] or die "$_[0]: $!"; local $/; scalar <$fh> }
+
+# Fill each plane with a repeating byte pattern, including the padding of each row
+sub new_pic {
+	my ($chroma, $w, $h, @fill)= @_;
+	my $pic= VideoLAN::LibVLC::Picture->new({ chroma => $chroma, width => $w, height => $h });
+	for (0..$#fill) {
+		my $plane= $pic->plane($_);
+		substr($$plane, 0, length($$plane), substr($fill[$_] x length($$plane), 0, length($$plane)));
+	}
+	$pic;
+}
+
+sub wait_for_jobs {
+	for (1..500) {
+		last unless $vlc->encode_pending;
+		$vlc->callback_dispatch or select(undef, undef, undef, .01);
+	}
+	!$vlc->encode_pending;
+}
+
+# Decode the pixels of a PNG written by the encoder (8-bit, one IDAT stream, Sub filter)
+sub png_pixels {
+	my $png= shift;
+	substr($png, 0, 8, '') eq "\x89PNG\r\n\x1A\n" or return;
+	my ($w, $h, $channels, $z)= (0, 0, 0, '');
+	while (length $png) {
+		my ($len, $type)= unpack 'N a4', substr($png, 0, 8, '');
+		my $data= substr($png, 0, $len, '');
+		my $crc= unpack 'N', substr($png, 0, 4, '');
+		return unless $crc == Compress::Zlib::crc32($type.$data);
+		if ($type eq 'IHDR') {
+			($w, $h, my ($depth, $color))= unpack 'N N C C', $data;
+			$channels= $color == 0? 1 : 3;
+		}
+		$z .= $data if $type eq 'IDAT';
+	}
+	my $raw= Compress::Zlib::uncompress($z) // return;
+	my $out= '';
+	for my $y (0 .. $h-1) {
+		my $row= substr($raw, $y * ($w * $channels + 1), $w * $channels + 1);
+		return unless ord($row) == 1;
+		my @b= unpack 'C*', substr($row, 1);
+		$b[$_]= ($b[$_] + $b[$_ - $channels]) & 0xFF for $channels .. $#b;
+		$out .= pack 'C*', @b;
+	}
+	return [ $w, $h, $channels, $out ];
+}
+
+ok( VideoLAN::LibVLC::Picture->can_encode('RV32'), 'can encode RV32' );
+ok( !VideoLAN::LibVLC::Picture->can_encode('I0AL'), "can't encode I0AL" );
+
+subtest ppm => sub {
+	my @done;
+	my $rgba= new_pic('RGBA', 4, 2, "\x10\x20\x30\xFF");
+	my $grey= new_pic('GREY', 3, 2, "\x80");
+	my $yuv= new_pic('I420', 4, 2, "\xEB", "\x80", "\x80");
+	my $nv12= new_pic('NV12', 4, 2, "\x80", "\x80");
+	for ([ $rgba, 'rgba.ppm' ], [ $grey, 'grey.pgm' ], [ $yuv, 'i420.ppm' ], [ $nv12, 'nv12.ppm' ]) {
+		$_->[0]->encode_async(libvlc => $vlc, path => "$dir/$_->[1]", on_done => sub { push @done, $_[0] });
+	}
+	ok( wait_for_jobs(), 'jobs done' );
+	is( scalar @done, 4, 'on_done for each' );
+	is( slurp("$dir/rgba.ppm"), "P6\n4 2\n255\n" . ("\x10\x20\x30" x 8), 'RGBA' );
+	is( slurp("$dir/grey.pgm"), "P5\n3 2\n255\n" . ("\x80" x 6), 'GREY' );
+	is( slurp("$dir/i420.ppm"), "P6\n4 2\n255\n" . ("\xFF" x 24), 'I420 limited-range white' );
+	is( slurp("$dir/nv12.ppm"), "P6\n4 2\n255\n" . ("\x82" x 24), 'NV12 limited-range grey' );
+	is( $done[0]{path}, "$dir/rgba.ppm", 'path in event' );
+	is( $done[0]{bytes}, 11 + 24, 'bytes in event' );
+	ok( !-e "$dir/rgba.ppm.tmp", 'temporary file renamed' );
+};
+
+subtest png => sub {
+	unless (PERLVLC_HAVE_ZLIB) {
+		ok( !eval { new_pic('RGBA', 2, 2, "\0")->encode_async(libvlc => $vlc, path => "$dir/x.png") }, 'no PNG without zlib' );
+		like( $@, qr/PNG encoding needs zlib/, 'error message' );
+		return;
+	}
+	my $rgba= new_pic('BGRA', 37, 5, join '', map chr($_ * 7 % 256), 0..63);
+	my ($event, $png);
+	$rgba->encode_async(libvlc => $vlc, path => "$dir/bgra.png", level => 9, on_done => sub { $event= shift });
+	is( $rgba->shared_refs, 2, 'job holds the picture' );
+	ok( wait_for_jobs(), 'job done' );
+	ok( !$event->{error}, 'no error' );
+	is( $event->{picture}, $rgba, 'picture returned' );
+	is( $rgba->shared_refs, 1, 'job released the picture' );
+	ok( $png= png_pixels(slurp("$dir/bgra.png")), 'valid PNG' );
+	my $plane= ${ $rgba->plane(0) };
+	my $expect= join '', map { my $row= substr($plane, $_ * $rgba->pitch(0), 37*4);
+		join '', map { scalar reverse substr($row, $_*4, 3) } 0..36 } 0..4;
+	is_deeply( $png, [ 37, 5, 3, $expect ], 'pixels' );
+
+	my $grey= new_pic('Y800', 3, 1, "\x01\x02\x03");
+	$grey->encode_async(libvlc => $vlc, path => "$dir/grey.png", copy => 1, on_done => sub { $event= shift });
+	is( $grey->shared_refs, 1, 'copy does not hold the picture' );
+	ok( wait_for_jobs(), 'job done' );
+	ok( !exists $event->{picture}, 'no picture in event' );
+	is_deeply( png_pixels(slurp("$dir/grey.png")), [ 3, 1, 1, "\x01\x02\x03" ], 'greyscale' );
+};
+
+subtest errors => sub {
+	my $pic= new_pic('RGBA', 2, 2, "\0");
+	my $event;
+	$pic->encode_async(libvlc => $vlc, path => "$dir/missing/x.ppm", on_done => sub { $event= shift });
+	ok( wait_for_jobs(), 'job done' );
+	ok( $event->{error}, 'error reported' ) and note $event->{error};
+	ok( !eval { $pic->encode_async(libvlc => $vlc, path => "$dir/x.jpg") }, 'unknown format' );
+	like( $@, qr/Unknown image format 'jpg'/, 'error message' );
+	ok( !eval { new_pic('I0AL', 2, 2)->encode_async(libvlc => $vlc, path => "$dir/x.png") }, 'unsupported chroma' );
+	like( $@, qr/Can't encode chroma I0AL/, 'error message' );
+	ok( !eval { $pic->encode_async(path => "$dir/x.png") }, 'requires libvlc' );
+	my $buf= "\0" x 128;
+	my $scalar_pic= VideoLAN::LibVLC::Picture->new({ chroma => 'RGBA', width => 2, height => 2, pitch => 64, plane => \$buf });
+	ok( !eval { $scalar_pic->encode_async(libvlc => $vlc, path => "$dir/x.ppm") }, 'perl scalar planes need copy' );
+	like( $@, qr/belong to perl scalars/, 'error message' );
+	ok( $scalar_pic->encode_async(libvlc => $vlc, path => "$dir/scalar.ppm", copy => 1), 'copy' );
+	ok( wait_for_jobs(), 'job done' );
+};
+
+subtest snapshot_every => sub {
+	my (@shown, @snaps);
+	my $player= $vlc->new_media_player;
+	$player->set_video_callbacks(display => sub { push @shown, $_[1]{picture}; $_[0]->queue_picture($_[1]{picture}) });
+	$player->snapshot_every(3600, path => "$dir/snap-%02d.ppm", on_done => sub { push @snaps, $_[1] });
+	# Play the part of the video thread, as in t/36-replay.t
+	my $event_wr= $vlc->_event_pipe->[1];
+	send($event_wr, pack('L L a4 L L L3 L3 L', PERLVLC_MSG_VIDEO_FORMAT_EVENT, $player->{_callback_id},
+		'RGBA', 4, 2, 2, 0, 0, 64, 0, 0, 0), 0);
+	$vlc->callback_dispatch;
+	my @pics= map $_->{picture}, grep $_->{event_id} == PERLVLC_MSG_VIDEO_TRADE_PICTURE,
+		map $vlc->_inflate_message($_), $player->_vbuf_drain;
+	for (0, 1) {
+		send($event_wr, pack('L L J', PERLVLC_MSG_VIDEO_DISPLAY_EVENT, $player->{_callback_id}, $pics[$_]), 0);
+		$vlc->callback_dispatch;
+	}
+	is( scalar @shown, 2, 'both pictures displayed' );
+	ok( wait_for_jobs(), 'job done' );
+	is( scalar @snaps, 1, 'one snapshot per interval' );
+	is( $snaps[0]{path}, "$dir/snap-00.ppm", 'path from pattern' );
+	ok( -s "$dir/snap-00.ppm", 'file written' );
+	$player->snapshot_every(0);
+};
+
+subtest cancel => sub {
+	my $vlc2= VideoLAN::LibVLC->new;
+	my $pic= new_pic('RGBA', 640, 480, "\0");
+	$pic->encode_async(libvlc => $vlc2, path => "$dir/cancel-$_.ppm") for 1..3;
+	is( $pic->shared_refs, 4, 'held by 3 jobs' );
+	undef $vlc2;
+	is( $pic->shared_refs, 1, 'released when the instance is freed' );
+
+	# finished, and read off the pipe by callback_dispatch, but never dispatched
+	$vlc2= VideoLAN::LibVLC->new;
+	$pic->encode_async(libvlc => $vlc2, path => "$dir/cancel-4.ppm");
+	for (1..500) {
+		$vlc2->_recv_prioritized($vlc2->_event_queue, 256, -1);
+		last if $vlc2->callback_pending;
+		select(undef, undef, undef, .01);
+	}
+	is( $vlc2->callback_pending, 1, 'result queued in perl' );
+	undef $vlc2;
+	is( $pic->shared_refs, 1, 'released from the queue too' );
+
+	# the encoder must not hold its lock while the event pipe is full
+	$vlc2= VideoLAN::LibVLC->new;
+	my $ev_wr= $vlc2->_event_pipe->[1];
+	my $filler= pack('L L J', PERLVLC_MSG_VIDEO_WRITTEN, 0, 0);
+	1 while send($ev_wr, $filler, MSG_DONTWAIT);
+	local $SIG{ALRM}= sub { die "timeout\n" };
+	alarm 10;
+	ok( eval {
+		$pic->encode_async(libvlc => $vlc2, path => "$dir/cancel-$_.ppm") for 5..7;
+		undef $vlc2;
+		1;
+	}, 'submit and cancel with a full pipe' ) or diag $@;
+	alarm 0;
+	is( $pic->shared_refs, 1, 'released' );
+};
+
+subtest fork => sub {
+	my $pic= new_pic('RGBA', 4, 2, "\0");
+	$pic->encode_async(libvlc => $vlc, path => "$dir/fork-parent-1.ppm");
+	ok( wait_for_jobs(), 'encoder thread running' );
+	my $pid= fork;
+	defined $pid or die "fork: $!";
+	unless ($pid) {
+		# the child needs its own encoder thread, and must not wait on the parent's lock
+		alarm 10;
+		my $vlc2= VideoLAN::LibVLC->new;
+		$pic->encode_async(libvlc => $vlc2, path => "$dir/fork-child.ppm");
+		my $done;
+		for (1..500) {
+			last if $done= !$vlc2->encode_pending;
+			$vlc2->callback_dispatch or select(undef, undef, undef, .01);
+		}
+		POSIX::_exit($done && -s "$dir/fork-child.ppm"? 0 : 1);
+	}
+	waitpid($pid, 0);
+	is( $?, 0, 'child encoded a picture' );
+	$pic->encode_async(libvlc => $vlc, path => "$dir/fork-parent-2.ppm");
+	ok( wait_for_jobs() && -s "$dir/fork-parent-2.ppm", 'parent still encodes' );
+};
+
+done_testing;
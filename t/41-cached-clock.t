@@ -0,0 +1,72 @@
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw( sleep );
+use VideoLAN::LibVLC qw( :state_t );
+use VideoLAN::LibVLC::MediaPlayer;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+my $player= $vlc->new_media_player;
+
+ok( !$player->cached_clock, 'disabled by default' );
+is( $player->clock, undef, 'no clock' );
+ok( $player->cached_clock(1), 'enable' );
+ok( $player->clock, 'clock snapshot' );
+
+# Play the part of the libvlc event thread
+$player->_clock_event(length => 60000);
+$player->_clock_event('opening');
+ok( !$player->is_playing, 'not playing while opening' );
+$player->_clock_event('playing');
+$player->_clock_event(time => 1000);
+ok( $player->is_playing, 'playing' );
+is( $player->length, 60, 'length' );
+sleep .1;
+my $t= $player->time;
+ok( $t >= 1.1 && $t < 1.5, 'time advances between events' ) or diag "time = $t";
+ok( abs($player->position - $player->time / 60) < .001, 'position follows time' );
+
+subtest pause => sub {
+	$player->_clock_event('paused');
+	ok( !$player->is_playing, 'not playing' );
+	my $t= $player->time;
+	sleep .05;
+	is( $player->time, $t, 'time stops' );
+	is( $player->clock->{state}, STATE_PAUSED, 'state' );
+	$player->_clock_event('playing');
+	sleep .05;
+	ok( $player->time > $t, 'and resumes' );
+};
+
+subtest rate_and_seek => sub {
+	$player->set_rate(2);
+	is( $player->clock->{rate}, 2, 'rate' );
+	$player->_clock_event(time => 10000);
+	sleep .1;
+	my $t= $player->time;
+	ok( $t >= 10.2 && $t < 10.8, 'advances at twice real time' ) or diag "time = $t";
+	$player->time(30);
+	ok( $player->time >= 30 && $player->time < 30.2, 'seek moves the clock right away' );
+	$player->position(.75);
+	ok( $player->time >= 45 && $player->time < 45.2, 'seek by position' );
+	$player->set_rate(1);
+};
+
+subtest end => sub {
+	$player->_clock_event(time => 59990);
+	sleep .05;
+	is( $player->time, 60, 'clamped to length' );
+	is( $player->position, 1, 'position' );
+	$player->_clock_event('ended');
+	is( $player->clock->{state}, STATE_ENDED, 'ended' );
+	is( $player->time, 60, 'time kept' );
+	$player->_clock_event('stopped');
+	is( $player->time, undef, 'time unknown when stopped' );
+	is( $player->position, undef, 'position unknown when stopped' );
+	is( $player->clock->{events}, 10, 'event count' );
+};
+
+ok( !$player->cached_clock(0), 'disable' );
+is( $player->clock, undef, 'no clock' );
+
+done_testing;
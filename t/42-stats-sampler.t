@@ -0,0 +1,100 @@
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC qw( PERLVLC_FAKE_LIBVLC );
+use VideoLAN::LibVLC::MediaPlayer;
+use POSIX ();
+
+plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to test the stats sampler on the stand-in video output'
+	unless PERLVLC_FAKE_LIBVLC;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+is( $vlc->new_media('fake://frames=1')->stats, undef, 'no stats before playing' );
+
+sub dispatch_for {
+	my $until= time + shift;
+	while (time < $until) {
+		1 while $vlc->callback_dispatch;
+		sleep .005;
+	}
+}
+
+sub new_player {
+	my $p= (@_ > 1? shift : $vlc)->new_media_player;
+	$p->set_video_callbacks(display => sub { $_[0]->queue_picture($_[1]{picture}) });
+	$p->set_video_format(chroma => 'RGBA', width => 32, height => 16);
+	$p->queue_new_picture(id => $_) for 1..4;
+	$p->set_lock_timeout(.05);
+	$p->media(shift);
+	$p;
+}
+
+subtest sample_while_playing => sub {
+	my $p= new_player('fake://fps=200,frames=0');
+	my @samples;
+	$p->sample_stats(.05, sub { push @samples, $_[1] });
+	ok( $p->play, 'play' );
+	dispatch_for(.5);
+	ok( @samples >= 5, 'samples arrive' ) or diag scalar(@samples).' samples';
+	ok( !exists $samples[0]{delta}, 'no delta in first sample' );
+	my $s= $samples[-1];
+	is( $p->last_stats, $s, 'last_stats' );
+	ok( $s->{elapsed} > .02 && $s->{elapsed} < .2, 'elapsed' ) or diag "elapsed $s->{elapsed}";
+	is( $s->{read_bytes}, $s->{displayed_pictures} * 32*4*16, 'totals' );
+	is( $s->{delta}{displayed_pictures}, $s->{displayed_pictures} - $samples[-2]{displayed_pictures}, 'delta' );
+	ok( $s->{rate}{displayed_pictures} > 50 && $s->{rate}{displayed_pictures} < 400, 'about 200 fps' )
+		or diag "rate $s->{rate}{displayed_pictures}";
+	ok( $p->media->stats->{displayed_pictures} >= $s->{displayed_pictures}, 'media stats' );
+
+	$p->sample_stats(0);
+	1 while $vlc->callback_dispatch;
+	my $n= @samples;
+	dispatch_for(.2);
+	is( scalar @samples, $n, 'no samples after stopping the sampler' );
+	ok( $p->is_playing, 'still playing' );
+	$p->stop;
+};
+
+subtest only_while_playing => sub {
+	my $p= new_player('fake://fps=100,frames=10');
+	my $samples= 0;
+	$p->sample_stats(.02, sub { ++$samples });
+	ok( $p->play, 'play' );
+	dispatch_for(.3);
+	ok( !$p->is_playing, 'ended' );
+	my $n= $samples;
+	dispatch_for(.1);
+	is( $samples, $n, 'no samples after the end' );
+	undef $p;
+	dispatch_for(.05);
+};
+
+subtest fork => sub {
+	my $p= new_player('fake://fps=100,frames=0');
+	$p->sample_stats(.02, sub {});
+	ok( $p->play, 'play' );
+	my $pid= fork;
+	defined $pid or die "fork: $!";
+	unless ($pid) {
+		# the child has no sampler thread until it asks for one, and none of the parent's players
+		alarm 10;
+		my $vlc2= VideoLAN::LibVLC->new;
+		my $p2= new_player($vlc2, 'fake://fps=100,frames=0');
+		my $samples= 0;
+		$p2->sample_stats(.02, sub { ++$samples });
+		$p2->play;
+		for (my $until= time + .5; time < $until && !$samples; sleep .01) {
+			1 while $vlc2->callback_dispatch;
+		}
+		$p2->stop;
+		POSIX::_exit($samples? 0 : 1);
+	}
+	waitpid($pid, 0);
+	is( $?, 0, 'child sampled its own player' );
+	$p->stop;
+	undef $p;
+	dispatch_for(.05);
+};
+
+done_testing;
@@ -0,0 +1,124 @@
+use strict;
+use warnings;
+use Test::More;
+use File::Temp;
+use FindBin;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC qw( PERLVLC_FAKE_LIBVLC );
+use VideoLAN::LibVLC::MediaPlayer;
+use VideoLAN::LibVLC::ProbeCache;
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+my $dir= File::Temp->newdir;
+
+sub box     { my $type= shift; my $body= join '', @_; pack('N a4', 8 + length $body, $type) . $body }
+sub fullbox { my $type= shift; box($type, "\0\0\0\0", @_) }
+sub table   { my $type= shift; fullbox($type, pack('N', scalar @_), map pack('N*', @$_), @_) }
+
+# A movie with a sound track and then a video track, each with only the boxes that matter
+sub write_mp4 {
+	my ($name, %t)= @_;
+	my $trak= sub {
+		my ($handler, %t)= @_;
+		box('trak',
+			($t{elst}? box('edts', table('elst', @{ $t{elst} })) : ()),
+			box('mdia',
+				fullbox('mdhd', pack('N5', 0, 0, $t{scale}, 0, 0)),
+				fullbox('hdlr', pack('N a4 N3', 0, $handler, 0, 0, 0)),
+				box('minf', box('stbl',
+					table('stts', @{ $t{stts} }),
+					($t{stss}? table('stss', map [$_], @{ $t{stss} }) : ()),
+					($t{ctts}? table('ctts', @{ $t{ctts} }) : ()),
+				)),
+			),
+		);
+	};
+	open my $fh, '>:raw', "$dir/$name" or die "$dir/$name: $!";
+	print $fh box('ftyp', 'isom', "\0\0\0\1"),
+		box('moov',
+			fullbox('mvhd', pack('N5', 0, 0, $t{movie_scale} || 1000, 0, 0)),
+			$trak->('soun', scale => 48000, stts => [[ 10, 1024 ]], stss => [ 5 ]),
+			$trak->('vide', %t),
+		),
+		box('mdat', "\0" x 16);
+	close $fh;
+	"$dir/$name";
+}
+
+# 25 fps with a keyframe every second, and B-frames delayed by two frames
+my $gop= write_mp4('gop.mp4', scale => 1000, stts => [[ 100, 40 ]], stss => [ 1, 26, 51, 76 ],
+	ctts => [[ 100, 80 ]], elst => [[ 4000, 80, 0x10000 ]]);
+# every sample is a keyframe, after a one-second empty edit
+my $intra= write_mp4('intra.mp4', scale => 90000, movie_scale => 600,
+	stts => [[ 2, 45000 ], [ 1, 22500 ]], elst => [[ 600, 0xFFFFFFFF, 0x10000 ], [ 900, 0, 0x10000 ]]);
+# 29.97 fps with a keyframe every 15 frames, which land between whole milliseconds
+my $ntsc= write_mp4('ntsc.mp4', scale => 30000, stts => [[ 60, 1001 ]], stss => [ 1, 16, 31, 46 ]);
+
+subtest parse => sub {
+	is_deeply( VideoLAN::LibVLC::_mp4_keyframes($gop), [ 0, 1000, 2000, 3000 ], 'sync samples of the video track' );
+	is_deeply( VideoLAN::LibVLC::_mp4_keyframes($intra), [ 1000, 1500, 2000 ], 'no stss' );
+	is_deeply( VideoLAN::LibVLC::_mp4_keyframes($ntsc), [ 0, 501, 1001, 1502 ], 'rounded up to the next millisecond' );
+	is_deeply( VideoLAN::LibVLC::_mp4_keyframes("$FindBin::Bin/data/NASA-solar-flares-2017-04-02.mp4"), [ 0 ], 'real file' );
+	open my $fh, '>', "$dir/x.txt" or die; print $fh "not a movie\n"; close $fh;
+	is( VideoLAN::LibVLC::_mp4_keyframes("$dir/x.txt"), undef, 'not MP4' );
+	ok( !eval { VideoLAN::LibVLC::_mp4_keyframes("$dir/missing.mp4") }, 'missing file dies' );
+};
+
+subtest cache => sub {
+	my $cache= VideoLAN::LibVLC::ProbeCache->new(file => "$dir/probe");
+	$cache->store($_, { duration => 4000, metadata => {}, tracks => [] }) for $gop, $intra;
+	my $media= $vlc->new_media(path => $gop, probe_cache => $cache);
+	is( $media->keyframes, undef, 'no index yet' );
+	is( $media->build_seek_index, 4, 'build_seek_index' );
+	is_deeply( $media->keyframes, [ 0, 1, 2, 3 ], 'keyframes' );
+	$cache->save;
+
+	$cache= VideoLAN::LibVLC::ProbeCache->new(file => "$dir/probe");
+	is_deeply( $cache->lookup($gop)->{keyframes}, [ 0, 1000, 2000, 3000 ], 'saved in the cache' );
+	ok( !exists $cache->lookup($intra)->{keyframes}, 'entry without an index' );
+	is( $cache->lookup($intra)->{duration}, 4000, 'still decoded' );
+	$media= $vlc->new_media(path => $gop, probe_cache => $cache);
+	is_deeply( $media->keyframes, [ 0, 1, 2, 3 ], 'answered from the cache' );
+};
+
+subtest seek => sub {
+	my $p= $vlc->new_media_player;
+	$p->lock_stats(1);
+	$p->media($vlc->new_media(path => $gop));
+	is( $p->seek(2.5, mode => 'keyframe'), 2.5, 'accurate without an index' );
+	$p->media->build_seek_index;
+	is( $p->seek(2.5, mode => 'keyframe'), 2, 'keyframe before the target' );
+	is( $p->seek(3, mode => 'keyframe'), 3, 'keyframe at the target' );
+	is( $p->seek(99, mode => 'keyframe'), 3, 'past the last keyframe' );
+	is( $p->seek(2.5), 2.5, 'accurate' );
+	ok( !eval { $p->seek(1, mode => 'nearest') }, 'unknown mode' );
+	my $st= $p->lock_stats;
+	is( $st->{seeks}, 5, 'seeks counted' );
+	is( $st->{keyframe_seeks}, 3, 'keyframe seeks counted' );
+	is( $st->{seeks_done}, 0, 'nothing displayed' );
+};
+
+subtest latency => sub {
+	plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to measure seeks on the stand-in video output'
+		unless PERLVLC_FAKE_LIBVLC;
+	my $p= $vlc->new_media_player;
+	$p->set_video_callbacks(display => sub { $_[0]->queue_picture($_[1]{picture}) });
+	$p->set_video_format(chroma => 'RGBA', width => 32, height => 16);
+	$p->queue_new_picture(id => $_) for 1..4;
+	$p->set_lock_timeout(.05);
+	$p->media('fake://fps=100,frames=0');
+	ok( $p->play, 'play' );
+	sleep .1;
+	$p->seek(1);
+	for (my $until= time + .5; time < $until && !$p->lock_stats->{seeks_done}; sleep .01) {
+		1 while $vlc->callback_dispatch;
+	}
+	my $st= $p->lock_stats;
+	is( $st->{seeks_done}, 1, 'frame displayed after the seek' );
+	ok( $st->{seek_latency_last} > 0 && $st->{seek_latency_last} < .5, 'latency' )
+		or diag "latency $st->{seek_latency_last}";
+	is( $st->{seek_latency_max}, $st->{seek_latency_last}, 'max' );
+	$p->stop;
+};
+
+done_testing;
@@ -0,0 +1,88 @@
+use strict;
+use warnings;
+use Config;
+use Test::More;
+use Time::HiRes qw( sleep );
+use VideoLAN::LibVLC qw( PERLVLC_MSG_VIDEO_FORMAT_EVENT );
+use VideoLAN::LibVLC::MediaPlayer;
+
+my %fmt= ( chroma => 'RGBA', width => 64, height => 16 ); # 4096 bytes
+sub stats { VideoLAN::LibVLC::Picture->memory_stats }
+sub new_pic { VideoLAN::LibVLC::Picture->new({ %fmt, @_ }) }
+
+my $base= stats;
+is( VideoLAN::LibVLC::Picture->memory_budget->{limit}, 0, 'no limit by default' );
+
+subtest counters => sub {
+	my $pic= new_pic();
+	my $buf= "\0" x 4096;
+	my $scalar_pic= new_pic(plane => \$buf, pitch => 256, lines => 16);
+	my $st= stats;
+	is( $st->{pictures} - $base->{pictures}, 2, 'pictures' );
+	is( $st->{bytes} - $base->{bytes}, 8192, 'bytes' );
+	is( $st->{bytes_alloc} - $base->{bytes_alloc}, 4096, 'only allocated planes in bytes_alloc' );
+	is( $st->{bytes_perl} - $base->{bytes_perl}, 8192, 'held by perl' );
+	ok( $st->{bytes_peak} >= $st->{bytes}, 'peak' );
+	undef $pic; undef $scalar_pic;
+	is_deeply( [ @{ stats() }{qw( pictures bytes bytes_alloc )} ], [ @{$base}{qw( pictures bytes bytes_alloc )} ], 'freed' );
+};
+
+subtest limit => sub {
+	VideoLAN::LibVLC::Picture->memory_budget({ limit => $base->{bytes_alloc} + 3 * 4096, reserve => 4096 });
+	my @pics= map new_pic(), 1..2;
+	ok( !eval { new_pic(priority => -1) }, 'low priority refused first' );
+	like( $@, qr/budget exceeded/, 'error message' );
+	is( VideoLAN::LibVLC::Picture->_budget_fit(4096, 0, 8), 1, 'room for one more' );
+	push @pics, new_pic();
+	ok( !eval { new_pic() }, 'refused at the limit' );
+	my $buf= "\0" x 4096;
+	ok( new_pic(plane => \$buf, pitch => 256, lines => 16), 'supplied planes are not refused' );
+	is( stats->{refused}, 2, 'refused' );
+	pop @pics;
+	ok( new_pic(), 'room again after one is freed' );
+	VideoLAN::LibVLC::Picture->memory_budget({ limit => 0 });
+	is( VideoLAN::LibVLC::Picture->memory_stats(1)->{refused}, 2, 'reset' );
+	is( stats->{refused}, 0, 'after reset' );
+};
+
+subtest player => sub {
+	my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+	my $player= $vlc->new_media_player;
+	$player->set_video_callbacks(display => sub {});
+	$player->picture_priority(-1);
+	VideoLAN::LibVLC::Picture->memory_budget({ limit => stats->{bytes_alloc} + 5 * 4096, reserve => 2 * 4096 });
+	# Play the part of the video thread, as in t/36-replay.t
+	send($vlc->_event_pipe->[1], pack('L L a4 L L L3 L3 L', PERLVLC_MSG_VIDEO_FORMAT_EVENT, $player->{_callback_id},
+		'RGBA', 64, 16, 16, 0, 0, 256, 0, 0, 0), 0);
+	$vlc->callback_dispatch;
+	is( $player->video_format->{alloc_count}, 3, 'low priority player got fewer buffers' );
+	is( $player->queued_picture_count, 3, 'and queued them' );
+	is( stats->{bytes_vlc} - $base->{bytes_vlc}, 3 * 4096, 'held by VLC' );
+	my $full= $vlc->new_media_player;
+	$full->set_video_callbacks(display => sub {});
+	$full->picture_priority(-1);
+	send($vlc->_event_pipe->[1], pack('L L a4 L L L3 L3 L', PERLVLC_MSG_VIDEO_FORMAT_EVENT, $full->{_callback_id},
+		'RGBA', 64, 16, 16, 0, 0, 256, 0, 0, 0), 0);
+	ok( eval { $vlc->callback_dispatch; 1 }, 'no room for any buffer' ) or diag $@;
+	is( $full->video_format->{alloc_count}, 0, 'format refused' );
+	is( $full->queued_picture_count, 0, 'nothing queued' );
+	undef $full;
+	undef $player;
+	is( stats->{bytes_vlc}, $base->{bytes_vlc}, 'released with the player' );
+	VideoLAN::LibVLC::Picture->memory_budget({ limit => 0, reserve => 0 });
+};
+
+subtest wait => sub {
+	plan skip_all => 'Perl is not built with iThreads'
+		unless $Config{useithreads} && eval { require threads; 1 };
+	my $before= stats->{bytes_alloc};
+	VideoLAN::LibVLC::Picture->memory_budget({ limit => $before + 4096, wait => 2 });
+	my $thr= threads->create(sub { my $p= new_pic(); sleep .3; undef $p; 1 });
+	sleep .01 until stats->{bytes_alloc} > $before;
+	ok( new_pic(), 'waited for the other thread to free a picture' );
+	is( stats->{waits}, 1, 'waits' );
+	$thr->join;
+	VideoLAN::LibVLC::Picture->memory_budget({ limit => 0, wait => 0 });
+};
+
+done_testing;
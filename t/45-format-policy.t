@@ -0,0 +1,106 @@
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC qw( PERLVLC_FAKE_LIBVLC );
+use VideoLAN::LibVLC::MediaPlayer;
+
+sub apply { VideoLAN::LibVLC::MediaPlayer::_format_policy_apply(@_) }
+
+subtest apply => sub {
+	my $f= apply({ chroma => [ 'I420', 'RGBA' ] }, 'I420', 640, 360);
+	is_deeply( $f, { chroma => 'I420', width => 640, height => 360, pitch => [ 640, 320, 320 ], lines => [ 360, 180, 180 ] },
+		'native chroma kept when listed' );
+	$f= apply({ chroma => 'RGBA', max_width => 320, max_height => 320 }, 'I420', 640, 360);
+	is_deeply( [ @{$f}{qw( chroma width height )} ], [ 'RGBA', 320, 180 ], 'converted and scaled to fit' );
+	is_deeply( $f->{pitch}, [ 1280, 0, 0 ], 'single plane' );
+	$f= apply({ max_height => 100, align => 256 }, 'I420', 640, 360);
+	is_deeply( [ @{$f}{qw( chroma width height )} ], [ 'I420', 176, 100 ], 'no chroma list keeps native, even size' );
+	is_deeply( $f->{pitch}, [ 256, 256, 256 ], 'aligned pitch' );
+	is( apply({ chroma => 'XXXX' }, 'I420', 64, 32), undef, 'unknown chroma' );
+	ok( !eval { apply({ chroma => 'RGB' }, 'I420', 64, 32) }, 'bad chroma dies' );
+};
+
+my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+
+subtest player => sub {
+	my $p= $vlc->new_media_player;
+	$p->set_video_callbacks(display => sub {});
+	ok( $p->set_video_format_policy(chroma => 'RGBA', max_width => 32), 'set policy' );
+	is_deeply( $p->{_format_policy}, { chroma => 'RGBA', max_width => 32 }, 'remembered' );
+	is( $p->time_to_first_frame, undef, 'no first frame yet' );
+	ok( $p->set_video_format_policy(), 'remove policy' );
+	ok( !$p->{_format_policy}, 'removed' );
+};
+
+subtest play => sub {
+	plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to play on the stand-in video output'
+		unless PERLVLC_FAKE_LIBVLC;
+	my $p= $vlc->new_media_player;
+	my $displayed= 0;
+	$p->set_video_callbacks(display => sub { ++$displayed; $_[0]->queue_picture($_[1]{picture}) });
+	$p->set_video_format_policy(chroma => [ 'RGBA' ], max_width => 32, max_height => 32, alloc_count => 4);
+	$p->set_lock_timeout(.05);
+	$p->media('fake://format=I420:64x32,fps=100,frames=0');
+	ok( $p->play, 'play' );
+	for (my $until= time + 1; time < $until && $displayed < 5; sleep .01) {
+		1 while $vlc->callback_dispatch;
+	}
+	ok( $displayed >= 5, 'frames displayed' ) or diag "$displayed displayed";
+	is_deeply( [ @{ $p->video_format }{qw( chroma width height alloc_count )} ], [ 'RGBA', 32, 16, 4 ],
+		'format from the policy' );
+	ok( !$p->_need_format_response, 'perl was not asked' );
+	my ($fmt, $ttff)= ($p->time_to_format, $p->time_to_first_frame);
+	ok( defined $fmt && defined $ttff && $fmt <= $ttff && $ttff < 1, 'time to format and first frame' )
+		or diag "format $fmt, first frame $ttff";
+	$p->stop;
+	undef $p;
+	1 while $vlc->callback_dispatch;
+};
+
+subtest format_changes => sub {
+	plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to play on the stand-in video output'
+		unless PERLVLC_FAKE_LIBVLC;
+	my $before= VideoLAN::LibVLC::Picture->memory_stats->{pictures};
+	my $p= $vlc->new_media_player;
+	my $displayed= 0;
+	# pictures of an older format are dropped rather than queued again
+	$p->set_video_callbacks(display => sub { ++$displayed; $_[0]->_recycle_picture($_[1]{picture}) });
+	$p->set_video_format_policy(chroma => 'RGBA', alloc_count => 4);
+	$p->set_lock_timeout(.01);
+	$p->media('fake://format=RGBA:16x16,format=RGBA:32x16,change_every=2,fps=200,frames=0');
+	ok( $p->play, 'play' );
+	# several format changes answered by the video thread before perl adopts any pictures
+	sleep .2;
+	for (my $until= time + 1; time < $until && $displayed < 10; sleep .01) {
+		1 while $vlc->callback_dispatch;
+	}
+	ok( $displayed >= 10, 'frames displayed' ) or diag "$displayed displayed";
+	$p->stop;
+	1 while $vlc->callback_dispatch;
+	undef $p;
+	1 while $vlc->callback_dispatch;
+	is( VideoLAN::LibVLC::Picture->memory_stats->{pictures}, $before, 'every picture freed' );
+};
+
+subtest fallback => sub {
+	plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to play on the stand-in video output'
+		unless PERLVLC_FAKE_LIBVLC;
+	my $p= $vlc->new_media_player;
+	my $displayed= 0;
+	$p->set_video_callbacks(display => sub { ++$displayed; $_[0]->queue_picture($_[1]{picture}) });
+	$p->set_video_format_policy(chroma => 'XXXX');
+	$p->set_lock_timeout(.05);
+	$p->media('fake://format=I420:64x32,fps=100,frames=0');
+	ok( $p->play, 'play' );
+	for (my $until= time + 1; time < $until && !$displayed; sleep .01) {
+		1 while $vlc->callback_dispatch;
+	}
+	ok( $displayed, 'frames displayed' );
+	is( $p->video_format->{chroma}, 'I420', 'perl accepted the native format' );
+	$p->stop;
+	undef $p;
+	1 while $vlc->callback_dispatch;
+};
+
+done_testing;
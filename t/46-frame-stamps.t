@@ -0,0 +1,49 @@
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw( time sleep clock_gettime CLOCK_MONOTONIC );
+use VideoLAN::LibVLC qw( PERLVLC_FAKE_LIBVLC );
+use VideoLAN::LibVLC::MediaPlayer;
+
+my $pic= VideoLAN::LibVLC::Picture->new({ chroma => 'RGBA', width => 32, height => 16 });
+is( $pic->$_, undef, "no $_ before VLC used it" ) for qw( sequence lock_time unlock_time display_time media_time );
+
+subtest play => sub {
+	plan skip_all => 'Build with PERLVLC_FAKE_LIBVLC=1 to play on the stand-in video output'
+		unless PERLVLC_FAKE_LIBVLC;
+	my $vlc= new_ok( 'VideoLAN::LibVLC', [], 'init libvlc' );
+	my $p= $vlc->new_media_player;
+	my @seen;
+	$p->set_video_callbacks(display => sub {
+		my $pic= $_[1]{picture};
+		push @seen, { now => clock_gettime(CLOCK_MONOTONIC), map +($_ => $pic->$_),
+			qw( sequence lock_time unlock_time display_time media_time ) };
+		$_[0]->queue_picture($pic);
+	});
+	$p->set_video_format(chroma => 'RGBA', width => 32, height => 16);
+	$p->queue_new_picture(id => $_) for 1..4;
+	$p->set_lock_timeout(.05);
+	$p->cached_clock(1);
+	$p->media('fake://fps=100,frames=0');
+	ok( $p->play, 'play' );
+	# Play the part of the libvlc event thread, as in t/41-cached-clock.t
+	$p->_clock_event('playing');
+	$p->_clock_event(time => 5000);
+	for (my $until= time + 1; time < $until && @seen < 10; sleep .01) {
+		1 while $vlc->callback_dispatch;
+	}
+	$p->stop;
+	ok( @seen >= 10, 'frames displayed' ) or diag scalar(@seen).' displayed';
+	my @seq= map $_->{sequence}, @seen;
+	ok( !grep($seq[$_] <= $seq[$_-1], 1..$#seq), 'sequence increases' ) or diag "@seq";
+	ok( !grep(!($_->{lock_time} <= $_->{unlock_time} && $_->{unlock_time} <= $_->{display_time}
+		&& $_->{display_time} <= $_->{now}), @seen), 'lock, unlock, display, dispatch in order' );
+	my $s= $seen[-1];
+	ok( $s->{now} - $s->{display_time} < .5, 'display time is recent' );
+	ok( defined $s->{media_time} && $s->{media_time} >= 5 && $s->{media_time} < 7, 'media time from the cached clock' )
+		or diag "media_time ".($s->{media_time} // 'undef');
+	undef $p;
+	1 while $vlc->callback_dispatch;
+};
+
+done_testing;
@@ -0,0 +1,61 @@
+#! /usr/bin/env perl
+#
+# Measure the perl side of callback dispatch by replaying a recorded session.
+#
+#   util/bench-dispatch.pl --record session.pvlcmsg [--media FILE] [--seconds 5]
+#   util/bench-dispatch.pl session.pvlcmsg [--rounds 10]
+#
+# With --record, it plays the media into pictures of the native chroma (the default format
+# handler) and records every callback message.  Otherwise it replays the recording --rounds
+# times at full speed into fresh players with the same callbacks, and reports callbacks per
+# second and microseconds per callback spent in callback_dispatch.  No decoding happens
+# during the replay, so runs are directly comparable before and after a change.
+
+use strict;
+use warnings;
+use FindBin;
+use lib "$FindBin::Bin/../lib";
+use Getopt::Long;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC;
+use VideoLAN::LibVLC::MediaPlayer;
+use VideoLAN::LibVLC::Replay;
+
+GetOptions(
+	'record=s'  => \(my $record),
+	'media=s'   => \(my $media= "$FindBin::Bin/../t/data/NASA-solar-flares-2017-04-02.mp4"),
+	'seconds=f' => \(my $seconds= 5),
+	'rounds=i'  => \(my $rounds= 10),
+) or die "Usage: $0 --record FILE [--media FILE] [--seconds N]\n       $0 FILE [--rounds N]\n";
+$record || @ARGV == 1 or die "Expected --record or a recording to replay\n";
+
+my $vlc= VideoLAN::LibVLC->new;
+my %callbacks= (display => sub { $_[0]->queue_picture($_[1]{picture}) });
+
+if ($record) {
+	my $player= $vlc->new_media_player;
+	$player->set_video_callbacks(%callbacks);
+	$player->media($media);
+	$vlc->record_messages($record);
+	$player->play;
+	my $t0= time;
+	while (time - $t0 < $seconds) {
+		1 while $vlc->callback_dispatch;
+		sleep .002;
+	}
+	$player->stop;
+	1 while $vlc->callback_dispatch;
+	$vlc->record_messages(undef);
+	printf "recorded %d bytes to %s\n", -s $record, $record;
+	exit 0;
+}
+
+printf "%6s %10s %10s %8s %12s %10s\n", 'round', 'messages', 'callbacks', 'starved', 'callbacks/s', 'us/callback';
+for my $round (1..$rounds) {
+	my $player= $vlc->new_media_player;
+	$player->set_video_callbacks(%callbacks);
+	my $stats= VideoLAN::LibVLC::Replay->new(libvlc => $vlc, file => $ARGV[0], players => [ $player ])->run;
+	printf "%6d %10d %10d %8d %12.0f %10.2f\n", $round, @{$stats}{qw( messages dispatched starved )},
+		$stats->{dispatched} / ($stats->{dispatch_time} || 1),
+		$stats->{dispatch_time} * 1e6 / ($stats->{dispatched} || 1);
+}
@@ -0,0 +1,108 @@
+#! /usr/bin/env perl
+#
+# Compare the plane allocators of VideoLAN::LibVLC::Picture.
+#
+#   util/bench-plane-alloc.pl [--width 3840 --height 2160 --count 8 --rounds 20 --mlock]
+#   util/bench-plane-alloc.pl --media movie.mkv [--seconds 5]
+#
+# Without --media, it simulates a decoder: allocate --count RGBA pictures, write every
+# byte of the first one (first-frame latency, including the page faults of fresh memory),
+# then write all of them --rounds times (steady-state throughput).
+#
+# With --media, it plays the file into pictures from each allocator and reports the time
+# from play() to the first display callback, and the frames displayed per second.
+
+use strict;
+use warnings;
+use FindBin;
+use lib "$FindBin::Bin/../lib";
+use Getopt::Long;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC;
+
+GetOptions(
+	'width=i'   => \(my $width= 3840),
+	'height=i'  => \(my $height= 2160),
+	'count=i'   => \(my $count= 8),
+	'rounds=i'  => \(my $rounds= 20),
+	'mlock'     => \(my $mlock),
+	'media=s'   => \(my $media),
+	'seconds=f' => \(my $seconds= 5),
+) or die "Usage: $0 [--width N] [--height N] [--count N] [--rounds N] [--mlock] [--media FILE [--seconds N]]\n";
+
+my @configs= map { my $a= $_; map +{ alloc => $a, prefault => $_, mlock => $mlock? 1 : 0 }, 0, 1 }
+	qw( newx memalign mmap hugepage );
+
+# process-wide minor+major faults from /proc, so we count the ones taken outside the allocator
+sub faults {
+	open my $fh, '<', '/proc/self/stat' or return 0;
+	my @f= split / /, (<$fh> =~ s/^.*\) //r);
+	return $f[7] + $f[9];
+}
+
+sub label { my $c= shift; join '+', $c->{alloc}, ($c->{prefault}? 'prefault' : ()), ($c->{mlock}? 'mlock' : ()) }
+
+$media? bench_decode() : bench_synthetic();
+
+sub bench_synthetic {
+	my $pitch= $width * 4;
+	my $src= "\x55" x ($pitch * $height);
+	printf "%-24s %10s %12s %10s %10s %6s\n", 'allocator', 'alloc ms', '1st frame ms', 'faults', 'GB/s', 'fail';
+	for my $cfg (@configs) {
+		VideoLAN::LibVLC::Picture->alloc_stats(1);
+		my $f0= faults();
+		my $t0= time;
+		my @pics= map VideoLAN::LibVLC::Picture->new({ %$cfg, chroma => 'RGBA',
+			width => $width, height => $height, pitch => $pitch, lines => $height }), 1..$count;
+		my $t1= time;
+		my @planes= map $_->plane(0), @pics;
+		substr(${$planes[0]}, 0, length $src, $src);
+		my $t2= time;
+		substr($$_, 0, length $src, $src) for @planes[1..$#planes];
+		my $f1= faults();
+		my $t3= time;
+		for (1..$rounds) { substr($$_, 0, length $src, $src) for @planes }
+		my $t4= time;
+		my $st= VideoLAN::LibVLC::Picture->alloc_stats->{$cfg->{alloc}};
+		printf "%-24s %10.2f %12.2f %10d %10.2f %6d\n", label($cfg),
+			($t1-$t0)*1000, ($t2-$t0)*1000, $f1-$f0,
+			length($src) * $count * $rounds / ($t4-$t3) / 1e9, $st->{failures};
+	}
+}
+
+sub bench_decode {
+	my $vlc= VideoLAN::LibVLC->new;
+	printf "%-24s %14s %8s %10s\n", 'allocator', 'first frame ms', 'fps', 'faults';
+	for my $cfg (@configs) {
+		my $player= $vlc->new_media_player;
+		my ($t_first, $frames)= (undef, 0);
+		$player->set_video_callbacks(
+			format => sub {
+				my ($p, $event)= @_;
+				$p->set_video_format({ %$cfg, chroma => 'RGBA', width => $event->{width},
+					height => $event->{height}, alloc_count => $count });
+				$p->queue_new_picture(id => $_) for 1..$count;
+			},
+			display => sub {
+				my ($p, $event)= @_;
+				$t_first //= time;
+				$frames++;
+				$p->queue_picture($event->{picture});
+			},
+		);
+		$player->media($media);
+		my $f0= faults();
+		my $t0= time;
+		$player->play;
+		while (time - $t0 < $seconds) {
+			1 while $vlc->callback_dispatch;
+			sleep .002;
+		}
+		my $elapsed= time - ($t_first // $t0);
+		printf "%-24s %14s %8.1f %10d\n", label($cfg),
+			defined $t_first? sprintf('%.1f', ($t_first-$t0)*1000) : '-',
+			$frames / ($elapsed || 1), faults() - $f0;
+		$player->stop;
+		1 while $vlc->callback_dispatch;
+	}
+}
@@ -0,0 +1,57 @@
+#! /usr/bin/env perl
+#
+# Compare decoder throughput of the media profiles (see VideoLAN::LibVLC::Media/PROFILES).
+#
+#   util/bench-profiles.pl [--media t/data/NASA-solar-flares-2017-04-02.mp4] [--rate 32]
+#     [--seconds 30] [profile ...]
+#
+# Each profile plays the whole clip once at --rate times real time, into pictures of the
+# native chroma, recycling every picture as soon as it is displayed.  It reports frames
+# decoded (lock requests from the decoder), wall-clock fps, and CPU time per frame of the
+# whole process, which includes VLC's threads.
+
+use strict;
+use warnings;
+use FindBin;
+use lib "$FindBin::Bin/../lib";
+use Getopt::Long;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC;
+use VideoLAN::LibVLC::MediaPlayer;
+
+GetOptions(
+	'media=s'   => \(my $media= "$FindBin::Bin/../t/data/NASA-solar-flares-2017-04-02.mp4"),
+	'rate=f'    => \(my $rate= 32),
+	'seconds=f' => \(my $seconds= 30),
+) or die "Usage: $0 [--media FILE] [--rate N] [--seconds N] [profile ...]\n";
+my @profiles= @ARGV? @ARGV : ( 'none', sort keys %VideoLAN::LibVLC::Media::PROFILES );
+
+my $vlc= VideoLAN::LibVLC->new;
+printf "%-12s %8s %8s %8s %10s %12s\n", 'profile', 'frames', 'wall s', 'fps', 'cpu s', 'cpu ms/frame';
+for my $profile (@profiles) {
+	my $player= $vlc->new_media_player;
+	$player->profile($profile) unless $profile eq 'none';
+	# The default format handler accepts the native chroma and queues 8 pictures
+	$player->set_video_callbacks(display => sub { $_[0]->queue_picture($_[1]{picture}) });
+	$player->media($media);
+	$player->set_rate($rate);
+	my @cpu0= times;
+	my $t0= time;
+	$player->play;
+	my $started;
+	while (time - $t0 < $seconds) {
+		1 while $vlc->callback_dispatch;
+		my $playing= $player->is_playing;
+		last if $started && !$playing;
+		$started ||= $playing;
+		sleep .002;
+	}
+	my $wall= time - $t0;
+	my @cpu1= times;
+	my $cpu= $cpu1[0] + $cpu1[1] - $cpu0[0] - $cpu0[1];
+	my $frames= $player->lock_stats->{locks};
+	printf "%-12s %8d %8.2f %8.1f %10.2f %12.2f\n", $profile, $frames, $wall,
+		$frames / $wall, $cpu, $frames? $cpu * 1000 / $frames : 0;
+	$player->stop;
+	1 while $vlc->callback_dispatch;
+}
@@ -0,0 +1,75 @@
+#! /usr/bin/env perl
+#
+# Load-test the video callbacks with the stand-in video output.  Requires a build made with
+# PERLVLC_FAKE_LIBVLC=1 perl Makefile.PL
+#
+#   util/stress-callbacks.pl [--players 4] [--format I420:1920x1080 ...] [--fps 0]
+#     [--frames 2000] [--change-every 0] [--pictures 8] [--lock-timeout 0]
+#
+# Each player decodes --frames synthetic frames (--fps 0 means as fast as perl keeps up),
+# cycling through the --format list every --change-every frames, and recycles each picture
+# as it is displayed.  Reports frames per second per player and in total, and the lock
+# counters, which show how often the decoders waited on perl.
+
+use strict;
+use warnings;
+use FindBin;
+use lib "$FindBin::Bin/../lib";
+use Getopt::Long;
+use Time::HiRes qw( time sleep );
+use VideoLAN::LibVLC qw( PERLVLC_FAKE_LIBVLC );
+use VideoLAN::LibVLC::MediaPlayer;
+
+GetOptions(
+	'players=i'      => \(my $n_players= 4),
+	'format=s'       => \my @formats,
+	'fps=f'          => \(my $fps= 0),
+	'frames=i'       => \(my $frames= 2000),
+	'change-every=i' => \(my $change_every= 0),
+	'pictures=i'     => \(my $pictures= 8),
+	'lock-timeout=f' => \(my $lock_timeout= 0),
+) or die "Usage: $0 [--players N] [--format CCCC:WxH ...] [--fps N] [--frames N] [--change-every N] [--pictures N] [--lock-timeout SECONDS]\n";
+PERLVLC_FAKE_LIBVLC or die "VideoLAN::LibVLC was not built with PERLVLC_FAKE_LIBVLC=1\n";
+@formats= ('I420:1920x1080') unless @formats;
+
+my $mrl= 'fake://?'.join '&', (map "format=$_", @formats),
+	"fps=$fps", "frames=$frames", "change_every=$change_every";
+my $vlc= VideoLAN::LibVLC->new;
+my (@players, %displayed);
+for my $i (1..$n_players) {
+	my $p= $vlc->new_media_player;
+	$p->set_video_callbacks(
+		format => sub {
+			my ($p, $event)= @_;
+			$p->set_video_format({ %$event, alloc_count => $pictures });
+			$p->queue_new_picture(id => $_) for 1..$pictures;
+		},
+		display => sub {
+			my ($p, $event)= @_;
+			$displayed{$i}++;
+			my ($pic, $fmt)= ($event->{picture}, $p->video_format);
+			$p->queue_picture($pic) if $fmt->{chroma} eq $pic->chroma && $fmt->{width} == $pic->width;
+		},
+	);
+	$p->set_lock_timeout($lock_timeout) if $lock_timeout;
+	$p->media($mrl);
+	push @players, $p;
+}
+my $t0= time;
+$_->play or die "Can't play $mrl\n" for @players;
+while (grep $_->is_playing, @players) {
+	1 while $vlc->callback_dispatch;
+	sleep .001;
+}
+1 while $vlc->callback_dispatch;
+my $elapsed= time - $t0;
+
+printf "%6s %8s %10s %8s %10s %12s\n", 'player', 'frames', 'fps', 'scratch', 'wait_max', 'wait_total';
+my $total= 0;
+for my $i (1..$n_players) {
+	my $st= $players[$i-1]->lock_stats;
+	$total += $displayed{$i} || 0;
+	printf "%6d %8d %10.1f %8d %10.4f %12.3f\n", $i, $displayed{$i} || 0,
+		($displayed{$i} || 0) / $elapsed, @{$st}{qw( scratch wait_max wait_total )};
+}
+printf "total %d frames in %.2fs, %.1f fps\n", $total, $elapsed, $total / $elapsed;